@@ -0,0 +1,432 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+/* Throughput and latency of s3sink against the loopback S3 stand-in of
+ * the tests. Every stream is a source feeding its own s3sink:
+ *
+ *   s3sink-benchmark --streams 4 --bitrate 20000000 --size 268435456 \
+ *       -p buffer-size=10485760 -p upload-threads=8
+ *
+ * The stand-in runs in the process and only keeps the size of what's
+ * uploaded, so the CPU time reported includes its share of receiving the
+ * data. */
+#include "s3mockserver.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <gst/gst.h>
+
+#define BENCH_BUCKET "benchmark"
+
+typedef struct {
+  GstElement *source;
+  GstElement *sink;
+  GThread *feeder;
+  GstPadChainFunction chain;
+  /* GstClockTime, the time each buffer spent in the sink */
+  GArray *render_latencies;
+  guint64 bytes;
+} BenchStream;
+
+static GQuark bench_stream_quark;
+
+static gchar *source_name = NULL;
+static gint64 bitrate = 0;
+static gint buffer_size = 64 * 1024;
+static gint stream_count = 1;
+static gint64 stream_size = 256 * 1024 * 1024;
+static gint upload_latency = 0;
+static gchar **sink_properties = NULL;
+
+static GOptionEntry entries[] = {
+  {"source", 0, 0, G_OPTION_ARG_STRING, &source_name,
+      "Element feeding the sinks: fakesrc or appsrc (default: fakesrc)",
+      "NAME"},
+  {"bitrate", 'b', 0, G_OPTION_ARG_INT64, &bitrate,
+      "Bits per second of every stream (default: 0, as fast as possible)",
+      "BPS"},
+  {"buffer-size", 0, 0, G_OPTION_ARG_INT, &buffer_size,
+      "Size of the buffers fed to the sinks (default: 65536)", "BYTES"},
+  {"streams", 'n', 0, G_OPTION_ARG_INT, &stream_count,
+      "Number of streams uploaded at the same time (default: 1)", "N"},
+  {"size", 's', 0, G_OPTION_ARG_INT64, &stream_size,
+      "Bytes written by every stream (default: 268435456)", "BYTES"},
+  {"upload-latency", 0, 0, G_OPTION_ARG_INT, &upload_latency,
+      "Delay added by the stand-in to every part upload (default: 0)", "MS"},
+  {"property", 'p', 0, G_OPTION_ARG_STRING_ARRAY, &sink_properties,
+      "Property set on every s3sink, can be repeated", "NAME=VALUE"},
+  {NULL}
+};
+
+/* Times the buffers going through the sink, from the moment they're
+ * handed to it to the moment it gives the flow back. */
+static GstFlowReturn
+bench_stream_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  BenchStream *stream = g_object_get_qdata (G_OBJECT (pad),
+      bench_stream_quark);
+  GstClockTime start = gst_util_get_timestamp ();
+  GstClockTime latency;
+  GstFlowReturn ret;
+
+  stream->bytes += gst_buffer_get_size (buffer);
+  ret = stream->chain (pad, parent, buffer);
+  latency = gst_util_get_timestamp () - start;
+  g_array_append_val (stream->render_latencies, latency);
+
+  return ret;
+}
+
+static gpointer
+bench_stream_feed (gpointer data)
+{
+  BenchStream *stream = data;
+  GstClockTime start = gst_util_get_timestamp ();
+  gint64 written = 0;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  while (written < stream_size && ret == GST_FLOW_OK) {
+    gsize size = MIN (buffer_size, stream_size - written);
+    GstBuffer *buffer = gst_buffer_new_allocate (NULL, size, NULL);
+
+    gst_buffer_memset (buffer, 0, 0, size);
+
+    if (bitrate > 0) {
+      GstClockTime due = start + gst_util_uint64_scale (written, 8 * GST_SECOND,
+          bitrate);
+      GstClockTime now = gst_util_get_timestamp ();
+
+      if (due > now)
+        g_usleep (GST_TIME_AS_USECONDS (due - now));
+    }
+
+    /* blocks while the queue of appsrc is full */
+    g_signal_emit_by_name (stream->source, "push-buffer", buffer, &ret);
+    gst_buffer_unref (buffer);
+    written += size;
+  }
+
+  g_signal_emit_by_name (stream->source, "end-of-stream", &ret);
+  return NULL;
+}
+
+static GstElement *
+make_source (void)
+{
+  GstElement *source;
+
+  if (g_strcmp0 (source_name, "appsrc") == 0) {
+    source = gst_element_factory_make ("appsrc", NULL);
+    if (source == NULL)
+      return NULL;
+
+    g_object_set (source, "block", TRUE, "max-bytes",
+        (guint64) 4 * buffer_size, NULL);
+    gst_util_set_object_arg (G_OBJECT (source), "format", "bytes");
+    return source;
+  }
+
+  source = gst_element_factory_make ("fakesrc", NULL);
+  if (source == NULL)
+    return NULL;
+
+  /* the last buffer is as large as the others */
+  g_object_set (source, "sizemax", buffer_size,
+      "num-buffers", (gint) ((stream_size + buffer_size - 1) / buffer_size),
+      NULL);
+  gst_util_set_object_arg (G_OBJECT (source), "sizetype", "fixed");
+  gst_util_set_object_arg (G_OBJECT (source), "filltype", "zero");
+  if (bitrate > 0)
+    g_object_set (source, "datarate", (gint) (bitrate / 8), "sync", TRUE,
+        NULL);
+
+  return source;
+}
+
+static gboolean
+setup_stream (BenchStream * stream, guint index, GstS3MockServer * server,
+    GstBin * pipeline)
+{
+  GstPad *pad;
+  gchar *key;
+  gchar **property;
+
+  stream->source = make_source ();
+  stream->sink = gst_element_factory_make ("s3sink", NULL);
+  if (stream->source == NULL || stream->sink == NULL) {
+    g_printerr ("Missing the %s element\n", stream->source ? "s3sink" :
+        source_name ? source_name : "fakesrc");
+    if (stream->source)
+      gst_object_unref (stream->source);
+    if (stream->sink)
+      gst_object_unref (stream->sink);
+    return FALSE;
+  }
+
+  key = g_strdup_printf ("stream%u", index);
+  g_object_set (stream->sink,
+      "bucket", BENCH_BUCKET,
+      "key", key,
+      "region", "us-east-1",
+      "aws-sdk-endpoint", gst_s3_mock_server_get_endpoint (server),
+      "aws-sdk-use-http", TRUE,
+      NULL);
+  gst_util_set_object_arg (G_OBJECT (stream->sink), "aws-credentials",
+      "access-key-id=AKIDEXAMPLE|secret-access-key=secret");
+  g_free (key);
+
+  for (property = sink_properties; property && *property; property++) {
+    gchar **name_value = g_strsplit (*property, "=", 2);
+
+    if (name_value[1] == NULL || !g_object_class_find_property
+        (G_OBJECT_GET_CLASS (stream->sink), name_value[0])) {
+      g_printerr ("Invalid s3sink property: %s\n", *property);
+      g_strfreev (name_value);
+      return FALSE;
+    }
+    gst_util_set_object_arg (G_OBJECT (stream->sink), name_value[0],
+        name_value[1]);
+    g_strfreev (name_value);
+  }
+
+  gst_bin_add_many (pipeline, stream->source, stream->sink, NULL);
+  if (!gst_element_link (stream->source, stream->sink))
+    return FALSE;
+
+  stream->render_latencies = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+  pad = gst_element_get_static_pad (stream->sink, "sink");
+  stream->chain = GST_PAD_CHAINFUNC (pad);
+  g_object_set_qdata (G_OBJECT (pad), bench_stream_quark, stream);
+  gst_pad_set_chain_function (pad, bench_stream_chain);
+  gst_object_unref (pad);
+
+  return TRUE;
+}
+
+static gint
+compare_times (gconstpointer a, gconstpointer b)
+{
+  GstClockTime ta = *(const GstClockTime *) a;
+  GstClockTime tb = *(const GstClockTime *) b;
+
+  return ta < tb ? -1 : ta > tb;
+}
+
+/* Of sorted times. */
+static GstClockTime
+get_percentile (GArray * times, guint percentile)
+{
+  guint index;
+
+  if (times->len == 0)
+    return 0;
+
+  index = MIN ((guint64) times->len * percentile / 100, times->len - 1);
+  return g_array_index (times, GstClockTime, index);
+}
+
+static void
+print_latencies (const gchar * name, GArray * times)
+{
+  g_array_sort (times, compare_times);
+  g_print ("%s: %u, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", name,
+      times->len, get_percentile (times, 50) / (gdouble) GST_MSECOND,
+      get_percentile (times, 99) / (gdouble) GST_MSECOND,
+      times->len ? g_array_index (times, GstClockTime, times->len - 1)
+      / (gdouble) GST_MSECOND : 0.0);
+}
+
+/* Buckets of powers of two milliseconds. */
+static void
+print_histogram (const gchar * name, GArray * times)
+{
+  guint counts[32] = { 0 };
+  guint i, first = G_N_ELEMENTS (counts), last = 0;
+
+  for (i = 0; i < times->len; i++) {
+    guint64 ms = g_array_index (times, GstClockTime, i) / GST_MSECOND;
+    guint bucket = 0;
+
+    while (ms > 0 && bucket < G_N_ELEMENTS (counts) - 1) {
+      ms >>= 1;
+      bucket++;
+    }
+    counts[bucket]++;
+    first = MIN (first, bucket);
+    last = MAX (last, bucket);
+  }
+
+  g_print ("%s histogram:\n", name);
+  for (i = first; i <= last && i < G_N_ELEMENTS (counts); i++) {
+    g_print ("  %8u - %8u ms: %u\n", i ? 1u << (i - 1) : 0, 1u << i,
+        counts[i]);
+  }
+}
+
+static gdouble
+get_cpu_time (const struct rusage *usage)
+{
+  return usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6
+      + usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  GstS3MockServer *server;
+  GstElement *pipeline;
+  BenchStream *streams;
+  GstBus *bus;
+  GstMessage *message;
+  GArray *render_latencies, *part_latencies;
+  struct rusage usage_start, usage_end;
+  GstClockTime start_time, elapsed;
+  gdouble seconds, cpu_seconds, total_bytes = 0;
+  gint ret = EXIT_SUCCESS;
+  gint i;
+
+  /* keep the SDK from looking for an instance metadata service */
+  g_setenv ("AWS_EC2_METADATA_DISABLED", "true", TRUE);
+
+  context = g_option_context_new ("- benchmark s3sink");
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gst_init_get_option_group ());
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    g_clear_error (&error);
+    g_option_context_free (context);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (context);
+
+  if (buffer_size <= 0 || stream_count <= 0 || stream_size <= 0
+      || bitrate < 0 || (source_name && g_strcmp0 (source_name, "fakesrc")
+          && g_strcmp0 (source_name, "appsrc"))) {
+    g_printerr ("Invalid arguments, see --help\n");
+    return EXIT_FAILURE;
+  }
+
+  bench_stream_quark = g_quark_from_static_string ("bench-stream");
+
+  server = gst_s3_mock_server_new ();
+  gst_s3_mock_server_set_discard_data (server, TRUE);
+  gst_s3_mock_server_set_latency (server, GST_S3_MOCK_OPERATION_UPLOAD_PART,
+      upload_latency * GST_MSECOND);
+
+  pipeline = gst_pipeline_new (NULL);
+  streams = g_new0 (BenchStream, stream_count);
+  for (i = 0; i < stream_count; i++) {
+    if (!setup_stream (&streams[i], i, server, GST_BIN (pipeline))) {
+      ret = EXIT_FAILURE;
+      goto done;
+    }
+  }
+
+  getrusage (RUSAGE_SELF, &usage_start);
+  start_time = gst_util_get_timestamp ();
+
+  if (gst_element_set_state (pipeline, GST_STATE_PLAYING)
+      == GST_STATE_CHANGE_FAILURE) {
+    g_printerr ("Failed to start the pipeline\n");
+    ret = EXIT_FAILURE;
+    goto done;
+  }
+
+  if (g_strcmp0 (source_name, "appsrc") == 0) {
+    for (i = 0; i < stream_count; i++)
+      streams[i].feeder = g_thread_new ("feeder", bench_stream_feed,
+          &streams[i]);
+  }
+
+  bus = gst_element_get_bus (pipeline);
+  message = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  elapsed = gst_util_get_timestamp () - start_time;
+  getrusage (RUSAGE_SELF, &usage_end);
+
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ERROR) {
+    gchar *debug = NULL;
+
+    gst_message_parse_error (message, &error, &debug);
+    g_printerr ("Error from %s: %s\n%s\n", GST_OBJECT_NAME (message->src),
+        error->message, GST_STR_NULL (debug));
+    g_clear_error (&error);
+    g_free (debug);
+    ret = EXIT_FAILURE;
+  }
+  gst_message_unref (message);
+  gst_object_unref (bus);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  for (i = 0; i < stream_count; i++) {
+    if (streams[i].feeder)
+      g_thread_join (streams[i].feeder);
+  }
+
+  if (ret != EXIT_SUCCESS)
+    goto done;
+
+  render_latencies = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+  for (i = 0; i < stream_count; i++) {
+    g_array_append_vals (render_latencies, streams[i].render_latencies->data,
+        streams[i].render_latencies->len);
+    total_bytes += streams[i].bytes;
+  }
+  part_latencies = gst_s3_mock_server_get_request_durations (server,
+      GST_S3_MOCK_OPERATION_UPLOAD_PART);
+
+  seconds = elapsed / (gdouble) GST_SECOND;
+  cpu_seconds = get_cpu_time (&usage_end) - get_cpu_time (&usage_start);
+
+  g_print ("streams: %d, %" G_GINT64_FORMAT " bytes each, buffers of %d "
+      "bytes from %s\n", stream_count, stream_size, buffer_size,
+      source_name ? source_name : "fakesrc");
+  g_print ("time: %.3f s\n", seconds);
+  g_print ("throughput: %.2f MB/s\n", total_bytes / 1e6 / seconds);
+  g_print ("cpu: %.3f s, %.3f s per GB\n", cpu_seconds,
+      cpu_seconds / (total_bytes / 1e9));
+  /* kilobytes on Linux, bytes on macOS */
+#ifdef __APPLE__
+  g_print ("peak rss: %.1f MiB\n", usage_end.ru_maxrss / 1048576.0);
+#else
+  g_print ("peak rss: %.1f MiB\n", usage_end.ru_maxrss / 1024.0);
+#endif
+  print_latencies ("render", render_latencies);
+  print_latencies ("part uploads", part_latencies);
+  print_histogram ("part upload latency", part_latencies);
+
+  g_array_unref (render_latencies);
+  g_array_unref (part_latencies);
+
+done:
+  gst_object_unref (pipeline);
+  for (i = 0; i < stream_count; i++) {
+    if (streams[i].render_latencies)
+      g_array_unref (streams[i].render_latencies);
+  }
+  g_free (streams);
+  gst_s3_mock_server_free (server);
+  g_strfreev (sink_properties);
+  g_free (source_name);
+
+  return ret;
+}
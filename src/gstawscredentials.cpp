@@ -28,26 +28,39 @@ GST_DEBUG_CATEGORY_STATIC (gst_aws_credentials_debug);
 using namespace Aws::Auth;
 
 struct _GstAWSCredentials {
-  _GstAWSCredentials(GstAWSCredentialsProviderFactory factory) :
-    credentials_provider_factory(std::move(factory))
+  _GstAWSCredentials(GstAWSCredentialsProviderFactory factory, std::string key) :
+    credentials_provider_factory(std::move(factory)),
+    key(std::move(key))
   {
   }
 
   GstAWSCredentialsProviderFactory credentials_provider_factory;
+  std::string key;
 };
 
+static GstAWSCredentials *
+_gst_aws_credentials_new_with_key (GstAWSCredentialsProviderFactory factory, std::string key)
+{
+  return new GstAWSCredentials(std::move(factory), std::move(key));
+}
+
 GstAWSCredentials *
 gst_aws_credentials_new (GstAWSCredentialsProviderFactory factory)
 {
-  return new GstAWSCredentials(std::move(factory));
+  /* nothing is known about the factory, so it's never shared */
+  static gint counter = 0;
+  gchar *key = g_strdup_printf ("factory-%d", g_atomic_int_add (&counter, 1));
+  GstAWSCredentials *credentials = _gst_aws_credentials_new_with_key (std::move(factory), key);
+  g_free (key);
+  return credentials;
 }
 
 GstAWSCredentials *
 gst_aws_credentials_new_default (void)
 {
-  return gst_aws_credentials_new ([] {
+  return _gst_aws_credentials_new_with_key ([] {
     return std::unique_ptr<AWSCredentialsProvider> (new DefaultAWSCredentialsProviderChain ());
-  });
+  }, "default");
 }
 
 std::unique_ptr<AWSCredentialsProvider>
@@ -59,7 +72,14 @@ gst_aws_credentials_create_provider (GstAWSCredentials * credentials)
 GstAWSCredentials *
 gst_aws_credentials_copy (GstAWSCredentials * credentials)
 {
-  return gst_aws_credentials_new (credentials->credentials_provider_factory);
+  return _gst_aws_credentials_new_with_key (credentials->credentials_provider_factory,
+      credentials->key);
+}
+
+std::string
+gst_aws_credentials_get_key (GstAWSCredentials * credentials)
+{
+  return credentials->key;
 }
 
 void
@@ -176,9 +196,14 @@ static GstAWSCredentials *
 _gst_aws_credentials_from_string (const gchar * str)
 {
   std::string credentials_str = str;
-  return gst_aws_credentials_new ([credentials_str] {
+  /* the string holds the secrets, only keep a digest of it */
+  gchar *digest = g_compute_checksum_for_string (G_CHECKSUM_SHA256, str, -1);
+  std::string key = std::string ("string-") + digest;
+  g_free (digest);
+
+  return _gst_aws_credentials_new_with_key ([credentials_str] {
     return _gst_aws_credentials_provider_from_string (credentials_str.c_str());
-  });
+  }, std::move (key));
 }
 
 static gboolean
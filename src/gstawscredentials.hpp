@@ -23,6 +23,7 @@
 
 #include <aws/core/auth/AWSCredentialsProvider.h>
 #include <functional>
+#include <string>
 
 using GstAWSCredentialsProviderFactory = std::function<std::unique_ptr<Aws::Auth::AWSCredentialsProvider>()>;
 
@@ -34,4 +35,11 @@ GST_EXPORT
 std::unique_ptr<Aws::Auth::AWSCredentialsProvider>
 gst_aws_credentials_create_provider (GstAWSCredentials * credentials);
 
+/* Identifies the source of the credentials without exposing any secret, so
+ * that clients can be shared between elements using the same credentials.
+ * Copies keep the key of the original. */
+GST_EXPORT
+std::string
+gst_aws_credentials_get_key (GstAWSCredentials * credentials);
+
 #endif /* __GST_AWS_CREDENTIALS_HPP__ */
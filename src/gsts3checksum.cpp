@@ -0,0 +1,86 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include "gsts3checksum.h"
+
+#include <aws/core/utils/HashingUtils.h>
+#include <aws/core/utils/crypto/CRC32.h>
+#include <aws/core/utils/crypto/Factories.h>
+#include <aws/core/utils/crypto/Hash.h>
+
+#include <memory>
+
+static const char* CHECKSUM_ALLOCATION_TAG = "GstS3Checksum";
+
+struct _GstS3Checksum
+{
+    GstS3ChecksumAlgorithm algorithm;
+    std::shared_ptr<Aws::Utils::Crypto::Hash> hash;
+};
+
+static std::shared_ptr<Aws::Utils::Crypto::Hash>
+create_hash (GstS3ChecksumAlgorithm algorithm)
+{
+    switch (algorithm)
+    {
+    case GST_S3_CHECKSUM_ALGORITHM_CRC32:
+        return Aws::MakeShared<Aws::Utils::Crypto::CRC32>(CHECKSUM_ALLOCATION_TAG);
+    case GST_S3_CHECKSUM_ALGORITHM_CRC32C:
+        return Aws::MakeShared<Aws::Utils::Crypto::CRC32C>(CHECKSUM_ALLOCATION_TAG);
+    case GST_S3_CHECKSUM_ALGORITHM_SHA256:
+        return Aws::Utils::Crypto::CreateSha256Implementation();
+    default:
+        return nullptr;
+    }
+}
+
+GstS3Checksum *
+gst_s3_checksum_new (GstS3ChecksumAlgorithm algorithm)
+{
+    auto hash = create_hash(algorithm);
+    if (!hash)
+    {
+        return NULL;
+    }
+    return new GstS3Checksum { algorithm, std::move(hash) };
+}
+
+void
+gst_s3_checksum_update (GstS3Checksum * checksum, const guint8 * data, gsize size)
+{
+    checksum->hash->Update(const_cast<unsigned char*>(data), size);
+}
+
+gchar *
+gst_s3_checksum_finish (GstS3Checksum * checksum)
+{
+    auto result = checksum->hash->GetHash();
+    checksum->hash = create_hash(checksum->algorithm);
+
+    if (!result.IsSuccess())
+    {
+        return NULL;
+    }
+    return g_strdup(Aws::Utils::HashingUtils::Base64Encode(result.GetResult()).c_str());
+}
+
+void
+gst_s3_checksum_free (GstS3Checksum * checksum)
+{
+    delete checksum;
+}
@@ -0,0 +1,44 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#ifndef __GST_S3_CHECKSUM_H__
+#define __GST_S3_CHECKSUM_H__
+
+#include "gsts3uploaderconfig.h"
+
+G_BEGIN_DECLS
+
+/* Incremental checksum of a part, updated as the data arrives so that the
+ * part doesn't need a second pass once it's full. CRC32C and SHA-256 use
+ * the CPU instructions for them when available. */
+typedef struct _GstS3Checksum GstS3Checksum;
+
+GstS3Checksum *gst_s3_checksum_new (GstS3ChecksumAlgorithm algorithm);
+
+void gst_s3_checksum_update (GstS3Checksum * checksum, const guint8 * data,
+    gsize size);
+
+/* Returns the base64 encoded checksum of the data added since the last
+ * call, as expected by S3, and starts over. Free with g_free(). */
+gchar *gst_s3_checksum_finish (GstS3Checksum * checksum);
+
+void gst_s3_checksum_free (GstS3Checksum * checksum);
+
+G_END_DECLS
+
+#endif /* __GST_S3_CHECKSUM_H__ */
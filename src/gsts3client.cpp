@@ -0,0 +1,482 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "gsts3client.hpp"
+
+#include "gstawscredentials.hpp"
+
+#include <aws/core/Aws.h>
+#include <aws/core/utils/logging/AWSLogging.h>
+#include <aws/core/utils/logging/LogSystemInterface.h>
+#include <aws/s3/model/GetBucketLocationRequest.h>
+#include <aws/s3/model/GetBucketLocationResult.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+GST_DEBUG_CATEGORY (gst_s3_client_debug);
+#define GST_CAT_DEFAULT gst_s3_client_debug
+
+namespace gst
+{
+namespace aws
+{
+namespace s3
+{
+class Logger : public Aws::Utils::Logging::LogSystemInterface
+{
+public:
+    Aws::Utils::Logging::LogLevel GetLogLevel(void) const override
+    {
+        return _to_aws_log_level(gst_debug_category_get_threshold(gst_s3_client_debug));
+    }
+
+    void Log(Aws::Utils::Logging::LogLevel log_level, const char* tag, const char* format, ...) override
+    {
+        GstDebugLevel level = _to_gst_log_level(log_level);
+        va_list varargs;
+        va_start (varargs, format);
+
+        if (G_UNLIKELY ((level) <= GST_LEVEL_MAX && (level) <= _gst_debug_min))
+        {
+            gst_debug_log_valist(gst_s3_client_debug, level, "", tag, 0, NULL, format, varargs);
+        }
+        va_end (varargs);
+    }
+
+    void vaLog(Aws::Utils::Logging::LogLevel logLevel, const char* tag, const char* formatStr, va_list args) override
+    {
+    }
+
+    void LogStream(Aws::Utils::Logging::LogLevel log_level, const char* tag, const Aws::OStringStream &message_stream) override
+    {
+        Log(log_level, tag, "%s", message_stream.str().c_str());
+    }
+
+    void Flush() override
+    {
+    }
+
+private:
+    static Aws::Utils::Logging::LogLevel _to_aws_log_level(GstDebugLevel level)
+    {
+        using Aws::Utils::Logging::LogLevel;
+        switch (level)
+        {
+            case GST_LEVEL_NONE: return LogLevel::Off;
+            case GST_LEVEL_ERROR: return LogLevel::Error;
+            case GST_LEVEL_WARNING: return LogLevel::Warn;
+            case GST_LEVEL_FIXME:
+            case GST_LEVEL_INFO: return LogLevel::Info;
+            case GST_LEVEL_DEBUG: return LogLevel::Debug;
+            default: return LogLevel::Trace;
+        }
+    }
+
+    static GstDebugLevel _to_gst_log_level(Aws::Utils::Logging::LogLevel level)
+    {
+        using Aws::Utils::Logging::LogLevel;
+        switch (level)
+        {
+            case LogLevel::Off: return GST_LEVEL_NONE;
+            case LogLevel::Fatal:
+            case LogLevel::Error: return GST_LEVEL_ERROR;
+            case LogLevel::Warn: return GST_LEVEL_WARNING;
+            case LogLevel::Info: return GST_LEVEL_INFO;
+            case LogLevel::Debug: return GST_LEVEL_DEBUG;
+            default: return GST_LEVEL_TRACE;
+        }
+    }
+};
+
+std::shared_ptr<AwsApiHandle> AwsApiHandle::GetHandle()
+{
+    static std::mutex mutex;
+    static std::weak_ptr<AwsApiHandle> instance;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto ptr = instance.lock()) {
+        return ptr;
+    }
+
+    std::shared_ptr<AwsApiHandle> ptr(new AwsApiHandle());
+    instance = ptr;
+    return ptr;
+}
+
+AwsApiHandle::~AwsApiHandle()
+{
+    Aws::ShutdownAPI(Aws::SDKOptions {});
+    Aws::Utils::Logging::ShutdownAWSLogging();
+}
+
+AwsApiHandle::AwsApiHandle()
+{
+    Aws::Utils::Logging::InitializeAWSLogging(std::make_shared<Logger>());
+    Aws::SDKOptions options;
+    Aws::InitAPI(options);
+}
+
+const char* const CLIENT_ALLOCATION_TAG = "GstS3Client";
+
+#ifdef __linux__
+static const gint64 MAX_CPUS = CPU_SETSIZE;
+#else
+static const gint64 MAX_CPUS = 1024;
+#endif
+
+// Runs the asynchronous requests of the clients on a fixed set of threads,
+// created up front so that no thread is spawned per request. Unlike the SDK's
+// PooledThreadExecutor, the threads can be pinned to some CPUs and niced, to
+// keep them away from the encoders.
+class UploadThreadExecutor : public Aws::Utils::Threading::Executor
+{
+public:
+    UploadThreadExecutor(size_t threads, std::vector<int> cpus, int nice) :
+        _state(std::make_shared<State>())
+    {
+        _state->cpus = std::move(cpus);
+        _state->nice = nice;
+        for (size_t i = 0; i < threads; i++)
+        {
+            _threads.emplace_back(&UploadThreadExecutor::_run, _state);
+        }
+    }
+
+    ~UploadThreadExecutor() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(_state->mutex);
+            _state->stopping = true;
+        }
+        _state->tasks_cv.notify_all();
+
+        for (auto& thread : _threads)
+        {
+            // The last reference may be dropped by a task, e.g. the
+            // completion callback of the last request of a client. That
+            // thread keeps the state alive until it's done.
+            if (thread.get_id() == std::this_thread::get_id())
+            {
+                thread.detach();
+            }
+            else
+            {
+                thread.join();
+            }
+        }
+    }
+
+protected:
+    bool SubmitToThread(std::function<void()>&& task) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(_state->mutex);
+            _state->tasks.push_back(std::move(task));
+        }
+        _state->tasks_cv.notify_one();
+        return true;
+    }
+
+private:
+    struct State
+    {
+        std::vector<int> cpus;
+        int nice = 0;
+
+        std::mutex mutex;
+        std::condition_variable tasks_cv;
+        std::deque<std::function<void()>> tasks;
+        bool stopping = false;
+    };
+
+    static void _run(std::shared_ptr<State> state)
+    {
+        _setup_thread(*state);
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        while (true)
+        {
+            state->tasks_cv.wait(lock, [&state] { return state->stopping || !state->tasks.empty(); });
+            if (state->tasks.empty())
+            {
+                return;
+            }
+
+            auto task = std::move(state->tasks.front());
+            state->tasks.pop_front();
+
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+    }
+
+    static void _setup_thread(const State& state)
+    {
+#ifdef __linux__
+        if (!state.cpus.empty())
+        {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            for (int cpu : state.cpus)
+            {
+                CPU_SET(cpu, &cpu_set);
+            }
+            int error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+            if (error != 0)
+            {
+                GST_WARNING("Failed to set the CPU affinity of an upload thread: %s", g_strerror(error));
+            }
+        }
+
+        // On Linux, the nice value is a per-thread attribute.
+        if (state.nice != 0 && setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), state.nice) != 0)
+        {
+            GST_WARNING("Failed to set the nice value of an upload thread: %s", g_strerror(errno));
+        }
+#endif
+    }
+
+    std::shared_ptr<State> _state;
+    std::vector<std::thread> _threads;
+};
+
+size_t get_upload_threads(guint threads)
+{
+    if (threads > 0)
+    {
+        return threads;
+    }
+    if (const char* env = g_getenv("GST_S3_UPLOAD_THREADS"))
+    {
+        return std::max<guint64>(g_ascii_strtoull(env, nullptr, 10), 1);
+    }
+    return DEFAULT_UPLOAD_THREADS;
+}
+
+std::vector<int> parse_cpu_list(const char* str)
+{
+    std::vector<int> cpus;
+    if (str == nullptr)
+    {
+        return cpus;
+    }
+
+    gchar** ranges = g_strsplit(str, ",", -1);
+    for (gchar** range = ranges; *range; range++)
+    {
+        gchar* end = nullptr;
+        gint64 first = g_ascii_strtoll(*range, &end, 10);
+        gint64 last = first;
+        if (end && *end == '-')
+        {
+            last = g_ascii_strtoll(end + 1, &end, 10);
+        }
+        if (end == *range || (end && *end != '\0') || first < 0 || last < first || last >= MAX_CPUS)
+        {
+            GST_WARNING("Ignoring invalid CPU range '%s'", *range);
+            continue;
+        }
+        for (gint64 cpu = first; cpu <= last; cpu++)
+        {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+    }
+    g_strfreev(ranges);
+
+    return cpus;
+}
+
+std::shared_ptr<Aws::Utils::Threading::Executor> get_upload_executor(size_t threads, const std::vector<int>& cpus, int nice)
+{
+    static std::mutex mutex;
+    static std::map<Aws::String, std::weak_ptr<Aws::Utils::Threading::Executor>> executors;
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Aws::StringStream key;
+    key << threads << '|' << nice;
+    for (int cpu : cpus)
+    {
+        key << '|' << cpu;
+    }
+
+    auto& instance = executors[key.str()];
+    if (auto executor = instance.lock())
+    {
+        return executor;
+    }
+
+    std::shared_ptr<Aws::Utils::Threading::Executor> executor =
+        Aws::MakeShared<UploadThreadExecutor>(CLIENT_ALLOCATION_TAG, threads, cpus, nice);
+    instance = executor;
+    return executor;
+}
+
+DelayedTaskQueue& DelayedTaskQueue::get_instance()
+{
+    static DelayedTaskQueue instance;
+    return instance;
+}
+
+DelayedTaskQueue::DelayedTaskQueue() :
+    _thread(&DelayedTaskQueue::_run, this)
+{
+}
+
+DelayedTaskQueue::~DelayedTaskQueue()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _tasks_cv.notify_all();
+    _thread.join();
+}
+
+guint64 DelayedTaskQueue::schedule(std::chrono::steady_clock::duration delay, Task task)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    guint64 id = _next_id++;
+    auto due_time = std::chrono::steady_clock::now() + delay;
+    bool earliest = _tasks.empty() || due_time < _tasks.begin()->first.first;
+    _tasks.emplace(std::make_pair(due_time, id), std::move(task));
+    _due_times[id] = due_time;
+
+    lock.unlock();
+    if (earliest)
+    {
+        _tasks_cv.notify_all();
+    }
+    return id;
+}
+
+bool DelayedTaskQueue::cancel(guint64 id)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    auto it = _due_times.find(id);
+    if (it == _due_times.end())
+    {
+        return false;
+    }
+    auto task_it = _tasks.find(std::make_pair(it->second, id));
+    Task task = std::move(task_it->second);
+    _tasks.erase(task_it);
+    _due_times.erase(it);
+
+    lock.unlock();
+    task(false);
+    return true;
+}
+
+void DelayedTaskQueue::_run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stopping)
+    {
+        if (_tasks.empty())
+        {
+            _tasks_cv.wait(lock);
+            continue;
+        }
+
+        auto due_time = _tasks.begin()->first.first;
+        if (std::chrono::steady_clock::now() < due_time)
+        {
+            _tasks_cv.wait_until(lock, due_time);
+            continue;
+        }
+
+        // Tasks only submit a request, they don't hold up the next ones.
+        Task task = std::move(_tasks.begin()->second);
+        _due_times.erase(_tasks.begin()->first.second);
+        _tasks.erase(_tasks.begin());
+
+        lock.unlock();
+        task(true);
+        lock.lock();
+    }
+}
+
+bool get_bucket_location(const char* bucket_name, const Aws::Client::ClientConfiguration& client_config, Aws::String& location)
+{
+    auto client = S3ClientCache::get_client("lookup|" + client_config.caFile, [&client_config]() {
+        return Aws::MakeShared<Aws::S3::S3Client>(CLIENT_ALLOCATION_TAG, client_config,
+            Aws::Client::AWSAuthV4Signer::PayloadSigningPolicy::Never, false);
+    });
+
+    auto outcome = client->GetBucketLocation(Aws::S3::Model::GetBucketLocationRequest().WithBucket(bucket_name));
+    if (!outcome.IsSuccess())
+    {
+        return false;
+    }
+
+    location = Aws::S3::Model::BucketLocationConstraintMapper::GetNameForBucketLocationConstraint(outcome.GetResult().GetLocationConstraint());
+    return true;
+}
+
+std::shared_ptr<Aws::S3::S3Client> get_s3_client(const Aws::S3::S3ClientConfiguration& client_config,
+    size_t threads, const std::vector<int>& cpus, int nice, GstAWSCredentials* credentials)
+{
+    Aws::StringStream key;
+    key << client_config.region << '|' << client_config.endpointOverride << '|'
+        << static_cast<int>(client_config.scheme) << '|' << client_config.verifySSL << '|'
+        << client_config.caFile << '|' << static_cast<int>(client_config.payloadSigningPolicy) << '|'
+        << client_config.useVirtualAddressing << '|' << client_config.maxConnections << '|'
+        << client_config.requestTimeoutMs << '|'
+        << (client_config.retryStrategy ? client_config.retryStrategy->GetMaxAttempts() : -1) << '|'
+        << threads << '|' << nice << '|';
+    for (int cpu : cpus)
+    {
+        key << cpu << ',';
+    }
+    key << '|' << gst_aws_credentials_get_key(credentials);
+
+    return S3ClientCache::get_client(key.str(), [&]() -> std::shared_ptr<Aws::S3::S3Client> {
+        std::shared_ptr<Aws::Auth::AWSCredentialsProvider> credentials_provider =
+            gst_aws_credentials_create_provider(credentials);
+        if (!credentials_provider)
+        {
+            return nullptr;
+        }
+
+        Aws::S3::S3ClientConfiguration config(client_config);
+        config.executor = get_upload_executor(threads, cpus, nice);
+
+        const char* endpoint_provider_allocation_tag = "AWSS3EndpointProvider";
+
+        return Aws::MakeShared<Aws::S3::S3Client>(CLIENT_ALLOCATION_TAG, std::move(credentials_provider),
+            Aws::MakeShared<Aws::S3::Endpoint::S3EndpointProvider>(endpoint_provider_allocation_tag), config);
+    });
+}
+
+} // namespace s3
+} // namespace aws
+} // namespace gst
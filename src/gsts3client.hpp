@@ -0,0 +1,310 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#ifndef __GST_S3_CLIENT_HPP__
+#define __GST_S3_CLIENT_HPP__
+
+#include "gstawscredentials.h"
+
+#include <aws/core/utils/threading/Executor.h>
+#include <aws/s3/S3Client.h>
+#include <aws/s3/S3ClientConfiguration.h>
+
+#include <gst/gst.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The category of the code shared by the elements, the AWS SDK included.
+G_BEGIN_DECLS
+GST_DEBUG_CATEGORY_EXTERN(gst_s3_client_debug);
+G_END_DECLS
+
+// What the S3 elements share: the SDK initialization, the clients and their
+// threads, and the bucket regions.
+namespace gst
+{
+namespace aws
+{
+namespace s3
+{
+extern const char* const CLIENT_ALLOCATION_TAG;
+
+static const size_t DEFAULT_UPLOAD_THREADS = 25;
+
+class AwsApiHandle
+{
+    public:
+        static std::shared_ptr<AwsApiHandle> GetHandle();
+
+        virtual ~AwsApiHandle();
+
+    protected:
+        AwsApiHandle();
+
+    private:
+        AwsApiHandle(const AwsApiHandle&) = delete;
+        AwsApiHandle& operator=(const AwsApiHandle&) = delete;
+};
+
+// The number of upload threads: the configured one, or else the
+// GST_S3_UPLOAD_THREADS environment variable, or DEFAULT_UPLOAD_THREADS.
+size_t get_upload_threads(guint threads);
+
+// Parses a CPU list such as "0-3,6".
+std::vector<int> parse_cpu_list(const char* str);
+
+// Executors are shared by every client using the same thread settings; with
+// the default settings, that's one executor for the whole process.
+std::shared_ptr<Aws::Utils::Threading::Executor> get_upload_executor(size_t threads, const std::vector<int>& cpus, int nice);
+
+// Runs tasks after a delay on a thread of its own, so that waiting, e.g. the
+// backoff before a retry, doesn't hold a thread of the executors. A task is
+// passed true when it's due, or false when it's cancelled before.
+class DelayedTaskQueue
+{
+public:
+    using Task = std::function<void(bool)>;
+
+    static DelayedTaskQueue& get_instance();
+
+    ~DelayedTaskQueue();
+
+    // Returns the id to cancel the task with.
+    guint64 schedule(std::chrono::steady_clock::duration delay, Task task);
+
+    // Runs the task with false on the calling thread, unless it already ran.
+    // Returns false if it did.
+    bool cancel(guint64 id);
+
+private:
+    DelayedTaskQueue();
+    DelayedTaskQueue(const DelayedTaskQueue&) = delete;
+    DelayedTaskQueue& operator=(const DelayedTaskQueue&) = delete;
+
+    void _run();
+
+    std::mutex _mutex;
+    std::condition_variable _tasks_cv;
+    // Ordered by due time, then by id.
+    std::map<std::pair<std::chrono::steady_clock::time_point, guint64>, Task> _tasks;
+    std::map<guint64, std::chrono::steady_clock::time_point> _due_times;
+    guint64 _next_id = 1;
+    bool _stopping = false;
+    std::thread _thread;
+};
+
+// Clients are shared by every uploader and downloader with the same
+// configuration, so that they also share their connection pool, and with it
+// keep-alive connections and TLS sessions. A client lives as long as one of
+// them still uses it.
+class S3ClientCache
+{
+public:
+    using Factory = std::function<std::shared_ptr<Aws::S3::S3Client>()>;
+
+    static std::shared_ptr<Aws::S3::S3Client> get_client(const Aws::String& key, const Factory& factory)
+    {
+        std::lock_guard<std::mutex> lock(_get_mutex());
+        auto& clients = _get_clients();
+
+        auto it = clients.find(key);
+        if (it != clients.end())
+        {
+            if (auto client = it->second.lock())
+            {
+                return client;
+            }
+        }
+
+        for (auto expired = clients.begin(); expired != clients.end();)
+        {
+            expired = expired->second.expired() ? clients.erase(expired) : std::next(expired);
+        }
+
+        auto client = factory();
+        if (client)
+        {
+            clients[key] = client;
+        }
+        return client;
+    }
+
+private:
+    static std::mutex& _get_mutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::map<Aws::String, std::weak_ptr<Aws::S3::S3Client>>& _get_clients()
+    {
+        static std::map<Aws::String, std::weak_ptr<Aws::S3::S3Client>> clients;
+        return clients;
+    }
+};
+
+bool get_bucket_location(const char* bucket_name, const Aws::Client::ClientConfiguration& client_config, Aws::String& location);
+
+// The client of this configuration, threads and credentials, shared through
+// S3ClientCache. Returns null if the credentials provider can't be created.
+std::shared_ptr<Aws::S3::S3Client> get_s3_client(const Aws::S3::S3ClientConfiguration& client_config,
+    size_t threads, const std::vector<int>& cpus, int nice, GstAWSCredentials* credentials);
+
+// Remembers the region of the buckets for a while, so that an element started
+// for every object doesn't need a GetBucketLocation round trip each time.
+// Entries can also be kept in a key file shared across restarts.
+class BucketRegionCache
+{
+public:
+    static BucketRegionCache& get_instance()
+    {
+        static BucketRegionCache instance;
+        return instance;
+    }
+
+    bool lookup(const Aws::String& bucket, const std::string& file, Aws::String& region)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (!file.empty() && _loaded_files.insert(file).second)
+        {
+            _load(file);
+        }
+
+        auto it = _entries.find(bucket);
+        if (it == _entries.end() || it->second.expiration_time <= g_get_real_time())
+        {
+            return false;
+        }
+        region = it->second.region;
+        return true;
+    }
+
+    void store(const Aws::String& bucket, const Aws::String& region, std::chrono::nanoseconds ttl, const std::string& file)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        Entry& entry = _entries[bucket];
+        entry.region = region;
+        entry.expiration_time = g_get_real_time() + std::chrono::duration_cast<std::chrono::microseconds>(ttl).count();
+
+        if (!file.empty())
+        {
+            _save(file, bucket, entry);
+        }
+    }
+
+private:
+    struct Entry
+    {
+        Aws::String region;
+        // Wall clock time in microseconds, so that it survives restarts.
+        gint64 expiration_time = 0;
+    };
+
+    void _load(const std::string& file)
+    {
+        GKeyFile* key_file = g_key_file_new();
+        if (g_key_file_load_from_file(key_file, file.c_str(), G_KEY_FILE_NONE, nullptr))
+        {
+            gchar** buckets = g_key_file_get_groups(key_file, nullptr);
+            for (gchar** bucket = buckets; *bucket; bucket++)
+            {
+                gchar* region = g_key_file_get_string(key_file, *bucket, "region", nullptr);
+                gint64 expiration_time = g_key_file_get_int64(key_file, *bucket, "expiration-time", nullptr);
+                Entry& entry = _entries[*bucket];
+                if (region && expiration_time > entry.expiration_time)
+                {
+                    entry.region = region;
+                    entry.expiration_time = expiration_time;
+                }
+                g_free(region);
+            }
+            g_strfreev(buckets);
+        }
+        g_key_file_free(key_file);
+    }
+
+    // Other processes may use the same file, so only this entry is updated.
+    void _save(const std::string& file, const Aws::String& bucket, const Entry& entry)
+    {
+        GKeyFile* key_file = g_key_file_new();
+        GError* error = nullptr;
+
+        g_key_file_load_from_file(key_file, file.c_str(), G_KEY_FILE_NONE, nullptr);
+        g_key_file_set_string(key_file, bucket.c_str(), "region", entry.region.c_str());
+        g_key_file_set_int64(key_file, bucket.c_str(), "expiration-time", entry.expiration_time);
+
+        if (!g_key_file_save_to_file(key_file, file.c_str(), &error))
+        {
+            GST_CAT_WARNING(gst_s3_client_debug, "Failed to save the bucket region cache to %s: %s", file.c_str(), error->message);
+            g_error_free(error);
+        }
+        g_key_file_free(key_file);
+    }
+
+    std::mutex _mutex;
+    std::map<Aws::String, Entry> _entries;
+    std::set<std::string> _loaded_files;
+};
+
+// The region S3 names in the error of a request sent to the wrong one (301
+// PermanentRedirect, or 400 for a mismatching signature). Returns false if
+// it names none, or the region the request was sent to.
+template <typename Error>
+bool get_redirect_region(const Error& error, const Aws::String& current_region, Aws::String& region)
+{
+    const auto& headers = error.GetResponseHeaders();
+    auto it = headers.find("x-amz-bucket-region");
+    if (it == headers.end() || it->second.empty() || it->second == current_region)
+    {
+        return false;
+    }
+    region = it->second;
+    return true;
+}
+
+// The S3 error code, e.g. "SlowDown", or the HTTP status code when the
+// response has none, e.g. the 404 of a HEAD request.
+template <typename Error>
+Aws::String get_error_code(const Error& error)
+{
+    if (!error.GetExceptionName().empty())
+    {
+        return error.GetExceptionName();
+    }
+
+    Aws::StringStream ss;
+    ss << static_cast<int>(error.GetResponseCode());
+    return ss.str();
+}
+
+} // namespace s3
+} // namespace aws
+} // namespace gst
+
+#endif /* __GST_S3_CLIENT_HPP__ */
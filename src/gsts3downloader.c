@@ -0,0 +1,47 @@
+#include "gsts3downloader.h"
+
+#define GET_CLASS_(downloader) ((GstS3Downloader*) (downloader))->klass
+
+void
+gst_s3_downloader_destroy (GstS3Downloader * downloader)
+{
+  GET_CLASS_ (downloader)->destroy (downloader);
+}
+
+gboolean
+gst_s3_downloader_get_size (GstS3Downloader * downloader, guint64 * size)
+{
+  return GET_CLASS_ (downloader)->get_size (downloader, size);
+}
+
+GstBuffer *
+gst_s3_downloader_read (GstS3Downloader * downloader, guint64 offset,
+    gsize size)
+{
+  return GET_CLASS_ (downloader)->read (downloader, offset, size);
+}
+
+void
+gst_s3_downloader_unlock (GstS3Downloader * downloader)
+{
+  if (GET_CLASS_ (downloader)->unlock != NULL)
+    GET_CLASS_ (downloader)->unlock (downloader);
+}
+
+void
+gst_s3_downloader_unlock_stop (GstS3Downloader * downloader)
+{
+  if (GET_CLASS_ (downloader)->unlock_stop != NULL)
+    GET_CLASS_ (downloader)->unlock_stop (downloader);
+}
+
+gboolean
+gst_s3_downloader_get_error (GstS3Downloader * downloader,
+    gchar ** error_code, gchar ** error_message)
+{
+  if (GET_CLASS_ (downloader)->get_error == NULL)
+    return FALSE;
+
+  return GET_CLASS_ (downloader)->get_error (downloader, error_code,
+      error_message);
+}
@@ -0,0 +1,70 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#ifndef __GST_S3_DOWNLOADER_H__
+#define __GST_S3_DOWNLOADER_H__
+
+#include <gst/gst.h>
+
+#include "gsts3downloaderconfig.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GstS3Downloader GstS3Downloader;
+
+typedef struct {
+  void (*destroy) (GstS3Downloader *);
+  /* The size of the object. Returns FALSE if it can't be read. */
+  gboolean (*get_size) (GstS3Downloader *, guint64 *);
+  /* Reads at most size bytes at offset. The buffer may be shorter when
+   * the data arrives in chunks, and is only empty past the end of the
+   * object. Returns NULL on failure, or when interrupted by unlock(). */
+  GstBuffer * (*read) (GstS3Downloader *, guint64, gsize);
+
+  /* Optional. A downloader that doesn't implement these can't be
+   * interrupted while reading. */
+  void (*unlock) (GstS3Downloader *);
+  void (*unlock_stop) (GstS3Downloader *);
+
+  /* Optional. Returns TRUE once a request failed, along with the S3 error;
+   * every out parameter may be NULL. */
+  gboolean (*get_error) (GstS3Downloader *, gchar **, gchar **);
+} GstS3DownloaderClass;
+
+struct _GstS3Downloader {
+  GstS3DownloaderClass *klass;
+};
+
+void gst_s3_downloader_destroy (GstS3Downloader * downloader);
+
+gboolean gst_s3_downloader_get_size (GstS3Downloader * downloader,
+    guint64 * size);
+
+GstBuffer *gst_s3_downloader_read (GstS3Downloader * downloader,
+    guint64 offset, gsize size);
+
+void gst_s3_downloader_unlock (GstS3Downloader * downloader);
+
+void gst_s3_downloader_unlock_stop (GstS3Downloader * downloader);
+
+gboolean gst_s3_downloader_get_error (GstS3Downloader * downloader,
+    gchar ** error_code, gchar ** error_message);
+
+G_END_DECLS
+
+#endif /* __GST_S3_DOWNLOADER_H__ */
@@ -22,14 +22,30 @@
 #include <gst/gst.h>
 
 #include "gsts3sink.h"
+#include "gsts3hlssink.h"
+#include "gsts3src.h"
+
+/* the code shared by the elements logs there, the AWS SDK included */
+GST_DEBUG_CATEGORY_EXTERN (gst_s3_client_debug);
 
 static gboolean
 plugin_init (GstPlugin * plugin)
 {
+  GST_DEBUG_CATEGORY_INIT (gst_s3_client_debug, "s3client", 0,
+      "S3 client of the S3 elements");
+
   if (!gst_element_register (plugin, "s3sink", GST_RANK_NONE,
           gst_s3_sink_get_type ()))
     return FALSE;
 
+  if (!gst_element_register (plugin, "s3hlssink", GST_RANK_NONE,
+          gst_s3_hls_sink_get_type ()))
+    return FALSE;
+
+  if (!gst_element_register (plugin, "s3src", GST_RANK_NONE,
+          gst_s3_src_get_type ()))
+    return FALSE;
+
   return TRUE;
 }
 
@@ -0,0 +1,1144 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/**
+ * SECTION:element-s3hlssink
+ * @title: s3hlssink
+ *
+ * Publish an HLS stream to an Amazon S3 bucket. The stream is segmented by
+ * hlssink2 (1.18 or newer), and every segment is written with a single
+ * PutObject as soon as it's closed, while the next one is being recorded.
+ * A playlist is only uploaded once all the segments it refers to are, so
+ * that players never see a segment that isn't there yet; a newer playlist
+ * replaces the one still waiting.
+ *
+ * The keys of the segments and of the playlist are the file names set by
+ * the location and playlist-location properties, after key-prefix. Segments
+ * dropped from the playlist (see max-files) are left in the bucket.
+ *
+ * Every object written is announced with an `s3hlssink-object` element
+ * message with the same fields as the `s3sink-object` one of s3sink, where
+ * the duration is the time between the end of the object and its upload.
+ *
+ * ## Example launch line
+ * |[
+ * gst-launch-1.0 -e v4l2src ! videoconvert ! x264enc key-int-max=60 ! h264parse ! s3hlssink bucket=test-bucket key-prefix=live/ target-duration=2
+ * ]| Publish a live HLS stream of a v4l2 camera under live/ in test-bucket.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "gsts3hlssink.h"
+#include "gsts3metrics.h"
+#include "gsts3multipartuploader.h"
+
+static GstStaticPadTemplate video_template = GST_STATIC_PAD_TEMPLATE ("video",
+    GST_PAD_SINK,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS_ANY);
+
+static GstStaticPadTemplate audio_template = GST_STATIC_PAD_TEMPLATE ("audio",
+    GST_PAD_SINK,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS_ANY);
+
+GST_DEBUG_CATEGORY_STATIC (gst_s3_hls_sink_debug);
+#define GST_CAT_DEFAULT gst_s3_hls_sink_debug
+
+#define DEFAULT_MAX_CONCURRENT_UPLOADS 4
+/* the defaults of hlssink2 */
+#define DEFAULT_LOCATION "segment%05d.ts"
+#define DEFAULT_PLAYLIST_LOCATION "playlist.m3u8"
+#define DEFAULT_TARGET_DURATION 15
+#define DEFAULT_PLAYLIST_LENGTH 5
+#define DEFAULT_MAX_FILES 10
+
+enum
+{
+  PROP_0,
+  PROP_BUCKET,
+  PROP_KEY_PREFIX,
+  PROP_REGION,
+  PROP_ACL,
+  PROP_CA_FILE,
+  PROP_CREDENTIALS,
+  PROP_INIT_AWS_SDK,
+  PROP_AWS_SDK_ENDPOINT,
+  PROP_AWS_SDK_USE_HTTP,
+  PROP_AWS_SDK_VERIFY_SSL,
+  PROP_MAX_CONNECTIONS,
+  PROP_MAX_CONCURRENT_UPLOADS,
+  PROP_LOCATION,
+  PROP_PLAYLIST_LOCATION,
+  PROP_PLAYLIST_ROOT,
+  PROP_TARGET_DURATION,
+  PROP_PLAYLIST_LENGTH,
+  PROP_MAX_FILES,
+  PROP_LAST
+};
+
+typedef enum
+{
+  GST_S3_HLS_SEGMENT_WRITING,
+  GST_S3_HLS_SEGMENT_UPLOADING,
+  GST_S3_HLS_SEGMENT_DONE,
+  GST_S3_HLS_SEGMENT_FAILED
+} GstS3HlsSegmentState;
+
+/* A segment or a playlist, once hlssink2 is done writing it. */
+struct _GstS3HlsObject
+{
+  gchar *key;
+  GstS3Uploader *uploader;
+  GstBufferList *buffers;
+  guint64 size;
+  /* when it was closed */
+  GstClockTime close_time;
+  /* the keys of the segments a playlist refers to */
+  GPtrArray *segments;
+};
+
+static void
+gst_s3_hls_object_free (GstS3HlsObject * object)
+{
+  if (object->uploader)
+    gst_s3_uploader_destroy (object->uploader);
+  if (object->buffers)
+    gst_buffer_list_unref (object->buffers);
+  if (object->segments)
+    g_ptr_array_unref (object->segments);
+  g_free (object->key);
+  g_free (object);
+}
+
+static void gst_s3_hls_sink_submit (GstS3HlsSink * sink,
+    GstS3HlsObject * object, gboolean is_playlist);
+static void gst_s3_hls_sink_forget_stream (GstS3HlsSink * sink,
+    gpointer stream);
+
+/**
+ * GstS3HlsOutputStream: the stream hlssink2 writes a segment or a playlist
+ * to. The data is kept in memory and handed to the sink on close.
+ */
+#define GST_TYPE_S3_HLS_OUTPUT_STREAM (gst_s3_hls_output_stream_get_type ())
+#define GST_S3_HLS_OUTPUT_STREAM(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_S3_HLS_OUTPUT_STREAM,GstS3HlsOutputStream))
+
+typedef struct
+{
+  GOutputStream parent;
+
+  /* the stream may outlive the sink, e.g. in giostreamsink */
+  GWeakRef sink;
+  gboolean is_playlist;
+  GstS3HlsObject *object;
+} GstS3HlsOutputStream;
+
+typedef struct
+{
+  GOutputStreamClass parent_class;
+} GstS3HlsOutputStreamClass;
+
+static GType gst_s3_hls_output_stream_get_type (void);
+G_DEFINE_TYPE (GstS3HlsOutputStream, gst_s3_hls_output_stream,
+    G_TYPE_OUTPUT_STREAM);
+
+static gssize
+gst_s3_hls_output_stream_write (GOutputStream * stream, const void *buffer,
+    gsize count, GCancellable * cancellable, GError ** error)
+{
+  GstS3HlsOutputStream *self = GST_S3_HLS_OUTPUT_STREAM (stream);
+  GstBuffer *buf;
+
+  (void) cancellable;
+
+  if (!self->object) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+        "The object is uploaded already");
+    return -1;
+  }
+
+  buf = gst_buffer_new_allocate (NULL, count, NULL);
+  gst_buffer_fill (buf, 0, buffer, count);
+  gst_buffer_list_add (self->object->buffers, buf);
+  self->object->size += count;
+
+  return count;
+}
+
+/* Hands the object over to the sink. The stream itself is left open when
+ * the sink finishes it, as giostreamsink may still flush it. */
+static void
+gst_s3_hls_output_stream_finish (GstS3HlsOutputStream * self)
+{
+  GstS3HlsSink *sink = g_weak_ref_get (&self->sink);
+  GstS3HlsObject *object = self->object;
+
+  self->object = NULL;
+
+  if (sink == NULL) {
+    if (object)
+      gst_s3_hls_object_free (object);
+    return;
+  }
+
+  gst_s3_hls_sink_forget_stream (sink, self);
+  if (object)
+    gst_s3_hls_sink_submit (sink, object, self->is_playlist);
+  gst_object_unref (sink);
+}
+
+static gboolean
+gst_s3_hls_output_stream_close (GOutputStream * stream,
+    GCancellable * cancellable, GError ** error)
+{
+  (void) cancellable;
+  (void) error;
+
+  gst_s3_hls_output_stream_finish (GST_S3_HLS_OUTPUT_STREAM (stream));
+  return TRUE;
+}
+
+static void
+gst_s3_hls_output_stream_finalize (GObject * object)
+{
+  GstS3HlsOutputStream *self = GST_S3_HLS_OUTPUT_STREAM (object);
+
+  if (self->object)
+    gst_s3_hls_object_free (self->object);
+  g_weak_ref_clear (&self->sink);
+
+  G_OBJECT_CLASS (gst_s3_hls_output_stream_parent_class)->finalize (object);
+}
+
+static void
+gst_s3_hls_output_stream_class_init (GstS3HlsOutputStreamClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GOutputStreamClass *stream_class = G_OUTPUT_STREAM_CLASS (klass);
+
+  gobject_class->finalize = gst_s3_hls_output_stream_finalize;
+  stream_class->write_fn = gst_s3_hls_output_stream_write;
+  stream_class->close_fn = gst_s3_hls_output_stream_close;
+}
+
+static void
+gst_s3_hls_output_stream_init (GstS3HlsOutputStream * self)
+{
+  g_weak_ref_init (&self->sink, NULL);
+  self->object = NULL;
+}
+
+/**
+ * GstS3HlsSink
+ */
+static void gst_s3_hls_sink_dispose (GObject * object);
+static void gst_s3_hls_sink_finalize (GObject * object);
+
+static void gst_s3_hls_sink_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_s3_hls_sink_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
+
+static GstStateChangeReturn gst_s3_hls_sink_change_state (GstElement *
+    element, GstStateChange transition);
+static GstPad *gst_s3_hls_sink_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps);
+static void gst_s3_hls_sink_release_pad (GstElement * element, GstPad * pad);
+static void gst_s3_hls_sink_handle_message (GstBin * bin,
+    GstMessage * message);
+
+static GOutputStream *gst_s3_hls_sink_get_fragment_stream (GstElement *
+    hlssink, const gchar * location, gpointer user_data);
+static GOutputStream *gst_s3_hls_sink_get_playlist_stream (GstElement *
+    hlssink, const gchar * location, gpointer user_data);
+static void gst_s3_hls_sink_delete_fragment (GstElement * hlssink,
+    const gchar * location, gpointer user_data);
+
+#define gst_s3_hls_sink_parent_class parent_class
+G_DEFINE_TYPE (GstS3HlsSink, gst_s3_hls_sink, GST_TYPE_BIN);
+
+static void
+gst_s3_hls_sink_class_init (GstS3HlsSinkClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
+  GstBinClass *gstbin_class = GST_BIN_CLASS (klass);
+
+  GST_DEBUG_CATEGORY_INIT (gst_s3_hls_sink_debug, "s3hlssink", 0,
+      "s3hlssink element");
+
+  gobject_class->dispose = gst_s3_hls_sink_dispose;
+  gobject_class->finalize = gst_s3_hls_sink_finalize;
+  gobject_class->set_property = gst_s3_hls_sink_set_property;
+  gobject_class->get_property = gst_s3_hls_sink_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_BUCKET,
+      g_param_spec_string ("bucket", "S3 bucket",
+          "The bucket to publish the stream to", NULL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_KEY_PREFIX,
+      g_param_spec_string ("key-prefix", "Key prefix",
+          "Put in front of the file names of the segments and of the playlist "
+          "to make their keys (e.g. live/)", NULL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_REGION,
+      g_param_spec_string ("region", "AWS Region",
+          "An AWS region (e.g. eu-west-2). Leave empty for region-autodetection "
+          "(Please note region-autodetection requires an extra network call)", NULL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_ACL,
+      g_param_spec_string ("acl", "S3 object acl",
+          "The canned acl for s3 objects to upload", NULL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CA_FILE,
+      g_param_spec_string ("ca-file", "CA file",
+          "A path to a CA file", NULL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CREDENTIALS,
+      g_param_spec_boxed ("aws-credentials", "AWS credentials",
+          "The AWS credentials to use", GST_TYPE_AWS_CREDENTIALS,
+          G_PARAM_WRITABLE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_INIT_AWS_SDK,
+      g_param_spec_boolean ("init-aws-sdk", "Init AWS SDK",
+          "Whether to initialize AWS SDK",
+          GST_S3_UPLOADER_CONFIG_DEFAULT_INIT_AWS_SDK,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_AWS_SDK_ENDPOINT,
+      g_param_spec_string ("aws-sdk-endpoint", "AWS SDK Endpoint",
+          "AWS SDK endpoint override (ip:port)", NULL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_AWS_SDK_USE_HTTP,
+      g_param_spec_boolean ("aws-sdk-use-http", "AWS SDK Use HTTP",
+          "Whether to enable http for the AWS SDK (default https)",
+          GST_S3_UPLOADER_CONFIG_DEFAULT_PROP_AWS_SDK_USE_HTTP,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_AWS_SDK_VERIFY_SSL,
+      g_param_spec_boolean ("aws-sdk-verify-ssl", "AWS SDK Verify SSL",
+          "Whether to enable/disable tls validation for the AWS SDK",
+          GST_S3_UPLOADER_CONFIG_DEFAULT_PROP_AWS_SDK_VERIFY_SSL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_CONNECTIONS,
+      g_param_spec_uint ("max-connections", "Max connections",
+          "Maximum number of HTTP connections to S3, shared with the s3sink "
+          "elements that use the same client", 1, G_MAXUINT,
+          GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_CONNECTIONS,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_CONCURRENT_UPLOADS,
+      g_param_spec_uint ("max-concurrent-uploads", "Max concurrent uploads",
+          "Maximum number of segments being uploaded at the same time", 1,
+          G_MAXUINT, DEFAULT_MAX_CONCURRENT_UPLOADS,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  /* passed on to hlssink2 */
+  g_object_class_install_property (gobject_class, PROP_LOCATION,
+      g_param_spec_string ("location", "File Location",
+          "Location of the segment files, of which only the file name is "
+          "used as the key", DEFAULT_LOCATION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PLAYLIST_LOCATION,
+      g_param_spec_string ("playlist-location", "Playlist Location",
+          "Location of the playlist, of which only the file name is used as "
+          "the key", DEFAULT_PLAYLIST_LOCATION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PLAYLIST_ROOT,
+      g_param_spec_string ("playlist-root", "Playlist Root",
+          "Base path for the segments in the playlist", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_TARGET_DURATION,
+      g_param_spec_uint ("target-duration", "Target duration",
+          "The target duration in seconds of a segment/file "
+          "(0 - disabled, useful for management of segment duration by the "
+          "streaming server)", 0, G_MAXUINT, DEFAULT_TARGET_DURATION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PLAYLIST_LENGTH,
+      g_param_spec_uint ("playlist-length", "Playlist length",
+          "Length of HLS playlist. To allow players to conform to section "
+          "6.3.3 of the HLS specification, this should be at least 3. If set "
+          "to 0, the playlist will be infinite.", 0, G_MAXUINT,
+          DEFAULT_PLAYLIST_LENGTH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_FILES,
+      g_param_spec_uint ("max-files", "Max files",
+          "Maximum number of segments kept track of (0 = unlimited)", 0,
+          G_MAXUINT, DEFAULT_MAX_FILES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  gst_element_class_set_static_metadata (gstelement_class,
+      "S3 HLS Sink",
+      "Sink/S3", "Publish an HLS stream to an Amazon S3 bucket",
+      "Marcin Kolny <marcin.kolny at gmail.com>");
+  gst_element_class_add_static_pad_template (gstelement_class,
+      &video_template);
+  gst_element_class_add_static_pad_template (gstelement_class,
+      &audio_template);
+
+  gstelement_class->change_state =
+      GST_DEBUG_FUNCPTR (gst_s3_hls_sink_change_state);
+  gstelement_class->request_new_pad =
+      GST_DEBUG_FUNCPTR (gst_s3_hls_sink_request_new_pad);
+  gstelement_class->release_pad =
+      GST_DEBUG_FUNCPTR (gst_s3_hls_sink_release_pad);
+  gstbin_class->handle_message =
+      GST_DEBUG_FUNCPTR (gst_s3_hls_sink_handle_message);
+}
+
+static void
+gst_s3_hls_sink_init (GstS3HlsSink * sink)
+{
+  sink->config = GST_S3_UPLOADER_CONFIG_INIT;
+  sink->config.credentials = gst_aws_credentials_new_default ();
+  sink->stats = gst_s3_upload_stats_new ();
+  sink->config.stats = sink->stats;
+  sink->key_prefix = NULL;
+  sink->max_concurrent_uploads = DEFAULT_MAX_CONCURRENT_UPLOADS;
+  sink->uploader = NULL;
+  sink->uploads = NULL;
+  g_mutex_init (&sink->lock);
+  g_cond_init (&sink->cond);
+  sink->open_streams = NULL;
+  sink->segments = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      NULL);
+  sink->pending_playlist = NULL;
+  sink->playlist_uploading = FALSE;
+  sink->uploads_in_flight = 0;
+
+  /* the stream signals came with 1.18 */
+  sink->hlssink = gst_element_factory_make ("hlssink2", "hlssink");
+  if (sink->hlssink
+      && g_signal_lookup ("get-fragment-stream",
+          G_OBJECT_TYPE (sink->hlssink)) == 0) {
+    gst_object_unref (gst_object_ref_sink (sink->hlssink));
+    sink->hlssink = NULL;
+  }
+  if (!sink->hlssink)
+    return;
+
+  g_signal_connect (sink->hlssink, "get-fragment-stream",
+      G_CALLBACK (gst_s3_hls_sink_get_fragment_stream), sink);
+  g_signal_connect (sink->hlssink, "get-playlist-stream",
+      G_CALLBACK (gst_s3_hls_sink_get_playlist_stream), sink);
+  g_signal_connect (sink->hlssink, "delete-fragment",
+      G_CALLBACK (gst_s3_hls_sink_delete_fragment), sink);
+  gst_bin_add (GST_BIN (sink), sink->hlssink);
+}
+
+static void
+gst_s3_hls_sink_dispose (GObject * object)
+{
+  GstS3HlsSink *sink = GST_S3_HLS_SINK (object);
+
+  if (sink->uploader) {
+    gst_s3_uploader_destroy (sink->uploader);
+    sink->uploader = NULL;
+  }
+  sink->hlssink = NULL;
+  gst_s3_metrics_unregister (GST_ELEMENT (sink));
+
+  G_OBJECT_CLASS (parent_class)->dispose (object);
+}
+
+static void
+gst_s3_hls_sink_finalize (GObject * object)
+{
+  GstS3HlsSink *sink = GST_S3_HLS_SINK (object);
+
+  g_free (sink->config.region);
+  g_free (sink->config.bucket);
+  g_free (sink->config.acl);
+  g_free (sink->config.ca_file);
+  g_free (sink->config.aws_sdk_endpoint);
+  gst_aws_credentials_free (sink->config.credentials);
+  gst_s3_upload_stats_unref (sink->stats);
+  g_free (sink->key_prefix);
+
+  g_list_free (sink->open_streams);
+  g_hash_table_unref (sink->segments);
+  if (sink->pending_playlist)
+    gst_s3_hls_object_free (sink->pending_playlist);
+  g_mutex_clear (&sink->lock);
+  g_cond_clear (&sink->cond);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_s3_hls_sink_set_string_property (GstS3HlsSink * sink,
+    const gchar * value, gchar ** property, const gchar * property_name)
+{
+  g_free (*property);
+  *property = g_strdup (value);
+  GST_INFO_OBJECT (sink, "%s : %s", property_name, GST_STR_NULL (*property));
+}
+
+static void
+gst_s3_hls_sink_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstS3HlsSink *sink = GST_S3_HLS_SINK (object);
+
+  switch (prop_id) {
+    case PROP_BUCKET:
+      gst_s3_hls_sink_set_string_property (sink, g_value_get_string (value),
+          &sink->config.bucket, "bucket");
+      break;
+    case PROP_KEY_PREFIX:
+      gst_s3_hls_sink_set_string_property (sink, g_value_get_string (value),
+          &sink->key_prefix, "key-prefix");
+      break;
+    case PROP_REGION:
+      gst_s3_hls_sink_set_string_property (sink, g_value_get_string (value),
+          &sink->config.region, "region");
+      break;
+    case PROP_ACL:
+      gst_s3_hls_sink_set_string_property (sink, g_value_get_string (value),
+          &sink->config.acl, "acl");
+      break;
+    case PROP_CA_FILE:
+      gst_s3_hls_sink_set_string_property (sink, g_value_get_string (value),
+          &sink->config.ca_file, "ca-file");
+      break;
+    case PROP_CREDENTIALS:
+      if (sink->config.credentials)
+        gst_aws_credentials_free (sink->config.credentials);
+      sink->config.credentials = gst_aws_credentials_copy (g_value_get_boxed (value));
+      break;
+    case PROP_INIT_AWS_SDK:
+      sink->config.init_aws_sdk = g_value_get_boolean (value);
+      break;
+    case PROP_AWS_SDK_ENDPOINT:
+      gst_s3_hls_sink_set_string_property (sink, g_value_get_string (value),
+          &sink->config.aws_sdk_endpoint, "aws-sdk-endpoint");
+      break;
+    case PROP_AWS_SDK_USE_HTTP:
+      sink->config.aws_sdk_use_http = g_value_get_boolean (value);
+      break;
+    case PROP_AWS_SDK_VERIFY_SSL:
+      sink->config.aws_sdk_verify_ssl = g_value_get_boolean (value);
+      break;
+    case PROP_MAX_CONNECTIONS:
+      sink->config.max_connections = g_value_get_uint (value);
+      break;
+    case PROP_MAX_CONCURRENT_UPLOADS:
+      sink->max_concurrent_uploads = g_value_get_uint (value);
+      break;
+    case PROP_LOCATION:
+    case PROP_PLAYLIST_LOCATION:
+    case PROP_PLAYLIST_ROOT:
+    case PROP_TARGET_DURATION:
+    case PROP_PLAYLIST_LENGTH:
+    case PROP_MAX_FILES:
+      if (sink->hlssink)
+        g_object_set_property (G_OBJECT (sink->hlssink), pspec->name, value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_s3_hls_sink_get_property (GObject * object, guint prop_id, GValue * value,
+    GParamSpec * pspec)
+{
+  GstS3HlsSink *sink = GST_S3_HLS_SINK (object);
+
+  switch (prop_id) {
+    case PROP_BUCKET:
+      g_value_set_string (value, sink->config.bucket);
+      break;
+    case PROP_KEY_PREFIX:
+      g_value_set_string (value, sink->key_prefix);
+      break;
+    case PROP_REGION:
+      g_value_set_string (value, sink->config.region);
+      break;
+    case PROP_ACL:
+      g_value_set_string (value, sink->config.acl);
+      break;
+    case PROP_CA_FILE:
+      g_value_set_string (value, sink->config.ca_file);
+      break;
+    case PROP_INIT_AWS_SDK:
+      g_value_set_boolean (value, sink->config.init_aws_sdk);
+      break;
+    case PROP_AWS_SDK_ENDPOINT:
+      g_value_set_string (value, sink->config.aws_sdk_endpoint);
+      break;
+    case PROP_AWS_SDK_USE_HTTP:
+      g_value_set_boolean (value, sink->config.aws_sdk_use_http);
+      break;
+    case PROP_AWS_SDK_VERIFY_SSL:
+      g_value_set_boolean (value, sink->config.aws_sdk_verify_ssl);
+      break;
+    case PROP_MAX_CONNECTIONS:
+      g_value_set_uint (value, sink->config.max_connections);
+      break;
+    case PROP_MAX_CONCURRENT_UPLOADS:
+      g_value_set_uint (value, sink->max_concurrent_uploads);
+      break;
+    case PROP_LOCATION:
+    case PROP_PLAYLIST_LOCATION:
+    case PROP_PLAYLIST_ROOT:
+    case PROP_TARGET_DURATION:
+    case PROP_PLAYLIST_LENGTH:
+    case PROP_MAX_FILES:
+      if (sink->hlssink)
+        g_object_get_property (G_OBJECT (sink->hlssink), pspec->name, value);
+      else
+        g_param_value_set_default (pspec, value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static GstPad *
+gst_s3_hls_sink_request_new_pad (GstElement * element, GstPadTemplate * templ,
+    const gchar * name, const GstCaps * caps)
+{
+  GstS3HlsSink *sink = GST_S3_HLS_SINK (element);
+  GstPad *target, *pad;
+
+  (void) name;
+  (void) caps;
+
+  if (!sink->hlssink)
+    return NULL;
+
+  target = gst_element_get_request_pad (sink->hlssink,
+      GST_PAD_TEMPLATE_NAME_TEMPLATE (templ));
+  if (!target)
+    return NULL;
+
+  pad = gst_ghost_pad_new_from_template (GST_PAD_NAME (target), target, templ);
+  gst_object_unref (target);
+
+  if (GST_STATE (element) > GST_STATE_NULL)
+    gst_pad_set_active (pad, TRUE);
+  gst_element_add_pad (element, pad);
+
+  return pad;
+}
+
+static void
+gst_s3_hls_sink_release_pad (GstElement * element, GstPad * pad)
+{
+  GstS3HlsSink *sink = GST_S3_HLS_SINK (element);
+  GstPad *target = gst_ghost_pad_get_target (GST_GHOST_PAD (pad));
+
+  if (target) {
+    gst_element_release_request_pad (sink->hlssink, target);
+    gst_object_unref (target);
+  }
+
+  gst_pad_set_active (pad, FALSE);
+  gst_element_remove_pad (element, pad);
+}
+
+static gboolean
+gst_s3_hls_sink_is_null_or_empty (const gchar * str)
+{
+  return str == NULL || str[0] == '\0';
+}
+
+/* The key of a segment or of a playlist: its file name after key-prefix. */
+static gchar *
+gst_s3_hls_sink_get_key (GstS3HlsSink * sink, const gchar * location)
+{
+  gchar *name = g_path_get_basename (location);
+  gchar *key = g_strconcat (sink->key_prefix ? sink->key_prefix : "", name,
+      NULL);
+
+  g_free (name);
+  return key;
+}
+
+static const gchar *
+gst_s3_hls_sink_get_content_type (const gchar * key)
+{
+  if (g_str_has_suffix (key, ".m3u8"))
+    return "application/vnd.apple.mpegurl";
+  if (g_str_has_suffix (key, ".ts"))
+    return "video/mp2t";
+  if (g_str_has_suffix (key, ".m4s") || g_str_has_suffix (key, ".mp4"))
+    return "video/mp4";
+  return NULL;
+}
+
+static GstS3Uploader *
+gst_s3_hls_sink_new_uploader (GstS3HlsSink * sink, const gchar * key)
+{
+  GstS3UploaderConfig config = sink->config;
+  GstS3Uploader *uploader = NULL;
+
+  config.key = (gchar *) key;
+  config.content_type = (gchar *) gst_s3_hls_sink_get_content_type (key);
+
+  if (sink->uploader)
+    uploader = gst_s3_uploader_create_next (sink->uploader, &config);
+  if (!uploader)
+    uploader = gst_s3_multipart_uploader_new (&config);
+
+  return uploader;
+}
+
+static GOutputStream *
+gst_s3_hls_sink_open_stream (GstS3HlsSink * sink, const gchar * location,
+    gboolean is_playlist)
+{
+  GstS3HlsOutputStream *stream;
+  GstS3HlsObject *object = g_new0 (GstS3HlsObject, 1);
+
+  object->key = gst_s3_hls_sink_get_key (sink, location);
+  object->buffers = gst_buffer_list_new ();
+  object->close_time = GST_CLOCK_TIME_NONE;
+
+  /* created now, so that the client is ready by the time it's closed */
+  object->uploader = gst_s3_hls_sink_new_uploader (sink, object->key);
+  if (!object->uploader)
+    goto init_failed;
+
+  GST_DEBUG_OBJECT (sink, "opened %s", object->key);
+
+  stream = g_object_new (GST_TYPE_S3_HLS_OUTPUT_STREAM, NULL);
+  g_weak_ref_set (&stream->sink, sink);
+  stream->is_playlist = is_playlist;
+  stream->object = object;
+
+  g_mutex_lock (&sink->lock);
+  sink->open_streams = g_list_prepend (sink->open_streams, stream);
+  if (!is_playlist)
+    g_hash_table_insert (sink->segments, g_strdup (object->key),
+        GINT_TO_POINTER (GST_S3_HLS_SEGMENT_WRITING));
+  g_mutex_unlock (&sink->lock);
+
+  return G_OUTPUT_STREAM (stream);
+
+init_failed:
+  {
+    GST_ELEMENT_ERROR (sink, RESOURCE, OPEN_WRITE,
+        ("Unable to initialize the uploader of %s.", object->key), (NULL));
+    gst_s3_hls_object_free (object);
+    return NULL;
+  }
+}
+
+static GOutputStream *
+gst_s3_hls_sink_get_fragment_stream (GstElement * hlssink,
+    const gchar * location, gpointer user_data)
+{
+  (void) hlssink;
+  return gst_s3_hls_sink_open_stream (GST_S3_HLS_SINK (user_data), location,
+      FALSE);
+}
+
+static GOutputStream *
+gst_s3_hls_sink_get_playlist_stream (GstElement * hlssink,
+    const gchar * location, gpointer user_data)
+{
+  (void) hlssink;
+  return gst_s3_hls_sink_open_stream (GST_S3_HLS_SINK (user_data), location,
+      TRUE);
+}
+
+/* There is no local file to remove; the segment stays in the bucket. */
+static void
+gst_s3_hls_sink_delete_fragment (GstElement * hlssink,
+    const gchar * location, gpointer user_data)
+{
+  GstS3HlsSink *sink = GST_S3_HLS_SINK (user_data);
+  gchar *key = gst_s3_hls_sink_get_key (sink, location);
+
+  GST_DEBUG_OBJECT (sink, "%s is out of the playlist", key);
+  g_free (key);
+
+  g_signal_stop_emission_by_name (hlssink, "delete-fragment");
+}
+
+static void
+gst_s3_hls_sink_forget_stream (GstS3HlsSink * sink, gpointer stream)
+{
+  g_mutex_lock (&sink->lock);
+  sink->open_streams = g_list_remove (sink->open_streams, stream);
+  g_mutex_unlock (&sink->lock);
+}
+
+/* The keys of the segments listed in a playlist. */
+static GPtrArray *
+gst_s3_hls_sink_get_playlist_segments (GstS3HlsSink * sink,
+    GstBufferList * buffers)
+{
+  GPtrArray *segments = g_ptr_array_new_with_free_func (g_free);
+  GString *text = g_string_new (NULL);
+  gchar **lines;
+  guint i;
+
+  for (i = 0; i < gst_buffer_list_length (buffers); i++) {
+    GstMapInfo info;
+    GstBuffer *buf = gst_buffer_list_get (buffers, i);
+
+    if (gst_buffer_map (buf, &info, GST_MAP_READ)) {
+      g_string_append_len (text, (const gchar *) info.data, info.size);
+      gst_buffer_unmap (buf, &info);
+    }
+  }
+
+  lines = g_strsplit (text->str, "\n", -1);
+  for (i = 0; lines[i]; i++) {
+    gchar *uri = g_strstrip (lines[i]);
+
+    if (uri[0] == '\0' || uri[0] == '#')
+      continue;
+
+    /* playlist-root doesn't end up in the key */
+    uri[strcspn (uri, "?#")] = '\0';
+    g_ptr_array_add (segments, gst_s3_hls_sink_get_key (sink, uri));
+  }
+
+  g_strfreev (lines);
+  g_string_free (text, TRUE);
+
+  return segments;
+}
+
+/* Whether all the segments of the playlist are uploaded. A playlist that
+ * refers to a segment that failed is never published. */
+static gboolean
+gst_s3_hls_sink_is_playlist_ready (GstS3HlsSink * sink,
+    GstS3HlsObject * playlist)
+{
+  guint i;
+
+  for (i = 0; i < playlist->segments->len; i++) {
+    gpointer state;
+
+    /* from an earlier run, or published already */
+    if (!g_hash_table_lookup_extended (sink->segments,
+            g_ptr_array_index (playlist->segments, i), NULL, &state))
+      continue;
+
+    if (GPOINTER_TO_INT (state) != GST_S3_HLS_SEGMENT_DONE)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Forgets the segments that are uploaded and out of the playlist. */
+static void
+gst_s3_hls_sink_prune_segments (GstS3HlsSink * sink,
+    GstS3HlsObject * playlist)
+{
+  GHashTableIter iter;
+  gpointer key, state;
+  guint i;
+
+  g_hash_table_iter_init (&iter, sink->segments);
+  while (g_hash_table_iter_next (&iter, &key, &state)) {
+    if (GPOINTER_TO_INT (state) != GST_S3_HLS_SEGMENT_DONE)
+      continue;
+
+    for (i = 0; i < playlist->segments->len; i++) {
+      if (g_str_equal (key, g_ptr_array_index (playlist->segments, i)))
+        break;
+    }
+    if (i == playlist->segments->len)
+      g_hash_table_iter_remove (&iter);
+  }
+}
+
+static gboolean
+gst_s3_hls_sink_put_object (GstS3HlsSink * sink, GstS3HlsObject * object)
+{
+  GstBufferList *buffers = object->buffers;
+  gchar *etag;
+  gboolean ret;
+
+  object->buffers = NULL;
+  ret = gst_s3_uploader_put_object (object->uploader, buffers);
+
+  if (!ret) {
+    GST_ELEMENT_ERROR (sink, RESOURCE, WRITE,
+        ("Failed to upload %s to S3.", object->key), (NULL));
+    return FALSE;
+  }
+
+  GST_INFO_OBJECT (sink, "published %s", object->key);
+
+  etag = gst_s3_uploader_get_etag (object->uploader);
+  gst_element_post_message (GST_ELEMENT_CAST (sink),
+      gst_message_new_element (GST_OBJECT_CAST (sink),
+          gst_structure_new ("s3hlssink-object",
+              "bucket", G_TYPE_STRING, sink->config.bucket,
+              "key", G_TYPE_STRING, object->key,
+              "size", G_TYPE_UINT64, object->size,
+              "etag", G_TYPE_STRING, etag,
+              "duration", G_TYPE_UINT64,
+              gst_util_get_timestamp () - object->close_time, NULL)));
+  g_free (etag);
+
+  return TRUE;
+}
+
+/* Uploads the pending playlist for as long as there is one ready. Only
+ * one playlist is uploaded at a time, so that they can't overtake each
+ * other. */
+static void
+gst_s3_hls_sink_publish_playlist (GstS3HlsSink * sink)
+{
+  GstS3HlsObject *playlist;
+  gboolean ret;
+
+  g_mutex_lock (&sink->lock);
+  while (!sink->playlist_uploading && sink->pending_playlist
+      && gst_s3_hls_sink_is_playlist_ready (sink, sink->pending_playlist)) {
+    playlist = sink->pending_playlist;
+    sink->pending_playlist = NULL;
+    sink->playlist_uploading = TRUE;
+    g_mutex_unlock (&sink->lock);
+
+    ret = gst_s3_hls_sink_put_object (sink, playlist);
+
+    g_mutex_lock (&sink->lock);
+    sink->playlist_uploading = FALSE;
+    if (ret)
+      gst_s3_hls_sink_prune_segments (sink, playlist);
+    gst_s3_hls_object_free (playlist);
+  }
+  g_mutex_unlock (&sink->lock);
+}
+
+static void
+gst_s3_hls_sink_upload (gpointer data, gpointer user_data)
+{
+  GstS3HlsObject *object = data;
+  GstS3HlsSink *sink = GST_S3_HLS_SINK (user_data);
+  gboolean ret;
+
+  /* segments come with their data, playlists are taken from the sink */
+  if (object->buffers) {
+    ret = gst_s3_hls_sink_put_object (sink, object);
+
+    g_mutex_lock (&sink->lock);
+    g_hash_table_insert (sink->segments, g_strdup (object->key),
+        GINT_TO_POINTER (ret ? GST_S3_HLS_SEGMENT_DONE :
+            GST_S3_HLS_SEGMENT_FAILED));
+    g_mutex_unlock (&sink->lock);
+  }
+  gst_s3_hls_object_free (object);
+
+  gst_s3_hls_sink_publish_playlist (sink);
+
+  g_mutex_lock (&sink->lock);
+  sink->uploads_in_flight--;
+  g_cond_broadcast (&sink->cond);
+  g_mutex_unlock (&sink->lock);
+}
+
+static void
+gst_s3_hls_sink_submit (GstS3HlsSink * sink, GstS3HlsObject * object,
+    gboolean is_playlist)
+{
+  object->close_time = gst_util_get_timestamp ();
+
+  g_mutex_lock (&sink->lock);
+  if (!sink->uploads) {
+    g_mutex_unlock (&sink->lock);
+    GST_WARNING_OBJECT (sink, "dropping %s, the sink is stopped", object->key);
+    gst_s3_hls_object_free (object);
+    return;
+  }
+
+  GST_DEBUG_OBJECT (sink, "closed %s, %" G_GUINT64_FORMAT " bytes",
+      object->key, object->size);
+
+  if (is_playlist) {
+    object->segments =
+        gst_s3_hls_sink_get_playlist_segments (sink, object->buffers);
+    if (sink->pending_playlist)
+      gst_s3_hls_object_free (sink->pending_playlist);
+    sink->pending_playlist = object;
+    /* just a nudge, in case its segments are uploaded already */
+    object = g_new0 (GstS3HlsObject, 1);
+  } else {
+    g_hash_table_insert (sink->segments, g_strdup (object->key),
+        GINT_TO_POINTER (GST_S3_HLS_SEGMENT_UPLOADING));
+  }
+
+  sink->uploads_in_flight++;
+  g_thread_pool_push (sink->uploads, object, NULL);
+  g_mutex_unlock (&sink->lock);
+}
+
+/* Closes the streams hlssink2 left open, e.g. the last segment, and waits
+ * until everything that can be published is. */
+static void
+gst_s3_hls_sink_wait_for_uploads (GstS3HlsSink * sink)
+{
+  GList *streams, *l;
+
+  g_mutex_lock (&sink->lock);
+  streams = g_list_copy_deep (sink->open_streams, (GCopyFunc) g_object_ref,
+      NULL);
+  g_mutex_unlock (&sink->lock);
+
+  for (l = streams; l; l = l->next)
+    gst_s3_hls_output_stream_finish (GST_S3_HLS_OUTPUT_STREAM (l->data));
+  g_list_free_full (streams, g_object_unref);
+
+  g_mutex_lock (&sink->lock);
+  while (sink->uploads_in_flight > 0 || sink->playlist_uploading)
+    g_cond_wait (&sink->cond, &sink->lock);
+  g_mutex_unlock (&sink->lock);
+}
+
+static gboolean
+gst_s3_hls_sink_start (GstS3HlsSink * sink)
+{
+  GstS3UploaderConfig config;
+  gchar *location = NULL;
+
+  if (!sink->hlssink)
+    goto no_hlssink;
+
+  if (gst_s3_hls_sink_is_null_or_empty (sink->config.bucket))
+    goto no_bucket;
+
+  /* shares the client with the uploaders of the objects */
+  if (sink->uploader == NULL) {
+    g_object_get (sink->hlssink, "playlist-location", &location, NULL);
+    config = sink->config;
+    config.key = gst_s3_hls_sink_get_key (sink,
+        location ? location : DEFAULT_PLAYLIST_LOCATION);
+    sink->uploader = gst_s3_multipart_uploader_new (&config);
+    g_free (config.key);
+    g_free (location);
+  }
+
+  if (!sink->uploader)
+    goto init_failed;
+
+  gst_s3_metrics_register (GST_ELEMENT (sink), &sink->config);
+
+  g_hash_table_remove_all (sink->segments);
+  sink->uploads = g_thread_pool_new (gst_s3_hls_sink_upload, sink,
+      sink->max_concurrent_uploads, FALSE, NULL);
+
+  return TRUE;
+
+no_hlssink:
+  {
+    GST_ELEMENT_ERROR (sink, CORE, MISSING_PLUGIN,
+        ("hlssink2 (1.18 or newer) is required."), (NULL));
+    return FALSE;
+  }
+no_bucket:
+  {
+    GST_ELEMENT_ERROR (sink, RESOURCE, NOT_FOUND,
+        ("No bucket specified for writing."), (NULL));
+    return FALSE;
+  }
+init_failed:
+  {
+    GST_ELEMENT_ERROR (sink, RESOURCE, OPEN_WRITE,
+        ("Unable to initialize the uploader."), (NULL));
+    return FALSE;
+  }
+}
+
+static void
+gst_s3_hls_sink_stop (GstS3HlsSink * sink)
+{
+  GThreadPool *uploads;
+
+  if (!sink->uploads)
+    return;
+
+  gst_s3_hls_sink_wait_for_uploads (sink);
+
+  g_mutex_lock (&sink->lock);
+  uploads = sink->uploads;
+  sink->uploads = NULL;
+  if (sink->pending_playlist) {
+    GST_WARNING_OBJECT (sink, "%s refers to segments that failed, dropping it",
+        sink->pending_playlist->key);
+    gst_s3_hls_object_free (sink->pending_playlist);
+    sink->pending_playlist = NULL;
+  }
+  g_mutex_unlock (&sink->lock);
+
+  g_thread_pool_free (uploads, FALSE, TRUE);
+}
+
+static GstStateChangeReturn
+gst_s3_hls_sink_change_state (GstElement * element, GstStateChange transition)
+{
+  GstS3HlsSink *sink = GST_S3_HLS_SINK (element);
+  GstStateChangeReturn ret;
+
+  if (transition == GST_STATE_CHANGE_NULL_TO_READY
+      && !gst_s3_hls_sink_start (sink))
+    return GST_STATE_CHANGE_FAILURE;
+
+  ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+  /* hlssink2 is done writing by now */
+  if (transition == GST_STATE_CHANGE_READY_TO_NULL
+      || (transition == GST_STATE_CHANGE_NULL_TO_READY
+          && ret == GST_STATE_CHANGE_FAILURE))
+    gst_s3_hls_sink_stop (sink);
+
+  return ret;
+}
+
+static void
+gst_s3_hls_sink_handle_message (GstBin * bin, GstMessage * message)
+{
+  GstS3HlsSink *sink = GST_S3_HLS_SINK (bin);
+
+  /* the stream is only over once the last playlist is published */
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_EOS)
+    gst_s3_hls_sink_wait_for_uploads (sink);
+
+  GST_BIN_CLASS (parent_class)->handle_message (bin, message);
+}
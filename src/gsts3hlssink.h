@@ -0,0 +1,91 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#ifndef __GST_S3_HLS_SINK_H__
+#define __GST_S3_HLS_SINK_H__
+
+#include <gst/gst.h>
+
+#include "gsts3uploader.h"
+#include "gstawscredentials.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_S3_HLS_SINK \
+  (gst_s3_hls_sink_get_type())
+#define GST_S3_HLS_SINK(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_S3_HLS_SINK,GstS3HlsSink))
+#define GST_S3_HLS_SINK_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_S3_HLS_SINK,GstS3HlsSinkClass))
+#define GST_IS_S3_HLS_SINK(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_S3_HLS_SINK))
+#define GST_IS_S3_HLS_SINK_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_S3_HLS_SINK))
+#define GST_S3_HLS_SINK_CAST(obj) ((GstS3HlsSink *)(obj))
+typedef struct _GstS3HlsSink GstS3HlsSink;
+typedef struct _GstS3HlsSinkClass GstS3HlsSinkClass;
+typedef struct _GstS3HlsObject GstS3HlsObject;
+
+/**
+ * GstS3HlsSink:
+ *
+ * Opaque #GstS3HlsSink structure.
+ */
+struct _GstS3HlsSink {
+  GstBin parent;
+
+  /*< private > */
+  GstS3UploaderConfig config;
+  gchar *key_prefix;
+  guint max_concurrent_uploads;
+
+  /* hlssink2, writing to the streams handed out by this element */
+  GstElement *hlssink;
+
+  /* the uploaders of the objects are created from this one, so that
+   * they share the S3 client */
+  GstS3Uploader *uploader;
+
+  /* of all the uploads, shared with the uploaders through the config */
+  GstS3UploadStats *stats;
+
+  /* uploads the segments, and the playlists once they can be published */
+  GThreadPool *uploads;
+
+  GMutex lock;
+  GCond cond;
+  /* the streams hlssink2 is still writing to */
+  GList *open_streams;
+  /* key -> state of the segments the playlists may refer to */
+  GHashTable *segments;
+  /* the latest playlist, waiting for its segments to be uploaded */
+  GstS3HlsObject *pending_playlist;
+  gboolean playlist_uploading;
+  guint uploads_in_flight;
+};
+
+struct _GstS3HlsSinkClass {
+  GstBinClass parent_class;
+};
+
+GST_EXPORT
+GType gst_s3_hls_sink_get_type (void);
+
+G_END_DECLS
+
+#endif /* __GST_S3_HLS_SINK_H__ */
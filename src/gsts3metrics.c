@@ -0,0 +1,597 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include "gsts3metrics.h"
+
+#include <string.h>
+
+#include <gio/gio.h>
+
+GST_DEBUG_CATEGORY_STATIC (gst_s3_metrics_debug);
+#define GST_CAT_DEFAULT gst_s3_metrics_debug
+
+#define METRICS_ADDRESS_ENV "GST_S3_METRICS_ADDRESS"
+#define CONTENT_TYPE \
+  "application/openmetrics-text; version=1.0.0; charset=utf-8"
+/* of a scrape that doesn't send its request */
+#define CONNECTION_TIMEOUT 10
+/* a scrape is a short GET, anything longer is refused */
+#define MAX_REQUEST_SIZE 8192
+
+typedef enum
+{
+  METRIC_COUNTER,
+  METRIC_GAUGE
+} MetricType;
+
+/* Exported from the fields of the stats structure. */
+static const struct
+{
+  const gchar *field;
+  const gchar *name;
+  MetricType type;
+  /* nanoseconds in the stats */
+  gboolean seconds;
+  const gchar *help;
+} metrics[] = {
+  {"bytes-enqueued", "gst_s3_upload_enqueued_bytes", METRIC_COUNTER, FALSE,
+      "Bytes handed over to the uploads"},
+  {"bytes-acknowledged", "gst_s3_upload_acknowledged_bytes", METRIC_COUNTER,
+      FALSE, "Bytes acknowledged by S3"},
+  {"parts-in-flight", "gst_s3_upload_parts_in_flight", METRIC_GAUGE, FALSE,
+      "Parts being uploaded"},
+  {"parts-completed", "gst_s3_upload_parts_completed", METRIC_COUNTER, FALSE,
+      "Parts acknowledged by S3"},
+  {"parts-failed", "gst_s3_upload_parts_failed", METRIC_COUNTER, FALSE,
+      "Parts that failed for good"},
+  {"parts-retried", "gst_s3_upload_part_retries", METRIC_COUNTER, FALSE,
+      "Part uploads that were tried again"},
+  {"blocked-time", "gst_s3_upload_blocked_seconds", METRIC_COUNTER, TRUE,
+      "Time the elements waited for the uploads to take more data"},
+};
+
+#define REQUESTS_METRIC "gst_s3_upload_requests"
+
+static const struct
+{
+  const gchar *field;
+  const gchar *api;
+} requests[] = {
+  {"create-multipart-upload-requests", "CreateMultipartUpload"},
+  {"upload-part-requests", "UploadPart"},
+  {"complete-multipart-upload-requests", "CompleteMultipartUpload"},
+  {"abort-multipart-upload-requests", "AbortMultipartUpload"},
+  {"list-parts-requests", "ListParts"},
+  {"put-object-requests", "PutObject"},
+};
+
+#define LATENCY_METRIC "gst_s3_upload_part_latency_seconds"
+
+typedef struct
+{
+  gchar *path;
+  gchar *bucket;
+  GstS3UploadStats *stats;
+} Registration;
+
+/* the stats of the elements with the same path and bucket, added up */
+typedef struct
+{
+  gchar *path;
+  gchar *bucket;
+  guint64 values[G_N_ELEMENTS (metrics)];
+  guint64 requests[G_N_ELEMENTS (requests)];
+  guint64 latency_counts[GST_S3_UPLOAD_STATS_LATENCY_BUCKETS];
+  GstClockTime latency_sum;
+} Sample;
+
+static GMutex registry_lock;
+/* element -> Registration */
+static GHashTable *registry;
+
+static GMutex server_lock;
+static GSocketListener *server_listener;
+static guint16 server_port;
+
+static void
+registration_free (Registration * registration)
+{
+  g_free (registration->path);
+  g_free (registration->bucket);
+  gst_s3_upload_stats_unref (registration->stats);
+  g_free (registration);
+}
+
+static void
+sample_free (Sample * sample)
+{
+  g_free (sample->path);
+  g_free (sample->bucket);
+  g_free (sample);
+}
+
+/* Also needed by a server started before any element registers. */
+static void
+init_debug_category (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized)) {
+    GST_DEBUG_CATEGORY_INIT (gst_s3_metrics_debug, "s3metrics", 0,
+        "S3 upload metrics");
+    g_once_init_leave (&initialized, 1);
+  }
+}
+
+static void
+serve_from_environment (void)
+{
+  const gchar *address = g_getenv (METRICS_ADDRESS_ENV);
+  GError *err = NULL;
+
+  if (address == NULL || *address == '\0')
+    return;
+
+  if (gst_s3_metrics_serve (address, &err) == 0) {
+    GST_WARNING ("Failed to serve the S3 metrics on %s: %s", address,
+        err->message);
+    g_clear_error (&err);
+  }
+}
+
+static gchar *
+get_bucket (const GstS3UploaderConfig * config)
+{
+  GstUri *uri;
+  gchar *bucket;
+
+  if (config->location == NULL || *config->location == '\0')
+    return g_strdup (config->bucket ? config->bucket : "");
+
+  uri = gst_uri_from_string (config->location);
+  bucket = g_strdup (uri && gst_uri_get_host (uri) ?
+      gst_uri_get_host (uri) : "");
+  if (uri)
+    gst_uri_unref (uri);
+
+  return bucket;
+}
+
+void
+gst_s3_metrics_register (GstElement * element,
+    const GstS3UploaderConfig * config)
+{
+  static gsize environment_checked = 0;
+  Registration *registration;
+
+  g_return_if_fail (GST_IS_ELEMENT (element));
+  g_return_if_fail (config->stats != NULL);
+
+  init_debug_category ();
+
+  /* like the AWS SDK, set up by the first element that needs it */
+  if (g_once_init_enter (&environment_checked)) {
+    serve_from_environment ();
+    g_once_init_leave (&environment_checked, 1);
+  }
+
+  registration = g_new0 (Registration, 1);
+  registration->path = gst_object_get_path_string (GST_OBJECT (element));
+  registration->bucket = get_bucket (config);
+  registration->stats = gst_s3_upload_stats_ref (config->stats);
+
+  g_mutex_lock (&registry_lock);
+  if (registry == NULL)
+    registry = g_hash_table_new_full (NULL, NULL, NULL,
+        (GDestroyNotify) registration_free);
+  g_hash_table_replace (registry, element, registration);
+  g_mutex_unlock (&registry_lock);
+}
+
+void
+gst_s3_metrics_unregister (GstElement * element)
+{
+  g_mutex_lock (&registry_lock);
+  if (registry)
+    g_hash_table_remove (registry, element);
+  g_mutex_unlock (&registry_lock);
+}
+
+static void
+add_registration (GHashTable * samples, Registration * registration)
+{
+  gchar *key = g_strconcat (registration->path, "\n", registration->bucket,
+      NULL);
+  Sample *sample = g_hash_table_lookup (samples, key);
+  GstStructure *s;
+  guint64 counts[GST_S3_UPLOAD_STATS_LATENCY_BUCKETS];
+  guint64 value;
+  guint i;
+
+  if (sample == NULL) {
+    sample = g_new0 (Sample, 1);
+    sample->path = g_strdup (registration->path);
+    sample->bucket = g_strdup (registration->bucket);
+    g_hash_table_insert (samples, key, sample);
+  } else {
+    g_free (key);
+  }
+
+  s = gst_s3_upload_stats_to_structure (registration->stats, "metrics");
+  for (i = 0; i < G_N_ELEMENTS (metrics); i++) {
+    if (gst_structure_get_uint64 (s, metrics[i].field, &value))
+      sample->values[i] += value;
+  }
+  for (i = 0; i < G_N_ELEMENTS (requests); i++) {
+    if (gst_structure_get_uint64 (s, requests[i].field, &value))
+      sample->requests[i] += value;
+  }
+  gst_structure_free (s);
+
+  sample->latency_sum += gst_s3_upload_stats_get_latency_histogram
+      (registration->stats, counts);
+  for (i = 0; i < GST_S3_UPLOAD_STATS_LATENCY_BUCKETS; i++)
+    sample->latency_counts[i] += counts[i];
+}
+
+static gint
+compare_samples (gconstpointer a, gconstpointer b)
+{
+  const Sample *sa = *(const Sample **) a;
+  const Sample *sb = *(const Sample **) b;
+  gint ret = strcmp (sa->path, sb->path);
+
+  return ret != 0 ? ret : strcmp (sa->bucket, sb->bucket);
+}
+
+static void
+append_label_value (GString * out, const gchar * value)
+{
+  for (; *value; value++) {
+    switch (*value) {
+      case '\\':
+        g_string_append (out, "\\\\");
+        break;
+      case '"':
+        g_string_append (out, "\\\"");
+        break;
+      case '\n':
+        g_string_append (out, "\\n");
+        break;
+      default:
+        g_string_append_c (out, *value);
+        break;
+    }
+  }
+}
+
+static void
+append_sample_name (GString * out, const gchar * name, const gchar * suffix,
+    const Sample * sample)
+{
+  g_string_append_printf (out, "%s%s{element=\"", name, suffix);
+  append_label_value (out, sample->path);
+  g_string_append (out, "\",bucket=\"");
+  append_label_value (out, sample->bucket);
+  g_string_append_c (out, '"');
+}
+
+static void
+append_seconds (GString * out, GstClockTime time)
+{
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_string_append (out, g_ascii_formatd (buf, sizeof (buf), "%.9f",
+          (gdouble) time / GST_SECOND));
+}
+
+static void
+append_family (GString * out, const gchar * name, const gchar * type,
+    const gchar * help)
+{
+  g_string_append_printf (out, "# TYPE %s %s\n# HELP %s %s.\n", name, type,
+      name, help);
+}
+
+static void
+append_latency_histogram (GString * out, const Sample * sample)
+{
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+  guint64 count = 0;
+  guint i;
+
+  for (i = 0; i < GST_S3_UPLOAD_STATS_LATENCY_BUCKETS; i++) {
+    GstClockTime bound = gst_s3_upload_stats_get_latency_bound (i);
+
+    count += sample->latency_counts[i];
+    append_sample_name (out, LATENCY_METRIC, "_bucket", sample);
+    g_string_append_printf (out, ",le=\"%s\"} %" G_GUINT64_FORMAT "\n",
+        GST_CLOCK_TIME_IS_VALID (bound) ?
+        g_ascii_formatd (buf, sizeof (buf), "%g",
+            (gdouble) bound / GST_SECOND) : "+Inf", count);
+  }
+
+  append_sample_name (out, LATENCY_METRIC, "_count", sample);
+  g_string_append_printf (out, "} %" G_GUINT64_FORMAT "\n", count);
+  append_sample_name (out, LATENCY_METRIC, "_sum", sample);
+  g_string_append (out, "} ");
+  append_seconds (out, sample->latency_sum);
+  g_string_append_c (out, '\n');
+}
+
+gchar *
+gst_s3_metrics_render (void)
+{
+  GHashTable *samples = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) sample_free);
+  GPtrArray *sorted = g_ptr_array_new ();
+  GString *out = g_string_new (NULL);
+  GHashTableIter iter;
+  gpointer value;
+  guint i, j;
+
+  g_mutex_lock (&registry_lock);
+  if (registry) {
+    g_hash_table_iter_init (&iter, registry);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+      add_registration (samples, value);
+  }
+  g_mutex_unlock (&registry_lock);
+
+  g_hash_table_iter_init (&iter, samples);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    g_ptr_array_add (sorted, value);
+  g_ptr_array_sort (sorted, compare_samples);
+
+  for (i = 0; i < G_N_ELEMENTS (metrics); i++) {
+    gboolean counter = metrics[i].type == METRIC_COUNTER;
+
+    append_family (out, metrics[i].name, counter ? "counter" : "gauge",
+        metrics[i].help);
+    for (j = 0; j < sorted->len; j++) {
+      const Sample *sample = g_ptr_array_index (sorted, j);
+
+      append_sample_name (out, metrics[i].name, counter ? "_total" : "",
+          sample);
+      g_string_append (out, "} ");
+      if (metrics[i].seconds)
+        append_seconds (out, sample->values[i]);
+      else
+        g_string_append_printf (out, "%" G_GUINT64_FORMAT, sample->values[i]);
+      g_string_append_c (out, '\n');
+    }
+  }
+
+  append_family (out, REQUESTS_METRIC, "counter",
+      "Requests made to each S3 API, not counting the retries of the SDK");
+  for (j = 0; j < sorted->len; j++) {
+    const Sample *sample = g_ptr_array_index (sorted, j);
+
+    for (i = 0; i < G_N_ELEMENTS (requests); i++) {
+      append_sample_name (out, REQUESTS_METRIC, "_total", sample);
+      g_string_append_printf (out, ",api=\"%s\"} %" G_GUINT64_FORMAT "\n",
+          requests[i].api, sample->requests[i]);
+    }
+  }
+
+  append_family (out, LATENCY_METRIC, "histogram",
+      "Time to upload a part, retries included");
+  for (j = 0; j < sorted->len; j++)
+    append_latency_histogram (out, g_ptr_array_index (sorted, j));
+
+  g_string_append (out, "# EOF\n");
+
+  g_ptr_array_unref (sorted);
+  g_hash_table_unref (samples);
+
+  return g_string_free (out, FALSE);
+}
+
+/* Reads the request up to the blank line ending its headers, and returns
+ * its path. Gives up on requests longer than MAX_REQUEST_SIZE, setting
+ * too_large, and on those not sent within CONNECTION_TIMEOUT. */
+static gchar *
+read_request_path (GInputStream * stream, gboolean * head,
+    gboolean * too_large)
+{
+  gchar request[MAX_REQUEST_SIZE + 1];
+  gsize size = 0;
+  gint64 deadline =
+      g_get_monotonic_time () + CONNECTION_TIMEOUT * G_TIME_SPAN_SECOND;
+  gchar **tokens;
+  gchar *path = NULL;
+
+  request[0] = '\0';
+  while (!strstr (request, "\r\n\r\n") && !strstr (request, "\n\n")) {
+    gssize len;
+
+    if (size == MAX_REQUEST_SIZE) {
+      *too_large = TRUE;
+      return NULL;
+    }
+    if (g_get_monotonic_time () > deadline)
+      return NULL;
+
+    len = g_input_stream_read (stream, request + size,
+        MAX_REQUEST_SIZE - size, NULL, NULL);
+    if (len <= 0)
+      return NULL;
+    size += len;
+    request[size] = '\0';
+  }
+
+  request[strcspn (request, "\r\n")] = '\0';
+  tokens = g_strsplit (request, " ", 3);
+  if (g_strv_length (tokens) == 3) {
+    *head = strcmp (tokens[0], "HEAD") == 0;
+    if (*head || strcmp (tokens[0], "GET") == 0)
+      path = g_strndup (tokens[1], strcspn (tokens[1], "?"));
+  }
+  g_strfreev (tokens);
+
+  return path;
+}
+
+/* Drops what's already received of a request that wasn't read whole, so
+ * that closing the socket doesn't reset the connection before the client
+ * gets the response. */
+static void
+discard_input (GSocket * socket)
+{
+  gchar buffer[MAX_REQUEST_SIZE];
+  gsize discarded = 0;
+  gssize len;
+
+  g_socket_set_blocking (socket, FALSE);
+  while (discarded < 16 * MAX_REQUEST_SIZE
+      && (len = g_socket_receive (socket, buffer, sizeof (buffer), NULL,
+              NULL)) > 0)
+    discarded += len;
+}
+
+static void
+handle_connection (GSocketConnection * connection)
+{
+  GOutputStream *out =
+      g_io_stream_get_output_stream (G_IO_STREAM (connection));
+  gboolean head = FALSE, too_large = FALSE;
+  gchar *path, *body, *response;
+
+  g_socket_set_timeout (g_socket_connection_get_socket (connection),
+      CONNECTION_TIMEOUT);
+
+  path = read_request_path (g_io_stream_get_input_stream (G_IO_STREAM
+          (connection)), &head, &too_large);
+
+  if (g_strcmp0 (path, "/metrics") == 0) {
+    body = gst_s3_metrics_render ();
+    response = g_strdup_printf ("HTTP/1.1 200 OK\r\n"
+        "Content-Type: " CONTENT_TYPE "\r\n"
+        "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+        "Connection: close\r\n\r\n%s", strlen (body), head ? "" : body);
+    g_free (body);
+  } else if (too_large) {
+    response = g_strdup ("HTTP/1.1 431 Request Header Fields Too Large\r\n"
+        "Content-Length: 0\r\n" "Connection: close\r\n\r\n");
+  } else {
+    response = g_strdup ("HTTP/1.1 404 Not Found\r\n"
+        "Content-Length: 0\r\n" "Connection: close\r\n\r\n");
+  }
+
+  g_output_stream_write_all (out, response, strlen (response), NULL, NULL,
+      NULL);
+  if (too_large)
+    discard_input (g_socket_connection_get_socket (connection));
+  g_io_stream_close (G_IO_STREAM (connection), NULL, NULL);
+
+  g_free (response);
+  g_free (path);
+}
+
+/* Scrapes are few and quick, they're served one at a time; a client can
+ * only hold the thread for so long, see read_request_path(). */
+static gpointer
+serve_thread (gpointer data)
+{
+  GSocketListener *listener = data;
+
+  for (;;) {
+    GError *err = NULL;
+    GSocketConnection *connection =
+        g_socket_listener_accept (listener, NULL, NULL, &err);
+
+    if (connection == NULL) {
+      GST_WARNING ("Failed to accept a metrics connection: %s", err->message);
+      g_clear_error (&err);
+      g_usleep (G_USEC_PER_SEC / 10);
+      continue;
+    }
+
+    handle_connection (connection);
+    g_object_unref (connection);
+  }
+
+  return NULL;
+}
+
+guint16
+gst_s3_metrics_serve (const gchar * address, GError ** error)
+{
+  GSocketConnectable *connectable = NULL;
+  GInetAddress *inet_address = NULL;
+  GSocketAddress *socket_address = NULL;
+  GSocketAddress *effective_address = NULL;
+  GSocketListener *listener = NULL;
+  GThread *thread;
+  guint16 port = 0;
+
+  g_return_val_if_fail (address != NULL, 0);
+
+  init_debug_category ();
+
+  g_mutex_lock (&server_lock);
+  if (server_listener) {
+    port = server_port;
+    goto done;
+  }
+
+  connectable = g_network_address_parse (address, 0, error);
+  if (connectable == NULL)
+    goto done;
+
+  inet_address = g_inet_address_new_from_string (g_network_address_get_hostname
+      (G_NETWORK_ADDRESS (connectable)));
+  if (inet_address == NULL) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+        "Not an IP address and a port: %s", address);
+    goto done;
+  }
+
+  socket_address = g_inet_socket_address_new (inet_address,
+      g_network_address_get_port (G_NETWORK_ADDRESS (connectable)));
+  listener = g_socket_listener_new ();
+  if (!g_socket_listener_add_address (listener, socket_address,
+          G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, NULL,
+          &effective_address, error))
+    goto done;
+
+  thread = g_thread_try_new ("s3-metrics", serve_thread, listener, error);
+  if (thread == NULL)
+    goto done;
+  g_thread_unref (thread);
+
+  port = g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS
+      (effective_address));
+  GST_INFO ("Serving the S3 metrics on port %u", port);
+
+  /* owned by the thread */
+  server_listener = listener;
+  server_port = port;
+  listener = NULL;
+
+done:
+  g_mutex_unlock (&server_lock);
+
+  g_clear_object (&listener);
+  g_clear_object (&effective_address);
+  g_clear_object (&socket_address);
+  g_clear_object (&inet_address);
+  g_clear_object (&connectable);
+
+  return port;
+}
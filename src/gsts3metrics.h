@@ -0,0 +1,57 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#ifndef __GST_S3_METRICS_H__
+#define __GST_S3_METRICS_H__
+
+#include <gst/gst.h>
+
+#include "gsts3uploaderconfig.h"
+
+G_BEGIN_DECLS
+
+/* Process-wide registry of the upload stats of the S3 elements, exported in
+ * the OpenMetrics text format that Prometheus scrapes. The stats of the
+ * elements with the same path and bucket are added up.
+ *
+ * The registry is served over HTTP at /metrics by gst_s3_metrics_serve().
+ * The first element registered starts the endpoint if GST_S3_METRICS_ADDRESS
+ * is set in the environment, e.g. to "127.0.0.1:9464". The metrics name the
+ * buckets and the elements: only listen on other interfaces if that's fine
+ * for whoever can reach them. */
+
+/* Adds the stats of the config, or updates the bucket of an element already
+ * registered. The element is labelled with its path at the time it's
+ * registered. */
+void gst_s3_metrics_register (GstElement * element,
+    const GstS3UploaderConfig * config);
+
+void gst_s3_metrics_unregister (GstElement * element);
+
+/* The metrics of all the registered elements. Free with g_free(). */
+gchar *gst_s3_metrics_render (void);
+
+/* Starts serving the metrics on the address, an IP address and a port
+ * (0 to pick one), in a thread of its own that lives as long as the
+ * process. There's one endpoint per process: once it's started, this only
+ * returns its port. Returns 0 on failure. */
+guint16 gst_s3_metrics_serve (const gchar * address, GError ** error);
+
+G_END_DECLS
+
+#endif /* __GST_S3_METRICS_H__ */
@@ -18,21 +18,21 @@
  */
 
 #include "gsts3multipartuploader.h"
+#include "gsts3client.hpp"
+#include "gsts3spool.h"
 
 #include "gstawscredentials.hpp"
 
 #include <aws/core/Aws.h>
 #include <aws/core/auth/AWSCredentials.h>
 #include <aws/core/auth/AWSCredentialsProviderChain.h>
-#include <aws/core/utils/HashingUtils.h>
-#include <aws/core/utils/logging/AWSLogging.h>
-#include <aws/core/utils/logging/LogSystemInterface.h>
-#include <aws/core/utils/ResourceManager.h>
-#include <aws/core/utils/stream/PreallocatedStreamBuf.h>
+#include <aws/core/client/DefaultRetryStrategy.h>
+#include <aws/s3/model/AbortMultipartUploadRequest.h>
+#include <aws/s3/model/ChecksumAlgorithm.h>
 #include <aws/s3/model/CompleteMultipartUploadRequest.h>
 #include <aws/s3/model/CreateMultipartUploadRequest.h>
-#include <aws/s3/model/GetBucketLocationRequest.h>
-#include <aws/s3/model/GetBucketLocationResult.h>
+#include <aws/s3/model/ListPartsRequest.h>
+#include <aws/s3/model/PutObjectRequest.h>
 #include <aws/s3/model/UploadPartRequest.h>
 #include <aws/s3/S3Client.h>
 #include <aws/s3/S3ClientConfiguration.h>
@@ -40,6 +40,21 @@
 #include <aws/sts/STSClient.h>
 
 #include <gst/gst.h>
+#include <glib/gstdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#define GST_CAT_DEFAULT gst_s3_client_debug
 
 namespace gst
 {
@@ -47,115 +62,59 @@ namespace aws
 {
 namespace s3
 {
-class Logger : public Aws::Utils::Logging::LogSystemInterface
-{
-public:
-    Aws::Utils::Logging::LogLevel GetLogLevel(void) const override
-    {
-        return _to_aws_log_level(gst_debug_category_get_threshold(gst_s3_sink_debug));
-    }
-
-    void Log(Aws::Utils::Logging::LogLevel log_level, const char* tag, const char* format, ...) override
-    {
-        GstDebugLevel level = _to_gst_log_level(log_level);
-        va_list varargs;
-        va_start (varargs, format);
-
-        if (G_UNLIKELY ((level) <= GST_LEVEL_MAX && (level) <= _gst_debug_min))
-        {
-            gst_debug_log_valist(gst_s3_sink_debug, level, "", tag, 0, NULL, format, varargs);
-        }
-        va_end (varargs);
-    }
-
-    void vaLog(Aws::Utils::Logging::LogLevel logLevel, const char* tag, const char* formatStr, va_list args) override
-    {
-    }
-
-    void LogStream(Aws::Utils::Logging::LogLevel log_level, const char* tag, const Aws::OStringStream &message_stream) override
-    {
-        Log(log_level, tag, "%s", message_stream.str().c_str());
-    }
+// A streamed part only gets data as fast as the pipeline produces it, so
+// the connection is allowed to stall for longer than the SDK default: for
+// as long as S3 waits for data, or as max-part-duration if it's longer.
+static const long STREAMING_REQUEST_TIMEOUT_MS = 20000;
 
-    void Flush() override
-    {
-    }
-
-private:
-    static Aws::Utils::Logging::LogLevel _to_aws_log_level(GstDebugLevel level)
+template <typename Target>
+static void set_checksum(Target& target, Aws::S3::Model::ChecksumAlgorithm algorithm, const Aws::String& checksum)
+{
+    switch (algorithm)
     {
-        using Aws::Utils::Logging::LogLevel;
-        switch (level)
-        {
-            case GST_LEVEL_NONE: return LogLevel::Off;
-            case GST_LEVEL_ERROR: return LogLevel::Error;
-            case GST_LEVEL_WARNING: return LogLevel::Warn;
-            case GST_LEVEL_FIXME:
-            case GST_LEVEL_INFO: return LogLevel::Info;
-            case GST_LEVEL_DEBUG: return LogLevel::Debug;
-            default: return LogLevel::Trace;
-        }
+    case Aws::S3::Model::ChecksumAlgorithm::CRC32:
+        target.SetChecksumCRC32(checksum);
+        break;
+    case Aws::S3::Model::ChecksumAlgorithm::CRC32C:
+        target.SetChecksumCRC32C(checksum);
+        break;
+    case Aws::S3::Model::ChecksumAlgorithm::SHA256:
+        target.SetChecksumSHA256(checksum);
+        break;
+    default:
+        break;
     }
+}
 
-    static GstDebugLevel _to_gst_log_level(Aws::Utils::Logging::LogLevel level)
+template <typename Source>
+static Aws::String get_checksum(const Source& source, Aws::S3::Model::ChecksumAlgorithm algorithm)
+{
+    switch (algorithm)
     {
-        using Aws::Utils::Logging::LogLevel;
-        switch (level)
-        {
-            case LogLevel::Off: return GST_LEVEL_NONE;
-            case LogLevel::Fatal:
-            case LogLevel::Error: return GST_LEVEL_ERROR;
-            case LogLevel::Warn: return GST_LEVEL_WARNING;
-            case LogLevel::Info: return GST_LEVEL_INFO;
-            case LogLevel::Debug: return GST_LEVEL_DEBUG;
-            default: return GST_LEVEL_TRACE;
-        }
+    case Aws::S3::Model::ChecksumAlgorithm::CRC32:
+        return source.GetChecksumCRC32();
+    case Aws::S3::Model::ChecksumAlgorithm::CRC32C:
+        return source.GetChecksumCRC32C();
+    case Aws::S3::Model::ChecksumAlgorithm::SHA256:
+        return source.GetChecksumSHA256();
+    default:
+        return Aws::String();
     }
-};
-
-class AwsApiHandle
-{
-    public:
-        static std::shared_ptr<AwsApiHandle> GetHandle() {
-            static std::weak_ptr<AwsApiHandle> instance;
-            if (auto ptr = instance.lock()) {
-                return ptr;
-            }
-
-            std::shared_ptr<AwsApiHandle> ptr(new AwsApiHandle());
-            instance = ptr;
-            return ptr;
-        }
-
-        virtual ~AwsApiHandle() {
-            Aws::ShutdownAPI(Aws::SDKOptions {});
-            Aws::Utils::Logging::ShutdownAWSLogging();
-        }
-
-    protected:
-        AwsApiHandle() {
-            Aws::Utils::Logging::InitializeAWSLogging(std::make_shared<Logger>());
-            Aws::SDKOptions options;
-            Aws::InitAPI(options);
-        }
-
-    private:
-        AwsApiHandle(const AwsApiHandle&) = delete;
-        AwsApiHandle& operator=(const AwsApiHandle&) = delete;
-};
+}
 
-static bool get_bucket_location(const char* bucket_name, const Aws::Client::ClientConfiguration& client_config, Aws::String& location)
+static Aws::S3::Model::ChecksumAlgorithm to_aws_checksum_algorithm(GstS3ChecksumAlgorithm algorithm)
 {
-    Aws::S3::S3Client client(client_config, Aws::Client::AWSAuthV4Signer::PayloadSigningPolicy::Never, false);
-
-    auto outcome = client.GetBucketLocation(Aws::S3::Model::GetBucketLocationRequest().WithBucket(bucket_name));
-    if (!outcome.IsSuccess())
+    switch (algorithm)
     {
-        return false;
+    case GST_S3_CHECKSUM_ALGORITHM_CRC32:
+        return Aws::S3::Model::ChecksumAlgorithm::CRC32;
+    case GST_S3_CHECKSUM_ALGORITHM_CRC32C:
+        return Aws::S3::Model::ChecksumAlgorithm::CRC32C;
+    case GST_S3_CHECKSUM_ALGORITHM_SHA256:
+        return Aws::S3::Model::ChecksumAlgorithm::SHA256;
+    default:
+        return Aws::S3::Model::ChecksumAlgorithm::NOT_SET;
     }
-
-    location = Aws::S3::Model::BucketLocationConstraintMapper::GetNameForBucketLocationConstraint(outcome.GetResult().GetLocationConstraint());
-    return true;
 }
 
 static bool is_null_or_empty(const char* str)
@@ -192,376 +151,2056 @@ static const Aws::String get_key_from_config(const GstS3UploaderConfig * config)
     }
 }
 
-using BufferManager = Aws::Utils::ExclusiveOwnershipResourceManager<uint8_t*>;
-
-class PartState
+// Read-only, seekable view over the memories of a GstBufferList. The memories
+// are mapped once and read in place by the HTTP client, so the part data is
+// never copied into an intermediate buffer.
+class BufferListStreamBuf : public std::streambuf
 {
 public:
-    explicit PartState(int part_number) :
-        _part_number(part_number)
+    explicit BufferListStreamBuf(GstBufferList* buffers) :
+        _buffers(buffers)
+    {
+        guint n_buffers = gst_buffer_list_length(_buffers);
+        for (guint i = 0; i < n_buffers; i++)
+        {
+            GstBuffer* buffer = gst_buffer_list_get(_buffers, i);
+            guint n_mem = gst_buffer_n_memory(buffer);
+            for (guint j = 0; j < n_mem; j++)
+            {
+                GstMapInfo info;
+                if (!gst_memory_map(gst_buffer_peek_memory(buffer, j), &info, GST_MAP_READ))
+                {
+                    GST_ERROR("Failed to map memory of the part buffer");
+                    _valid = false;
+                    continue;
+                }
+                if (info.size == 0)
+                {
+                    gst_memory_unmap(info.memory, &info);
+                    continue;
+                }
+                _offsets.push_back(_size);
+                _maps.push_back(info);
+                _size += info.size;
+            }
+        }
+        _set_position(0);
+    }
+
+    ~BufferListStreamBuf()
     {
+        for (auto& info : _maps)
+        {
+            gst_memory_unmap(info.memory, &info);
+        }
+        gst_buffer_list_unref(_buffers);
     }
 
-    int get_part_number() const
+    size_t size() const
     {
-        return _part_number;
+        return _size;
     }
 
-    Aws::String get_etag() const
+    bool is_valid() const
     {
-        return _etag;
+        return _valid;
     }
-    void set_etag(Aws::String etag)
+
+protected:
+    int_type underflow() override
     {
-        _etag = std::move(etag);
+        if (gptr() < egptr())
+        {
+            return traits_type::to_int_type(*gptr());
+        }
+        if (_current + 1 >= _maps.size())
+        {
+            return traits_type::eof();
+        }
+        _set_chunk(_current + 1, 0);
+        return traits_type::to_int_type(*gptr());
+    }
+
+    std::streamsize showmanyc() override
+    {
+        return _size - _position();
     }
 
-    void set_md5_hash(Aws::Utils::ByteBuffer md5_hash)
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
     {
-        _md5_hash = std::move(md5_hash);
+        off_type base = 0;
+        if (dir == std::ios_base::cur)
+        {
+            base = _position();
+        }
+        else if (dir == std::ios_base::end)
+        {
+            base = _size;
+        }
+        return seekpos(base + off, which);
     }
 
-    bool verify_upload_outcome(const Aws::S3::Model::UploadPartOutcome& outcome) const
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
     {
-        Aws::StringStream ss;
-        ss << "\"" << Aws::Utils::HashingUtils::HexEncode(_md5_hash) << "\"";
-        return ss.str() == outcome.GetResult().GetETag();
+        off_type offset = off_type(pos);
+        if (!(which & std::ios_base::in) || offset < 0 || static_cast<size_t>(offset) > _size)
+        {
+            return pos_type(off_type(-1));
+        }
+        _set_position(static_cast<size_t>(offset));
+        return pos;
     }
 
 private:
-    Aws::Utils::ByteBuffer _md5_hash;
-    Aws::String _etag;
-    int _part_number;
+    size_t _position() const
+    {
+        if (_maps.empty())
+        {
+            return 0;
+        }
+        return _offsets[_current] + (gptr() - eback());
+    }
+
+    void _set_position(size_t pos)
+    {
+        if (_maps.empty())
+        {
+            setg(nullptr, nullptr, nullptr);
+            return;
+        }
+        // Find the last chunk starting at or before the requested position;
+        // the end of the stream maps onto the end of the last chunk.
+        auto it = std::upper_bound(_offsets.begin(), _offsets.end(), pos);
+        size_t index = std::distance(_offsets.begin(), it) - 1;
+        _set_chunk(index, pos - _offsets[index]);
+    }
+
+    void _set_chunk(size_t index, size_t offset)
+    {
+        char* data = reinterpret_cast<char*>(_maps[index].data);
+        _current = index;
+        setg(data, data + offset, data + _maps[index].size);
+    }
+
+    GstBufferList* _buffers;
+    std::vector<GstMapInfo> _maps;
+    std::vector<size_t> _offsets;
+    size_t _size = 0;
+    size_t _current = 0;
+    bool _valid = true;
 };
 
-using PartStateMap = std::map<int, PartState>;
+class PartStream : public Aws::IOStream
+{
+public:
+    explicit PartStream(GstBufferList* buffers) :
+        Aws::IOStream(&_stream_buf),
+        _stream_buf(buffers)
+    {
+    }
 
-class PartStateCollection
+    size_t size() const
+    {
+        return _stream_buf.size();
+    }
+
+    bool is_valid() const
+    {
+        return _stream_buf.is_valid();
+    }
+
+private:
+    BufferListStreamBuf _stream_buf;
+};
+
+// Seekable view over a part that is sent while it's being filled. Reads
+// block until the data is appended, and end early if the part is aborted.
+// The buffers are kept until the part is done with, for retries.
+class StreamingPartStreamBuf : public std::streambuf
 {
 public:
-    PartStateCollection(bool verify_hash) :
-        _verify_hash(verify_hash)
+    explicit StreamingPartStreamBuf(size_t size) :
+        _size(size)
     {
+        setg(nullptr, nullptr, nullptr);
     }
 
-    void start(PartState state)
+    ~StreamingPartStreamBuf()
     {
-        std::lock_guard<std::mutex> l(_mtx);
+        for (auto& info : _maps)
+        {
+            gst_memory_unmap(info.memory, &info);
+        }
+        for (GstBuffer* buffer : _buffers)
+        {
+            gst_buffer_unref(buffer);
+        }
+    }
 
-        int num = state.get_part_number();
-        _insert(_parts_in_flight, num, std::move(state));
+    size_t size() const
+    {
+        return _size;
+    }
+
+    size_t get_appended_size() const
+    {
+        std::lock_guard<std::mutex> l(_mtx);
+        return _appended;
     }
 
-    void mark_part_as_completed(int part_number, const Aws::String& etag)
+    bool append(GstBuffer* buffer)
     {
         std::unique_lock<std::mutex> l(_mtx);
+        if (_aborted)
+        {
+            return false;
+        }
 
-        PartState state = std::move(_parts_in_flight.at(part_number));
-        _parts_in_flight.erase(part_number);
-        state.set_etag(etag);
-        _insert(_parts_completed, part_number, std::move(state));
+        guint n_mem = gst_buffer_n_memory(buffer);
+        for (guint i = 0; i < n_mem; i++)
+        {
+            GstMapInfo info;
+            if (!gst_memory_map(gst_buffer_peek_memory(buffer, i), &info, GST_MAP_READ))
+            {
+                GST_ERROR("Failed to map memory of the streamed part");
+                _aborted = true;
+                break;
+            }
+            if (info.size == 0)
+            {
+                gst_memory_unmap(info.memory, &info);
+                continue;
+            }
+            _offsets.push_back(_appended);
+            _maps.push_back(info);
+            _appended += info.size;
+        }
+        _buffers.push_back(gst_buffer_ref(buffer));
 
+        bool aborted = _aborted;
         l.unlock();
-        _upload_completed_cv.notify_one();
+        _data_cv.notify_all();
+        return !aborted;
     }
 
-    void mark_part_as_failed(int part_number)
+    void abort()
     {
         std::unique_lock<std::mutex> l(_mtx);
-
-        _insert(_parts_failed, part_number, std::move(_parts_in_flight.at(part_number)));
-        _parts_in_flight.erase(part_number);
+        _aborted = true;
 
         l.unlock();
-        _upload_completed_cv.notify_one();
+        _data_cv.notify_all();
     }
 
-    size_t get_failed_parts_count() const
+    bool is_aborted() const
     {
-        return _parts_failed.size();
+        std::lock_guard<std::mutex> l(_mtx);
+        return _aborted;
     }
 
-    bool verify_upload_outcome(int part_number, const Aws::S3::Model::UploadPartOutcome& outcome) const
+protected:
+    int_type underflow() override
     {
-        if (!_verify_hash)
+        if (gptr() < egptr())
         {
-            return true;
+            return traits_type::to_int_type(*gptr());
         }
-        std::lock_guard<std::mutex> l(_mtx);
-        return _parts_completed.at(part_number).verify_upload_outcome(outcome);
-    }
 
-    void wait_for_complete()
-    {
         std::unique_lock<std::mutex> lk(_mtx);
-        _upload_completed_cv.wait(lk, [this] { return _parts_in_flight.empty(); });
+        size_t next = _has_chunk ? _current + 1 : 0;
+        _data_cv.wait(lk, [&] { return _aborted || next < _maps.size() || _appended >= _size; });
+        if (_aborted || next >= _maps.size())
+        {
+            return traits_type::eof();
+        }
+        _set_chunk(next, 0);
+        return traits_type::to_int_type(*gptr());
     }
 
-    PartStateMap get_completed_parts() const
+    std::streamsize showmanyc() override
     {
         std::lock_guard<std::mutex> l(_mtx);
-        return _parts_completed;
+        return _appended - _position();
     }
 
-    void clear()
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+    {
+        off_type base = 0;
+        if (dir == std::ios_base::cur)
+        {
+            std::lock_guard<std::mutex> l(_mtx);
+            base = _position();
+        }
+        else if (dir == std::ios_base::end)
+        {
+            base = _size;
+        }
+        return seekpos(base + off, which);
+    }
+
+    // Only the data appended so far can be sought to.
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
     {
         std::lock_guard<std::mutex> l(_mtx);
-        _parts_in_flight.clear();
-        _parts_completed.clear();
-        _parts_failed.clear();
+        off_type offset = off_type(pos);
+        if (!(which & std::ios_base::in) || offset < 0 || static_cast<size_t>(offset) > _appended)
+        {
+            return pos_type(off_type(-1));
+        }
+        if (_maps.empty())
+        {
+            setg(nullptr, nullptr, nullptr);
+            _has_chunk = false;
+            return pos;
+        }
+        auto it = std::upper_bound(_offsets.begin(), _offsets.end(), static_cast<size_t>(offset));
+        size_t index = std::distance(_offsets.begin(), it) - 1;
+        _set_chunk(index, offset - _offsets[index]);
+        return pos;
     }
 
 private:
-    static void _insert(PartStateMap& map, int number, PartState part)
+    size_t _position() const
     {
-        map.insert(std::make_pair(number, std::move(part)));
+        if (!_has_chunk)
+        {
+            return 0;
+        }
+        return _offsets[_current] + (gptr() - eback());
     }
 
-    std::condition_variable _upload_completed_cv;
-    mutable std::mutex _mtx;
-
-    PartStateMap _parts_in_flight;
-    PartStateMap _parts_completed;
-    PartStateMap _parts_failed;
+    void _set_chunk(size_t index, size_t offset)
+    {
+        char* data = reinterpret_cast<char*>(_maps[index].data);
+        _current = index;
+        _has_chunk = true;
+        setg(data, data + offset, data + _maps[index].size);
+    }
 
-    bool _verify_hash;
+    mutable std::mutex _mtx;
+    std::condition_variable _data_cv;
+    std::vector<GstBuffer*> _buffers;
+    std::vector<GstMapInfo> _maps;
+    std::vector<size_t> _offsets;
+    size_t _size;
+    size_t _appended = 0;
+    size_t _current = 0;
+    bool _has_chunk = false;
+    bool _aborted = false;
 };
 
-class MultipartUploaderContext : public Aws::Client::AsyncCallerContext
+class StreamingPartStream : public Aws::IOStream
 {
 public:
-    MultipartUploaderContext(std::shared_ptr<PartStateCollection> states, std::shared_ptr<BufferManager> buffer_manager, int part_number) :
-        _part_states(std::move(states)),
-        _buffer_manager(std::move(buffer_manager)),
-        _part_number(part_number)
+    explicit StreamingPartStream(size_t size) :
+        Aws::IOStream(&_stream_buf),
+        _stream_buf(size)
     {
     }
 
-    int get_part_number() const
+    size_t size() const
     {
-        return _part_number;
+        return _stream_buf.size();
     }
 
-    std::shared_ptr<BufferManager> get_buffer_manager() const
+    size_t get_appended_size() const
     {
-        return _buffer_manager;
+        return _stream_buf.get_appended_size();
     }
 
-    std::shared_ptr<PartStateCollection> get_part_states() const
+    bool append(GstBuffer* buffer)
     {
-        return _part_states;
+        return _stream_buf.append(buffer);
     }
 
-private:
-    std::shared_ptr<PartStateCollection> _part_states;
-    std::shared_ptr<BufferManager> _buffer_manager;
-    int _part_number;
-};
-
-class MultipartUploader
-{
-public:
-    static std::unique_ptr<MultipartUploader> create(const GstS3UploaderConfig *config)
+    void abort()
     {
-        auto uploader = std::unique_ptr<MultipartUploader>(new MultipartUploader(config));
-        if (!uploader->_init_uploader(config))
-        {
-            return nullptr;
-        }
-        return uploader;
+        _stream_buf.abort();
     }
 
-    ~MultipartUploader();
-
-    bool upload(const char* data, size_t size);
-    bool complete();
+    bool is_aborted() const
+    {
+        return _stream_buf.is_aborted();
+    }
 
 private:
-    explicit MultipartUploader(const GstS3UploaderConfig *config);
-    bool _init_uploader(const GstS3UploaderConfig * config);
-
-    void _init_buffer_manager(size_t buffer_count, size_t buffer_size);
-
-    std::unique_ptr<Aws::IOStream> _create_stream(const char* data, size_t size);
-
-    static void _handle_upload_completed(const Aws::S3::S3Client*, const Aws::S3::Model::UploadPartRequest&, const Aws::S3::Model::UploadPartOutcome& outcome, const std::shared_ptr<const Aws::Client::AsyncCallerContext>& ctx);
-
-    Aws::String _bucket;
-    Aws::String _key;
-    Aws::S3::Model::ObjectCannedACL _acl;
-
-    Aws::S3::Model::CreateMultipartUploadOutcome _upload_outcome;
-
-    std::shared_ptr<AwsApiHandle> _api_handle;
-    std::unique_ptr<Aws::S3::S3Client> _s3_client;
-
-    std::condition_variable _upload_completed_cv;
-    std::shared_ptr<PartStateCollection> _part_states;
-
-    std::shared_ptr<BufferManager> _buffer_manager;
-    size_t _buffer_count = 0;
-
-    int _part_counter = 0;
-    bool _verify_hash = false;
+    StreamingPartStreamBuf _stream_buf;
 };
 
-// TODO: There's a few things I didn't implement because they're not critical (yet), but might
-//       be needed in the (near) future:
-//        * retry mechanism
-//        * early failure notification - currently we notify user about the failure on complete() call
-//        * implement hash verification - _verify_hash is already there, just need to expose it
-//          as an option and test if works fine
-//        * tests - not sure if AWS provide any infrastructure/framework for testing this kind of code,
-//          or we have to rely on stable internet connection and run tests with credentials that allow
-//          uploading/downloading files from S3.
-
-MultipartUploader::MultipartUploader(const GstS3UploaderConfig *config) :
-    _bucket(std::move(get_bucket_from_config(config))),
-    _key(std::move(get_key_from_config(config))),
-    _api_handle(config->init_aws_sdk ? AwsApiHandle::GetHandle() : nullptr),
-    _part_states(std::make_shared<PartStateCollection>(false))
-{
-}
-
-MultipartUploader::~MultipartUploader()
+class PartState
 {
-    if (_buffer_manager)
+public:
+    PartState(int part_number, size_t size) :
+        _part_number(part_number),
+        _size(size),
+        _start_time(std::chrono::steady_clock::now())
     {
-        for (auto buffer : _buffer_manager->ShutdownAndWait(_buffer_count))
-        {
-            free(buffer);
-        }
     }
-}
 
-void MultipartUploader::_init_buffer_manager(size_t buffer_count, size_t buffer_size)
-{
-    _buffer_manager = std::make_shared<BufferManager>();
-    _buffer_count = buffer_count;
+    std::chrono::steady_clock::duration get_elapsed_time() const
+    {
+        return std::chrono::steady_clock::now() - _start_time;
+    }
 
-    for (size_t i = 0; i < buffer_count; i++)
+    int get_part_number() const
     {
-        _buffer_manager->PutResource(reinterpret_cast<uint8_t*>(malloc(buffer_size)));
+        return _part_number;
     }
-}
 
-bool MultipartUploader::_init_uploader(const GstS3UploaderConfig * config)
-{
-    Aws::S3::S3ClientConfiguration client_config;
-    if (!is_null_or_empty(config->ca_file))
+    size_t get_size() const
     {
-        client_config.caFile = config->ca_file;
+        return _size;
     }
-    if (is_null_or_empty(config->region))
+
+    Aws::String get_etag() const
     {
-        Aws::String region;
-        if (!get_bucket_location(config->bucket, client_config, region))
-        {
-            // TODO report warning
-        }
-        else if (!region.empty())
-        {
-            client_config.region = std::move(region);
-        }
+        return _etag;
     }
-    else
+    void set_etag(Aws::String etag)
     {
-        client_config.region = config->region;
+        _etag = std::move(etag);
     }
 
-    auto credentials_provider = gst_aws_credentials_create_provider(config->credentials);
-    if (!credentials_provider)
+    // Base64 encoded, computed by the sink while the part was filled, or
+    // by the SDK for streamed parts.
+    const Aws::String& get_checksum() const
     {
-        return false;
+        return _checksum;
     }
-
-    // Configure AWS SDK specific client configuration
-    if (!is_null_or_empty(config->aws_sdk_endpoint))
+    void set_checksum(Aws::String checksum)
     {
-        client_config.endpointOverride = Aws::String(config->aws_sdk_endpoint);
+        _checksum = std::move(checksum);
+    }
+
+private:
+    Aws::String _checksum;
+    Aws::String _etag;
+    int _part_number;
+    size_t _size;
+    std::chrono::steady_clock::time_point _start_time;
+};
+
+using PartStateMap = std::map<int, PartState>;
+
+using UploadStatsPtr = std::shared_ptr<GstS3UploadStats>;
+
+static UploadStatsPtr
+share_upload_stats(GstS3UploadStats* stats)
+{
+    return UploadStatsPtr(stats ? gst_s3_upload_stats_ref(stats) : gst_s3_upload_stats_new(),
+        gst_s3_upload_stats_unref);
+}
+
+// Upper bound of the adaptive part count, relative to buffer_count, used
+// when max_in_flight_parts doesn't set one.
+static const size_t ADAPTIVE_BUFFER_COUNT_GROWTH = 4;
+
+class PartStateCollection
+{
+public:
+    explicit PartStateCollection(UploadStatsPtr stats) :
+        _stats(std::move(stats))
+    {
+    }
+
+    const UploadStatsPtr& get_stats() const
+    {
+        return _stats;
+    }
+
+    void start(PartState state)
+    {
+        std::lock_guard<std::mutex> l(_mtx);
+
+        int num = state.get_part_number();
+        _bytes_in_flight += state.get_size();
+        _insert(_parts_in_flight, num, std::move(state));
+        gst_s3_upload_stats_add(_stats.get(), GST_S3_UPLOAD_COUNTER_PARTS_STARTED, 1);
+    }
+
+    void mark_part_as_completed(int part_number, const Aws::String& etag, const Aws::String& checksum)
+    {
+        std::unique_lock<std::mutex> l(_mtx);
+
+        PartState state = std::move(_parts_in_flight.at(part_number));
+        _parts_in_flight.erase(part_number);
+        _bytes_in_flight -= state.get_size();
+        _update_upload_latency(state.get_elapsed_time());
+        gst_s3_upload_stats_add_completed_part(_stats.get(), state.get_size(),
+            std::chrono::duration_cast<std::chrono::nanoseconds>(state.get_elapsed_time()).count());
+        state.set_etag(etag);
+        if (state.get_checksum().empty())
+        {
+            state.set_checksum(checksum);
+        }
+        _insert(_parts_completed, part_number, std::move(state));
+
+        l.unlock();
+        _upload_completed_cv.notify_all();
+    }
+
+    void mark_part_as_failed(int part_number, const Aws::String& error_code, const Aws::String& error_message)
+    {
+        std::unique_lock<std::mutex> l(_mtx);
+
+        if (_abandoned_parts.erase(part_number) > 0)
+        {
+            l.unlock();
+            _upload_completed_cv.notify_all();
+            return;
+        }
+
+        if (_parts_failed.empty())
+        {
+            _first_failure.part_number = part_number;
+            _first_failure.error_code = error_code;
+            _first_failure.error_message = error_message;
+        }
+        _bytes_in_flight -= _parts_in_flight.at(part_number).get_size();
+        _insert(_parts_failed, part_number, std::move(_parts_in_flight.at(part_number)));
+        _parts_in_flight.erase(part_number);
+        gst_s3_upload_stats_add(_stats.get(), GST_S3_UPLOAD_COUNTER_PARTS_FAILED, 1);
+
+        l.unlock();
+        _upload_completed_cv.notify_all();
+    }
+
+    // A part that S3 already has, uploaded by a previous uploader.
+    void add_completed(PartState state)
+    {
+        std::lock_guard<std::mutex> l(_mtx);
+        int num = state.get_part_number();
+        _insert(_parts_completed, num, std::move(state));
+    }
+
+    // Gives up on a part while its request is still running, e.g. a streamed
+    // part that ended up shorter than announced. It stops counting against
+    // the in-flight limits right away and isn't part of the object, but
+    // wait_for_complete() still waits for its request to end.
+    void abandon(int part_number)
+    {
+        std::unique_lock<std::mutex> l(_mtx);
+
+        auto it = _parts_in_flight.find(part_number);
+        if (it == _parts_in_flight.end())
+        {
+            return;
+        }
+        _bytes_in_flight -= it->second.get_size();
+        _parts_in_flight.erase(it);
+        _abandoned_parts.insert(part_number);
+        gst_s3_upload_stats_add(_stats.get(), GST_S3_UPLOAD_COUNTER_PARTS_ABANDONED, 1);
+
+        l.unlock();
+        _upload_completed_cv.notify_all();
+    }
+
+    // Returns true, and forgets about the part, if it was abandoned.
+    bool discard_if_abandoned(int part_number)
+    {
+        std::unique_lock<std::mutex> l(_mtx);
+        if (_abandoned_parts.erase(part_number) == 0)
+        {
+            return false;
+        }
+
+        l.unlock();
+        _upload_completed_cv.notify_all();
+        return true;
+    }
+
+    struct Failure
+    {
+        int part_number = 0;
+        Aws::String error_code;
+        Aws::String error_message;
+    };
+
+    // Reports the first part that failed for good, i.e. after all its retries.
+    bool get_first_failure(Failure& failure) const
+    {
+        std::lock_guard<std::mutex> l(_mtx);
+        if (_parts_failed.empty())
+        {
+            return false;
+        }
+        failure = _first_failure;
+        return true;
+    }
+
+    // Smoothed time it takes to upload a part, zero until the first part completes.
+    double get_upload_latency() const
+    {
+        std::lock_guard<std::mutex> l(_mtx);
+        return _upload_latency;
+    }
+
+    size_t get_failed_parts_count() const
+    {
+        std::lock_guard<std::mutex> l(_mtx);
+        return _parts_failed.size();
+    }
+
+    // Runs the retry once the delay is over, without holding an executor
+    // thread meanwhile. If retries are cancelled before, it's run right away
+    // and passed false. Returns false if they already are.
+    bool schedule_retry(std::chrono::steady_clock::duration delay, std::function<void(bool)> retry)
+    {
+        std::lock_guard<std::mutex> l(_mtx);
+        if (_retries_cancelled)
+        {
+            return false;
+        }
+
+        // The task can't run before the id is known: it needs the lock too.
+        auto id = std::make_shared<guint64>(0);
+        *id = DelayedTaskQueue::get_instance().schedule(delay, [this, id, retry](bool due) {
+            {
+                std::lock_guard<std::mutex> lock(_mtx);
+                _scheduled_retries.erase(*id);
+            }
+            retry(due);
+        });
+        _scheduled_retries.insert(*id);
+        return true;
+    }
+
+    void cancel_retries()
+    {
+        std::unique_lock<std::mutex> l(_mtx);
+        _retries_cancelled = true;
+        std::set<guint64> scheduled_retries = _scheduled_retries;
+
+        l.unlock();
+        for (guint64 id : scheduled_retries)
+        {
+            DelayedTaskQueue::get_instance().cancel(id);
+        }
+        _upload_completed_cv.notify_all();
+    }
+
+    // Waits out the delay before a request is retried on the calling
+    // thread. Returns false if cancel_retries(), or unlock() when
+    // interruptible, cut it short.
+    bool wait_for_retry(std::chrono::steady_clock::duration delay, bool interruptible)
+    {
+        std::unique_lock<std::mutex> lk(_mtx);
+        return !_upload_completed_cv.wait_for(lk, delay, [&] {
+            return (interruptible && _unlocked) || _retries_cancelled;
+        });
+    }
+
+    bool has_capacity(size_t max_parts_in_flight, size_t max_bytes_in_flight, size_t size) const
+    {
+        std::lock_guard<std::mutex> l(_mtx);
+        return _has_capacity(max_parts_in_flight, max_bytes_in_flight, size);
+    }
+
+    // Returns false if the wait was interrupted with unlock() before
+    // the part could be accepted.
+    bool wait_for_capacity(size_t max_parts_in_flight, size_t max_bytes_in_flight, size_t size, bool interruptible)
+    {
+        std::unique_lock<std::mutex> lk(_mtx);
+        _upload_completed_cv.wait(lk, [&] {
+            return (interruptible && _unlocked) || _has_capacity(max_parts_in_flight, max_bytes_in_flight, size);
+        });
+        return _has_capacity(max_parts_in_flight, max_bytes_in_flight, size);
+    }
+
+    void set_unlocked(bool unlocked)
+    {
+        std::unique_lock<std::mutex> l(_mtx);
+        _unlocked = unlocked;
+
+        l.unlock();
+        _upload_completed_cv.notify_all();
+    }
+
+    void wait_for_complete()
+    {
+        std::unique_lock<std::mutex> lk(_mtx);
+        _upload_completed_cv.wait(lk, [this] { return _parts_in_flight.empty() && _abandoned_parts.empty(); });
+    }
+
+    PartStateMap get_completed_parts() const
+    {
+        std::lock_guard<std::mutex> l(_mtx);
+        return _parts_completed;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> l(_mtx);
+        _parts_in_flight.clear();
+        _parts_completed.clear();
+        _parts_failed.clear();
+        _abandoned_parts.clear();
+        _bytes_in_flight = 0;
+    }
+
+private:
+    void _update_upload_latency(std::chrono::steady_clock::duration elapsed)
+    {
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        _upload_latency = _upload_latency == 0.0 ? seconds : _upload_latency + 0.25 * (seconds - _upload_latency);
+    }
+
+    bool _has_capacity(size_t max_parts_in_flight, size_t max_bytes_in_flight, size_t size) const
+    {
+        if (_parts_in_flight.size() >= max_parts_in_flight)
+        {
+            return false;
+        }
+        // A part bigger than the byte limit is still accepted once
+        // nothing else is in flight, otherwise it would never be sent.
+        return max_bytes_in_flight == 0 || _bytes_in_flight == 0 ||
+            _bytes_in_flight + size <= max_bytes_in_flight;
+    }
+
+    static void _insert(PartStateMap& map, int number, PartState part)
+    {
+        map.insert(std::make_pair(number, std::move(part)));
+    }
+
+    std::condition_variable _upload_completed_cv;
+    mutable std::mutex _mtx;
+
+    UploadStatsPtr _stats;
+    PartStateMap _parts_in_flight;
+    PartStateMap _parts_completed;
+    PartStateMap _parts_failed;
+    std::set<int> _abandoned_parts;
+    Failure _first_failure;
+    size_t _bytes_in_flight = 0;
+    double _upload_latency = 0.0;
+
+    bool _unlocked = false;
+    bool _retries_cancelled = false;
+    std::set<guint64> _scheduled_retries;
+};
+
+class RetryPolicy
+{
+public:
+    RetryPolicy(unsigned max_attempts, std::chrono::nanoseconds budget) :
+        _max_attempts(max_attempts),
+        _budget(budget)
+    {
+    }
+
+    bool can_retry(unsigned attempt, std::chrono::steady_clock::duration elapsed, std::chrono::steady_clock::duration delay) const
+    {
+        return attempt < _max_attempts && elapsed + delay <= _budget;
+    }
+
+    // Exponential backoff with full jitter, so that parts failing at the
+    // same time (e.g. on throttling) don't retry in lockstep.
+    std::chrono::steady_clock::duration get_delay(unsigned attempt) const
+    {
+        const double base_delay_ms = 100.0;
+        const double max_delay_ms = 20000.0;
+        double max_delay = std::min(base_delay_ms * std::pow(2.0, attempt - 1), max_delay_ms);
+        return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double, std::milli>(g_random_double_range(0.0, max_delay)));
+    }
+
+private:
+    unsigned _max_attempts;
+    std::chrono::nanoseconds _budget;
+};
+
+static const char* const UPLOAD_GROUP = "upload";
+
+// Record of a multipart upload kept next to its spooled parts (see
+// gsts3spool.h), so that another uploader can finish it after a crash: the
+// UploadId, and every part handed over with its spool file until S3 has it,
+// then with its ETag. Written on every change, replacing the file atomically.
+class UploadJournal
+{
+public:
+    struct Part
+    {
+        int part_number = 0;
+        std::string file;
+        Aws::String checksum;
+        Aws::String etag;
+        // Whether it was in the spool before S3 had it; a streamed part
+        // may not be.
+        bool spooled = false;
+    };
+
+    UploadJournal(std::string path, bool sync) :
+        _path(std::move(path)),
+        _sync(sync),
+        _key_file(g_key_file_new())
+    {
+    }
+
+    ~UploadJournal()
+    {
+        g_key_file_free(_key_file);
+    }
+
+    // Returns false if there's no journal to resume from.
+    bool load()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return g_key_file_load_from_file(_key_file, _path.c_str(), G_KEY_FILE_NONE, nullptr);
+    }
+
+    Aws::String get_upload_id() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _get_string(UPLOAD_GROUP, "upload-id");
+    }
+
+    std::vector<Part> get_parts() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::vector<Part> parts;
+
+        gchar** groups = g_key_file_get_groups(_key_file, nullptr);
+        for (gchar** group = groups; *group; group++)
+        {
+            int part_number = 0;
+            if (sscanf(*group, "part-%d", &part_number) != 1)
+            {
+                continue;
+            }
+            Part part;
+            part.part_number = part_number;
+            part.file = _get_string(*group, "file");
+            part.checksum = _get_string(*group, "checksum");
+            part.etag = _get_string(*group, "etag");
+            part.spooled = g_key_file_get_boolean(_key_file, *group, "spooled", nullptr);
+            parts.push_back(std::move(part));
+        }
+        g_strfreev(groups);
+
+        std::sort(parts.begin(), parts.end(), [](const Part& a, const Part& b) {
+            return a.part_number < b.part_number;
+        });
+        return parts;
+    }
+
+    void set_upload_id(const Aws::String& bucket, const Aws::String& key, const Aws::String& upload_id)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        g_key_file_set_string(_key_file, UPLOAD_GROUP, "bucket", bucket.c_str());
+        g_key_file_set_string(_key_file, UPLOAD_GROUP, "key", key.c_str());
+        g_key_file_set_string(_key_file, UPLOAD_GROUP, "upload-id", upload_id.c_str());
+        _save();
+    }
+
+    void set_part_pending(int part_number, const char* file, const char* checksum)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::string group = _get_group(part_number);
+
+        // The part may already be in S3, e.g. a streamed one, or the upload
+        // may have been aborted.
+        if (_removed || g_key_file_has_key(_key_file, group.c_str(), "etag", nullptr))
+        {
+            g_unlink(file);
+            return;
+        }
+        g_key_file_set_string(_key_file, group.c_str(), "file", file);
+        if (checksum)
+        {
+            g_key_file_set_string(_key_file, group.c_str(), "checksum", checksum);
+        }
+        _save();
+    }
+
+    // The spool file of the part isn't needed anymore once this is saved.
+    void set_part_completed(int part_number, const Aws::String& etag)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::string group = _get_group(part_number);
+
+        std::string file = _get_string(group.c_str(), "file");
+        g_key_file_remove_key(_key_file, group.c_str(), "file", nullptr);
+        g_key_file_set_string(_key_file, group.c_str(), "etag", etag.c_str());
+        if (!file.empty())
+        {
+            g_key_file_set_boolean(_key_file, group.c_str(), "spooled", TRUE);
+        }
+        if (_save() && !file.empty())
+        {
+            g_unlink(file.c_str());
+        }
+    }
+
+    // Deletes the journal along with the spool files it refers to.
+    void remove()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        gchar** groups = g_key_file_get_groups(_key_file, nullptr);
+        for (gchar** group = groups; *group; group++)
+        {
+            std::string file = _get_string(*group, "file");
+            if (!file.empty())
+            {
+                g_unlink(file.c_str());
+            }
+        }
+        g_strfreev(groups);
+
+        g_unlink(_path.c_str());
+        g_key_file_free(_key_file);
+        _key_file = g_key_file_new();
+    }
+
+    // Removes the journal for good: parts that finish later aren't recorded.
+    void discard()
+    {
+        remove();
+        std::lock_guard<std::mutex> lock(_mutex);
+        _removed = true;
+    }
+
+private:
+    static std::string _get_group(int part_number)
+    {
+        return "part-" + std::to_string(part_number);
+    }
+
+    std::string _get_string(const char* group, const char* key) const
+    {
+        gchar* value = g_key_file_get_string(_key_file, group, key, nullptr);
+        std::string result = value ? value : "";
+        g_free(value);
+        return result;
+    }
+
+    bool _save()
+    {
+        if (_removed)
+        {
+            return true;
+        }
+
+        GError* error = nullptr;
+        gsize length = 0;
+        gchar* data = g_key_file_to_data(_key_file, &length, nullptr);
+        GFileSetContentsFlags flags = _sync ?
+            GFileSetContentsFlags(G_FILE_SET_CONTENTS_CONSISTENT | G_FILE_SET_CONTENTS_DURABLE) :
+            G_FILE_SET_CONTENTS_CONSISTENT;
+
+        bool saved = g_file_set_contents_full(_path.c_str(), data, length, flags, 0600, &error);
+        if (!saved)
+        {
+            GST_WARNING("Failed to save the upload journal %s: %s", _path.c_str(), error->message);
+            g_error_free(error);
+        }
+        g_free(data);
+        return saved;
+    }
+
+    std::string _path;
+    bool _sync;
+    bool _removed = false;
+    mutable std::mutex _mutex;
+    GKeyFile* _key_file;
+};
+
+class MultipartUploaderContext : public Aws::Client::AsyncCallerContext
+{
+public:
+    MultipartUploaderContext(std::shared_ptr<PartStateCollection> states, std::shared_ptr<UploadJournal> journal,
+        int part_number, RetryPolicy retry_policy) :
+        _part_states(std::move(states)),
+        _journal(std::move(journal)),
+        _part_number(part_number),
+        _retry_policy(retry_policy),
+        _attempt(1),
+        _first_attempt_time(std::chrono::steady_clock::now())
+    {
+    }
+
+    std::shared_ptr<MultipartUploaderContext> next_attempt() const
+    {
+        auto context = std::make_shared<MultipartUploaderContext>(*this);
+        context->_attempt++;
+        return context;
+    }
+
+    int get_part_number() const
+    {
+        return _part_number;
+    }
+
+    unsigned get_attempt() const
+    {
+        return _attempt;
+    }
+
+    const RetryPolicy& get_retry_policy() const
+    {
+        return _retry_policy;
+    }
+
+    std::chrono::steady_clock::duration get_elapsed_time() const
+    {
+        return std::chrono::steady_clock::now() - _first_attempt_time;
+    }
+
+    std::shared_ptr<PartStateCollection> get_part_states() const
+    {
+        return _part_states;
+    }
+
+    // Null unless the parts are spooled.
+    std::shared_ptr<UploadJournal> get_journal() const
+    {
+        return _journal;
+    }
+
+private:
+    std::shared_ptr<PartStateCollection> _part_states;
+    std::shared_ptr<UploadJournal> _journal;
+    int _part_number;
+    RetryPolicy _retry_policy;
+    unsigned _attempt;
+    std::chrono::steady_clock::time_point _first_attempt_time;
+};
+
+class MultipartUploader
+{
+public:
+    // Without stats in the config, the uploader adds to the given ones, or
+    // to its own.
+    static std::unique_ptr<MultipartUploader> create(const GstS3UploaderConfig *config,
+        GstS3UploadStats* stats = nullptr)
+    {
+        auto uploader = std::unique_ptr<MultipartUploader>(new MultipartUploader(config, stats));
+        if (!uploader->_init_uploader(config))
+        {
+            return nullptr;
+        }
+        return uploader;
+    }
+
+    std::unique_ptr<MultipartUploader> create_next(const GstS3UploaderConfig *config);
+
+    ~MultipartUploader();
+
+    bool upload(GstBufferList* buffers);
+    bool complete();
+    bool put_object(GstBufferList* buffers);
+    bool begin_part(size_t size);
+    void append_part(GstBuffer* buffer);
+
+    bool get_error(int& part_number, Aws::String& error_code, Aws::String& error_message) const;
+    const Aws::String& get_etag() const { return _etag; }
+
+    bool has_capacity(size_t size) const;
+    bool wait_for_capacity(size_t size);
+    void set_unlocked(bool unlocked);
+
+private:
+    MultipartUploader(const GstS3UploaderConfig *config, GstS3UploadStats* stats);
+    MultipartUploader(const MultipartUploader& other, const GstS3UploaderConfig *config);
+    bool _init_uploader(const GstS3UploaderConfig * config);
+    void _init_journal(const GstS3UploaderConfig * config);
+    void _lookup_region(const Aws::Client::ClientConfiguration& lookup_config);
+    bool _create_client();
+    template <typename Error>
+    bool _update_region_from_error(const Error& error);
+    template <typename Outcome, typename Send>
+    void _retry(Outcome& outcome, const Send& send, std::chrono::steady_clock::time_point start_time,
+        const char* request_name, bool interruptible);
+    void _create_multipart_upload();
+    void _abort_upload();
+    void _abort_stale_upload();
+    void _abort_multipart_upload(const Aws::String& bucket, const Aws::String& key, const Aws::String& upload_id);
+    void _resume_upload(const std::string& handed_over_file);
+    bool _list_parts(std::map<int, Aws::S3::Model::Part>& parts, Aws::String& error_code, Aws::String& error_message);
+    void _resume_parts(const std::map<int, Aws::S3::Model::Part>& listed_parts);
+    void _start_part(int part_number, std::shared_ptr<PartStream> stream, const char* checksum, const char* file);
+    void _submit_part(Aws::S3::Model::UploadPartRequest request);
+    void _upload_part_async(const Aws::S3::Model::UploadPartRequest& request);
+
+    void _update_max_parts_in_flight(size_t part_size);
+
+    static void _fail_part(PartStateCollection& states, int part_number, unsigned attempt, const Aws::S3::S3Error& error);
+    static void _handle_upload_completed(const Aws::S3::S3Client*, const Aws::S3::Model::UploadPartRequest&, const Aws::S3::Model::UploadPartOutcome& outcome, const std::shared_ptr<const Aws::Client::AsyncCallerContext>& ctx);
+
+    Aws::String _bucket;
+    Aws::String _key;
+    Aws::S3::Model::ObjectCannedACL _acl;
+    bool _has_acl = false;
+    Aws::String _content_type;
+
+    // CreateMultipartUpload is deferred until the first part is uploaded,
+    // so that objects smaller than a part only need a single PutObject. It
+    // then runs in the background while parts queue up in _pending_parts
+    // (they already count against the in-flight limits).
+    enum class UploadState
+    {
+        NOT_REQUESTED,
+        PENDING,
+        CREATED,
+        FAILED,
+        COMPLETED,
+        ABORTED
+    };
+
+    std::mutex _upload_mutex;
+    UploadState _upload_state = UploadState::NOT_REQUESTED;
+    Aws::String _upload_id;
+    Aws::String _upload_error_code;
+    Aws::String _upload_error_message;
+    // Whether an upload that can't be completed is aborted or kept for resume.
+    bool _abort_incomplete_upload = true;
+    std::vector<Aws::S3::Model::UploadPartRequest> _pending_parts;
+    std::future<void> _upload_created;
+    // Of the journal dropped when not resuming.
+    Aws::String _stale_upload_id;
+    // AbortMultipartUpload requests still running.
+    std::vector<std::future<void>> _aborts;
+    // Of the object, once it's written.
+    Aws::String _etag;
+
+    std::shared_ptr<AwsApiHandle> _api_handle;
+
+    // The bucket region lookup and the client construction run in the
+    // background too, so that starting the sink doesn't wait for S3. The
+    // client is shared with other uploaders, see S3ClientCache.
+    std::shared_future<void> _client_ready;
+    std::shared_ptr<Aws::S3::S3Client> _s3_client;
+    Aws::S3::S3ClientConfiguration _client_config;
+    std::shared_ptr<GstAWSCredentials> _credentials;
+
+    std::chrono::nanoseconds _region_cache_ttl;
+    std::string _region_cache_file;
+
+    size_t _upload_threads = DEFAULT_UPLOAD_THREADS;
+    std::vector<int> _upload_thread_cpus;
+    int _upload_thread_nice = 0;
+
+    std::condition_variable _upload_completed_cv;
+    UploadStatsPtr _stats;
+    std::shared_ptr<PartStateCollection> _part_states;
+
+    size_t _max_parts_in_flight = 0;
+    size_t _max_bytes_in_flight = 0;
+
+    bool _adaptive_parts_in_flight = false;
+    size_t _min_adaptive_parts_in_flight = 0;
+    size_t _max_adaptive_parts_in_flight = 0;
+    double _input_rate = 0.0;
+    std::chrono::steady_clock::time_point _last_upload_time;
+
+    RetryPolicy _retry_policy;
+
+    Aws::S3::Model::ChecksumAlgorithm _checksum_algorithm = Aws::S3::Model::ChecksumAlgorithm::NOT_SET;
+
+    int _part_counter = 0;
+
+    // Only set when the parts are spooled, see UploadJournal.
+    std::shared_ptr<UploadJournal> _journal;
+    std::vector<UploadJournal::Part> _resumed_parts;
+
+    // The part being streamed, between begin_part() and upload().
+    std::shared_ptr<StreamingPartStream> _streaming_part;
+    int _streaming_part_number = 0;
+};
+
+// TODO: There's a few things I didn't implement because they're not critical (yet), but might
+//       be needed in the (near) future:
+//        * tests - not sure if AWS provide any infrastructure/framework for testing this kind of code,
+//          or we have to rely on stable internet connection and run tests with credentials that allow
+//          uploading/downloading files from S3.
+
+MultipartUploader::MultipartUploader(const GstS3UploaderConfig *config, GstS3UploadStats* stats) :
+    _bucket(std::move(get_bucket_from_config(config))),
+    _key(std::move(get_key_from_config(config))),
+    _api_handle(config->init_aws_sdk ? AwsApiHandle::GetHandle() : nullptr),
+    _region_cache_ttl(std::min<guint64>(config->bucket_region_cache_ttl, G_MAXINT64)),
+    _region_cache_file(is_null_or_empty(config->bucket_region_cache_file) ? "" : config->bucket_region_cache_file),
+    _stats(share_upload_stats(config->stats ? config->stats : stats)),
+    _part_states(std::make_shared<PartStateCollection>(_stats)),
+    _retry_policy(std::max<unsigned>(config->retry_max_attempts, 1), std::chrono::nanoseconds(std::min<guint64>(config->retry_budget, G_MAXINT64)))
+{
+}
+
+// Takes the settings and the client of the other uploader, which must be
+// ready; only the destination, and the content type if set, come from the
+// config. The upload thread settings of the config must be the same.
+MultipartUploader::MultipartUploader(const MultipartUploader& other, const GstS3UploaderConfig *config) :
+    _bucket(std::move(get_bucket_from_config(config))),
+    _key(std::move(get_key_from_config(config))),
+    _acl(other._acl),
+    _has_acl(other._has_acl),
+    _content_type(is_null_or_empty(config->content_type) ? other._content_type : Aws::String(config->content_type)),
+    _abort_incomplete_upload(other._abort_incomplete_upload),
+    _api_handle(other._api_handle),
+    _client_ready(other._client_ready),
+    _s3_client(other._s3_client),
+    _client_config(other._client_config),
+    _credentials(other._credentials),
+    _region_cache_ttl(other._region_cache_ttl),
+    _region_cache_file(other._region_cache_file),
+    _upload_threads(other._upload_threads),
+    _upload_thread_cpus(other._upload_thread_cpus),
+    _upload_thread_nice(other._upload_thread_nice),
+    _stats(config->stats ? share_upload_stats(config->stats) : other._stats),
+    _part_states(std::make_shared<PartStateCollection>(_stats)),
+    _max_parts_in_flight(other._max_parts_in_flight),
+    _max_bytes_in_flight(other._max_bytes_in_flight),
+    _adaptive_parts_in_flight(other._adaptive_parts_in_flight),
+    _min_adaptive_parts_in_flight(other._min_adaptive_parts_in_flight),
+    _max_adaptive_parts_in_flight(other._max_adaptive_parts_in_flight),
+    _input_rate(other._input_rate),
+    _retry_policy(other._retry_policy),
+    _checksum_algorithm(other._checksum_algorithm)
+{
+}
+
+// Sets up the uploader of the next object of a segmented stream. Neither
+// the region lookup nor the client are done again. If this object needed a
+// multipart upload, the next one most likely will too, so it's created right
+// away and is ready by the time the object starts; objects written with a
+// single PutObject don't pay for it.
+std::unique_ptr<MultipartUploader> MultipartUploader::create_next(const GstS3UploaderConfig *config)
+{
+    _client_ready.wait();
+    // A different bucket may be in another region, and other thread
+    // settings need another client.
+    if (!_s3_client || get_bucket_from_config(config) != _bucket
+        || get_upload_threads(config->upload_threads) != _upload_threads
+        || parse_cpu_list(config->upload_thread_affinity) != _upload_thread_cpus
+        || config->upload_thread_nice != _upload_thread_nice)
+    {
+        return create(config, _stats.get());
+    }
+
+    auto uploader = std::unique_ptr<MultipartUploader>(new MultipartUploader(*this, config));
+    uploader->_init_journal(config);
+
+    {
+        std::lock_guard<std::mutex> lock(_upload_mutex);
+        if (_upload_state == UploadState::NOT_REQUESTED)
+        {
+            return uploader;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(uploader->_upload_mutex);
+    if (uploader->_upload_state == UploadState::NOT_REQUESTED)
+    {
+        uploader->_upload_state = UploadState::PENDING;
+        uploader->_upload_created = std::async(std::launch::async, &MultipartUploader::_create_multipart_upload,
+            uploader.get());
+    }
+    return uploader;
+}
+
+MultipartUploader::~MultipartUploader()
+{
+    if (_streaming_part)
+    {
+        _streaming_part->abort();
+    }
+    // The requests waiting for a retry, the creation of the upload included,
+    // give up right away rather than delaying the teardown.
+    _part_states->cancel_retries();
+    if (_client_ready.valid())
+    {
+        _client_ready.wait();
+        _abort_stale_upload();
+    }
+    if (_upload_created.valid())
+    {
+        _upload_created.wait();
+    }
+
+    // The async callbacks run on the client's executor, so the client
+    // must outlive every part that is still being uploaded.
+    _part_states->wait_for_complete();
+
+    // Not completed, e.g. the sink was destroyed without being stopped.
+    // Only aborted now, as S3 could keep a part that completes after the
+    // abort.
+    _abort_upload();
+
+    std::vector<std::future<void>> aborts;
+    {
+        std::lock_guard<std::mutex> lock(_upload_mutex);
+        aborts.swap(_aborts);
+    }
+    for (auto& abort : aborts)
+    {
+        abort.wait();
+    }
+}
+
+bool MultipartUploader::_init_uploader(const GstS3UploaderConfig * config)
+{
+    if (!is_null_or_empty(config->ca_file))
+    {
+        _client_config.caFile = config->ca_file;
+    }
+
+    // The region lookup only needs the CA file, copy it before anything else is set.
+    Aws::Client::ClientConfiguration lookup_config(_client_config);
+    bool lookup_region = is_null_or_empty(config->region);
+    if (!lookup_region)
+    {
+        _client_config.region = config->region;
+    }
+    else if (_region_cache_ttl.count() > 0)
+    {
+        Aws::String region;
+        if (BucketRegionCache::get_instance().lookup(_bucket, _region_cache_file, region))
+        {
+            GST_DEBUG("Using cached region %s of bucket %s", region.c_str(), _bucket.c_str());
+            _client_config.region = std::move(region);
+            lookup_region = false;
+        }
+    }
+
+    // The provider is only created when no client can be shared, possibly in
+    // the background, so keep the credentials around until then.
+    _credentials = std::shared_ptr<GstAWSCredentials>(gst_aws_credentials_copy(config->credentials),
+        gst_aws_credentials_free);
+
+    // Configure AWS SDK specific client configuration
+    if (!is_null_or_empty(config->aws_sdk_endpoint))
+    {
+        _client_config.endpointOverride = Aws::String(config->aws_sdk_endpoint);
     }
     if (config->aws_sdk_use_http)
     {
-        client_config.scheme = Aws::Http::Scheme::HTTP;
+        _client_config.scheme = Aws::Http::Scheme::HTTP;
+    }
+    _client_config.verifySSL = config->aws_sdk_verify_ssl;
+    _client_config.maxConnections = std::max<guint>(config->max_connections, 1);
+    // The requests are retried by RetryPolicy, within retry-max-attempts
+    // and retry-budget; the SDK retrying too would multiply the attempts
+    // and sleep on the executor threads.
+    _client_config.retryStrategy = std::make_shared<Aws::Client::DefaultRetryStrategy>(0);
+
+    _upload_threads = get_upload_threads(config->upload_threads);
+    _upload_thread_cpus = parse_cpu_list(config->upload_thread_affinity);
+    _upload_thread_nice = config->upload_thread_nice;
+
+    _checksum_algorithm = to_aws_checksum_algorithm(config->checksum_algorithm);
+
+    if (config->streaming_parts)
+    {
+        guint64 max_part_duration_ms = config->max_part_duration / GST_MSECOND;
+        _client_config.requestTimeoutMs = static_cast<long>(std::min<guint64>(
+            std::max<guint64>(max_part_duration_ms, STREAMING_REQUEST_TIMEOUT_MS), G_MAXINT32));
+    }
+
+    // The S3 client doesn't sign the payloads over HTTPS by default, and
+    // always signs them over plain HTTP, whatever the policy.
+    switch (config->payload_signing)
+    {
+    case GST_S3_PAYLOAD_SIGNING_ALWAYS:
+        _client_config.payloadSigningPolicy = Aws::Client::AWSAuthV4Signer::PayloadSigningPolicy::Always;
+        break;
+    case GST_S3_PAYLOAD_SIGNING_NEVER:
+        _client_config.payloadSigningPolicy = Aws::Client::AWSAuthV4Signer::PayloadSigningPolicy::Never;
+        break;
+    default:
+        if (!config->aws_sdk_s3_sign_payload) {
+            _client_config.payloadSigningPolicy = Aws::Client::AWSAuthV4Signer::PayloadSigningPolicy::Never;
+        }
+        break;
+    }
+    if (!config->aws_sdk_s3_sign_payload) {
+        _client_config.useVirtualAddressing = false;
+    }
+
+    if (lookup_region)
+    {
+        _client_ready = std::async(std::launch::async, [this, lookup_config]() {
+            _lookup_region(lookup_config);
+            _create_client();
+        }).share();
+    }
+    else
+    {
+        // Nothing to wait for, the client doesn't do any I/O until it's used.
+        std::promise<void> ready;
+        bool client_created = _create_client();
+        ready.set_value();
+        _client_ready = ready.get_future().share();
+        if (!client_created)
+        {
+            return false;
+        }
+    }
+
+    _max_bytes_in_flight = config->max_in_flight_bytes;
+    _adaptive_parts_in_flight = config->adaptive_buffer_count;
+    if (_adaptive_parts_in_flight)
+    {
+        // Start from buffer_count parts and grow up to max_in_flight_parts
+        // (or a multiple of buffer_count when no limit is set).
+        _min_adaptive_parts_in_flight = std::max<size_t>(config->buffer_count, 1);
+        _max_adaptive_parts_in_flight = config->max_in_flight_parts > _min_adaptive_parts_in_flight ?
+            config->max_in_flight_parts : _min_adaptive_parts_in_flight * ADAPTIVE_BUFFER_COUNT_GROWTH;
+        _max_parts_in_flight = _min_adaptive_parts_in_flight;
+    }
+    else
+    {
+        _max_parts_in_flight = config->max_in_flight_parts > 0 ? config->max_in_flight_parts : config->buffer_count;
+        _max_parts_in_flight = std::max<size_t>(_max_parts_in_flight, 1);
+    }
+
+    // A part holds a thread of the executor while it's sent, and the
+    // executor is shared by every uploader with the same thread settings.
+    size_t parts_in_flight = _adaptive_parts_in_flight ? _max_adaptive_parts_in_flight : _max_parts_in_flight;
+    if (parts_in_flight > _upload_threads)
+    {
+        GST_WARNING("Up to %" G_GSIZE_FORMAT " parts in flight but %" G_GSIZE_FORMAT
+            " upload threads, the other parts wait for a thread", parts_in_flight, _upload_threads);
+    }
+
+    if (!is_null_or_empty(config->acl))
+    {
+        _acl = Aws::S3::Model::ObjectCannedACLMapper::GetObjectCannedACLForName(Aws::String(config->acl));
+        _has_acl = true;
+    }
+
+    if (is_null_or_empty(config->content_type))
+    {
+        _content_type = "application/octet-stream";
+    }
+    else
+    {
+        _content_type = config->content_type;
+    }
+
+    switch (config->abort_policy)
+    {
+    case GST_S3_ABORT_POLICY_ABORT:
+        _abort_incomplete_upload = true;
+        break;
+    case GST_S3_ABORT_POLICY_KEEP:
+        _abort_incomplete_upload = false;
+        break;
+    default:
+        _abort_incomplete_upload = is_null_or_empty(config->spool_directory);
+        break;
+    }
+
+    _init_journal(config);
+
+    return true;
+}
+
+void MultipartUploader::_init_journal(const GstS3UploaderConfig * config)
+{
+    gchar* journal_path = gst_s3_spool_get_path(config, ".journal");
+    if (journal_path)
+    {
+        _journal = std::make_shared<UploadJournal>(journal_path, config->spool_sync);
+        g_free(journal_path);
+
+        gchar* handed_over_path = gst_s3_spool_get_handed_over_part(config);
+        std::string handed_over_file = handed_over_path ? handed_over_path : "";
+        g_free(handed_over_path);
+
+        if (_journal->load() || !handed_over_file.empty())
+        {
+            if (config->resume)
+            {
+                _resume_upload(handed_over_file);
+            }
+            else
+            {
+                GST_WARNING("Dropping the spooled upload of %s/%s", _bucket.c_str(), _key.c_str());
+                // Aborted once the client is ready, see _abort_stale_upload().
+                _stale_upload_id = _journal->get_upload_id();
+                _journal->remove();
+                if (!handed_over_file.empty())
+                {
+                    g_unlink(handed_over_file.c_str());
+                }
+            }
+        }
+    }
+}
+
+// Picks up the upload recorded in the journal. The upload is marked as
+// requested right away so that the object is never written with a single
+// PutObject; _create_multipart_upload() does the rest in the background.
+void MultipartUploader::_resume_upload(const std::string& handed_over_file)
+{
+    _resumed_parts = _journal->get_parts();
+    for (const auto& part : _resumed_parts)
+    {
+        _part_counter = std::max(_part_counter, part.part_number);
+    }
+
+    // The spool may have handed over one more part before the crash, which
+    // the journal doesn't know about. It's the last one, unless it was
+    // streamed and S3 already has it.
+    bool journaled = std::any_of(_resumed_parts.begin(), _resumed_parts.end(),
+        [&handed_over_file](const UploadJournal::Part& part) { return part.file == handed_over_file; });
+    if (!handed_over_file.empty() && !journaled)
+    {
+        if (!_resumed_parts.empty() && !_resumed_parts.back().etag.empty() && !_resumed_parts.back().spooled)
+        {
+            g_unlink(handed_over_file.c_str());
+        }
+        else
+        {
+            UploadJournal::Part part;
+            part.part_number = ++_part_counter;
+            part.file = handed_over_file;
+            _journal->set_part_pending(part.part_number, part.file.c_str(), nullptr);
+            _resumed_parts.push_back(std::move(part));
+        }
+    }
+
+    Aws::String upload_id = _journal->get_upload_id();
+    if (upload_id.empty() && _resumed_parts.empty())
+    {
+        return;
+    }
+
+    GST_INFO("Resuming upload %s of %s/%s with %" G_GSIZE_FORMAT " journaled part(s)",
+        upload_id.empty() ? "(not created)" : upload_id.c_str(), _bucket.c_str(), _key.c_str(),
+        _resumed_parts.size());
+
+    std::lock_guard<std::mutex> lock(_upload_mutex);
+    _upload_id = upload_id;
+    _upload_state = UploadState::PENDING;
+    _upload_created = std::async(std::launch::async, &MultipartUploader::_create_multipart_upload, this);
+}
+
+bool MultipartUploader::_list_parts(std::map<int, Aws::S3::Model::Part>& parts,
+    Aws::String& error_code, Aws::String& error_message)
+{
+    Aws::S3::Model::ListPartsRequest request;
+    request.WithBucket(_bucket)
+        .WithKey(_key)
+        .WithUploadId(_upload_id);
+
+    auto list_parts = [this, &request]() {
+        gst_s3_upload_stats_count_request(_stats.get(), GST_S3_REQUEST_LIST_PARTS);
+        return _s3_client->ListParts(request);
+    };
+
+    for (;;)
+    {
+        auto start_time = std::chrono::steady_clock::now();
+        auto outcome = list_parts();
+        if (!outcome.IsSuccess() && _update_region_from_error(outcome.GetError()))
+        {
+            outcome = list_parts();
+        }
+        _retry(outcome, list_parts, start_time, "ListParts", false);
+        if (!outcome.IsSuccess())
+        {
+            error_code = get_error_code(outcome.GetError());
+            error_message = outcome.GetError().GetMessage();
+            return false;
+        }
+
+        for (const auto& part : outcome.GetResult().GetParts())
+        {
+            parts[part.GetPartNumber()] = part;
+        }
+        if (!outcome.GetResult().GetIsTruncated())
+        {
+            return true;
+        }
+        request.SetPartNumberMarker(outcome.GetResult().GetNextPartNumberMarker());
+    }
+}
+
+// Parts S3 already has are only recorded; the others are uploaded again
+// from their spool files, with the same part numbers.
+void MultipartUploader::_resume_parts(const std::map<int, Aws::S3::Model::Part>& listed_parts)
+{
+    for (const auto& part : _resumed_parts)
+    {
+        auto listed = listed_parts.find(part.part_number);
+        if (listed != listed_parts.end())
+        {
+            PartState state(part.part_number, listed->second.GetSize());
+            state.set_etag(listed->second.GetETag());
+            Aws::String checksum = get_checksum(listed->second, _checksum_algorithm);
+            state.set_checksum(checksum.empty() ? part.checksum : checksum);
+            _part_states->add_completed(std::move(state));
+            if (!part.file.empty())
+            {
+                _journal->set_part_completed(part.part_number, listed->second.GetETag());
+            }
+            continue;
+        }
+
+        GError* error = nullptr;
+        GstBuffer* buffer = part.file.empty() ? nullptr : gst_s3_spool_map_file(part.file.c_str(), &error);
+        if (!buffer)
+        {
+            GST_ERROR("Part %d of the resumed upload is lost: %s", part.part_number,
+                error ? error->message : "not in S3 and not spooled");
+            g_clear_error(&error);
+            _part_states->start(PartState(part.part_number, 0));
+            _part_states->mark_part_as_failed(part.part_number, "NoSuchPart", "Part of the resumed upload is lost");
+            continue;
+        }
+
+        GstBufferList* buffers = gst_buffer_list_new();
+        gst_buffer_list_add(buffers, buffer);
+        _start_part(part.part_number, std::make_shared<PartStream>(buffers),
+            part.checksum.empty() ? nullptr : part.checksum.c_str(), part.file.c_str());
+    }
+    _resumed_parts.clear();
+}
+
+void MultipartUploader::_lookup_region(const Aws::Client::ClientConfiguration& lookup_config)
+{
+    Aws::String region;
+    if (!get_bucket_location(_bucket.c_str(), lookup_config, region))
+    {
+        // Requests will be redirected to the right region, see _update_region_from_error().
+        GST_WARNING("Failed to get the location of bucket %s", _bucket.c_str());
+        return;
+    }
+
+    // Buckets in us-east-1 have no location constraint.
+    if (region.empty())
+    {
+        region = "us-east-1";
+    }
+
+    _client_config.region = region;
+    if (_region_cache_ttl.count() > 0)
+    {
+        BucketRegionCache::get_instance().store(_bucket, region, _region_cache_ttl, _region_cache_file);
+    }
+}
+
+bool MultipartUploader::_create_client()
+{
+    _s3_client = get_s3_client(_client_config, _upload_threads, _upload_thread_cpus, _upload_thread_nice,
+        _credentials.get());
+
+    if (!_s3_client)
+    {
+        GST_ERROR("Failed to create the S3 client");
+        return false;
+    }
+    return true;
+}
+
+// S3 tells which region a bucket is in when a request is sent to the wrong
+// one (301 PermanentRedirect, or 400 for a mismatching signature). Switches
+// to that region and returns true, in which case the request can be retried.
+// Only called before any part is in flight, so that no request still uses
+// the previous client.
+template <typename Error>
+bool MultipartUploader::_update_region_from_error(const Error& error)
+{
+    Aws::String region;
+    if (!get_redirect_region(error, _client_config.region, region))
+    {
+        return false;
+    }
+
+    GST_INFO("Bucket %s is in region %s, not %s", _bucket.c_str(), region.c_str(),
+        _client_config.region.c_str());
+
+    _client_config.region = region;
+    if (_region_cache_ttl.count() > 0)
+    {
+        BucketRegionCache::get_instance().store(_bucket, region, _region_cache_ttl, _region_cache_file);
+    }
+
+    return _create_client();
+}
+
+void MultipartUploader::_create_multipart_upload()
+{
+    _client_ready.wait();
+    _abort_stale_upload();
+
+    Aws::S3::Model::CreateMultipartUploadRequest upload_request;
+    upload_request.SetBucket(_bucket);
+    upload_request.SetKey(_key);
+    upload_request.SetContentType(_content_type);
+
+    if (_has_acl)
+    {
+        upload_request.SetACL(_acl);
+    }
+
+    // Required for the parts to carry a checksum.
+    if (_checksum_algorithm != Aws::S3::Model::ChecksumAlgorithm::NOT_SET)
+    {
+        upload_request.SetChecksumAlgorithm(_checksum_algorithm);
+    }
+
+    bool created = false;
+    std::vector<Aws::S3::Model::UploadPartRequest> pending_parts;
+    std::map<int, Aws::S3::Model::Part> listed_parts;
+
+    if (!_s3_client)
+    {
+        std::lock_guard<std::mutex> lock(_upload_mutex);
+        _upload_error_code = "ClientError";
+        _upload_error_message = "Failed to create the S3 client";
+        _upload_state = UploadState::FAILED;
+        pending_parts.swap(_pending_parts);
+    }
+    else if (!_upload_id.empty())
+    {
+        // Resuming, the upload already exists.
+        Aws::String error_code, error_message;
+        created = _list_parts(listed_parts, error_code, error_message);
+
+        std::lock_guard<std::mutex> lock(_upload_mutex);
+        if (created)
+        {
+            _upload_state = UploadState::CREATED;
+        }
+        else
+        {
+            GST_ERROR("Failed to resume multipart upload %s: %s", _upload_id.c_str(), error_message.c_str());
+            _upload_error_code = error_code;
+            _upload_error_message = error_message;
+            _upload_state = UploadState::FAILED;
+        }
+        pending_parts.swap(_pending_parts);
+    }
+    else
+    {
+        auto create_multipart_upload = [this, &upload_request]() {
+            gst_s3_upload_stats_count_request(_stats.get(), GST_S3_REQUEST_CREATE_MULTIPART_UPLOAD);
+            return _s3_client->CreateMultipartUpload(upload_request);
+        };
+
+        auto start_time = std::chrono::steady_clock::now();
+        auto outcome = create_multipart_upload();
+        if (!outcome.IsSuccess() && _update_region_from_error(outcome.GetError()))
+        {
+            outcome = create_multipart_upload();
+        }
+        _retry(outcome, create_multipart_upload, start_time, "CreateMultipartUpload", false);
+
+        std::lock_guard<std::mutex> lock(_upload_mutex);
+        created = outcome.IsSuccess();
+        if (created)
+        {
+            _upload_id = outcome.GetResult().GetUploadId();
+            _upload_state = UploadState::CREATED;
+            if (_journal)
+            {
+                _journal->set_upload_id(_bucket, _key, _upload_id);
+            }
+        }
+        else
+        {
+            GST_ERROR("Failed to create multipart upload: %s", outcome.GetError().GetMessage().c_str());
+            _upload_error_code = get_error_code(outcome.GetError());
+            _upload_error_message = outcome.GetError().GetMessage();
+            _upload_state = UploadState::FAILED;
+        }
+        pending_parts.swap(_pending_parts);
+    }
+
+    for (auto& request : pending_parts)
+    {
+        if (created)
+        {
+            request.SetUploadId(_upload_id);
+            _upload_part_async(request);
+        }
+        else
+        {
+            _part_states->mark_part_as_failed(request.GetPartNumber(), _upload_error_code, _upload_error_message);
+        }
+    }
+
+    // The spooled parts are kept for another attempt if this one failed.
+    if (created && !_resumed_parts.empty())
+    {
+        _resume_parts(listed_parts);
+    }
+}
+
+void MultipartUploader::_submit_part(Aws::S3::Model::UploadPartRequest request)
+{
+    std::unique_lock<std::mutex> lock(_upload_mutex);
+
+    if (_upload_state == UploadState::NOT_REQUESTED)
+    {
+        _upload_state = UploadState::PENDING;
+        _upload_created = std::async(std::launch::async, &MultipartUploader::_create_multipart_upload, this);
+    }
+
+    if (_upload_state == UploadState::PENDING)
+    {
+        _pending_parts.push_back(std::move(request));
+    }
+    else if (_upload_state == UploadState::CREATED)
+    {
+        request.SetUploadId(_upload_id);
+        lock.unlock();
+        _upload_part_async(request);
+    }
+    else
+    {
+        lock.unlock();
+        _part_states->mark_part_as_failed(request.GetPartNumber(), _upload_error_code, _upload_error_message);
+    }
+}
+
+void MultipartUploader::_upload_part_async(const Aws::S3::Model::UploadPartRequest& request)
+{
+    auto context = std::make_shared<MultipartUploaderContext>(_part_states, _journal, request.GetPartNumber(), _retry_policy);
+
+    gst_s3_upload_stats_count_request(_stats.get(), GST_S3_REQUEST_UPLOAD_PART);
+    _s3_client->UploadPartAsync(request, _handle_upload_completed, context);
+}
+
+// Sizes the number of parts in flight to the bandwidth-delay product: with
+// parts produced at the input rate and each one taking the measured latency to
+// upload, that many parts (plus one being filled) are needed to never stall.
+void MultipartUploader::_update_max_parts_in_flight(size_t part_size)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (_part_counter > 0 && part_size > 0)
+    {
+        double interval = std::chrono::duration<double>(now - _last_upload_time).count();
+        if (interval > 0.0)
+        {
+            double rate = part_size / interval;
+            _input_rate = _input_rate == 0.0 ? rate : _input_rate + 0.25 * (rate - _input_rate);
+        }
+    }
+    _last_upload_time = now;
+
+    double latency = _part_states->get_upload_latency();
+    if (latency == 0.0 || _input_rate == 0.0 || part_size == 0)
+    {
+        return;
+    }
+
+    size_t needed = static_cast<size_t>(std::ceil(latency * _input_rate / part_size)) + 1;
+    needed = std::min(std::max(needed, _min_adaptive_parts_in_flight), _max_adaptive_parts_in_flight);
+    if (needed != _max_parts_in_flight)
+    {
+        GST_DEBUG("Adapting parts in flight from %" G_GSIZE_FORMAT " to %" G_GSIZE_FORMAT
+            " (latency %.3fs, input rate %.0f B/s)", _max_parts_in_flight, needed, latency, _input_rate);
+        _max_parts_in_flight = needed;
+    }
+}
+
+bool MultipartUploader::has_capacity(size_t size) const
+{
+    return _part_states->has_capacity(_max_parts_in_flight, _max_bytes_in_flight, size);
+}
+
+bool MultipartUploader::wait_for_capacity(size_t size)
+{
+    return _part_states->wait_for_capacity(_max_parts_in_flight, _max_bytes_in_flight, size, true);
+}
+
+void MultipartUploader::set_unlocked(bool unlocked)
+{
+    _part_states->set_unlocked(unlocked);
+}
+
+bool MultipartUploader::get_error(int& part_number, Aws::String& error_code, Aws::String& error_message) const
+{
+    PartStateCollection::Failure failure;
+    if (!_part_states->get_first_failure(failure))
+    {
+        return false;
     }
-    client_config.verifySSL = config->aws_sdk_verify_ssl;
-
-    const char* endpoint_provider_allocation_tag = "AWSS3EndpointProvider";
+    part_number = failure.part_number;
+    error_code = std::move(failure.error_code);
+    error_message = std::move(failure.error_message);
+    return true;
+}
 
-    if (!config->aws_sdk_s3_sign_payload) {
-        client_config.payloadSigningPolicy = Aws::Client::AWSAuthV4Signer::PayloadSigningPolicy::Never;
-        client_config.useVirtualAddressing = false;
+bool MultipartUploader::upload(GstBufferList* buffers)
+{
+    // The bytes appended to a streamed part were counted already, even if
+    // the part is sent again below.
+    size_t enqueued_size = gst_buffer_list_calculate_size(buffers);
+    if (_streaming_part)
+    {
+        enqueued_size -= std::min(enqueued_size, _streaming_part->get_appended_size());
     }
+    gst_s3_upload_stats_add(_stats.get(), GST_S3_UPLOAD_COUNTER_BYTES_ENQUEUED, enqueued_size);
 
-    _s3_client = std::unique_ptr<Aws::S3::S3Client>(new Aws::S3::S3Client(std::move(credentials_provider), Aws::MakeShared<Aws::S3::Endpoint::S3EndpointProvider>(endpoint_provider_allocation_tag), client_config));
-
-    _init_buffer_manager(config->buffer_count, config->buffer_size);
+    if (_streaming_part)
+    {
+        auto streaming_part = std::move(_streaming_part);
+        if (streaming_part->get_appended_size() == streaming_part->size())
+        {
+            // The data is already on its way.
+            const gchar* file = gst_s3_uploader_get_part_file(buffers);
+            if (_journal && file)
+            {
+                _journal->set_part_pending(_streaming_part_number, file, nullptr);
+            }
+            gst_buffer_list_unref(buffers);
+            return true;
+        }
 
-    Aws::S3::Model::CreateMultipartUploadRequest upload_request;
-    upload_request.SetBucket(_bucket);
-    upload_request.SetKey(_key);
+        // The Content-Length of the part can't be changed anymore, e.g. when
+        // the stream ends in the middle of it. Send it as a regular part,
+        // which takes another part number; gaps in the numbers are allowed.
+        GST_DEBUG("Streamed part %d ended after %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT " bytes, resending it",
+            _streaming_part_number, streaming_part->get_appended_size(), streaming_part->size());
+        _part_states->abandon(_streaming_part_number);
+        streaming_part->abort();
+    }
 
-    if (!is_null_or_empty(config->acl))
+    const gchar* checksum = gst_s3_uploader_get_part_checksum(buffers);
+    auto stream = std::make_shared<PartStream>(buffers);
+    if (!stream->is_valid())
     {
-        _acl = Aws::S3::Model::ObjectCannedACLMapper::GetObjectCannedACLForName(Aws::String(config->acl));
-        upload_request.SetACL(_acl);
+        return false;
     }
 
-    if (is_null_or_empty(config->content_type))
+    // The object can't be completed anymore, don't waste bandwidth on it.
+    if (_part_states->get_failed_parts_count() > 0)
     {
-        upload_request.SetContentType("application/octet-stream");
+        return false;
     }
-    else
+
+    if (_adaptive_parts_in_flight)
     {
-        upload_request.SetContentType(config->content_type);
+        _update_max_parts_in_flight(stream->size());
     }
 
-    _upload_outcome = _s3_client->CreateMultipartUpload(upload_request);
-    return _upload_outcome.IsSuccess();
+    // Every in-flight part keeps its buffers alive, so the in-flight limits
+    // bound the memory held by the uploader. The sink normally waits for
+    // capacity beforehand, in which case this returns immediately.
+    _part_states->wait_for_capacity(_max_parts_in_flight, _max_bytes_in_flight, stream->size(), false);
+
+    _start_part(++_part_counter, stream, checksum, gst_s3_uploader_get_part_file(buffers));
+
+    return true;
 }
 
-std::unique_ptr<Aws::IOStream> MultipartUploader::_create_stream(const char* data, size_t size)
+void MultipartUploader::_start_part(int part_number, std::shared_ptr<PartStream> stream,
+    const char* checksum, const char* file)
 {
-    auto buffer = _buffer_manager->Acquire();
-    memcpy(buffer, data, size);
+    Aws::S3::Model::UploadPartRequest request;
+    request.WithBucket(_bucket)
+        .WithKey(_key)
+        .WithPartNumber(part_number)
+        .WithContentLength(stream->size());
+    request.SetBody(stream);
+
+    PartState part_state(part_number, stream->size());
+
+    if (_checksum_algorithm != Aws::S3::Model::ChecksumAlgorithm::NOT_SET)
+    {
+        // Without a checksum from the sink, the SDK computes it.
+        request.SetChecksumAlgorithm(_checksum_algorithm);
+        if (checksum)
+        {
+            set_checksum(request, _checksum_algorithm, checksum);
+            part_state.set_checksum(checksum);
+        }
+    }
+
+    // Recorded before the part is sent, so that a crash can't lose track of it.
+    if (_journal && file)
+    {
+        _journal->set_part_pending(part_number, file, checksum);
+    }
+
+    _part_states->start(std::move(part_state));
 
-    return std::unique_ptr<Aws::IOStream>(
-        new Aws::IOStream(new Aws::Utils::Stream::PreallocatedStreamBuf(buffer, size)));
+    _submit_part(std::move(request));
 }
 
-bool MultipartUploader::upload(const char* data, size_t size)
+bool MultipartUploader::begin_part(size_t size)
 {
+    if (_part_states->get_failed_parts_count() > 0)
+    {
+        return false;
+    }
+
+    if (_adaptive_parts_in_flight)
+    {
+        _update_max_parts_in_flight(size);
+    }
+
+    _part_states->wait_for_capacity(_max_parts_in_flight, _max_bytes_in_flight, size, false);
+
+    auto stream = std::make_shared<StreamingPartStream>(size);
     int part_number = ++_part_counter;
 
-    std::shared_ptr<Aws::IOStream> stream = _create_stream(data, size);
     Aws::S3::Model::UploadPartRequest request;
     request.WithBucket(_bucket)
         .WithKey(_key)
         .WithPartNumber(part_number)
-        .WithUploadId(_upload_outcome.GetResult().GetUploadId())
         .WithContentLength(size);
     request.SetBody(stream);
 
-    PartState part_state(part_number);
+    // An aborted part stops the transfer rather than waiting for S3 to time
+    // out on the missing bytes.
+    request.SetContinueRequestHandler([stream](const Aws::Http::HttpRequest*) {
+        return !stream->is_aborted();
+    });
 
-    if (_verify_hash)
+    // The data isn't there yet, the SDK computes the checksum as it sends it.
+    if (_checksum_algorithm != Aws::S3::Model::ChecksumAlgorithm::NOT_SET)
     {
-        Aws::Utils::ByteBuffer md5_of_stream(Aws::Utils::HashingUtils::CalculateMD5(*stream));
-        request.SetContentMD5(Aws::Utils::HashingUtils::Base64Encode(md5_of_stream));
-        part_state.set_md5_hash(md5_of_stream);
+        request.SetChecksumAlgorithm(_checksum_algorithm);
     }
 
-    _part_states->start(std::move(part_state));
+    _part_states->start(PartState(part_number, size));
 
-    auto context = std::make_shared<MultipartUploaderContext>(_part_states, _buffer_manager, part_number);
+    _streaming_part = stream;
+    _streaming_part_number = part_number;
 
-    _s3_client->UploadPartAsync(request, _handle_upload_completed, context);
+    _submit_part(std::move(request));
 
     return true;
 }
 
+void MultipartUploader::append_part(GstBuffer* buffer)
+{
+    if (!_streaming_part)
+    {
+        return;
+    }
+
+    gsize size = gst_buffer_get_size(buffer);
+    if (_streaming_part->append(buffer))
+    {
+        gst_s3_upload_stats_add(_stats.get(), GST_S3_UPLOAD_COUNTER_BYTES_ENQUEUED, size);
+    }
+    else
+    {
+        GST_WARNING("Failed to append to streamed part %d", _streaming_part_number);
+    }
+}
+
 bool MultipartUploader::complete()
 {
+    bool requested;
+    {
+        std::lock_guard<std::mutex> lock(_upload_mutex);
+        requested = _upload_state != UploadState::NOT_REQUESTED;
+    }
+    if (!requested)
+    {
+        // Nothing was uploaded, write an empty object. put_object() takes
+        // the lock itself.
+        return put_object(gst_buffer_list_new());
+    }
+
+    _upload_created.wait();
     _part_states->wait_for_complete();
 
     Aws::S3::Model::CompletedMultipartUpload completed_multipart_upload;
@@ -570,6 +2209,10 @@ bool MultipartUploader::complete()
         Aws::S3::Model::CompletedPart completed_part;
         completed_part.SetETag(part.second.get_etag());
         completed_part.SetPartNumber(part.second.get_part_number());
+        if (!part.second.get_checksum().empty())
+        {
+            set_checksum(completed_part, _checksum_algorithm, part.second.get_checksum());
+        }
         completed_multipart_upload.AddParts(completed_part);
     }
 
@@ -579,35 +2222,329 @@ bool MultipartUploader::complete()
     Aws::S3::Model::CompleteMultipartUploadRequest upload_request;
     upload_request.SetBucket(_bucket);
     upload_request.SetKey(_key);
-    upload_request.SetUploadId(_upload_outcome.GetResult().GetUploadId());
+    upload_request.SetUploadId(_upload_id);
 
     upload_request.WithMultipartUpload(completed_multipart_upload);
 
-    return parts_failed_count == 0 && _s3_client->CompleteMultipartUpload(upload_request).IsSuccess();
+    if (parts_failed_count > 0 || _upload_state != UploadState::CREATED)
+    {
+        _abort_upload();
+        return false;
+    }
+
+    auto complete_multipart_upload = [this, &upload_request]() {
+        gst_s3_upload_stats_count_request(_stats.get(), GST_S3_REQUEST_COMPLETE_MULTIPART_UPLOAD);
+        return _s3_client->CompleteMultipartUpload(upload_request);
+    };
+
+    auto start_time = std::chrono::steady_clock::now();
+    auto outcome = complete_multipart_upload();
+    _retry(outcome, complete_multipart_upload, start_time, "CompleteMultipartUpload", true);
+    if (!outcome.IsSuccess())
+    {
+        GST_ERROR("Failed to complete multipart upload: %s", outcome.GetError().GetMessage().c_str());
+        _abort_upload();
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_upload_mutex);
+        _upload_state = UploadState::COMPLETED;
+    }
+    _etag = outcome.GetResult().GetETag();
+
+    if (_journal)
+    {
+        _journal->remove();
+    }
+    return true;
+}
+
+// Aborts the upload if it was created but not completed, unless it's kept
+// for resume.
+void MultipartUploader::_abort_upload()
+{
+    {
+        std::lock_guard<std::mutex> lock(_upload_mutex);
+        if (_upload_state != UploadState::CREATED)
+        {
+            return;
+        }
+        // An upload created ahead of an object that never came holds nothing
+        // worth keeping.
+        if (!_abort_incomplete_upload && _part_counter > 0)
+        {
+            GST_INFO("Keeping incomplete upload %s of %s/%s", _upload_id.c_str(), _bucket.c_str(), _key.c_str());
+            return;
+        }
+        _upload_state = UploadState::ABORTED;
+        _upload_error_code = "Aborted";
+        _upload_error_message = "The multipart upload was aborted";
+    }
+
+    // Nothing to resume anymore.
+    if (_journal)
+    {
+        _journal->discard();
+    }
+
+    _abort_multipart_upload(_bucket, _key, _upload_id);
+}
+
+// Aborts the upload of a journal dropped without resuming it, which would
+// otherwise be left behind in S3.
+void MultipartUploader::_abort_stale_upload()
+{
+    Aws::String upload_id;
+    {
+        std::lock_guard<std::mutex> lock(_upload_mutex);
+        upload_id.swap(_stale_upload_id);
+    }
+    if (upload_id.empty() || !_s3_client)
+    {
+        return;
+    }
+
+    GST_INFO("Aborting dropped upload %s of %s/%s", upload_id.c_str(), _bucket.c_str(), _key.c_str());
+    _abort_multipart_upload(_bucket, _key, upload_id);
+}
+
+// The request runs on the client's executor, so that the teardown of the
+// pipeline only waits for it in the destructor.
+void MultipartUploader::_abort_multipart_upload(const Aws::String& bucket, const Aws::String& key,
+    const Aws::String& upload_id)
+{
+    Aws::S3::Model::AbortMultipartUploadRequest request;
+    request.WithBucket(bucket)
+        .WithKey(key)
+        .WithUploadId(upload_id);
+
+    auto done = std::make_shared<std::promise<void>>();
+    {
+        std::lock_guard<std::mutex> lock(_upload_mutex);
+        _aborts.push_back(done->get_future());
+    }
+
+    gst_s3_upload_stats_count_request(_stats.get(), GST_S3_REQUEST_ABORT_MULTIPART_UPLOAD);
+    _s3_client->AbortMultipartUploadAsync(request, [done](const Aws::S3::S3Client*,
+        const Aws::S3::Model::AbortMultipartUploadRequest& request,
+        const Aws::S3::Model::AbortMultipartUploadOutcome& outcome,
+        const std::shared_ptr<const Aws::Client::AsyncCallerContext>&) {
+        if (outcome.IsSuccess())
+        {
+            GST_INFO("Aborted multipart upload %s", request.GetUploadId().c_str());
+        }
+        else
+        {
+            GST_WARNING("Failed to abort multipart upload %s: %s", request.GetUploadId().c_str(),
+                outcome.GetError().GetMessage().c_str());
+        }
+        done->set_value();
+    });
+}
+
+// Sends the request again after a failure, as long as the error is
+// retryable and RetryPolicy allows it, until it succeeds. The client itself
+// doesn't retry, see _init_uploader(). The requests made on the streaming
+// thread are interruptible: unlock() ends the wait, leaving the last failed
+// outcome.
+template <typename Outcome, typename Send>
+void MultipartUploader::_retry(Outcome& outcome, const Send& send, std::chrono::steady_clock::time_point start_time,
+    const char* request_name, bool interruptible)
+{
+    for (unsigned attempt = 1; !outcome.IsSuccess(); attempt++)
+    {
+        auto delay = _retry_policy.get_delay(attempt);
+        if (!outcome.GetError().ShouldRetry() ||
+            !_retry_policy.can_retry(attempt, std::chrono::steady_clock::now() - start_time, delay))
+        {
+            return;
+        }
+
+        GST_WARNING("%s failed (attempt %u): %s", request_name, attempt, outcome.GetError().GetMessage().c_str());
+        if (!_part_states->wait_for_retry(delay, interruptible))
+        {
+            return;
+        }
+        outcome = send();
+    }
+}
+
+bool MultipartUploader::put_object(GstBufferList* buffers)
+{
+    {
+        // A resumed upload already has parts, add this one to them. An
+        // upload created ahead of time without any part is left to the
+        // destructor to abort.
+        std::unique_lock<std::mutex> lock(_upload_mutex);
+        if (_upload_state != UploadState::NOT_REQUESTED && _part_counter > 0)
+        {
+            lock.unlock();
+            if (gst_buffer_list_calculate_size(buffers) == 0)
+            {
+                gst_buffer_list_unref(buffers);
+                return complete();
+            }
+            return upload(buffers) && complete();
+        }
+    }
+
+    const gchar* checksum = gst_s3_uploader_get_part_checksum(buffers);
+    auto stream = std::make_shared<PartStream>(buffers);
+    if (!stream->is_valid())
+    {
+        return false;
+    }
+
+    _client_ready.wait();
+    if (!_s3_client)
+    {
+        return false;
+    }
+
+    Aws::S3::Model::PutObjectRequest request;
+    request.WithBucket(_bucket)
+        .WithKey(_key)
+        .WithContentType(_content_type)
+        .WithContentLength(stream->size());
+    request.SetBody(stream);
+
+    if (_has_acl)
+    {
+        request.SetACL(_acl);
+    }
+
+    if (_checksum_algorithm != Aws::S3::Model::ChecksumAlgorithm::NOT_SET && checksum)
+    {
+        request.SetChecksumAlgorithm(_checksum_algorithm);
+        set_checksum(request, _checksum_algorithm, checksum);
+    }
+
+    gst_s3_upload_stats_add(_stats.get(), GST_S3_UPLOAD_COUNTER_BYTES_ENQUEUED, stream->size());
+
+    auto start_time = std::chrono::steady_clock::now();
+    for (unsigned attempt = 1; ; attempt++)
+    {
+        gst_s3_upload_stats_count_request(_stats.get(), GST_S3_REQUEST_PUT_OBJECT);
+        auto outcome = _s3_client->PutObject(request);
+        if (outcome.IsSuccess())
+        {
+            gst_s3_upload_stats_add(_stats.get(), GST_S3_UPLOAD_COUNTER_BYTES_ACKNOWLEDGED, stream->size());
+            _etag = outcome.GetResult().GetETag();
+            if (_journal)
+            {
+                _journal->remove();
+            }
+            return true;
+        }
+
+        if (_update_region_from_error(outcome.GetError()))
+        {
+            stream->clear();
+            stream->seekg(0, std::ios_base::beg);
+            continue;
+        }
+
+        auto delay = _retry_policy.get_delay(attempt);
+        if (!outcome.GetError().ShouldRetry() ||
+            !_retry_policy.can_retry(attempt, std::chrono::steady_clock::now() - start_time, delay))
+        {
+            GST_ERROR("Failed to upload object after %u attempt(s): %s", attempt, outcome.GetError().GetMessage().c_str());
+            return false;
+        }
+
+        GST_WARNING("Failed to upload object (attempt %u): %s", attempt, outcome.GetError().GetMessage().c_str());
+        // On the streaming thread: a flush or a state change ends the wait.
+        if (!_part_states->wait_for_retry(delay, true))
+        {
+            GST_ERROR("Gave up uploading the object after %u attempt(s), interrupted", attempt);
+            return false;
+        }
+        stream->clear();
+        stream->seekg(0, std::ios_base::beg);
+    }
 }
 
-void MultipartUploader::_handle_upload_completed(const Aws::S3::S3Client*,
+void MultipartUploader::_handle_upload_completed(const Aws::S3::S3Client* client,
     const Aws::S3::Model::UploadPartRequest& request,
     const Aws::S3::Model::UploadPartOutcome& outcome,
     const std::shared_ptr<const Aws::Client::AsyncCallerContext>& ctx)
 {
     auto context = std::static_pointer_cast<const MultipartUploaderContext>(ctx);
 
-    auto original_stream_buffer = (Aws::Utils::Stream::PreallocatedStreamBuf*)request.GetBody()->rdbuf();
-    context->get_buffer_manager()->Release(original_stream_buffer->GetBuffer());
-    delete original_stream_buffer;
-
     auto states = context->get_part_states();
     int part_number = context->get_part_number();
 
-    if (outcome.IsSuccess() && states->verify_upload_outcome(part_number, outcome))
+    if (states->discard_if_abandoned(part_number))
     {
-        states->mark_part_as_completed(part_number, outcome.GetResult().GetETag());
+        GST_DEBUG("Dropped abandoned part %d", part_number);
+        return;
     }
-    else
+
+    if (outcome.IsSuccess())
     {
-        states->mark_part_as_failed(part_number);
+        // Journaled first, complete() deletes the journal once every part is done.
+        if (auto journal = context->get_journal())
+        {
+            journal->set_part_completed(part_number, outcome.GetResult().GetETag());
+        }
+        states->mark_part_as_completed(part_number, outcome.GetResult().GetETag(),
+            get_checksum(outcome.GetResult(), request.GetChecksumAlgorithm()));
+        return;
+    }
+
+    // A part S3 received corrupted (its checksum doesn't match) is worth
+    // another attempt, as is anything the SDK considers transient (5xx,
+    // throttling, network errors) once its own retries are exhausted. The
+    // part keeps its buffers until then.
+    const auto& retry_policy = context->get_retry_policy();
+    unsigned attempt = context->get_attempt();
+    auto delay = retry_policy.get_delay(attempt);
+    bool retryable = outcome.GetError().ShouldRetry() || outcome.GetError().GetExceptionName() == "BadDigest";
+
+    if (retryable && retry_policy.can_retry(attempt, context->get_elapsed_time(), delay))
+    {
+        GST_WARNING("Upload of part %d failed (attempt %u): %s, retrying in %" G_GINT64_FORMAT " ms",
+            part_number, attempt, outcome.GetError().GetMessage().c_str(),
+            (gint64) std::chrono::duration_cast<std::chrono::milliseconds>(delay).count());
+
+        // The request keeps the body of the part until then.
+        auto retry_request = std::make_shared<Aws::S3::Model::UploadPartRequest>(request);
+        auto error = std::make_shared<Aws::S3::S3Error>(outcome.GetError());
+        bool scheduled = states->schedule_retry(delay, [client, retry_request, error, context, attempt](bool due) {
+            auto states = context->get_part_states();
+            if (!due)
+            {
+                _fail_part(*states, context->get_part_number(), attempt, *error);
+                return;
+            }
+
+            auto body = retry_request->GetBody();
+            body->clear();
+            body->seekg(0, std::ios_base::beg);
+
+            gst_s3_upload_stats_add(states->get_stats().get(), GST_S3_UPLOAD_COUNTER_PARTS_RETRIED, 1);
+            gst_s3_upload_stats_count_request(states->get_stats().get(), GST_S3_REQUEST_UPLOAD_PART);
+            client->UploadPartAsync(*retry_request, _handle_upload_completed, context->next_attempt());
+        });
+        if (scheduled)
+        {
+            return;
+        }
     }
+
+    _fail_part(*states, part_number, attempt, outcome.GetError());
+}
+
+void MultipartUploader::_fail_part(PartStateCollection& states, int part_number, unsigned attempt,
+    const Aws::S3::S3Error& error)
+{
+    Aws::String error_code = get_error_code(error);
+    Aws::String error_message = error.GetMessage();
+
+    GST_ERROR("Upload of part %d failed after %u attempt(s): %s: %s", part_number, attempt,
+        error_code.c_str(), error_message.c_str());
+    states.mark_part_as_failed(part_number, error_code, error_message);
 }
 
 } // namespace s3
@@ -635,11 +2572,11 @@ gst_s3_multipart_uploader_destroy (GstS3Uploader * uploader)
 
 static gboolean
 gst_s3_multipart_uploader_upload_part (GstS3Uploader *
-    uploader, const gchar * buffer, gsize size)
+    uploader, GstBufferList * buffers)
 {
   GstS3MultipartUploader *self = MULTIPART_UPLOADER_ (uploader);
   g_return_val_if_fail (self && self->impl, FALSE);
-  return self->impl->upload (buffer, size);
+  return self->impl->upload (buffers);
 }
 
 static gboolean
@@ -649,10 +2586,125 @@ gst_s3_multipart_uploader_complete (GstS3Uploader * uploader)
   g_return_val_if_fail (self && self->impl, FALSE);
   return self->impl->complete ();
 }
+
+static gboolean
+gst_s3_multipart_uploader_put_object (GstS3Uploader * uploader, GstBufferList * buffers)
+{
+  GstS3MultipartUploader *self = MULTIPART_UPLOADER_ (uploader);
+  g_return_val_if_fail (self && self->impl, FALSE);
+  return self->impl->put_object (buffers);
+}
+
+static gboolean
+gst_s3_multipart_uploader_get_error (GstS3Uploader * uploader, gint * part_number,
+    gchar ** error_code, gchar ** error_message)
+{
+  GstS3MultipartUploader *self = MULTIPART_UPLOADER_ (uploader);
+  g_return_val_if_fail (self && self->impl, FALSE);
+
+  int number;
+  Aws::String code, message;
+  if (!self->impl->get_error (number, code, message))
+    return FALSE;
+
+  if (part_number)
+    *part_number = number;
+  if (error_code)
+    *error_code = g_strdup (code.c_str ());
+  if (error_message)
+    *error_message = g_strdup (message.c_str ());
+  return TRUE;
+}
+
+static gboolean
+gst_s3_multipart_uploader_has_capacity (GstS3Uploader * uploader, gsize size)
+{
+  GstS3MultipartUploader *self = MULTIPART_UPLOADER_ (uploader);
+  g_return_val_if_fail (self && self->impl, FALSE);
+  return self->impl->has_capacity (size);
+}
+
+static gboolean
+gst_s3_multipart_uploader_wait_for_capacity (GstS3Uploader * uploader, gsize size)
+{
+  GstS3MultipartUploader *self = MULTIPART_UPLOADER_ (uploader);
+  g_return_val_if_fail (self && self->impl, FALSE);
+  return self->impl->wait_for_capacity (size);
+}
+
+static void
+gst_s3_multipart_uploader_unlock (GstS3Uploader * uploader)
+{
+  GstS3MultipartUploader *self = MULTIPART_UPLOADER_ (uploader);
+  g_return_if_fail (self && self->impl);
+  self->impl->set_unlocked (true);
+}
+
+static void
+gst_s3_multipart_uploader_unlock_stop (GstS3Uploader * uploader)
+{
+  GstS3MultipartUploader *self = MULTIPART_UPLOADER_ (uploader);
+  g_return_if_fail (self && self->impl);
+  self->impl->set_unlocked (false);
+}
+
+static gboolean
+gst_s3_multipart_uploader_begin_part (GstS3Uploader * uploader, gsize size)
+{
+  GstS3MultipartUploader *self = MULTIPART_UPLOADER_ (uploader);
+  g_return_val_if_fail (self && self->impl, FALSE);
+  return self->impl->begin_part (size);
+}
+
+static void
+gst_s3_multipart_uploader_append_part (GstS3Uploader * uploader, GstBuffer * buffer)
+{
+  GstS3MultipartUploader *self = MULTIPART_UPLOADER_ (uploader);
+  g_return_if_fail (self && self->impl);
+  self->impl->append_part (buffer);
+}
+
+static GstS3Uploader *
+gst_s3_multipart_uploader_create_next (GstS3Uploader * uploader,
+    const GstS3UploaderConfig * config)
+{
+  GstS3MultipartUploader *self = MULTIPART_UPLOADER_ (uploader);
+  g_return_val_if_fail (self && self->impl, NULL);
+
+  auto impl = self->impl->create_next (config);
+
+  if (!impl)
+  {
+    return NULL;
+  }
+
+  return reinterpret_cast < GstS3Uploader * >(new GstS3MultipartUploader (std::move (impl)));
+}
+
+static gchar *
+gst_s3_multipart_uploader_get_etag (GstS3Uploader * uploader)
+{
+  GstS3MultipartUploader *self = MULTIPART_UPLOADER_ (uploader);
+  g_return_val_if_fail (self && self->impl, NULL);
+
+  const Aws::String& etag = self->impl->get_etag ();
+  return etag.empty () ? NULL : g_strdup (etag.c_str ());
+}
+
 static GstS3UploaderClass default_class = {
   gst_s3_multipart_uploader_destroy,
   gst_s3_multipart_uploader_upload_part,
-  gst_s3_multipart_uploader_complete
+  gst_s3_multipart_uploader_complete,
+  gst_s3_multipart_uploader_has_capacity,
+  gst_s3_multipart_uploader_wait_for_capacity,
+  gst_s3_multipart_uploader_unlock,
+  gst_s3_multipart_uploader_unlock_stop,
+  gst_s3_multipart_uploader_get_error,
+  gst_s3_multipart_uploader_put_object,
+  gst_s3_multipart_uploader_begin_part,
+  gst_s3_multipart_uploader_append_part,
+  gst_s3_multipart_uploader_create_next,
+  gst_s3_multipart_uploader_get_etag
 };
 
 GstS3Uploader *
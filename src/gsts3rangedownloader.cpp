@@ -0,0 +1,1144 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "gsts3rangedownloader.h"
+#include "gsts3client.hpp"
+
+#include <aws/s3/model/GetObjectRequest.h>
+#include <aws/s3/model/HeadObjectRequest.h>
+#include <aws/s3/S3Client.h>
+#include <aws/s3/S3ClientConfiguration.h>
+
+#include <gst/gst.h>
+#include <glib/gstdio.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <vector>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define GST_CAT_DEFAULT gst_s3_src_debug
+
+namespace gst
+{
+namespace aws
+{
+namespace s3
+{
+static bool is_null_or_empty(const char* str)
+{
+    return str == nullptr || strcmp(str, "") == 0;
+}
+
+static const Aws::String get_bucket_from_config(const GstS3DownloaderConfig * config)
+{
+    if (is_null_or_empty(config->location)) {
+        return config->bucket;
+    } else {
+        GstUri *uri = gst_uri_from_string(config->location);
+        Aws::String bucket(gst_uri_get_host(uri));
+        gst_uri_unref(uri);
+        return bucket;
+    }
+}
+
+static const Aws::String get_key_from_config(const GstS3DownloaderConfig * config)
+{
+    if (is_null_or_empty(config->location)) {
+        return config->key;
+    } else {
+        GstUri *uri = gst_uri_from_string(config->location);
+        Aws::String path(gst_uri_get_path(uri));
+        gst_uri_unref(uri);
+
+        if (path[0] == '/') {
+            return path.substr(1);
+        } else {
+            return path;
+        }
+    }
+}
+
+// A block of the object, the unit of the cache. Only the last one of the
+// object may be shorter than the block size.
+struct Block
+{
+    Block(guint64 index, guint64 offset, size_t size) :
+        index(index),
+        offset(offset),
+        size(size)
+    {
+    }
+
+    ~Block()
+    {
+        if (buffer)
+        {
+            gst_buffer_unref(buffer);
+        }
+    }
+
+    const guint64 index;
+    const guint64 offset;
+    const size_t size;
+    // Set once done, unless failed.
+    GstBuffer* buffer = nullptr;
+    std::list<guint64>::iterator lru;
+
+    bool done = false;
+    bool failed = false;
+    Aws::String error_code;
+    Aws::String error_message;
+};
+
+// Writes the response body across the memories of the blocks of a range,
+// one after the other.
+class BlockStreamBuf : public std::streambuf
+{
+public:
+    explicit BlockStreamBuf(const std::vector<GstMapInfo>& maps) :
+        _maps(maps)
+    {
+        _next();
+    }
+
+protected:
+    int_type overflow(int_type ch) override
+    {
+        if (traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+            return traits_type::not_eof(ch);
+        }
+        if (pptr() == epptr() && !_next())
+        {
+            return traits_type::eof();
+        }
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+        return ch;
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override
+    {
+        std::streamsize written = 0;
+        while (written < n)
+        {
+            if (pptr() == epptr() && !_next())
+            {
+                break;
+            }
+            std::streamsize count = std::min<std::streamsize>({n - written, static_cast<std::streamsize>(epptr() - pptr()), G_MAXINT});
+            memcpy(pptr(), s + written, count);
+            pbump(static_cast<int>(count));
+            written += count;
+        }
+        return written;
+    }
+
+private:
+    bool _next()
+    {
+        if (_index == _maps.size())
+        {
+            return false;
+        }
+        char* data = reinterpret_cast<char*>(_maps[_index].data);
+        setp(data, data + _maps[_index].size);
+        _index++;
+        return true;
+    }
+
+    const std::vector<GstMapInfo>& _maps;
+    size_t _index = 0;
+};
+
+// A ranged GET of consecutive blocks. The response body is written straight
+// into the buffers of the blocks, each with memory of its own, so that a
+// block kept in the cache doesn't keep the rest of its range around.
+struct Fetch
+{
+    Fetch(guint64 offset, size_t size, std::vector<std::shared_ptr<Block>> blocks) :
+        offset(offset),
+        size(size),
+        blocks(std::move(blocks))
+    {
+        for (const auto& block : this->blocks)
+        {
+            GstBuffer* buffer = gst_buffer_new_allocate(nullptr, block->size, nullptr);
+            GstMapInfo map;
+            if (!gst_buffer_map(buffer, &map, GST_MAP_WRITE))
+            {
+                gst_buffer_unref(buffer);
+                break;
+            }
+            buffers.push_back(buffer);
+            maps.push_back(map);
+        }
+        mapped = maps.size() == this->blocks.size();
+    }
+
+    ~Fetch()
+    {
+        unmap();
+        for (GstBuffer* buffer : buffers)
+        {
+            gst_buffer_unref(buffer);
+        }
+    }
+
+    void unmap()
+    {
+        for (size_t i = 0; i < maps.size(); i++)
+        {
+            gst_buffer_unmap(buffers[i], &maps[i]);
+        }
+        maps.clear();
+    }
+
+    // Hands the buffers over to their blocks.
+    void release_buffers()
+    {
+        unmap();
+        for (size_t i = 0; i < buffers.size(); i++)
+        {
+            blocks[i]->buffer = buffers[i];
+        }
+        buffers.clear();
+    }
+
+    const guint64 offset;
+    const size_t size;
+    const std::vector<std::shared_ptr<Block>> blocks;
+    // One per block, mapped until the range is done.
+    std::vector<GstBuffer*> buffers;
+    std::vector<GstMapInfo> maps;
+    bool mapped = false;
+    std::unique_ptr<BlockStreamBuf> streambuf;
+    // Kept until the range is done, the client released before the SDK.
+    std::shared_ptr<AwsApiHandle> api_handle;
+    std::shared_ptr<Aws::S3::S3Client> client;
+};
+
+// The second tier of the block cache: the blocks evicted from memory are
+// written to a sparse file, at their offset in the object. The file is
+// unlinked as soon as it's created, so nothing is left behind. It's only
+// used by the streaming thread, with the blocks in memory unlocked, so that
+// the ranges completing never wait for the disk.
+class DiskBlockCache
+{
+public:
+    static std::unique_ptr<DiskBlockCache> create(const char* directory, guint64 max_size, size_t block_size)
+    {
+        gchar* path = g_build_filename(directory, "gst-s3src-XXXXXX", nullptr);
+        int fd = g_mkstemp_full(path, O_RDWR | O_BINARY, 0600);
+        if (fd < 0)
+        {
+            GST_WARNING("Failed to create the disk cache in %s: %s", directory, g_strerror(errno));
+            g_free(path);
+            return nullptr;
+        }
+        g_unlink(path);
+        g_free(path);
+
+        return std::unique_ptr<DiskBlockCache>(new DiskBlockCache(fd, max_size, block_size));
+    }
+
+    ~DiskBlockCache()
+    {
+        g_close(_fd, nullptr);
+    }
+
+    bool contains(guint64 index) const
+    {
+        return _blocks.count(index) > 0;
+    }
+
+    void store(guint64 index, GstBuffer* buffer)
+    {
+        if (contains(index))
+        {
+            return;
+        }
+
+        GstMapInfo map;
+        if (!gst_buffer_map(buffer, &map, GST_MAP_READ))
+        {
+            return;
+        }
+        bool written = _write_all(map.data, map.size, index * _block_size);
+        gsize size = map.size;
+        gst_buffer_unmap(buffer, &map);
+        if (!written)
+        {
+            GST_WARNING("Failed to write block %" G_GUINT64_FORMAT " to the disk cache: %s", index, g_strerror(errno));
+            return;
+        }
+
+        _lru.push_front(index);
+        _blocks[index] = std::make_pair(size, _lru.begin());
+        _size += size;
+
+        while (_size > _max_size && !_lru.empty())
+        {
+            _remove(_lru.back());
+        }
+    }
+
+    // Returns null when the block isn't there.
+    GstBuffer* load(guint64 index)
+    {
+        auto it = _blocks.find(index);
+        if (it == _blocks.end())
+        {
+            return nullptr;
+        }
+
+        GstBuffer* buffer = gst_buffer_new_allocate(nullptr, it->second.first, nullptr);
+        GstMapInfo map;
+        gst_buffer_map(buffer, &map, GST_MAP_WRITE);
+        bool read = _read_all(map.data, map.size, index * _block_size);
+        gst_buffer_unmap(buffer, &map);
+        if (!read)
+        {
+            GST_WARNING("Failed to read block %" G_GUINT64_FORMAT " from the disk cache: %s", index, g_strerror(errno));
+            gst_buffer_unref(buffer);
+            _remove(index);
+            return nullptr;
+        }
+
+        _lru.splice(_lru.begin(), _lru, it->second.second);
+        return buffer;
+    }
+
+private:
+    DiskBlockCache(int fd, guint64 max_size, size_t block_size) :
+        _fd(fd),
+        _max_size(max_size),
+        _block_size(block_size)
+    {
+    }
+
+    bool _write_all(const guint8* data, size_t size, guint64 offset)
+    {
+        while (size > 0)
+        {
+            ssize_t written = pwrite(_fd, data, size, offset);
+            if (written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (written <= 0)
+            {
+                return false;
+            }
+            data += written;
+            size -= written;
+            offset += written;
+        }
+        return true;
+    }
+
+    bool _read_all(guint8* data, size_t size, guint64 offset)
+    {
+        while (size > 0)
+        {
+            ssize_t read = pread(_fd, data, size, offset);
+            if (read < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (read <= 0)
+            {
+                return false;
+            }
+            data += read;
+            size -= read;
+            offset += read;
+        }
+        return true;
+    }
+
+    void _remove(guint64 index)
+    {
+        auto it = _blocks.find(index);
+#ifdef FALLOC_FL_PUNCH_HOLE
+        // Give the space back, the file is sparse.
+        fallocate(_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, index * _block_size, it->second.first);
+#endif
+        _size -= it->second.first;
+        _lru.erase(it->second.second);
+        _blocks.erase(it);
+    }
+
+    const int _fd;
+    const guint64 _max_size;
+    const size_t _block_size;
+    guint64 _size = 0;
+    // Most recently used first.
+    std::list<guint64> _lru;
+    std::map<guint64, std::pair<size_t, std::list<guint64>::iterator>> _blocks;
+};
+
+// The blocks of an object in memory, and what the callbacks of the ranges
+// use. The ranges can't be cancelled: rather than the downloader waiting for
+// them when it's destroyed, each one keeps this alive until it's done.
+class BlockCache
+{
+public:
+    // The blocks evicted are kept for the disk cache when keep_evicted is
+    // set, until they're taken.
+    BlockCache(guint64 max_size, bool keep_evicted) :
+        _max_size(max_size),
+        _keep_evicted(keep_evicted)
+    {
+    }
+
+    // Guards the blocks, and is held by the downloader while it uses them.
+    std::mutex mutex;
+    // Notified when blocks are done.
+    std::condition_variable cv;
+
+    // Called with mutex held.
+    // Returns null when the block isn't in memory.
+    std::shared_ptr<Block> get(guint64 index);
+    bool contains(guint64 index) const;
+    void insert(const std::shared_ptr<Block>& block);
+    void evict();
+    std::vector<std::shared_ptr<Block>> take_evicted();
+    void fetch_done(const std::shared_ptr<Fetch>& fetch, const Aws::String& error_code,
+        const Aws::String& error_message);
+
+    void on_fetched(const std::shared_ptr<Fetch>& fetch, const Aws::S3::Model::GetObjectOutcome& outcome);
+
+private:
+    void _remove(const std::shared_ptr<Block>& block);
+
+    const guint64 _max_size;
+    const bool _keep_evicted;
+    std::map<guint64, std::shared_ptr<Block>> _blocks;
+    // Most recently used first.
+    std::list<guint64> _lru;
+    guint64 _size = 0;
+    // Evicted, but not taken for the disk cache yet.
+    std::map<guint64, std::shared_ptr<Block>> _evicted;
+};
+
+std::shared_ptr<Block> BlockCache::get(guint64 index)
+{
+    auto it = _blocks.find(index);
+    if (it != _blocks.end())
+    {
+        _lru.splice(_lru.begin(), _lru, it->second->lru);
+        return it->second;
+    }
+
+    auto evicted = _evicted.find(index);
+    if (evicted != _evicted.end())
+    {
+        // Not written to disk yet, it goes back to memory.
+        std::shared_ptr<Block> block = evicted->second;
+        _evicted.erase(evicted);
+        insert(block);
+        evict();
+        return block;
+    }
+
+    return nullptr;
+}
+
+bool BlockCache::contains(guint64 index) const
+{
+    return _blocks.count(index) > 0 || _evicted.count(index) > 0;
+}
+
+void BlockCache::insert(const std::shared_ptr<Block>& block)
+{
+    _lru.push_front(block->index);
+    block->lru = _lru.begin();
+    _blocks[block->index] = block;
+    _size += block->size;
+}
+
+void BlockCache::_remove(const std::shared_ptr<Block>& block)
+{
+    auto it = _blocks.find(block->index);
+    if (it == _blocks.end() || it->second != block)
+    {
+        return;
+    }
+    _lru.erase(block->lru);
+    _size -= block->size;
+    _blocks.erase(it);
+}
+
+void BlockCache::evict()
+{
+    // The blocks still being fetched stay, they're about to be read.
+    auto it = _lru.end();
+    while (_size > _max_size && it != _lru.begin())
+    {
+        --it;
+        std::shared_ptr<Block> block = _blocks[*it];
+        if (!block->done)
+        {
+            continue;
+        }
+
+        GST_LOG("Evicting block %" G_GUINT64_FORMAT, block->index);
+        if (_keep_evicted)
+        {
+            _evicted[block->index] = block;
+        }
+        it = _lru.erase(it);
+        _size -= block->size;
+        _blocks.erase(block->index);
+    }
+}
+
+std::vector<std::shared_ptr<Block>> BlockCache::take_evicted()
+{
+    std::vector<std::shared_ptr<Block>> blocks;
+    for (const auto& evicted : _evicted)
+    {
+        blocks.push_back(evicted.second);
+    }
+    _evicted.clear();
+    return blocks;
+}
+
+void BlockCache::fetch_done(const std::shared_ptr<Fetch>& fetch, const Aws::String& error_code,
+    const Aws::String& error_message)
+{
+    if (error_code.empty())
+    {
+        fetch->release_buffers();
+    }
+    else
+    {
+        fetch->unmap();
+    }
+
+    for (const auto& block : fetch->blocks)
+    {
+        if (!error_code.empty())
+        {
+            // Fetched again if asked again.
+            block->failed = true;
+            block->error_code = error_code;
+            block->error_message = error_message;
+            _remove(block);
+        }
+        block->done = true;
+    }
+    evict();
+    cv.notify_all();
+}
+
+void BlockCache::on_fetched(const std::shared_ptr<Fetch>& fetch,
+    const Aws::S3::Model::GetObjectOutcome& outcome)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!outcome.IsSuccess())
+    {
+        Aws::String error_code = get_error_code(outcome.GetError());
+        GST_WARNING("Failed to get %" G_GSIZE_FORMAT " bytes at %" G_GUINT64_FORMAT ": %s: %s",
+            fetch->size, fetch->offset, error_code.c_str(), outcome.GetError().GetMessage().c_str());
+        fetch_done(fetch, error_code, outcome.GetError().GetMessage());
+    }
+    else if (outcome.GetResult().GetContentLength() != static_cast<long long>(fetch->size))
+    {
+        Aws::StringStream ss;
+        ss << "Got " << outcome.GetResult().GetContentLength() << " bytes instead of " << fetch->size;
+        GST_WARNING("Failed to get %" G_GSIZE_FORMAT " bytes at %" G_GUINT64_FORMAT ": %s",
+            fetch->size, fetch->offset, ss.str().c_str());
+        fetch_done(fetch, "ShortRead", ss.str());
+    }
+    else
+    {
+        fetch_done(fetch, Aws::String(), Aws::String());
+    }
+}
+
+// Reads an object through a cache of fixed-size blocks, least recently used
+// first out. Missing blocks are fetched with ranged GETs, consecutive ones
+// together in a single request of up to chunk_size bytes. While the object
+// is read sequentially, read_ahead chunks past the read position are
+// fetched at the same time, so that a single stream isn't limited to the
+// throughput of a single connection.
+class RangeDownloader
+{
+public:
+    static std::unique_ptr<RangeDownloader> create(const GstS3DownloaderConfig* config);
+
+    bool get_size(guint64& size);
+
+    GstBuffer* read(guint64 offset, size_t size);
+
+    void unlock();
+
+    void unlock_stop();
+
+    bool get_error(Aws::String& code, Aws::String& message);
+
+private:
+    explicit RangeDownloader(const GstS3DownloaderConfig* config);
+
+    bool _init_downloader(const GstS3DownloaderConfig* config);
+    void _lookup_region(const Aws::Client::ClientConfiguration& lookup_config);
+    template <typename Error>
+    bool _update_region_from_error(const Error& error);
+    bool _create_client();
+
+    // Called with the mutex of the cache held, which _get_block() and
+    // _store_evicted() release while they use the disk.
+    std::shared_ptr<Block> _get_block(std::unique_lock<std::mutex>& lock, guint64 index, guint64 last_index);
+    void _read_ahead_from(guint64 index);
+    bool _has_block(guint64 index) const;
+    std::shared_ptr<Block> _fetch_run(guint64 first_index, guint64 last_index);
+    void _store_evicted(std::unique_lock<std::mutex>& lock);
+
+    const Aws::String _bucket;
+    const Aws::String _key;
+    std::shared_ptr<AwsApiHandle> _api_handle;
+    std::chrono::nanoseconds _region_cache_ttl;
+    std::string _region_cache_file;
+    std::shared_ptr<GstAWSCredentials> _credentials;
+    Aws::S3::S3ClientConfiguration _client_config;
+    std::shared_ptr<Aws::S3::S3Client> _s3_client;
+
+    const size_t _block_size;
+    // In blocks.
+    const guint64 _chunk_blocks;
+    const guint64 _read_ahead_blocks;
+
+    bool _size_known = false;
+    guint64 _size = 0;
+    guint64 _block_count = 0;
+    // Every range is read from the version of the object the size is from.
+    Aws::String _etag;
+
+    std::shared_ptr<BlockCache> _cache;
+    std::unique_ptr<DiskBlockCache> _disk_cache;
+
+    // Guarded by the mutex of the cache.
+    // Where the last read ended, to tell sequential reads.
+    guint64 _read_position = 0;
+    bool _unlocked = false;
+    bool _failed = false;
+    Aws::String _error_code;
+    Aws::String _error_message;
+};
+
+RangeDownloader::RangeDownloader(const GstS3DownloaderConfig* config) :
+    _bucket(get_bucket_from_config(config)),
+    _key(get_key_from_config(config)),
+    _api_handle(config->init_aws_sdk ? AwsApiHandle::GetHandle() : nullptr),
+    _region_cache_ttl(std::min<guint64>(config->bucket_region_cache_ttl, G_MAXINT64)),
+    _region_cache_file(is_null_or_empty(config->bucket_region_cache_file) ? "" : config->bucket_region_cache_file),
+    _block_size(std::max<gsize>(config->block_size, 1)),
+    _chunk_blocks(std::max<guint64>(config->chunk_size / _block_size, 1)),
+    _read_ahead_blocks(_chunk_blocks * config->read_ahead)
+{
+    if (!is_null_or_empty(config->disk_cache_directory) && config->disk_cache_size > 0)
+    {
+        _disk_cache = DiskBlockCache::create(config->disk_cache_directory, config->disk_cache_size, _block_size);
+    }
+
+    // The blocks being read ahead must fit, or they'd be evicted before
+    // they're read.
+    guint64 cache_size = std::max<guint64>(config->cache_size, (_read_ahead_blocks + 2 * _chunk_blocks) * _block_size);
+    _cache = std::make_shared<BlockCache>(cache_size, _disk_cache != nullptr);
+}
+
+std::unique_ptr<RangeDownloader> RangeDownloader::create(const GstS3DownloaderConfig* config)
+{
+    std::unique_ptr<RangeDownloader> downloader(new RangeDownloader(config));
+    if (!downloader->_init_downloader(config))
+    {
+        return nullptr;
+    }
+    return downloader;
+}
+
+bool RangeDownloader::_init_downloader(const GstS3DownloaderConfig* config)
+{
+    if (!is_null_or_empty(config->ca_file))
+    {
+        _client_config.caFile = config->ca_file;
+    }
+
+    // The region lookup only needs the CA file, copy it before anything else is set.
+    Aws::Client::ClientConfiguration lookup_config(_client_config);
+    bool lookup_region = is_null_or_empty(config->region);
+    if (!lookup_region)
+    {
+        _client_config.region = config->region;
+    }
+    else if (_region_cache_ttl.count() > 0)
+    {
+        Aws::String region;
+        if (BucketRegionCache::get_instance().lookup(_bucket, _region_cache_file, region))
+        {
+            GST_DEBUG("Using cached region %s of bucket %s", region.c_str(), _bucket.c_str());
+            _client_config.region = std::move(region);
+            lookup_region = false;
+        }
+    }
+
+    _credentials = std::shared_ptr<GstAWSCredentials>(gst_aws_credentials_copy(config->credentials),
+        gst_aws_credentials_free);
+
+    if (!is_null_or_empty(config->aws_sdk_endpoint))
+    {
+        _client_config.endpointOverride = Aws::String(config->aws_sdk_endpoint);
+    }
+    if (config->aws_sdk_use_http)
+    {
+        _client_config.scheme = Aws::Http::Scheme::HTTP;
+    }
+    _client_config.verifySSL = config->aws_sdk_verify_ssl;
+    _client_config.maxConnections = std::max<guint>(config->max_connections, 1);
+
+    // The object can't be read before its size is known, so there's nothing
+    // to overlap the lookup with.
+    if (lookup_region)
+    {
+        _lookup_region(lookup_config);
+    }
+
+    return _create_client();
+}
+
+void RangeDownloader::_lookup_region(const Aws::Client::ClientConfiguration& lookup_config)
+{
+    Aws::String region;
+    if (!get_bucket_location(_bucket.c_str(), lookup_config, region))
+    {
+        // The HEAD request will be redirected to the right region, see _update_region_from_error().
+        GST_WARNING("Failed to get the region of bucket %s", _bucket.c_str());
+        return;
+    }
+
+    if (region.empty())
+    {
+        region = "us-east-1";
+    }
+
+    _client_config.region = region;
+    if (_region_cache_ttl.count() > 0)
+    {
+        BucketRegionCache::get_instance().store(_bucket, region, _region_cache_ttl, _region_cache_file);
+    }
+}
+
+template <typename Error>
+bool RangeDownloader::_update_region_from_error(const Error& error)
+{
+    Aws::String region;
+    if (!get_redirect_region(error, _client_config.region, region))
+    {
+        return false;
+    }
+
+    GST_INFO("Bucket %s is in region %s, not %s", _bucket.c_str(), region.c_str(),
+        _client_config.region.c_str());
+
+    _client_config.region = region;
+    if (_region_cache_ttl.count() > 0)
+    {
+        BucketRegionCache::get_instance().store(_bucket, region, _region_cache_ttl, _region_cache_file);
+    }
+    return _create_client();
+}
+
+bool RangeDownloader::_create_client()
+{
+    // The same client as the other sources with the same settings, and with
+    // it the same connections. Unlike the sinks, the source leaves the
+    // retries to the SDK. The source has no thread settings of its own:
+    // it runs on the default upload threads, GST_S3_UPLOAD_THREADS included.
+    _s3_client = get_s3_client(_client_config, get_upload_threads(0), std::vector<int>(), 0, _credentials.get());
+    if (!_s3_client)
+    {
+        GST_ERROR("Failed to create the S3 client");
+        return false;
+    }
+    return true;
+}
+
+bool RangeDownloader::get_size(guint64& size)
+{
+    if (!_size_known)
+    {
+        Aws::S3::Model::HeadObjectRequest request;
+        request.SetBucket(_bucket);
+        request.SetKey(_key);
+
+        auto outcome = _s3_client->HeadObject(request);
+        if (!outcome.IsSuccess() && _update_region_from_error(outcome.GetError()))
+        {
+            outcome = _s3_client->HeadObject(request);
+        }
+
+        if (!outcome.IsSuccess())
+        {
+            std::lock_guard<std::mutex> lock(_cache->mutex);
+            _failed = true;
+            _error_code = get_error_code(outcome.GetError());
+            _error_message = outcome.GetError().GetMessage();
+            GST_ERROR("Failed to get the size of s3://%s/%s: %s: %s", _bucket.c_str(), _key.c_str(),
+                _error_code.c_str(), _error_message.c_str());
+            return false;
+        }
+
+        _size = outcome.GetResult().GetContentLength();
+        _block_count = (_size + _block_size - 1) / _block_size;
+        _etag = outcome.GetResult().GetETag();
+        _size_known = true;
+        GST_DEBUG("s3://%s/%s is %" G_GUINT64_FORMAT " bytes", _bucket.c_str(), _key.c_str(), _size);
+    }
+
+    size = _size;
+    return true;
+}
+
+GstBuffer* RangeDownloader::read(guint64 offset, size_t size)
+{
+    guint64 object_size;
+    if (!get_size(object_size))
+    {
+        return nullptr;
+    }
+    if (offset >= object_size || size == 0)
+    {
+        return gst_buffer_new();
+    }
+
+    std::unique_lock<std::mutex> lock(_cache->mutex);
+
+    guint64 index = offset / _block_size;
+    // The blocks missing in the requested range come in one request.
+    guint64 last_index = (std::min<guint64>(offset + size, _size) - 1) / _block_size;
+    std::shared_ptr<Block> block = _get_block(lock, index, std::min(last_index, index + _chunk_blocks - 1));
+
+    // A seeking demuxer jumps around the object, only read ahead when it
+    // reads on from where it stopped.
+    if (offset == _read_position)
+    {
+        _read_ahead_from(index);
+    }
+
+    _cache->cv.wait(lock, [this, &block] { return block->done || _unlocked; });
+    if (!block->done)
+    {
+        return nullptr;
+    }
+
+    if (block->failed)
+    {
+        _failed = true;
+        _error_code = block->error_code;
+        _error_message = block->error_message;
+        return nullptr;
+    }
+
+    size_t skip = offset - block->offset;
+    size_t length = std::min(size, block->size - skip);
+    _read_position = offset + length;
+    GstBuffer* buffer = gst_buffer_copy_region(block->buffer, GST_BUFFER_COPY_MEMORY, skip, length);
+
+    _store_evicted(lock);
+    return buffer;
+}
+
+std::shared_ptr<Block> RangeDownloader::_get_block(std::unique_lock<std::mutex>& lock, guint64 index,
+    guint64 last_index)
+{
+    if (std::shared_ptr<Block> block = _cache->get(index))
+    {
+        return block;
+    }
+
+    if (_disk_cache && _disk_cache->contains(index))
+    {
+        // Only this thread adds blocks, it's still missing afterwards.
+        lock.unlock();
+        GstBuffer* buffer = _disk_cache->load(index);
+        lock.lock();
+
+        if (buffer)
+        {
+            GST_LOG("Block %" G_GUINT64_FORMAT " read from the disk cache", index);
+            auto block = std::make_shared<Block>(index, index * _block_size, gst_buffer_get_size(buffer));
+            block->buffer = buffer;
+            block->done = true;
+            _cache->insert(block);
+            _cache->evict();
+            return block;
+        }
+    }
+
+    return _fetch_run(index, last_index);
+}
+
+void RangeDownloader::_read_ahead_from(guint64 index)
+{
+    guint64 last_index = std::min(index + _read_ahead_blocks, _block_count - 1);
+    for (guint64 i = index + 1; i <= last_index; i++)
+    {
+        if (!_has_block(i))
+        {
+            _fetch_run(i, std::min(last_index, i + _chunk_blocks - 1));
+        }
+    }
+}
+
+bool RangeDownloader::_has_block(guint64 index) const
+{
+    return _cache->contains(index) || (_disk_cache && _disk_cache->contains(index));
+}
+
+std::shared_ptr<Block> RangeDownloader::_fetch_run(guint64 first_index, guint64 last_index)
+{
+    guint64 count = 1;
+    while (first_index + count <= last_index && !_has_block(first_index + count))
+    {
+        count++;
+    }
+
+    guint64 offset = first_index * _block_size;
+    size_t size = std::min<guint64>(count * _block_size, _size - offset);
+    std::vector<std::shared_ptr<Block>> blocks;
+    for (guint64 i = 0; i < count; i++)
+    {
+        guint64 block_offset = offset + i * _block_size;
+        auto block = std::make_shared<Block>(first_index + i, block_offset,
+            std::min<guint64>(_block_size, _size - block_offset));
+        _cache->insert(block);
+        blocks.push_back(block);
+    }
+    auto fetch = std::make_shared<Fetch>(offset, size, std::move(blocks));
+
+    if (!fetch->mapped)
+    {
+        _cache->fetch_done(fetch, "MapFailed", "Failed to map the buffers of the range");
+        return fetch->blocks.front();
+    }
+
+    Aws::S3::Model::GetObjectRequest request;
+    request.SetBucket(_bucket);
+    request.SetKey(_key);
+
+    Aws::StringStream range;
+    range << "bytes=" << offset << "-" << offset + size - 1;
+    request.SetRange(range.str());
+    // Fail rather than mix the ranges of two versions of the object.
+    if (!_etag.empty())
+    {
+        request.SetIfMatch(_etag);
+    }
+
+    // Called again on every attempt, the data is written from the start.
+    request.SetResponseStreamFactory([fetch]() {
+        fetch->streambuf.reset(new BlockStreamBuf(fetch->maps));
+        return Aws::New<Aws::IOStream>(CLIENT_ALLOCATION_TAG, fetch->streambuf.get());
+    });
+
+    GST_LOG("Fetching %s (%" G_GUINT64_FORMAT " block(s))", range.str().c_str(), count);
+    fetch->api_handle = _api_handle;
+    fetch->client = _s3_client;
+    std::shared_ptr<BlockCache> cache = _cache;
+    _s3_client->GetObjectAsync(request,
+        [cache, fetch](const Aws::S3::S3Client*, const Aws::S3::Model::GetObjectRequest&,
+            const Aws::S3::Model::GetObjectOutcome& outcome,
+            const std::shared_ptr<const Aws::Client::AsyncCallerContext>&) {
+            cache->on_fetched(fetch, outcome);
+        });
+
+    return fetch->blocks.front();
+}
+
+void RangeDownloader::_store_evicted(std::unique_lock<std::mutex>& lock)
+{
+    if (!_disk_cache)
+    {
+        return;
+    }
+
+    std::vector<std::shared_ptr<Block>> blocks = _cache->take_evicted();
+    if (blocks.empty())
+    {
+        return;
+    }
+
+    lock.unlock();
+    for (const auto& block : blocks)
+    {
+        _disk_cache->store(block->index, block->buffer);
+    }
+    lock.lock();
+}
+
+void RangeDownloader::unlock()
+{
+    std::lock_guard<std::mutex> lock(_cache->mutex);
+    _unlocked = true;
+    _cache->cv.notify_all();
+}
+
+void RangeDownloader::unlock_stop()
+{
+    std::lock_guard<std::mutex> lock(_cache->mutex);
+    _unlocked = false;
+}
+
+bool RangeDownloader::get_error(Aws::String& code, Aws::String& message)
+{
+    std::lock_guard<std::mutex> lock(_cache->mutex);
+    if (!_failed)
+    {
+        return false;
+    }
+    code = _error_code;
+    message = _error_message;
+    return true;
+}
+
+} // namespace s3
+} // namespace aws
+} // namespace gst
+
+#define RANGE_DOWNLOADER_(downloader) reinterpret_cast<GstS3RangeDownloader*>(downloader)
+
+using gst::aws::s3::RangeDownloader;
+
+struct _GstS3RangeDownloader
+{
+  GstS3Downloader base;
+  std::unique_ptr<RangeDownloader> impl;
+
+  _GstS3RangeDownloader(std::unique_ptr<RangeDownloader> impl);
+};
+
+static void
+gst_s3_range_downloader_destroy (GstS3Downloader * downloader)
+{
+  delete
+  RANGE_DOWNLOADER_ (downloader);
+}
+
+static gboolean
+gst_s3_range_downloader_get_size (GstS3Downloader * downloader, guint64 * size)
+{
+  GstS3RangeDownloader *self = RANGE_DOWNLOADER_ (downloader);
+  g_return_val_if_fail (self && self->impl && size, FALSE);
+
+  guint64 object_size;
+  if (!self->impl->get_size (object_size))
+    return FALSE;
+
+  *size = object_size;
+  return TRUE;
+}
+
+static GstBuffer *
+gst_s3_range_downloader_read (GstS3Downloader * downloader, guint64 offset, gsize size)
+{
+  GstS3RangeDownloader *self = RANGE_DOWNLOADER_ (downloader);
+  g_return_val_if_fail (self && self->impl, NULL);
+  return self->impl->read (offset, size);
+}
+
+static void
+gst_s3_range_downloader_unlock (GstS3Downloader * downloader)
+{
+  GstS3RangeDownloader *self = RANGE_DOWNLOADER_ (downloader);
+  g_return_if_fail (self && self->impl);
+  self->impl->unlock ();
+}
+
+static void
+gst_s3_range_downloader_unlock_stop (GstS3Downloader * downloader)
+{
+  GstS3RangeDownloader *self = RANGE_DOWNLOADER_ (downloader);
+  g_return_if_fail (self && self->impl);
+  self->impl->unlock_stop ();
+}
+
+static gboolean
+gst_s3_range_downloader_get_error (GstS3Downloader * downloader,
+    gchar ** error_code, gchar ** error_message)
+{
+  GstS3RangeDownloader *self = RANGE_DOWNLOADER_ (downloader);
+  g_return_val_if_fail (self && self->impl, FALSE);
+
+  Aws::String code, message;
+  if (!self->impl->get_error (code, message))
+    return FALSE;
+
+  if (error_code)
+    *error_code = g_strdup (code.c_str ());
+  if (error_message)
+    *error_message = g_strdup (message.c_str ());
+  return TRUE;
+}
+
+static GstS3DownloaderClass default_class = {
+  gst_s3_range_downloader_destroy,
+  gst_s3_range_downloader_get_size,
+  gst_s3_range_downloader_read,
+  gst_s3_range_downloader_unlock,
+  gst_s3_range_downloader_unlock_stop,
+  gst_s3_range_downloader_get_error
+};
+
+GstS3Downloader *
+gst_s3_range_downloader_new (const GstS3DownloaderConfig * config)
+{
+  g_return_val_if_fail (config, NULL);
+
+  auto impl = RangeDownloader::create(config);
+
+  if (!impl)
+  {
+    return NULL;
+  }
+
+  return reinterpret_cast < GstS3Downloader * >(new GstS3RangeDownloader (std::move (impl)));
+}
+
+_GstS3RangeDownloader::_GstS3RangeDownloader(std::unique_ptr<RangeDownloader> impl) :
+    impl(std::move(impl))
+{
+  base.klass = &default_class;
+}
@@ -39,6 +39,7 @@
 #include <gst/gsturi.h>
 
 #include "gsts3sink.h"
+#include "gsts3metrics.h"
 #include "gsts3multipartuploader.h"
 
 static GstStaticPadTemplate sinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
@@ -52,9 +53,96 @@ GST_DEBUG_CATEGORY (gst_s3_sink_debug);
 #define MIN_BUFFER_SIZE 5 * 1024 * 1024
 #define DEFAULT_BUFFER_SIZE GST_S3_UPLOADER_CONFIG_DEFAULT_BUFFER_SIZE
 #define DEFAULT_BUFFER_COUNT GST_S3_UPLOADER_CONFIG_DEFAULT_BUFFER_COUNT
+#define DEFAULT_STATS_INTERVAL 0
 
 #define REQUIRED_BUT_UNUSED(x) (void)(x)
 
+#define GST_TYPE_S3_CHECKSUM_ALGORITHM (gst_s3_checksum_algorithm_get_type ())
+static GType
+gst_s3_checksum_algorithm_get_type (void)
+{
+  static gsize id = 0;
+  static const GEnumValue values[] = {
+    {GST_S3_CHECKSUM_ALGORITHM_NONE, "No checksum", "none"},
+    {GST_S3_CHECKSUM_ALGORITHM_CRC32, "CRC32", "crc32"},
+    {GST_S3_CHECKSUM_ALGORITHM_CRC32C, "CRC32C", "crc32c"},
+    {GST_S3_CHECKSUM_ALGORITHM_SHA256, "SHA-256", "sha256"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&id)) {
+    GType tmp = g_enum_register_static ("GstS3ChecksumAlgorithm", values);
+    g_once_init_leave (&id, tmp);
+  }
+
+  return (GType) id;
+}
+
+#define GST_TYPE_S3_PAYLOAD_SIGNING (gst_s3_payload_signing_get_type ())
+static GType
+gst_s3_payload_signing_get_type (void)
+{
+  static gsize id = 0;
+  static const GEnumValue values[] = {
+    {GST_S3_PAYLOAD_SIGNING_AUTO,
+        "Leave it to the S3 client, which doesn't sign it over HTTPS", "auto"},
+    {GST_S3_PAYLOAD_SIGNING_ALWAYS,
+        "Hash and sign the whole payload before sending it", "always"},
+    {GST_S3_PAYLOAD_SIGNING_NEVER,
+        "Send the payload unsigned (UNSIGNED-PAYLOAD) over HTTPS", "never"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&id)) {
+    GType tmp = g_enum_register_static ("GstS3PayloadSigning", values);
+    g_once_init_leave (&id, tmp);
+  }
+
+  return (GType) id;
+}
+
+#define GST_TYPE_S3_PART_DURATION_MODE (gst_s3_part_duration_mode_get_type ())
+static GType
+gst_s3_part_duration_mode_get_type (void)
+{
+  static gsize id = 0;
+  static const GEnumValue values[] = {
+    {GST_S3_PART_DURATION_MODE_RUNNING_TIME,
+        "Running time of the buffers (needs timestamps)", "running-time"},
+    {GST_S3_PART_DURATION_MODE_WALL_CLOCK, "Wall clock", "wall-clock"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&id)) {
+    GType tmp = g_enum_register_static ("GstS3PartDurationMode", values);
+    g_once_init_leave (&id, tmp);
+  }
+
+  return (GType) id;
+}
+
+#define GST_TYPE_S3_ABORT_POLICY (gst_s3_abort_policy_get_type ())
+static GType
+gst_s3_abort_policy_get_type (void)
+{
+  static gsize id = 0;
+  static const GEnumValue values[] = {
+    {GST_S3_ABORT_POLICY_AUTO,
+        "Keep the upload when spool-directory is set, abort it otherwise",
+        "auto"},
+    {GST_S3_ABORT_POLICY_ABORT, "Abort the upload", "abort"},
+    {GST_S3_ABORT_POLICY_KEEP, "Keep the upload for resume", "keep"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&id)) {
+    GType tmp = g_enum_register_static ("GstS3AbortPolicy", values);
+    g_once_init_leave (&id, tmp);
+  }
+
+  return (GType) id;
+}
+
 enum
 {
   PROP_0,
@@ -66,16 +154,43 @@ enum
   PROP_CA_FILE,
   PROP_REGION,
   PROP_BUFFER_SIZE,
+  PROP_BUFFER_COUNT,
+  PROP_ADAPTIVE_BUFFER_COUNT,
   PROP_INIT_AWS_SDK,
   PROP_CREDENTIALS,
   PROP_AWS_SDK_ENDPOINT,
   PROP_AWS_SDK_USE_HTTP,
   PROP_AWS_SDK_VERIFY_SSL,
   PROP_AWS_SDK_S3_SIGN_PAYLOAD,
+  PROP_MAX_IN_FLIGHT_PARTS,
+  PROP_MAX_IN_FLIGHT_BYTES,
+  PROP_RETRY_MAX_ATTEMPTS,
+  PROP_RETRY_BUDGET,
+  PROP_MAX_CONNECTIONS,
+  PROP_BUCKET_REGION_CACHE_TTL,
+  PROP_BUCKET_REGION_CACHE_FILE,
+  PROP_UPLOAD_THREADS,
+  PROP_UPLOAD_THREAD_AFFINITY,
+  PROP_UPLOAD_THREAD_NICE,
+  PROP_CHECKSUM_ALGORITHM,
+  PROP_PAYLOAD_SIGNING,
+  PROP_STREAMING_PARTS,
+  PROP_MAX_PART_DURATION,
+  PROP_PART_DURATION_MODE,
+  PROP_SPOOL_DIRECTORY,
+  PROP_SPOOL_SYNC,
+  PROP_RESUME,
+  PROP_ABORT_POLICY,
+  PROP_MAX_SEGMENT_SIZE,
+  PROP_MAX_SEGMENT_DURATION,
+  PROP_ASYNC_FINALIZE,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
   PROP_LAST
 };
 
 static void gst_s3_sink_dispose (GObject * object);
+static void gst_s3_sink_finalize (GObject * object);
 
 static void gst_s3_sink_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec);
@@ -88,9 +203,22 @@ static gboolean gst_s3_sink_event (GstBaseSink * sink, GstEvent * event);
 static GstFlowReturn gst_s3_sink_render (GstBaseSink * sink,
     GstBuffer * buffer);
 static gboolean gst_s3_sink_query (GstBaseSink * bsink, GstQuery * query);
+static gboolean gst_s3_sink_unlock (GstBaseSink * sink);
+static gboolean gst_s3_sink_unlock_stop (GstBaseSink * sink);
 
-static gboolean gst_s3_sink_fill_buffer (GstS3Sink * sink, GstBuffer * buffer);
-static gboolean gst_s3_sink_flush_buffer (GstS3Sink * sink);
+static GstFlowReturn gst_s3_sink_fill_buffer (GstS3Sink * sink,
+    GstBuffer * buffer);
+static GstFlowReturn gst_s3_sink_flush_buffer (GstS3Sink * sink);
+static GstFlowReturn gst_s3_sink_check_part_duration (GstS3Sink * sink,
+    GstBuffer * buffer);
+static GstFlowReturn gst_s3_sink_check_segment (GstS3Sink * sink,
+    GstBuffer * buffer);
+static void gst_s3_sink_update_checksum (GstS3Sink * sink,
+    GstBuffer * buffer);
+static gboolean gst_s3_sink_upload_buffer (GstS3Sink * sink);
+static gboolean gst_s3_sink_finalize_object (GstS3Sink * sink);
+static gboolean gst_s3_sink_finalize_object_async (GstS3Sink * sink);
+static void gst_s3_sink_maybe_post_stats (GstS3Sink * sink, gboolean force);
 
 /**
  * GstURIHandler Interface implementation
@@ -151,6 +279,7 @@ gst_s3_sink_class_init (GstS3SinkClass * klass)
   GST_DEBUG_CATEGORY_INIT (gst_s3_sink_debug, "s3sink", 0, "s3sink element");
 
   gobject_class->dispose = gst_s3_sink_dispose;
+  gobject_class->finalize = gst_s3_sink_finalize;
   gobject_class->set_property = gst_s3_sink_set_property;
   gobject_class->get_property = gst_s3_sink_get_property;
 
@@ -196,6 +325,21 @@ gst_s3_sink_class_init (GstS3SinkClass * klass)
           G_MAXUINT, DEFAULT_BUFFER_SIZE,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_BUFFER_COUNT,
+      g_param_spec_uint ("buffer-count", "Buffer count",
+          "Number of parts uploaded at the same time (the lower bound when "
+          "adaptive-buffer-count is enabled)", 1,
+          G_MAXUINT, DEFAULT_BUFFER_COUNT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_ADAPTIVE_BUFFER_COUNT,
+      g_param_spec_boolean ("adaptive-buffer-count", "Adaptive buffer count",
+          "Grow and shrink the number of parts uploaded at the same time "
+          "between buffer-count and max-in-flight-parts, based on the "
+          "measured part upload latency and the input bitrate",
+          GST_S3_UPLOADER_CONFIG_DEFAULT_ADAPTIVE_BUFFER_COUNT,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
   g_object_class_install_property (gobject_class, PROP_INIT_AWS_SDK,
       g_param_spec_boolean ("init-aws-sdk", "Init AWS SDK",
           "Whether to initialize AWS SDK",
@@ -230,6 +374,197 @@ gst_s3_sink_class_init (GstS3SinkClass * klass)
           GST_S3_UPLOADER_CONFIG_DEFAULT_PROP_AWS_SDK_S3_SIGN_PAYLOAD,
           G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_MAX_IN_FLIGHT_PARTS,
+      g_param_spec_uint ("max-in-flight-parts", "Max in-flight parts",
+          "Maximum number of parts being uploaded at the same time; rendering "
+          "blocks when the limit is reached (0 = use buffer-count)",
+          0, G_MAXUINT, GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_IN_FLIGHT_PARTS,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_IN_FLIGHT_BYTES,
+      g_param_spec_uint64 ("max-in-flight-bytes", "Max in-flight bytes",
+          "Maximum number of bytes being uploaded at the same time; rendering "
+          "blocks when the limit is reached (0 = unlimited)",
+          0, G_MAXUINT64, GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_IN_FLIGHT_BYTES,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_RETRY_MAX_ATTEMPTS,
+      g_param_spec_uint ("retry-max-attempts", "Retry max attempts",
+          "Maximum number of attempts to upload a part before giving up "
+          "(1 = no retries)", 1, G_MAXUINT,
+          GST_S3_UPLOADER_CONFIG_DEFAULT_RETRY_MAX_ATTEMPTS,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_RETRY_BUDGET,
+      g_param_spec_uint64 ("retry-budget", "Retry budget",
+          "Maximum time in nanoseconds spent retrying a part, counted from "
+          "its first attempt", 0, G_MAXUINT64,
+          GST_S3_UPLOADER_CONFIG_DEFAULT_RETRY_BUDGET,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_CONNECTIONS,
+      g_param_spec_uint ("max-connections", "Max connections",
+          "Maximum number of HTTP connections to S3. Sinks with the same "
+          "region, endpoint, credentials and TLS settings share one client, "
+          "and with it their connections", 1, G_MAXUINT,
+          GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_CONNECTIONS,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_BUCKET_REGION_CACHE_TTL,
+      g_param_spec_uint64 ("bucket-region-cache-ttl", "Bucket region cache TTL",
+          "How long in nanoseconds the region of a bucket is remembered when "
+          "the region property is not set (0 = look it up on every start)",
+          0, G_MAXUINT64, GST_S3_UPLOADER_CONFIG_DEFAULT_BUCKET_REGION_CACHE_TTL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_BUCKET_REGION_CACHE_FILE,
+      g_param_spec_string ("bucket-region-cache-file", "Bucket region cache file",
+          "File keeping the bucket regions across restarts", NULL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_UPLOAD_THREADS,
+      g_param_spec_uint ("upload-threads", "Upload threads",
+          "Number of threads running the requests to S3, shared by the sinks "
+          "with the same upload thread settings (0 = GST_S3_UPLOAD_THREADS "
+          "environment variable, or 25)", 0, G_MAXUINT,
+          GST_S3_UPLOADER_CONFIG_DEFAULT_UPLOAD_THREADS,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_UPLOAD_THREAD_AFFINITY,
+      g_param_spec_string ("upload-thread-affinity", "Upload thread affinity",
+          "CPUs the upload threads run on, e.g. \"0-3,6\" (Linux only)", NULL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_UPLOAD_THREAD_NICE,
+      g_param_spec_int ("upload-thread-nice", "Upload thread nice",
+          "Nice value of the upload threads (0 = unchanged, Linux only)",
+          -20, 19, GST_S3_UPLOADER_CONFIG_DEFAULT_UPLOAD_THREAD_NICE,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CHECKSUM_ALGORITHM,
+      g_param_spec_enum ("checksum-algorithm", "Checksum algorithm",
+          "Checksum sent along with every part and verified by S3",
+          GST_TYPE_S3_CHECKSUM_ALGORITHM,
+          GST_S3_UPLOADER_CONFIG_DEFAULT_CHECKSUM_ALGORITHM,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PAYLOAD_SIGNING,
+      g_param_spec_enum ("payload-signing", "Payload signing",
+          "Whether the parts are hashed into the request signature. Signing "
+          "delays sending a part until it's fully hashed; unsigned parts are "
+          "sent right away and rely on TLS and checksum-algorithm for their "
+          "integrity. Payloads aren't signed over HTTPS unless set to always, "
+          "and are always signed over plain HTTP", GST_TYPE_S3_PAYLOAD_SIGNING,
+          GST_S3_UPLOADER_CONFIG_DEFAULT_PAYLOAD_SIGNING,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STREAMING_PARTS,
+      g_param_spec_boolean ("streaming-parts", "Streaming parts",
+          "Start uploading each part as soon as its first buffer arrives "
+          "instead of when it's full. Every part being filled holds a "
+          "connection and an upload thread, which give up after 20 seconds "
+          "without data, or max-part-duration if it's longer. Only used "
+          "with unsigned payloads over HTTPS and no checksum-algorithm: "
+          "otherwise the parts are read whole before being sent anyway",
+          GST_S3_UPLOADER_CONFIG_DEFAULT_STREAMING_PARTS,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_PART_DURATION,
+      g_param_spec_uint64 ("max-part-duration", "Max part duration",
+          "Upload a part before it reaches buffer-size once it has been "
+          "filling for that long, in nanoseconds (0 = disabled). S3 doesn't "
+          "accept parts "
+          "smaller than 5 MiB but the last one, so smaller parts keep "
+          "filling up to that size; use streaming-parts to bound how long "
+          "those stay unsent", 0, G_MAXUINT64,
+          GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_PART_DURATION,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PART_DURATION_MODE,
+      g_param_spec_enum ("part-duration-mode", "Part duration mode",
+          "How the duration of a part is measured for max-part-duration",
+          GST_TYPE_S3_PART_DURATION_MODE,
+          GST_S3_UPLOADER_CONFIG_DEFAULT_PART_DURATION_MODE,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SPOOL_DIRECTORY,
+      g_param_spec_string ("spool-directory", "Spool directory",
+          "Directory the data is written to until it's in S3, along with a "
+          "journal of the multipart upload, so that the object can be "
+          "finished after a crash (NULL = keep the data in memory only). "
+          "Not used for the objects of a segmented stream",
+          NULL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SPOOL_SYNC,
+      g_param_spec_boolean ("spool-sync", "Spool sync",
+          "Flush the spooled parts and the journal to disk, so that they "
+          "also survive a power loss",
+          GST_S3_UPLOADER_CONFIG_DEFAULT_SPOOL_SYNC,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_RESUME,
+      g_param_spec_boolean ("resume", "Resume",
+          "Finish the object left in spool-directory by a previous sink: "
+          "the parts already in S3 are kept, the others are uploaded from "
+          "the spool, and the new data is appended. Otherwise whatever is "
+          "left there for the object is dropped, and its upload aborted",
+          GST_S3_UPLOADER_CONFIG_DEFAULT_RESUME,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_ABORT_POLICY,
+      g_param_spec_enum ("abort-policy", "Abort policy",
+          "What happens to a multipart upload that can't be completed, "
+          "because a part failed or the sink went away before finishing it. "
+          "Aborting deletes the uploaded parts in the background",
+          GST_TYPE_S3_ABORT_POLICY, GST_S3_UPLOADER_CONFIG_DEFAULT_ABORT_POLICY,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_SEGMENT_SIZE,
+      g_param_spec_uint64 ("max-segment-size", "Max segment size",
+          "Split the stream into objects of about that many bytes (0 = "
+          "disabled). The key, or the location, is then a template for the "
+          "keys of the objects, with strftime conversions in UTC and an "
+          "index in printf style, e.g. \"cam1/%Y/%m/%d/%H%M%S-%05d.mkv\". "
+          "A new object starts at the first keyframe past the limit, with "
+          "the streamheader of the caps. resume doesn't apply to the objects",
+          0, G_MAXUINT64, GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_SEGMENT_SIZE,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_SEGMENT_DURATION,
+      g_param_spec_uint64 ("max-segment-duration", "Max segment duration",
+          "Split the stream into objects spanning about that much running "
+          "time, in nanoseconds (0 = disabled), see max-segment-size", 0,
+          G_MAXUINT64, GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_SEGMENT_DURATION,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_ASYNC_FINALIZE,
+      g_param_spec_boolean ("async-finalize", "Async finalize",
+          "Finish writing the object in the background on EOS or when "
+          "stopping, so that the sink can be pointed to the next one right "
+          "away, e.g. as the sink of splitmuxsink. The next object reuses "
+          "the S3 client and starts its upload as soon as the sink starts. "
+          "Failures are still posted as errors, and an s3sink-object "
+          "message is posted for every object written. One object is written "
+          "at a time: the next one waits for it when it's handed over",
+          GST_S3_UPLOADER_CONFIG_DEFAULT_ASYNC_FINALIZE,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Stats",
+          "Upload statistics since the element was created: bytes enqueued "
+          "and acknowledged, parts in flight, completed, failed and retried, "
+          "part latency and throughput, time blocked waiting for the "
+          "uploads, and the number of requests of each S3 API",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint64 ("stats-interval", "Stats interval",
+          "Post the stats as an s3sink-stats element message about that "
+          "often while streaming, and once more on EOS, in nanoseconds "
+          "(0 = disabled)", 0, G_MAXUINT64, DEFAULT_STATS_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   gst_element_class_set_static_metadata (gstelement_class,
       "S3 Sink",
       "Sink/S3", "Write stream to an Amazon S3 bucket",
@@ -241,6 +576,8 @@ gst_s3_sink_class_init (GstS3SinkClass * klass)
   gstbasesink_class->query = GST_DEBUG_FUNCPTR (gst_s3_sink_query);
   gstbasesink_class->render = GST_DEBUG_FUNCPTR (gst_s3_sink_render);
   gstbasesink_class->event = GST_DEBUG_FUNCPTR (gst_s3_sink_event);
+  gstbasesink_class->unlock = GST_DEBUG_FUNCPTR (gst_s3_sink_unlock);
+  gstbasesink_class->unlock_stop = GST_DEBUG_FUNCPTR (gst_s3_sink_unlock_stop);
 }
 
 static void
@@ -258,6 +595,22 @@ gst_s3_sink_init (GstS3Sink * s3sink)
   s3sink->config = GST_S3_UPLOADER_CONFIG_INIT;
   s3sink->config.credentials = gst_aws_credentials_new_default ();
   s3sink->uploader = NULL;
+  s3sink->checksum = NULL;
+  s3sink->spool = NULL;
+  s3sink->segment_target = NULL;
+  s3sink->next_uploader = NULL;
+  s3sink->next_segment_target = NULL;
+  s3sink->finalizer = NULL;
+  s3sink->previous_uploader = NULL;
+  s3sink->previous_uploader_done = FALSE;
+  g_mutex_init (&s3sink->finalizer_lock);
+  g_cond_init (&s3sink->finalizer_cond);
+  s3sink->finalizing_objects = 0;
+  s3sink->stream_headers = NULL;
+  s3sink->stats = gst_s3_upload_stats_new ();
+  s3sink->config.stats = s3sink->stats;
+  s3sink->stats_interval = DEFAULT_STATS_INTERVAL;
+  s3sink->last_stats_time = GST_CLOCK_TIME_NONE;
   s3sink->is_started = FALSE;
 
   gst_base_sink_set_sync (GST_BASE_SINK (s3sink), FALSE);
@@ -274,23 +627,48 @@ gst_s3_sink_release_config (GstS3UploaderConfig * config)
   g_free (config->content_type);
   g_free (config->ca_file);
   g_free (config->aws_sdk_endpoint);
+  g_free (config->bucket_region_cache_file);
+  g_free (config->spool_directory);
+  g_free (config->upload_thread_affinity);
   gst_aws_credentials_free (config->credentials);
 
   *config = GST_S3_UPLOADER_CONFIG_INIT;
 }
 
+static void gst_s3_sink_drain_finalizer (GstS3Sink * sink);
+
 static void
 gst_s3_sink_dispose (GObject * object)
 {
   GstS3Sink *sink = GST_S3_SINK (object);
 
+  /* objects handed over with async-finalize */
+  gst_s3_sink_drain_finalizer (sink);
+  if (sink->previous_uploader) {
+    gst_s3_uploader_destroy (sink->previous_uploader);
+    sink->previous_uploader = NULL;
+  }
+
   gst_s3_sink_release_config (&sink->config);
 
   gst_s3_destroy_uploader (sink);
+  gst_s3_metrics_unregister (GST_ELEMENT (sink));
 
   G_OBJECT_CLASS (parent_class)->dispose (object);
 }
 
+static void
+gst_s3_sink_finalize (GObject * object)
+{
+  GstS3Sink *sink = GST_S3_SINK (object);
+
+  g_mutex_clear (&sink->finalizer_lock);
+  g_cond_clear (&sink->finalizer_cond);
+  gst_s3_upload_stats_unref (sink->stats);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
 static void
 gst_s3_sink_set_string_property (GstS3Sink * sink, const gchar * value,
     gchar ** property, const gchar * property_name)
@@ -355,6 +733,17 @@ gst_s3_sink_set_property (GObject * object, guint prop_id,
         sink->config.buffer_size = g_value_get_uint (value);
       }
       break;
+    case PROP_BUFFER_COUNT:
+      if (sink->is_started) {
+        GST_WARNING
+            ("Changing buffer-count property after starting the element is not supported yet.");
+      } else {
+        sink->config.buffer_count = g_value_get_uint (value);
+      }
+      break;
+    case PROP_ADAPTIVE_BUFFER_COUNT:
+      sink->config.adaptive_buffer_count = g_value_get_boolean (value);
+      break;
     case PROP_INIT_AWS_SDK:
       sink->config.init_aws_sdk = g_value_get_boolean (value);
       break;
@@ -376,6 +765,105 @@ gst_s3_sink_set_property (GObject * object, guint prop_id,
     case PROP_AWS_SDK_S3_SIGN_PAYLOAD:
       sink->config.aws_sdk_s3_sign_payload = g_value_get_boolean (value);
       break;
+    case PROP_MAX_IN_FLIGHT_PARTS:
+      sink->config.max_in_flight_parts = g_value_get_uint (value);
+      break;
+    case PROP_MAX_IN_FLIGHT_BYTES:
+      sink->config.max_in_flight_bytes = g_value_get_uint64 (value);
+      break;
+    case PROP_RETRY_MAX_ATTEMPTS:
+      sink->config.retry_max_attempts = g_value_get_uint (value);
+      break;
+    case PROP_RETRY_BUDGET:
+      sink->config.retry_budget = g_value_get_uint64 (value);
+      break;
+    case PROP_MAX_CONNECTIONS:
+      sink->config.max_connections = g_value_get_uint (value);
+      break;
+    case PROP_BUCKET_REGION_CACHE_TTL:
+      sink->config.bucket_region_cache_ttl = g_value_get_uint64 (value);
+      break;
+    case PROP_BUCKET_REGION_CACHE_FILE:
+      gst_s3_sink_set_string_property (sink, g_value_get_string (value),
+          &sink->config.bucket_region_cache_file, "bucket-region-cache-file");
+      break;
+    case PROP_UPLOAD_THREADS:
+      sink->config.upload_threads = g_value_get_uint (value);
+      break;
+    case PROP_UPLOAD_THREAD_AFFINITY:
+      gst_s3_sink_set_string_property (sink, g_value_get_string (value),
+          &sink->config.upload_thread_affinity, "upload-thread-affinity");
+      break;
+    case PROP_UPLOAD_THREAD_NICE:
+      sink->config.upload_thread_nice = g_value_get_int (value);
+      break;
+    case PROP_CHECKSUM_ALGORITHM:
+      if (sink->is_started) {
+        GST_WARNING
+            ("Changing checksum-algorithm property after starting the element is not supported.");
+      } else {
+        sink->config.checksum_algorithm = g_value_get_enum (value);
+      }
+      break;
+    case PROP_PAYLOAD_SIGNING:
+      sink->config.payload_signing = g_value_get_enum (value);
+      break;
+    case PROP_STREAMING_PARTS:
+      if (sink->is_started) {
+        GST_WARNING
+            ("Changing streaming-parts property after starting the element is not supported.");
+      } else {
+        sink->config.streaming_parts = g_value_get_boolean (value);
+      }
+      break;
+    case PROP_MAX_PART_DURATION:
+      sink->config.max_part_duration = g_value_get_uint64 (value);
+      break;
+    case PROP_PART_DURATION_MODE:
+      sink->config.part_duration_mode = g_value_get_enum (value);
+      break;
+    case PROP_SPOOL_DIRECTORY:
+      gst_s3_sink_set_string_property (sink, g_value_get_string (value),
+          &sink->config.spool_directory, "spool-directory");
+      break;
+    case PROP_SPOOL_SYNC:
+      sink->config.spool_sync = g_value_get_boolean (value);
+      break;
+    case PROP_RESUME:
+      if (sink->is_started) {
+        GST_WARNING
+            ("Changing resume property after starting the element is not supported.");
+      } else {
+        sink->config.resume = g_value_get_boolean (value);
+      }
+      break;
+    case PROP_ABORT_POLICY:
+      sink->config.abort_policy = g_value_get_enum (value);
+      break;
+    case PROP_MAX_SEGMENT_SIZE:
+      if (sink->is_started) {
+        GST_WARNING
+            ("Changing max-segment-size property after starting the element is not supported.");
+      } else {
+        sink->config.max_segment_size = g_value_get_uint64 (value);
+      }
+      break;
+    case PROP_ASYNC_FINALIZE:
+      sink->config.async_finalize = g_value_get_boolean (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      GST_OBJECT_LOCK (sink);
+      sink->stats_interval = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (sink);
+      break;
+    case PROP_MAX_SEGMENT_DURATION:
+      if (sink->is_started) {
+        GST_WARNING
+            ("Changing max-segment-duration property after starting the element is not supported.");
+      } else {
+        sink->config.max_segment_duration = g_value_get_uint64 (value);
+      }
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -413,6 +901,12 @@ gst_s3_sink_get_property (GObject * object, guint prop_id, GValue * value,
     case PROP_BUFFER_SIZE:
       g_value_set_uint (value, sink->config.buffer_size);
       break;
+    case PROP_BUFFER_COUNT:
+      g_value_set_uint (value, sink->config.buffer_count);
+      break;
+    case PROP_ADAPTIVE_BUFFER_COUNT:
+      g_value_set_boolean (value, sink->config.adaptive_buffer_count);
+      break;
     case PROP_INIT_AWS_SDK:
       g_value_set_boolean (value, sink->config.init_aws_sdk);
       break;
@@ -428,6 +922,81 @@ gst_s3_sink_get_property (GObject * object, guint prop_id, GValue * value,
     case PROP_AWS_SDK_S3_SIGN_PAYLOAD:
       g_value_set_boolean (value, sink->config.aws_sdk_s3_sign_payload);
       break;
+    case PROP_MAX_IN_FLIGHT_PARTS:
+      g_value_set_uint (value, sink->config.max_in_flight_parts);
+      break;
+    case PROP_MAX_IN_FLIGHT_BYTES:
+      g_value_set_uint64 (value, sink->config.max_in_flight_bytes);
+      break;
+    case PROP_RETRY_MAX_ATTEMPTS:
+      g_value_set_uint (value, sink->config.retry_max_attempts);
+      break;
+    case PROP_RETRY_BUDGET:
+      g_value_set_uint64 (value, sink->config.retry_budget);
+      break;
+    case PROP_MAX_CONNECTIONS:
+      g_value_set_uint (value, sink->config.max_connections);
+      break;
+    case PROP_BUCKET_REGION_CACHE_TTL:
+      g_value_set_uint64 (value, sink->config.bucket_region_cache_ttl);
+      break;
+    case PROP_BUCKET_REGION_CACHE_FILE:
+      g_value_set_string (value, sink->config.bucket_region_cache_file);
+      break;
+    case PROP_UPLOAD_THREADS:
+      g_value_set_uint (value, sink->config.upload_threads);
+      break;
+    case PROP_UPLOAD_THREAD_AFFINITY:
+      g_value_set_string (value, sink->config.upload_thread_affinity);
+      break;
+    case PROP_UPLOAD_THREAD_NICE:
+      g_value_set_int (value, sink->config.upload_thread_nice);
+      break;
+    case PROP_CHECKSUM_ALGORITHM:
+      g_value_set_enum (value, sink->config.checksum_algorithm);
+      break;
+    case PROP_PAYLOAD_SIGNING:
+      g_value_set_enum (value, sink->config.payload_signing);
+      break;
+    case PROP_STREAMING_PARTS:
+      g_value_set_boolean (value, sink->config.streaming_parts);
+      break;
+    case PROP_MAX_PART_DURATION:
+      g_value_set_uint64 (value, sink->config.max_part_duration);
+      break;
+    case PROP_PART_DURATION_MODE:
+      g_value_set_enum (value, sink->config.part_duration_mode);
+      break;
+    case PROP_SPOOL_DIRECTORY:
+      g_value_set_string (value, sink->config.spool_directory);
+      break;
+    case PROP_SPOOL_SYNC:
+      g_value_set_boolean (value, sink->config.spool_sync);
+      break;
+    case PROP_RESUME:
+      g_value_set_boolean (value, sink->config.resume);
+      break;
+    case PROP_ABORT_POLICY:
+      g_value_set_enum (value, sink->config.abort_policy);
+      break;
+    case PROP_MAX_SEGMENT_SIZE:
+      g_value_set_uint64 (value, sink->config.max_segment_size);
+      break;
+    case PROP_MAX_SEGMENT_DURATION:
+      g_value_set_uint64 (value, sink->config.max_segment_duration);
+      break;
+    case PROP_ASYNC_FINALIZE:
+      g_value_set_boolean (value, sink->config.async_finalize);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value,
+          gst_s3_upload_stats_to_structure (sink->stats, "s3sink-stats"));
+      break;
+    case PROP_STATS_INTERVAL:
+      GST_OBJECT_LOCK (sink);
+      g_value_set_uint64 (value, sink->stats_interval);
+      GST_OBJECT_UNLOCK (sink);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -440,29 +1009,185 @@ gst_s3_sink_is_null_or_empty (const gchar * str)
   return str == NULL || str[0] == '\0';
 }
 
+static gboolean
+gst_s3_sink_is_segmented (GstS3Sink * sink)
+{
+  return sink->config.max_segment_size > 0
+      || sink->config.max_segment_duration > 0;
+}
+
+/* Expands the key template of a segmented stream for the object with the
+ * given index: the strftime conversions are replaced with the current time
+ * in UTC, and a "%0<width>d" conversion with the index. */
+static gchar *
+gst_s3_sink_format_segment_target (GstS3Sink * sink, guint index)
+{
+  const gchar *template = gst_s3_sink_is_null_or_empty (sink->config.location)
+      ? sink->config.key : sink->config.location;
+  GString *format = g_string_new (NULL);
+  GDateTime *now;
+  gchar *target;
+  const gchar *p;
+
+  for (p = template; *p != '\0'; p++) {
+    if (p[0] == '%' && p[1] == '0' && g_ascii_isdigit (p[2])) {
+      gchar *end;
+      guint64 width = g_ascii_strtoull (p + 1, &end, 10);
+
+      if (*end == 'd') {
+        g_string_append_printf (format, "%0*u", (gint) MIN (width, 32), index);
+        p = end;
+        continue;
+      }
+    }
+
+    g_string_append_c (format, p[0]);
+    /* the other conversions, "%%" included, are left to strftime */
+    if (p[0] == '%' && p[1] != '\0')
+      g_string_append_c (format, *++p);
+  }
+
+  now = g_date_time_new_now_utc ();
+  target = g_date_time_format (now, format->str);
+  g_date_time_unref (now);
+  g_string_free (format, TRUE);
+
+  return target;
+}
+
+/* The config of the object with the given key, or location, in a
+ * segmented stream. It shares the strings of the sink's config. */
+static void
+gst_s3_sink_get_segment_config (GstS3Sink * sink, const gchar * target,
+    GstS3UploaderConfig * config)
+{
+  *config = sink->config;
+  if (gst_s3_sink_is_null_or_empty (sink->config.location))
+    config->key = (gchar *) target;
+  else
+    config->location = (gchar *) target;
+
+  /* the keys are different on every run: nothing could be resumed, so the
+   * objects aren't spooled, and their uploads are aborted on failure */
+  config->resume = FALSE;
+  config->spool_directory = NULL;
+  config->streaming_parts = sink->streaming_parts;
+}
+
+/* Waits for the objects handed over to the finalizer to be written. */
+static void
+gst_s3_sink_drain_finalizer (GstS3Sink * sink)
+{
+  if (sink->finalizer) {
+    g_thread_pool_free (sink->finalizer, FALSE, TRUE);
+    sink->finalizer = NULL;
+  }
+}
+
 static gboolean
 gst_s3_sink_start (GstBaseSink * basesink)
 {
   GstS3Sink *sink = GST_S3_SINK (basesink);
+  GstS3UploaderConfig config;
+  GError *err = NULL;
 
   if (gst_s3_sink_is_null_or_empty (sink->config.location) && (
       gst_s3_sink_is_null_or_empty (sink->config.bucket)
       || gst_s3_sink_is_null_or_empty (sink->config.key)))
     goto no_destination;
 
+  g_clear_pointer (&sink->segment_target, g_free);
+  sink->segment_index = 0;
+  sink->object_bytes = 0;
+  sink->segment_start_time = GST_CLOCK_TIME_NONE;
+
+  /* The client reads a part whole before sending it when it hashes it,
+   * to sign it (which it always does over plain HTTP) or for its
+   * checksum: streaming it would only hold an upload thread longer. */
+  sink->streaming_parts = sink->config.streaming_parts;
+  if (sink->streaming_parts && (sink->config.aws_sdk_use_http
+          || sink->config.payload_signing == GST_S3_PAYLOAD_SIGNING_ALWAYS
+          || sink->config.checksum_algorithm !=
+          GST_S3_CHECKSUM_ALGORITHM_NONE)) {
+    GST_WARNING_OBJECT (sink, "streaming-parts needs unsigned payloads over "
+        "HTTPS and no checksum-algorithm, uploading full parts instead");
+    sink->streaming_parts = FALSE;
+  }
+
+  config = sink->config;
+  config.streaming_parts = sink->streaming_parts;
+  if (gst_s3_sink_is_segmented (sink)) {
+    sink->segment_target = gst_s3_sink_format_segment_target (sink, 0);
+    if (!sink->segment_target)
+      goto invalid_template;
+    gst_s3_sink_get_segment_config (sink, sink->segment_target, &config);
+    if (!gst_s3_sink_is_null_or_empty (sink->config.spool_directory))
+      GST_WARNING_OBJECT (sink, "spool-directory is ignored for the objects "
+          "of a segmented stream");
+  }
+
+  if (sink->uploader == NULL) {
+    /* carry on from the object handed over with async-finalize */
+    g_mutex_lock (&sink->finalizer_lock);
+    if (sink->previous_uploader) {
+      sink->uploader =
+          gst_s3_uploader_create_next (sink->previous_uploader, &config);
+      if (sink->previous_uploader_done)
+        gst_s3_uploader_destroy (sink->previous_uploader);
+      sink->previous_uploader = NULL;
+      sink->previous_uploader_done = FALSE;
+    }
+    g_mutex_unlock (&sink->finalizer_lock);
+  }
+
   if (sink->uploader == NULL) {
-    sink->uploader = gst_s3_multipart_uploader_new (&sink->config);
+    sink->uploader = gst_s3_multipart_uploader_new (&config);
   }
 
   if (!sink->uploader)
     goto init_failed;
 
-  g_free (sink->buffer);
-  sink->buffer = NULL;
+  gst_s3_metrics_register (GST_ELEMENT (sink), &config);
 
-  sink->buffer = g_malloc (sink->config.buffer_size);
+  if (sink->buffer_list)
+    gst_buffer_list_unref (sink->buffer_list);
+
+  sink->buffer_list = gst_buffer_list_new ();
   sink->current_buffer_size = 0;
   sink->total_bytes_written = 0;
+  sink->part_count = 0;
+  sink->part_start_time = GST_CLOCK_TIME_NONE;
+  sink->object_start_time = gst_util_get_timestamp ();
+
+  /* streamed parts are sent before they're complete, their checksum is
+   * computed by the uploader */
+  g_clear_pointer (&sink->checksum, gst_s3_checksum_free);
+  if (sink->config.checksum_algorithm != GST_S3_CHECKSUM_ALGORITHM_NONE
+      && !sink->streaming_parts) {
+    sink->checksum = gst_s3_checksum_new (sink->config.checksum_algorithm);
+    if (!sink->checksum)
+      goto init_failed;
+  }
+
+  g_clear_pointer (&sink->spool, gst_s3_spool_free);
+  if (!gst_s3_sink_is_null_or_empty (config.spool_directory)) {
+    GstBuffer *leftover;
+
+    sink->spool = gst_s3_spool_new (&config, config.resume, &err);
+    if (!sink->spool)
+      goto spool_failed;
+
+    /* the part a previous sink was filling goes on with the new data */
+    leftover = gst_s3_spool_take_leftover (sink->spool);
+    if (leftover) {
+      GST_INFO_OBJECT (sink, "resuming with %" G_GSIZE_FORMAT
+          " spooled bytes", gst_buffer_get_size (leftover));
+      sink->current_buffer_size = gst_buffer_get_size (leftover);
+      gst_s3_sink_update_checksum (sink, leftover);
+      gst_buffer_list_add (sink->buffer_list, leftover);
+    }
+  }
+  sink->is_finalized = FALSE;
 
   if ( gst_s3_sink_is_null_or_empty (sink->config.location) )
   {
@@ -486,6 +1211,13 @@ no_destination:
     return FALSE;
   }
 
+invalid_template:
+  {
+    GST_ELEMENT_ERROR (sink, RESOURCE, SETTINGS,
+        ("Invalid key template for the objects of the stream."), (NULL));
+    return FALSE;
+  }
+
 init_failed:
   {
     gst_s3_destroy_uploader (sink);
@@ -493,6 +1225,15 @@ init_failed:
         ("Unable to initialize S3 uploader."), (NULL));
     return FALSE;
   }
+
+spool_failed:
+  {
+    gst_s3_destroy_uploader (sink);
+    GST_ELEMENT_ERROR (sink, RESOURCE, OPEN_WRITE,
+        ("Unable to open the spool."), ("%s", err->message));
+    g_clear_error (&err);
+    return FALSE;
+  }
 }
 
 static gboolean
@@ -501,17 +1242,33 @@ gst_s3_sink_stop (GstBaseSink * basesink)
   GstS3Sink *sink = GST_S3_SINK (basesink);
   gboolean ret = TRUE;
 
-  if (sink->buffer) {
-    gst_s3_sink_flush_buffer (sink);
-    ret = gst_s3_uploader_complete (sink->uploader);
+  if (sink->buffer_list) {
+    if (sink->is_finalized)
+      ret = TRUE;
+    else if (sink->config.async_finalize)
+      ret = gst_s3_sink_finalize_object_async (sink);
+    else
+      ret = gst_s3_sink_finalize_object (sink);
 
-    g_free (sink->buffer);
-    sink->buffer = NULL;
+    gst_buffer_list_unref (sink->buffer_list);
+    sink->buffer_list = NULL;
     sink->current_buffer_size = 0;
     sink->total_bytes_written = 0;
   }
 
+  if (!sink->config.async_finalize)
+    gst_s3_sink_drain_finalizer (sink);
+
   gst_s3_destroy_uploader (sink);
+  if (sink->next_uploader) {
+    gst_s3_uploader_destroy (sink->next_uploader);
+    sink->next_uploader = NULL;
+  }
+  g_clear_pointer (&sink->checksum, gst_s3_checksum_free);
+  g_clear_pointer (&sink->spool, gst_s3_spool_free);
+  g_clear_pointer (&sink->segment_target, g_free);
+  g_clear_pointer (&sink->next_segment_target, g_free);
+  g_clear_pointer (&sink->stream_headers, gst_buffer_list_unref);
 
   sink->is_started = FALSE;
 
@@ -566,6 +1323,36 @@ gst_s3_sink_query (GstBaseSink * base_sink, GstQuery * query)
   return ret;
 }
 
+/* The streamheader of the caps is written again at the start of every
+ * object but the first, which gets it from the stream. */
+static void
+gst_s3_sink_update_stream_headers (GstS3Sink * sink, GstEvent * event)
+{
+  GstCaps *caps;
+  const GValue *headers;
+  guint i;
+
+  g_clear_pointer (&sink->stream_headers, gst_buffer_list_unref);
+
+  gst_event_parse_caps (event, &caps);
+  if (gst_caps_get_size (caps) == 0)
+    return;
+
+  headers = gst_structure_get_value (gst_caps_get_structure (caps, 0),
+      "streamheader");
+  if (headers == NULL || !GST_VALUE_HOLDS_ARRAY (headers))
+    return;
+
+  sink->stream_headers = gst_buffer_list_new ();
+  for (i = 0; i < gst_value_array_get_size (headers); i++) {
+    const GValue *header = gst_value_array_get_value (headers, i);
+
+    if (GST_VALUE_HOLDS_BUFFER (header))
+      gst_buffer_list_add (sink->stream_headers,
+          gst_buffer_ref (gst_value_get_buffer (header)));
+  }
+}
+
 static gboolean
 gst_s3_sink_event (GstBaseSink * base_sink, GstEvent * event)
 {
@@ -576,8 +1363,32 @@ gst_s3_sink_event (GstBaseSink * base_sink, GstEvent * event)
   type = GST_EVENT_TYPE (event);
 
   switch (type) {
+    case GST_EVENT_CAPS:
+      if (gst_s3_sink_is_segmented (sink))
+        gst_s3_sink_update_stream_headers (sink, event);
+      break;
     case GST_EVENT_EOS:
-      gst_s3_sink_flush_buffer (sink);
+      if (sink->config.async_finalize) {
+        sink->is_finalized = TRUE;
+        if (!gst_s3_sink_finalize_object_async (sink))
+          GST_ELEMENT_ERROR (sink, RESOURCE, WRITE,
+              ("Failed to upload the object to S3."), (NULL));
+        break;
+      }
+
+      /* an object that fits in a single part is written right away with
+       * one request instead of a whole multipart upload */
+      if (sink->part_count == 0 && !sink->streaming_parts) {
+        sink->is_finalized = TRUE;
+        if (!gst_s3_sink_finalize_object (sink))
+          GST_ELEMENT_ERROR (sink, RESOURCE, WRITE,
+              ("Failed to upload the object to S3."), (NULL));
+      } else {
+        gst_s3_sink_flush_buffer (sink);
+      }
+      /* the previous objects of a segmented stream */
+      gst_s3_sink_drain_finalizer (sink);
+      gst_s3_sink_maybe_post_stats (sink, TRUE);
       break;
     default:
       break;
@@ -586,6 +1397,51 @@ gst_s3_sink_event (GstBaseSink * base_sink, GstEvent * event)
   return GST_BASE_SINK_CLASS (parent_class)->event (base_sink, event);
 }
 
+static gboolean
+gst_s3_sink_unlock (GstBaseSink * base_sink)
+{
+  GstS3Sink *sink = GST_S3_SINK (base_sink);
+
+  if (sink->uploader)
+    gst_s3_uploader_unlock (sink->uploader);
+
+  return TRUE;
+}
+
+static gboolean
+gst_s3_sink_unlock_stop (GstBaseSink * base_sink)
+{
+  GstS3Sink *sink = GST_S3_SINK (base_sink);
+
+  if (sink->uploader)
+    gst_s3_uploader_unlock_stop (sink->uploader);
+
+  return TRUE;
+}
+
+static void
+gst_s3_sink_post_upload_error (GstS3Sink * sink)
+{
+  gint part_number = 0;
+  gchar *error_code = NULL;
+  gchar *error_message = NULL;
+
+  if (gst_s3_uploader_get_error (sink->uploader, &part_number, &error_code,
+          &error_message)) {
+    GST_ELEMENT_ERROR_WITH_DETAILS (sink, RESOURCE, WRITE,
+        ("Failed to upload part %d to S3.", part_number),
+        ("%s: %s", error_code, error_message),
+        ("part-number", G_TYPE_INT, part_number,
+            "error-code", G_TYPE_STRING, error_code, NULL));
+  } else {
+    GST_ELEMENT_ERROR (sink, RESOURCE, WRITE,
+        ("Failed to upload a part to S3."), (NULL));
+  }
+
+  g_free (error_code);
+  g_free (error_message);
+}
+
 static GstFlowReturn
 gst_s3_sink_render (GstBaseSink * base_sink, GstBuffer * buffer)
 {
@@ -595,69 +1451,696 @@ gst_s3_sink_render (GstBaseSink * base_sink, GstBuffer * buffer)
 
   sink = GST_S3_SINK (base_sink);
 
+  /* written, or handed over (see async-finalize), on EOS; only a flush
+   * gets data past the EOS of the base class */
+  if (sink->uploader == NULL || sink->is_finalized) {
+    GST_WARNING_OBJECT (sink, "the object is already written, dropping %"
+        GST_PTR_FORMAT, buffer);
+    return GST_FLOW_EOS;
+  }
+
+  /* parts are uploaded in the background; stop the stream as soon as
+   * one of them failed for good instead of waiting for EOS */
+  if (gst_s3_uploader_get_error (sink->uploader, NULL, NULL, NULL)) {
+    gst_s3_sink_post_upload_error (sink);
+    return GST_FLOW_ERROR;
+  }
+
   n_mem = gst_buffer_n_memory (buffer);
 
   if (n_mem > 0) {
-    if (gst_s3_sink_fill_buffer (sink, buffer)) {
-      flow = GST_FLOW_OK;
-    } else {
+    flow = gst_s3_sink_check_segment (sink, buffer);
+    if (flow == GST_FLOW_OK)
+      flow = gst_s3_sink_fill_buffer (sink, buffer);
+    if (flow == GST_FLOW_OK)
+      flow = gst_s3_sink_check_part_duration (sink, buffer);
+    if (flow == GST_FLOW_ERROR) {
       GST_WARNING ("Failed to flush the internal buffer");
-      flow = GST_FLOW_ERROR;
     }
   } else {
     flow = GST_FLOW_OK;
   }
 
+  gst_s3_sink_maybe_post_stats (sink, FALSE);
+
   return flow;
 }
 
+/* Posts the stats once stats-interval has passed since they were last
+ * posted, or right away if forced. */
+static void
+gst_s3_sink_maybe_post_stats (GstS3Sink * sink, gboolean force)
+{
+  GstClockTime interval, now;
+
+  GST_OBJECT_LOCK (sink);
+  interval = sink->stats_interval;
+  GST_OBJECT_UNLOCK (sink);
+
+  if (interval == 0)
+    return;
+
+  now = gst_util_get_timestamp ();
+  if (!GST_CLOCK_TIME_IS_VALID (sink->last_stats_time)) {
+    /* the first interval starts with the stream */
+    sink->last_stats_time = now;
+    if (!force)
+      return;
+  } else if (!force && now - sink->last_stats_time < interval) {
+    return;
+  }
+  sink->last_stats_time = now;
+
+  gst_element_post_message (GST_ELEMENT_CAST (sink),
+      gst_message_new_element (GST_OBJECT_CAST (sink),
+          gst_s3_upload_stats_to_structure (sink->stats, "s3sink-stats")));
+}
+
+static void
+gst_s3_sink_post_backpressure_message (GstS3Sink * sink, gboolean stalled,
+    GstClockTime duration)
+{
+  GstStructure *s = gst_structure_new ("s3sink-backpressure",
+      "stalled", G_TYPE_BOOLEAN, stalled,
+      "duration", G_TYPE_UINT64, duration, NULL);
+
+  gst_element_post_message (GST_ELEMENT_CAST (sink),
+      gst_message_new_element (GST_OBJECT_CAST (sink), s));
+}
+
+/* Called with the PREROLL_LOCK held, so that an unlock() can make it
+ * return GST_FLOW_FLUSHING instead of blocking a state change. */
+static GstFlowReturn
+gst_s3_sink_wait_for_uploader (GstS3Sink * sink, gsize size)
+{
+  GstFlowReturn flow = GST_FLOW_OK;
+  GstClockTime start, duration;
+
+  if (gst_s3_uploader_has_capacity (sink->uploader, size))
+    return GST_FLOW_OK;
+
+  GST_DEBUG_OBJECT (sink, "waiting for in-flight parts to complete");
+  start = gst_util_get_timestamp ();
+  gst_s3_sink_post_backpressure_message (sink, TRUE, 0);
+
+  while (!gst_s3_uploader_wait_for_capacity (sink->uploader, size)) {
+    flow = gst_base_sink_wait_preroll (GST_BASE_SINK (sink));
+    if (flow != GST_FLOW_OK)
+      break;
+  }
+
+  duration = gst_util_get_timestamp () - start;
+  gst_s3_upload_stats_add (sink->stats, GST_S3_UPLOAD_COUNTER_BLOCKED_TIME,
+      duration);
+  gst_s3_sink_post_backpressure_message (sink, FALSE, duration);
+
+  return flow;
+}
+
+static void
+gst_s3_sink_update_checksum (GstS3Sink * sink, GstBuffer * buffer)
+{
+  GstMapInfo info;
+  guint i, n_mem;
+
+  if (!sink->checksum)
+    return;
+
+  /* map each memory on its own, mapping the buffer could merge them */
+  n_mem = gst_buffer_n_memory (buffer);
+  for (i = 0; i < n_mem; i++) {
+    GstMemory *mem = gst_buffer_peek_memory (buffer, i);
+
+    if (gst_memory_map (mem, &info, GST_MAP_READ)) {
+      gst_s3_checksum_update (sink->checksum, info.data, info.size);
+      gst_memory_unmap (mem, &info);
+    } else {
+      GST_WARNING_OBJECT (sink, "failed to map memory for the part checksum");
+    }
+  }
+}
+
+static void
+gst_s3_sink_attach_checksum (GstS3Sink * sink)
+{
+  gchar *checksum;
+
+  if (!sink->checksum)
+    return;
+
+  checksum = gst_s3_checksum_finish (sink->checksum);
+  gst_s3_uploader_set_part_checksum (sink->buffer_list, checksum);
+  g_free (checksum);
+}
+
 static gboolean
-gst_s3_sink_flush_buffer (GstS3Sink * sink)
+gst_s3_sink_upload_buffer (GstS3Sink * sink)
 {
   gboolean ret = TRUE;
 
   if (sink->current_buffer_size) {
-    ret = gst_s3_uploader_upload_part (sink->uploader, sink->buffer,
-        sink->current_buffer_size);
+    gst_s3_sink_attach_checksum (sink);
+    /* the uploader takes ownership of the part's buffers */
+    ret = gst_s3_uploader_upload_part (sink->uploader, sink->buffer_list);
+    sink->buffer_list = gst_buffer_list_new ();
     sink->current_buffer_size = 0;
+    sink->part_count++;
   }
 
   return ret;
 }
 
+/* Swaps the in-memory data of the part for its spool file, which the
+ * uploader then reads from. */
+static gboolean
+gst_s3_sink_spool_part (GstS3Sink * sink)
+{
+  GstBufferList *buffers;
+  GError *err = NULL;
+
+  if (!sink->spool || !sink->current_buffer_size)
+    return TRUE;
+
+  buffers = gst_s3_spool_finish_part (sink->spool, &err);
+  if (!buffers) {
+    GST_ELEMENT_ERROR (sink, RESOURCE, WRITE,
+        ("Failed to spool the part."), ("%s", err->message));
+    g_clear_error (&err);
+    return FALSE;
+  }
+
+  gst_buffer_list_unref (sink->buffer_list);
+  sink->buffer_list = buffers;
+
+  return TRUE;
+}
+
+/* The key, or the location, of the object being written. */
+static const gchar *
+gst_s3_sink_get_target (GstS3Sink * sink)
+{
+  if (sink->segment_target)
+    return sink->segment_target;
+
+  return gst_s3_sink_is_null_or_empty (sink->config.location) ?
+      sink->config.key : sink->config.location;
+}
+
+static void
+gst_s3_sink_get_bucket_and_key (GstS3Sink * sink, gchar ** bucket,
+    gchar ** key)
+{
+  const gchar *target = gst_s3_sink_get_target (sink);
+  GstUri *uri;
+  gchar *path;
+
+  if (gst_s3_sink_is_null_or_empty (sink->config.location)) {
+    *bucket = g_strdup (sink->config.bucket);
+    *key = g_strdup (target);
+    return;
+  }
+
+  uri = gst_uri_from_string (target);
+  if (uri == NULL) {
+    *bucket = NULL;
+    *key = g_strdup (target);
+    return;
+  }
+
+  path = gst_uri_get_path (uri);
+  *bucket = g_strdup (gst_uri_get_host (uri));
+  *key = g_strdup (path && path[0] == '/' ? path + 1 : path);
+  g_free (path);
+  gst_uri_unref (uri);
+}
+
+static void
+gst_s3_sink_post_object_message (GstS3Sink * sink, GstS3Uploader * uploader,
+    const gchar * bucket, const gchar * key, guint64 size,
+    GstClockTime start_time)
+{
+  gchar *etag = gst_s3_uploader_get_etag (uploader);
+  GstStructure *s = gst_structure_new ("s3sink-object",
+      "bucket", G_TYPE_STRING, bucket,
+      "key", G_TYPE_STRING, key,
+      "size", G_TYPE_UINT64, size,
+      "etag", G_TYPE_STRING, etag,
+      "duration", G_TYPE_UINT64, gst_util_get_timestamp () - start_time,
+      NULL);
+
+  gst_element_post_message (GST_ELEMENT_CAST (sink),
+      gst_message_new_element (GST_OBJECT_CAST (sink), s));
+  g_free (etag);
+}
+
+static gboolean
+gst_s3_sink_finalize_object (GstS3Sink * sink)
+{
+  GstBufferList *buffers;
+  gchar *bucket, *key;
+  gboolean ret;
+
+  if (sink->part_count == 0 && !sink->streaming_parts) {
+    gst_s3_sink_attach_checksum (sink);
+    buffers = sink->buffer_list;
+    sink->buffer_list = gst_buffer_list_new ();
+    sink->current_buffer_size = 0;
+    ret = gst_s3_uploader_put_object (sink->uploader, buffers);
+  } else if (!gst_s3_sink_spool_part (sink)) {
+    ret = FALSE;
+  } else {
+    gst_s3_sink_upload_buffer (sink);
+    ret = gst_s3_uploader_complete (sink->uploader);
+  }
+
+  /* the object is written, there's nothing left to resume */
+  if (ret && sink->spool)
+    gst_s3_spool_remove (sink->spool);
+
+  if (ret) {
+    gst_s3_sink_get_bucket_and_key (sink, &bucket, &key);
+    gst_s3_sink_post_object_message (sink, sink->uploader, bucket, key,
+        sink->object_bytes, sink->object_start_time);
+    g_free (bucket);
+    g_free (key);
+  }
+
+  return ret;
+}
+
+/* An object whose data is all in, being written out by the finalizer. */
+typedef struct
+{
+  GstS3Uploader *uploader;
+  GstS3Spool *spool;
+  /* the whole object, when it's written with a single request */
+  GstBufferList *buffers;
+  gchar *bucket;
+  gchar *key;
+  guint64 size;
+  GstClockTime start_time;
+} GstS3SinkObject;
+
+static void
+gst_s3_sink_finalize_in_background (gpointer data, gpointer user_data)
+{
+  GstS3SinkObject *object = data;
+  GstS3Sink *sink = GST_S3_SINK (user_data);
+  gboolean ret;
+
+  if (object->buffers)
+    ret = gst_s3_uploader_put_object (object->uploader, object->buffers);
+  else
+    ret = gst_s3_uploader_complete (object->uploader);
+
+  if (ret) {
+    GST_INFO_OBJECT (sink, "finished object %s", object->key);
+    if (object->spool)
+      gst_s3_spool_remove (object->spool);
+    gst_s3_sink_post_object_message (sink, object->uploader, object->bucket,
+        object->key, object->size, object->start_time);
+  } else {
+    GST_ELEMENT_ERROR (sink, RESOURCE, WRITE,
+        ("Failed to upload %s to S3.", object->key), (NULL));
+  }
+
+  g_mutex_lock (&sink->finalizer_lock);
+  if (object->uploader == sink->previous_uploader)
+    sink->previous_uploader_done = TRUE;
+  else
+    gst_s3_uploader_destroy (object->uploader);
+  sink->finalizing_objects--;
+  g_cond_broadcast (&sink->finalizer_cond);
+  g_mutex_unlock (&sink->finalizer_lock);
+
+  if (object->spool)
+    gst_s3_spool_free (object->spool);
+  g_free (object->bucket);
+  g_free (object->key);
+  g_free (object);
+}
+
+/* Hands the current object over to the finalizer. Its last part must have
+ * been uploaded already, unless it's written with a single request. */
+static void
+gst_s3_sink_hand_over_object (GstS3Sink * sink)
+{
+  GstS3SinkObject *object = g_new0 (GstS3SinkObject, 1);
+
+  if (sink->part_count == 0 && !sink->streaming_parts) {
+    gst_s3_sink_attach_checksum (sink);
+    object->buffers = sink->buffer_list;
+    sink->buffer_list = gst_buffer_list_new ();
+    sink->current_buffer_size = 0;
+  }
+
+  object->uploader = sink->uploader;
+  object->spool = sink->spool;
+  gst_s3_sink_get_bucket_and_key (sink, &object->bucket, &object->key);
+  object->size = sink->object_bytes;
+  object->start_time = sink->object_start_time;
+
+  sink->uploader = NULL;
+  sink->spool = NULL;
+
+  g_mutex_lock (&sink->finalizer_lock);
+  sink->finalizing_objects++;
+  g_mutex_unlock (&sink->finalizer_lock);
+
+  if (!sink->finalizer)
+    sink->finalizer = g_thread_pool_new (gst_s3_sink_finalize_in_background,
+        sink, 1, FALSE, NULL);
+  g_thread_pool_push (sink->finalizer, object, NULL);
+}
+
+/* Like gst_s3_sink_finalize_object(), but the object is written in the
+ * background; the uploader of the next object is created from its
+ * uploader when the sink starts again. The objects handed over before are
+ * waited for first: only the last one is still being written once the sink
+ * stops, and the failure of an object is posted by the time the next one is
+ * handed over. */
 static gboolean
+gst_s3_sink_finalize_object_async (GstS3Sink * sink)
+{
+  if (sink->part_count > 0 || sink->streaming_parts) {
+    if (!gst_s3_sink_spool_part (sink))
+      return FALSE;
+    gst_s3_sink_upload_buffer (sink);
+  }
+
+  g_mutex_lock (&sink->finalizer_lock);
+  while (sink->finalizing_objects > 0)
+    g_cond_wait (&sink->finalizer_cond, &sink->finalizer_lock);
+  if (sink->previous_uploader && sink->previous_uploader_done)
+    gst_s3_uploader_destroy (sink->previous_uploader);
+  sink->previous_uploader = sink->uploader;
+  sink->previous_uploader_done = FALSE;
+  g_mutex_unlock (&sink->finalizer_lock);
+
+  gst_s3_sink_hand_over_object (sink);
+
+  return TRUE;
+}
+
+static GstFlowReturn
+gst_s3_sink_flush_buffer (GstS3Sink * sink)
+{
+  GstFlowReturn flow;
+
+  if (!sink->current_buffer_size)
+    return GST_FLOW_OK;
+
+  /* a streamed part waited for capacity when it began */
+  if (!sink->streaming_parts) {
+    flow = gst_s3_sink_wait_for_uploader (sink, sink->current_buffer_size);
+    if (flow != GST_FLOW_OK)
+      return flow;
+  }
+
+  if (!gst_s3_sink_spool_part (sink))
+    return GST_FLOW_ERROR;
+
+  if (!gst_s3_sink_upload_buffer (sink)) {
+    gst_s3_sink_post_upload_error (sink);
+    return GST_FLOW_ERROR;
+  }
+
+  return GST_FLOW_OK;
+}
+
+/* The running time of the start or the end of the buffer,
+ * GST_CLOCK_TIME_NONE if it has no timestamp. */
+static GstClockTime
+gst_s3_sink_get_running_time (GstS3Sink * sink, GstBuffer * buffer,
+    gboolean end)
+{
+  GstSegment *segment = &GST_BASE_SINK (sink)->segment;
+  GstClockTime ts;
+
+  ts = GST_BUFFER_DTS_OR_PTS (buffer);
+  if (segment->format != GST_FORMAT_TIME || !GST_CLOCK_TIME_IS_VALID (ts))
+    return GST_CLOCK_TIME_NONE;
+
+  if (end && GST_BUFFER_DURATION_IS_VALID (buffer))
+    ts += GST_BUFFER_DURATION (buffer);
+
+  return gst_segment_to_running_time (segment, GST_FORMAT_TIME, ts);
+}
+
+/* Where the buffer starts or ends on the clock max-part-duration is
+ * measured with, GST_CLOCK_TIME_NONE if it can't be told. */
+static GstClockTime
+gst_s3_sink_get_part_time (GstS3Sink * sink, GstBuffer * buffer,
+    gboolean end)
+{
+  if (sink->config.max_part_duration == 0)
+    return GST_CLOCK_TIME_NONE;
+
+  if (sink->config.part_duration_mode == GST_S3_PART_DURATION_MODE_WALL_CLOCK)
+    return gst_util_get_timestamp ();
+
+  return gst_s3_sink_get_running_time (sink, buffer, end);
+}
+
+/* Uploads the current part early when it has been filling for longer
+ * than max-part-duration, as long as S3 accepts it as a non-final part. */
+static GstFlowReturn
+gst_s3_sink_check_part_duration (GstS3Sink * sink, GstBuffer * buffer)
+{
+  GstClockTime now;
+
+  /* streamed parts are sent as they fill */
+  if (sink->config.max_part_duration == 0 || sink->streaming_parts
+      || sink->current_buffer_size == 0
+      || !GST_CLOCK_TIME_IS_VALID (sink->part_start_time))
+    return GST_FLOW_OK;
+
+  now = gst_s3_sink_get_part_time (sink, buffer, TRUE);
+  if (!GST_CLOCK_TIME_IS_VALID (now)
+      || now < sink->part_start_time + sink->config.max_part_duration)
+    return GST_FLOW_OK;
+
+  if (sink->current_buffer_size < MIN_BUFFER_SIZE) {
+    GST_LOG_OBJECT (sink, "part reached max-part-duration with only %"
+        G_GSIZE_FORMAT " bytes, waiting for %d", sink->current_buffer_size,
+        MIN_BUFFER_SIZE);
+    return GST_FLOW_OK;
+  }
+
+  GST_DEBUG_OBJECT (sink, "part reached max-part-duration, uploading %"
+      G_GSIZE_FORMAT " bytes", sink->current_buffer_size);
+  return gst_s3_sink_flush_buffer (sink);
+}
+
+/* Sets up the uploader of the next object, which creates its upload while
+ * the current object waits for a keyframe to end on. */
+static gboolean
+gst_s3_sink_prepare_next_object (GstS3Sink * sink)
+{
+  GstS3UploaderConfig config;
+
+  sink->next_segment_target =
+      gst_s3_sink_format_segment_target (sink, sink->segment_index + 1);
+  if (sink->next_segment_target) {
+    gst_s3_sink_get_segment_config (sink, sink->next_segment_target, &config);
+    sink->next_uploader = gst_s3_uploader_create_next (sink->uploader, &config);
+  }
+
+  if (!sink->next_uploader) {
+    g_clear_pointer (&sink->next_segment_target, g_free);
+    GST_ELEMENT_ERROR (sink, RESOURCE, OPEN_WRITE,
+        ("Unable to initialize S3 uploader."), (NULL));
+    return FALSE;
+  }
+
+  GST_DEBUG_OBJECT (sink, "prepared the upload of %s",
+      sink->next_segment_target);
+  return TRUE;
+}
+
+/* Hands the current object over to the finalizer and goes on with the
+ * prepared one, starting at the given buffer. */
+static GstFlowReturn
+gst_s3_sink_next_object (GstS3Sink * sink, GstBuffer * buffer,
+    GstClockTime start)
+{
+  GstFlowReturn flow;
+  guint i;
+
+  if (sink->part_count > 0 || sink->streaming_parts) {
+    flow = gst_s3_sink_flush_buffer (sink);
+    if (flow != GST_FLOW_OK)
+      return flow;
+  }
+
+  gst_s3_sink_hand_over_object (sink);
+
+  g_free (sink->segment_target);
+  sink->uploader = sink->next_uploader;
+  sink->segment_target = sink->next_segment_target;
+  sink->next_uploader = NULL;
+  sink->next_segment_target = NULL;
+  sink->segment_index++;
+  sink->object_bytes = 0;
+  sink->object_start_time = gst_util_get_timestamp ();
+  sink->segment_start_time = start;
+  sink->part_count = 0;
+  sink->part_start_time = GST_CLOCK_TIME_NONE;
+
+  GST_INFO_OBJECT (sink, "started object %s", sink->segment_target);
+
+  /* every object has to be readable on its own */
+  if (sink->stream_headers
+      && !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_HEADER)) {
+    for (i = 0; i < gst_buffer_list_length (sink->stream_headers); i++) {
+      flow = gst_s3_sink_fill_buffer (sink,
+          gst_buffer_list_get (sink->stream_headers, i));
+      if (flow != GST_FLOW_OK)
+        return flow;
+    }
+  }
+
+  return GST_FLOW_OK;
+}
+
+/* Ends the current object of a segmented stream once it's over
+ * max-segment-size or max-segment-duration, on the next keyframe. */
+static GstFlowReturn
+gst_s3_sink_check_segment (GstS3Sink * sink, GstBuffer * buffer)
+{
+  GstClockTime start;
+
+  if (!gst_s3_sink_is_segmented (sink))
+    return GST_FLOW_OK;
+
+  start = gst_s3_sink_get_running_time (sink, buffer, FALSE);
+  if (!GST_CLOCK_TIME_IS_VALID (sink->segment_start_time))
+    sink->segment_start_time = start;
+
+  if (sink->object_bytes == 0)
+    return GST_FLOW_OK;
+
+  if (!sink->next_uploader) {
+    gboolean due = sink->config.max_segment_size > 0
+        && sink->object_bytes >= sink->config.max_segment_size;
+
+    if (!due && sink->config.max_segment_duration > 0
+        && GST_CLOCK_TIME_IS_VALID (start)
+        && GST_CLOCK_TIME_IS_VALID (sink->segment_start_time))
+      due = start >= sink->segment_start_time
+          + sink->config.max_segment_duration;
+
+    if (!due)
+      return GST_FLOW_OK;
+
+    if (!gst_s3_sink_prepare_next_object (sink))
+      return GST_FLOW_ERROR;
+  }
+
+  if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+    return GST_FLOW_OK;
+
+  return gst_s3_sink_next_object (sink, buffer, start);
+}
+
+/* Opens the upload of the next part before its data arrives. */
+static GstFlowReturn
+gst_s3_sink_begin_part (GstS3Sink * sink)
+{
+  GstFlowReturn flow;
+
+  flow = gst_s3_sink_wait_for_uploader (sink, sink->config.buffer_size);
+  if (flow != GST_FLOW_OK)
+    return flow;
+
+  if (!gst_s3_uploader_begin_part (sink->uploader, sink->config.buffer_size)) {
+    gst_s3_sink_post_upload_error (sink);
+    return GST_FLOW_ERROR;
+  }
+
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
 gst_s3_sink_fill_buffer (GstS3Sink * sink, GstBuffer * buffer)
 {
-  GstMapInfo map_info = GST_MAP_INFO_INIT;
-  gsize ptr = 0;
-  gsize bytes_to_copy;
+  gsize size = gst_buffer_get_size (buffer);
+  gsize offset = 0;
+  gsize bytes_to_add;
+  GstBufferCopyFlags flags = GST_BUFFER_COPY_MEMORY;
+  GstBuffer *part_buffer;
+  GstFlowReturn flow;
+  GError *err = NULL;
 
-  if (!gst_buffer_map (buffer, &map_info, GST_MAP_READ))
-    goto map_failed;
+  /* Buffers are kept until their part is uploaded. Holding on to memory
+   * owned by an upstream pool could starve it, so copy those instead. */
+  if (buffer->pool != NULL)
+    flags |= GST_BUFFER_COPY_DEEP;
 
   do {
-    bytes_to_copy =
+    /* a previous flush may have been interrupted by flushing, and the
+     * part resumed from the spool may be bigger than buffer-size */
+    if (sink->current_buffer_size >= sink->config.buffer_size) {
+      flow = gst_s3_sink_flush_buffer (sink);
+      if (flow != GST_FLOW_OK)
+        return flow;
+    }
+
+    if (sink->current_buffer_size == 0)
+      sink->part_start_time = gst_s3_sink_get_part_time (sink, buffer, FALSE);
+
+    if (sink->streaming_parts && sink->current_buffer_size == 0) {
+      flow = gst_s3_sink_begin_part (sink);
+      if (flow != GST_FLOW_OK)
+        return flow;
+    }
+
+    bytes_to_add =
         MIN (sink->config.buffer_size - sink->current_buffer_size,
-        map_info.size - ptr);
-    memcpy (sink->buffer + sink->current_buffer_size, map_info.data + ptr,
-        bytes_to_copy);
-    sink->current_buffer_size += bytes_to_copy;
-    if (sink->current_buffer_size == sink->config.buffer_size) {
-      if (!gst_s3_sink_flush_buffer (sink)) {
-        return FALSE;
-      }
+        size - offset);
+
+    if (offset == 0 && bytes_to_add == size && !(flags & GST_BUFFER_COPY_DEEP))
+      part_buffer = gst_buffer_ref (buffer);
+    else
+      part_buffer = gst_buffer_copy_region (buffer, flags, offset,
+          bytes_to_add);
+
+    if (part_buffer == NULL)
+      goto copy_failed;
+
+    gst_s3_sink_update_checksum (sink, part_buffer);
+    if (sink->spool && !gst_s3_spool_write (sink->spool, part_buffer, &err)) {
+      gst_buffer_unref (part_buffer);
+      goto spool_failed;
     }
-    ptr += bytes_to_copy;
-    sink->total_bytes_written += bytes_to_copy;
-  } while (ptr < map_info.size);
+    if (sink->streaming_parts)
+      gst_s3_uploader_append_part (sink->uploader, part_buffer);
+    gst_buffer_list_add (sink->buffer_list, part_buffer);
+    sink->current_buffer_size += bytes_to_add;
+    offset += bytes_to_add;
+    sink->total_bytes_written += bytes_to_add;
+    sink->object_bytes += bytes_to_add;
+
+    if (sink->current_buffer_size >= sink->config.buffer_size) {
+      flow = gst_s3_sink_flush_buffer (sink);
+      if (flow != GST_FLOW_OK)
+        return flow;
+    }
+  } while (offset < size);
 
-  gst_buffer_unmap (buffer, &map_info);
-  return TRUE;
+  return GST_FLOW_OK;
 
-map_failed:
+copy_failed:
   {
     GST_ELEMENT_ERROR (sink, RESOURCE, NOT_FOUND,
-        ("Failed to map the buffer."), (NULL));
-    return FALSE;
+        ("Failed to copy the buffer."), (NULL));
+    return GST_FLOW_ERROR;
+  }
+spool_failed:
+  {
+    GST_ELEMENT_ERROR (sink, RESOURCE, WRITE,
+        ("Failed to write to the spool."), ("%s", err->message));
+    g_clear_error (&err);
+    return GST_FLOW_ERROR;
   }
 }
@@ -22,6 +22,8 @@
 #include <gst/gst.h>
 #include <gst/base/gstbasesink.h>
 
+#include "gsts3checksum.h"
+#include "gsts3spool.h"
 #include "gsts3uploader.h"
 #include "gstawscredentials.h"
 
@@ -54,11 +56,51 @@ struct _GstS3Sink {
 
   GstS3Uploader *uploader;
 
-  gchar *buffer;
+  GstBufferList *buffer_list;
+  GstS3Checksum *checksum;
+  GstS3Spool *spool;
   gsize current_buffer_size;
   gsize total_bytes_written;
+  guint part_count;
+  /* when the first byte of the current part came in, see max-part-duration */
+  GstClockTime part_start_time;
+  /* streaming-parts, unless the parts would be read whole anyway */
+  gboolean streaming_parts;
+
+  /* size of the object being written, and when it was started */
+  guint64 object_bytes;
+  GstClockTime object_start_time;
+
+  /* segmenting, see max-segment-size and max-segment-duration */
+  guint segment_index;
+  GstClockTime segment_start_time;
+  /* the key, or the location, of the object being written */
+  gchar *segment_target;
+  /* prepared once the current object is due to end */
+  GstS3Uploader *next_uploader;
+  gchar *next_segment_target;
+  /* writes the finished objects out in the background */
+  GThreadPool *finalizer;
+  /* the uploader of the last object handed over with async-finalize,
+   * which the uploader of the next one is created from; owned by the
+   * finalizer until it's done with it */
+  GMutex finalizer_lock;
+  GstS3Uploader *previous_uploader;
+  gboolean previous_uploader_done;
+  /* the objects handed over and not written yet, signalled on
+   * finalizer_cond when one is */
+  GCond finalizer_cond;
+  guint finalizing_objects;
+  /* the streamheader of the caps, repeated at the start of every object */
+  GstBufferList *stream_headers;
+
+  /* shared with the uploaders through the config, see the stats property */
+  GstS3UploadStats *stats;
+  GstClockTime stats_interval;
+  GstClockTime last_stats_time;
 
   gboolean is_started;
+  gboolean is_finalized;
 };
 
 struct _GstS3SinkClass {
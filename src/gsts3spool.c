@@ -0,0 +1,337 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include "gsts3spool.h"
+#include "gsts3uploader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#ifdef G_OS_WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+struct _GstS3Spool
+{
+  gchar *current_path;
+  gchar *part_template;
+  /* names the last part handed over, see
+   * gst_s3_spool_get_handed_over_part() */
+  gchar *handed_over_path;
+  gboolean sync;
+  gint fd;
+  GstBuffer *leftover;
+};
+
+static void
+set_error_from_errno (GError ** error, const gchar * action,
+    const gchar * path, gint errsv)
+{
+  g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+      "Failed to %s %s: %s", action, path, g_strerror (errsv));
+}
+
+/* Makes the renames in the directory of the file durable. */
+static gboolean
+sync_directory (const gchar * path, GError ** error)
+{
+#ifndef G_OS_WIN32
+  gchar *dir = g_path_get_dirname (path);
+  gint fd = g_open (dir, O_RDONLY, 0);
+  gboolean ret = fd >= 0 && g_fsync (fd) == 0;
+
+  if (!ret)
+    set_error_from_errno (error, "sync", dir, errno);
+  if (fd >= 0)
+    g_close (fd, NULL);
+  g_free (dir);
+
+  return ret;
+#else
+  return TRUE;
+#endif
+}
+
+static gint
+open_current (GstS3Spool * spool, gboolean truncate, GError ** error)
+{
+  gint flags = O_WRONLY | O_CREAT | O_APPEND | O_BINARY;
+
+  if (truncate)
+    flags |= O_TRUNC;
+
+  spool->fd = g_open (spool->current_path, flags, 0600);
+  if (spool->fd < 0)
+    set_error_from_errno (error, "open", spool->current_path, errno);
+
+  return spool->fd;
+}
+
+gchar *
+gst_s3_spool_get_path (const GstS3UploaderConfig * config,
+    const gchar * suffix)
+{
+  gchar *url, *name, *filename, *path;
+
+  if (config->spool_directory == NULL || *config->spool_directory == '\0')
+    return NULL;
+
+  /* one set of files per object, named after a hash of its URL */
+  if (config->location != NULL && *config->location != '\0')
+    url = g_strdup (config->location);
+  else
+    url = g_strdup_printf ("s3://%s/%s", config->bucket, config->key);
+
+  name = g_compute_checksum_for_string (G_CHECKSUM_SHA256, url, -1);
+  filename = g_strconcat (name, suffix, NULL);
+  path = g_build_filename (config->spool_directory, filename, NULL);
+
+  g_free (filename);
+  g_free (name);
+  g_free (url);
+
+  return path;
+}
+
+gchar *
+gst_s3_spool_get_handed_over_part (const GstS3UploaderConfig * config)
+{
+  gchar *handed_over_path = gst_s3_spool_get_path (config, ".next");
+  gchar *part_path = NULL;
+  GStatBuf st;
+
+  if (handed_over_path == NULL)
+    return NULL;
+
+  /* still empty if the part wasn't moved there, it's the current one */
+  if (g_file_get_contents (handed_over_path, &part_path, NULL, NULL)
+      && (g_stat (part_path, &st) != 0 || st.st_size == 0))
+    g_clear_pointer (&part_path, g_free);
+  g_free (handed_over_path);
+
+  return part_path;
+}
+
+GstS3Spool *
+gst_s3_spool_new (const GstS3UploaderConfig * config, gboolean resume,
+    GError ** error)
+{
+  GstS3Spool *spool;
+
+  g_return_val_if_fail (config->spool_directory != NULL, NULL);
+
+  if (g_mkdir_with_parents (config->spool_directory, 0700) != 0) {
+    set_error_from_errno (error, "create", config->spool_directory, errno);
+    return NULL;
+  }
+
+  spool = g_new0 (GstS3Spool, 1);
+  spool->current_path = gst_s3_spool_get_path (config, ".current");
+  spool->part_template = gst_s3_spool_get_path (config, "-XXXXXX");
+  spool->handed_over_path = gst_s3_spool_get_path (config, ".next");
+  spool->sync = config->spool_sync;
+  spool->fd = -1;
+
+  if (resume && g_file_test (spool->current_path, G_FILE_TEST_EXISTS)) {
+    spool->leftover = gst_s3_spool_map_file (spool->current_path, error);
+    if (spool->leftover == NULL)
+      goto failed;
+    if (gst_buffer_get_size (spool->leftover) == 0)
+      gst_buffer_replace (&spool->leftover, NULL);
+  }
+
+  /* new data goes after the leftover, they make up the same part */
+  if (open_current (spool, spool->leftover == NULL, error) < 0)
+    goto failed;
+
+  return spool;
+
+failed:
+  gst_s3_spool_free (spool);
+  return NULL;
+}
+
+GstBuffer *
+gst_s3_spool_take_leftover (GstS3Spool * spool)
+{
+  GstBuffer *leftover = spool->leftover;
+
+  spool->leftover = NULL;
+  return leftover;
+}
+
+gboolean
+gst_s3_spool_write (GstS3Spool * spool, GstBuffer * buffer, GError ** error)
+{
+  GstMapInfo info;
+  guint i, n_mem;
+
+  n_mem = gst_buffer_n_memory (buffer);
+  for (i = 0; i < n_mem; i++) {
+    GstMemory *mem = gst_buffer_peek_memory (buffer, i);
+    gsize written = 0;
+
+    if (!gst_memory_map (mem, &info, GST_MAP_READ)) {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+          "Failed to map the memory of a buffer");
+      return FALSE;
+    }
+
+    while (written < info.size) {
+      gssize ret = write (spool->fd, info.data + written, info.size - written);
+
+      if (ret < 0) {
+        gint errsv = errno;
+
+        if (errsv == EINTR)
+          continue;
+
+        gst_memory_unmap (mem, &info);
+        set_error_from_errno (error, "write to", spool->current_path, errsv);
+        return FALSE;
+      }
+      written += ret;
+    }
+
+    gst_memory_unmap (mem, &info);
+  }
+
+  return TRUE;
+}
+
+GstBufferList *
+gst_s3_spool_finish_part (GstS3Spool * spool, GError ** error)
+{
+  GstBufferList *buffers;
+  GstBuffer *buffer;
+  gchar *part_path;
+  gint fd;
+
+  if (spool->sync && g_fsync (spool->fd) != 0) {
+    set_error_from_errno (error, "sync", spool->current_path, errno);
+    return NULL;
+  }
+
+  g_close (spool->fd, NULL);
+  spool->fd = -1;
+
+  /* reserve a unique name, then move the part there */
+  part_path = g_strdup (spool->part_template);
+  fd = g_mkstemp_full (part_path, O_WRONLY | O_BINARY, 0600);
+  if (fd < 0) {
+    set_error_from_errno (error, "create", part_path, errno);
+    goto failed;
+  }
+  g_close (fd, NULL);
+
+  /* named before the part is moved there: until the uploader journals it,
+   * this is how a resumed upload finds it */
+  if (!g_file_set_contents_full (spool->handed_over_path, part_path, -1,
+          spool->sync ? G_FILE_SET_CONTENTS_CONSISTENT |
+          G_FILE_SET_CONTENTS_DURABLE : G_FILE_SET_CONTENTS_CONSISTENT, 0600,
+          error)) {
+    g_unlink (part_path);
+    goto failed;
+  }
+  if (spool->sync && !sync_directory (part_path, error)) {
+    g_unlink (part_path);
+    goto failed;
+  }
+
+  if (g_rename (spool->current_path, part_path) != 0) {
+    set_error_from_errno (error, "rename", spool->current_path, errno);
+    g_unlink (part_path);
+    goto failed;
+  }
+
+  if (spool->sync && !sync_directory (part_path, error))
+    goto failed;
+
+  if (open_current (spool, TRUE, error) < 0)
+    goto failed;
+
+  buffer = gst_s3_spool_map_file (part_path, error);
+  if (buffer == NULL)
+    goto failed;
+
+  buffers = gst_buffer_list_new ();
+  gst_buffer_list_add (buffers, buffer);
+  gst_s3_uploader_set_part_file (buffers, part_path);
+  g_free (part_path);
+
+  return buffers;
+
+failed:
+  g_free (part_path);
+  return NULL;
+}
+
+void
+gst_s3_spool_remove (GstS3Spool * spool)
+{
+  if (spool->fd >= 0) {
+    g_close (spool->fd, NULL);
+    spool->fd = -1;
+  }
+
+  g_unlink (spool->current_path);
+  g_unlink (spool->handed_over_path);
+}
+
+void
+gst_s3_spool_free (GstS3Spool * spool)
+{
+  if (spool->fd >= 0)
+    g_close (spool->fd, NULL);
+
+  gst_buffer_replace (&spool->leftover, NULL);
+  g_free (spool->current_path);
+  g_free (spool->part_template);
+  g_free (spool->handed_over_path);
+  g_free (spool);
+}
+
+GstBuffer *
+gst_s3_spool_map_file (const gchar * path, GError ** error)
+{
+  GMappedFile *file;
+  gsize size;
+
+  file = g_mapped_file_new (path, FALSE, error);
+  if (file == NULL)
+    return NULL;
+
+  size = g_mapped_file_get_length (file);
+  if (size == 0) {
+    g_mapped_file_unref (file);
+    return gst_buffer_new ();
+  }
+
+  return gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY,
+      g_mapped_file_get_contents (file), size, 0, size, file,
+      (GDestroyNotify) g_mapped_file_unref);
+}
@@ -0,0 +1,74 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#ifndef __GST_S3_SPOOL_H__
+#define __GST_S3_SPOOL_H__
+
+#include <gst/gst.h>
+
+#include "gsts3uploaderconfig.h"
+
+G_BEGIN_DECLS
+
+/* On-disk copy of the data of an object that isn't safely in S3 yet, in
+ * spool_directory. The part being filled is written through to a file as
+ * the data arrives; once full, the file is closed and handed over to the
+ * uploader, which deletes it when the part is uploaded. Along with the
+ * journal kept by the uploader, this lets a new sink finish the object
+ * after a crash. */
+typedef struct _GstS3Spool GstS3Spool;
+
+/* Path of the spool file with the given suffix for the object set in the
+ * config, or NULL if spooling is disabled. Free with g_free(). */
+gchar *gst_s3_spool_get_path (const GstS3UploaderConfig * config,
+    const gchar * suffix);
+
+/* Path of the file of the last part handed over to the uploader for the
+ * object set in the config, if it has the data of the part, or NULL. After
+ * a crash, the journal of the uploader may not know about it yet. Free with
+ * g_free(). */
+gchar *gst_s3_spool_get_handed_over_part (const GstS3UploaderConfig * config);
+
+/* With resume set, the data of the part that was being filled by a previous
+ * sink is kept, see gst_s3_spool_take_leftover(); otherwise it's dropped. */
+GstS3Spool *gst_s3_spool_new (const GstS3UploaderConfig * config,
+    gboolean resume, GError ** error);
+
+/* Returns the data left over by a previous sink, if any. */
+GstBuffer *gst_s3_spool_take_leftover (GstS3Spool * spool);
+
+gboolean gst_s3_spool_write (GstS3Spool * spool, GstBuffer * buffer,
+    GError ** error);
+
+/* Closes the file of the part written so far and returns its data, mapped
+ * from the file, with the file attached to it (see
+ * gst_s3_uploader_get_part_file()). */
+GstBufferList *gst_s3_spool_finish_part (GstS3Spool * spool,
+    GError ** error);
+
+/* Deletes the file of the part being filled, once the object is written. */
+void gst_s3_spool_remove (GstS3Spool * spool);
+
+void gst_s3_spool_free (GstS3Spool * spool);
+
+/* Maps a spooled file into a buffer, without copying it. */
+GstBuffer *gst_s3_spool_map_file (const gchar * path, GError ** error);
+
+G_END_DECLS
+
+#endif /* __GST_S3_SPOOL_H__ */
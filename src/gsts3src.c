@@ -0,0 +1,726 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+/**
+ * SECTION:element-s3src
+ * @title: s3src
+ *
+ * Read an object from an Amazon S3 bucket.
+ *
+ * The object is read through a cache of block-size blocks, so that seeking
+ * demuxers don't fetch the same ranges over and over. Missing blocks are
+ * fetched with ranged GETs, consecutive ones together in requests of up to
+ * chunk-size bytes. While the object is read sequentially, read-ahead chunks
+ * past the read position are fetched at the same time, so that a single
+ * stream can go faster than a single connection allows.
+ *
+ * Blocks evicted from the cache-size bytes kept in memory can be kept on
+ * disk too, by setting disk-cache-directory.
+ *
+ * ## Example launch line
+ * |[
+ * gst-launch-1.0 s3src location=s3://test-bucket/video.mp4 ! decodebin ! autovideosink
+ * ]| Play a video stored in S3.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+
+#include <gst/gst.h>
+#include <gst/gsturi.h>
+
+#include "gsts3src.h"
+#include "gsts3rangedownloader.h"
+
+static GstStaticPadTemplate srctemplate = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+GST_DEBUG_CATEGORY (gst_s3_src_debug);
+#define GST_CAT_DEFAULT gst_s3_src_debug
+
+#define MIN_BLOCK_SIZE 16 * 1024
+#define DEFAULT_BLOCK_SIZE GST_S3_DOWNLOADER_CONFIG_DEFAULT_BLOCK_SIZE
+#define MIN_CHUNK_SIZE 64 * 1024
+#define DEFAULT_CHUNK_SIZE GST_S3_DOWNLOADER_CONFIG_DEFAULT_CHUNK_SIZE
+#define DEFAULT_READ_AHEAD GST_S3_DOWNLOADER_CONFIG_DEFAULT_READ_AHEAD
+#define DEFAULT_CACHE_SIZE GST_S3_DOWNLOADER_CONFIG_DEFAULT_CACHE_SIZE
+#define DEFAULT_DISK_CACHE_SIZE GST_S3_DOWNLOADER_CONFIG_DEFAULT_DISK_CACHE_SIZE
+
+#define REQUIRED_BUT_UNUSED(x) (void)(x)
+
+enum
+{
+  PROP_0,
+  PROP_BUCKET,
+  PROP_KEY,
+  PROP_LOCATION,
+  PROP_CA_FILE,
+  PROP_REGION,
+  PROP_BLOCK_SIZE,
+  PROP_CHUNK_SIZE,
+  PROP_READ_AHEAD,
+  PROP_CACHE_SIZE,
+  PROP_DISK_CACHE_DIRECTORY,
+  PROP_DISK_CACHE_SIZE,
+  PROP_INIT_AWS_SDK,
+  PROP_CREDENTIALS,
+  PROP_AWS_SDK_ENDPOINT,
+  PROP_AWS_SDK_USE_HTTP,
+  PROP_AWS_SDK_VERIFY_SSL,
+  PROP_MAX_CONNECTIONS,
+  PROP_BUCKET_REGION_CACHE_TTL,
+  PROP_BUCKET_REGION_CACHE_FILE,
+  PROP_LAST
+};
+
+static void gst_s3_src_dispose (GObject * object);
+
+static void gst_s3_src_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_s3_src_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
+
+static gboolean gst_s3_src_start (GstBaseSrc * src);
+static gboolean gst_s3_src_stop (GstBaseSrc * src);
+static gboolean gst_s3_src_get_size (GstBaseSrc * src, guint64 * size);
+static gboolean gst_s3_src_is_seekable (GstBaseSrc * src);
+static GstFlowReturn gst_s3_src_create (GstBaseSrc * src, guint64 offset,
+    guint length, GstBuffer ** buffer);
+static gboolean gst_s3_src_unlock (GstBaseSrc * src);
+static gboolean gst_s3_src_unlock_stop (GstBaseSrc * src);
+
+/**
+ * GstURIHandler Interface implementation
+ */
+static GstURIType
+gst_s3_src_urihandler_get_type (GType type)
+{
+  REQUIRED_BUT_UNUSED(type);
+  return GST_URI_SRC;
+}
+
+static const gchar * const*
+gst_s3_src_urihandler_get_protocols (GType type)
+{
+  REQUIRED_BUT_UNUSED(type);
+  static const gchar *protocols[] = { "s3", NULL};
+  return protocols;
+}
+
+static gchar *
+gst_s3_src_urihandler_get_uri (GstURIHandler * handler)
+{
+  return g_strdup (GST_S3_SRC (handler)->config.location);
+}
+
+static gboolean
+gst_s3_src_urihandler_set_uri (GstURIHandler * handler, const gchar * uri, GError **error)
+{
+  REQUIRED_BUT_UNUSED(error);
+  g_object_set( G_OBJECT(handler), "location", uri, NULL);
+  return TRUE;
+}
+
+static void
+gst_s3_src_urihandler_init (gpointer g_iface, gpointer iface_data)
+{
+  REQUIRED_BUT_UNUSED(iface_data);
+  GstURIHandlerInterface *iface = (GstURIHandlerInterface *) g_iface;
+  iface->get_type      = gst_s3_src_urihandler_get_type;
+  iface->get_protocols = gst_s3_src_urihandler_get_protocols;
+  iface->get_uri       = gst_s3_src_urihandler_get_uri;
+  iface->set_uri       = gst_s3_src_urihandler_set_uri;
+}
+
+#define gst_s3_src_parent_class parent_class
+G_DEFINE_TYPE_WITH_CODE (GstS3Src, gst_s3_src, GST_TYPE_BASE_SRC,
+  G_IMPLEMENT_INTERFACE (GST_TYPE_URI_HANDLER, gst_s3_src_urihandler_init));
+
+static void
+gst_s3_src_class_init (GstS3SrcClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
+  GstBaseSrcClass *gstbasesrc_class = GST_BASE_SRC_CLASS (klass);
+
+  GST_DEBUG_CATEGORY_INIT (gst_s3_src_debug, "s3src", 0, "s3src element");
+
+  gobject_class->dispose = gst_s3_src_dispose;
+  gobject_class->set_property = gst_s3_src_set_property;
+  gobject_class->get_property = gst_s3_src_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_BUCKET,
+      g_param_spec_string ("bucket", "S3 bucket",
+          "The bucket of the file to read (ignored when 'location' is set)", NULL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_KEY,
+      g_param_spec_string ("key", "S3 key",
+          "The key of the file to read (ignored when 'location' is set)", NULL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_LOCATION,
+      g_param_spec_string ("location", "S3 URI",
+          "The URI of the file to read", NULL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CA_FILE,
+      g_param_spec_string ("ca-file", "CA file",
+          "A path to a CA file", NULL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_REGION,
+      g_param_spec_string ("region", "AWS Region",
+          "An AWS region (e.g. eu-west-2). Leave empty for region-autodetection "
+          "(Please note region-autodetection requires an extra network call)", NULL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_BLOCK_SIZE,
+      g_param_spec_uint ("block-size", "Block size",
+          "Size in bytes of the blocks of the object kept in the cache",
+          MIN_BLOCK_SIZE, G_MAXUINT, DEFAULT_BLOCK_SIZE,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CHUNK_SIZE,
+      g_param_spec_uint ("chunk-size", "Chunk size",
+          "Maximum size in bytes of the ranges requested from S3, rounded to "
+          "whole blocks; also the default blocksize", MIN_CHUNK_SIZE,
+          G_MAXUINT, DEFAULT_CHUNK_SIZE,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_READ_AHEAD,
+      g_param_spec_uint ("read-ahead", "Read ahead",
+          "Number of chunks fetched past the read position, at the same time, "
+          "while the object is read sequentially (0 = no read ahead)",
+          0, G_MAXUINT, DEFAULT_READ_AHEAD,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CACHE_SIZE,
+      g_param_spec_uint64 ("cache-size", "Cache size",
+          "Maximum size in bytes of the blocks kept in memory. It's raised to "
+          "fit the blocks being read ahead", 0, G_MAXUINT64, DEFAULT_CACHE_SIZE,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_DISK_CACHE_DIRECTORY,
+      g_param_spec_string ("disk-cache-directory", "Disk cache directory",
+          "Directory where the blocks evicted from memory are kept, in a file "
+          "removed once the element stops (NULL = no disk cache)", NULL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_DISK_CACHE_SIZE,
+      g_param_spec_uint64 ("disk-cache-size", "Disk cache size",
+          "Maximum size in bytes of the blocks kept on disk", 0, G_MAXUINT64,
+          DEFAULT_DISK_CACHE_SIZE,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_INIT_AWS_SDK,
+      g_param_spec_boolean ("init-aws-sdk", "Init AWS SDK",
+          "Whether to initialize AWS SDK",
+          GST_S3_DOWNLOADER_CONFIG_DEFAULT_INIT_AWS_SDK,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CREDENTIALS,
+      g_param_spec_boxed ("aws-credentials", "AWS credentials",
+          "The AWS credentials to use", GST_TYPE_AWS_CREDENTIALS,
+          G_PARAM_WRITABLE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_AWS_SDK_ENDPOINT,
+      g_param_spec_string ("aws-sdk-endpoint", "AWS SDK Endpoint",
+          "AWS SDK endpoint override (ip:port)", NULL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_AWS_SDK_USE_HTTP,
+      g_param_spec_boolean ("aws-sdk-use-http", "AWS SDK Use HTTP",
+          "Whether to enable http for the AWS SDK (default https)",
+          GST_S3_DOWNLOADER_CONFIG_DEFAULT_PROP_AWS_SDK_USE_HTTP,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_AWS_SDK_VERIFY_SSL,
+      g_param_spec_boolean ("aws-sdk-verify-ssl", "AWS SDK Verify SSL",
+          "Whether to enable/disable tls validation for the AWS SDK",
+          GST_S3_DOWNLOADER_CONFIG_DEFAULT_PROP_AWS_SDK_VERIFY_SSL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_CONNECTIONS,
+      g_param_spec_uint ("max-connections", "Max connections",
+          "Maximum number of HTTP connections to S3. Elements with the same "
+          "region, endpoint, credentials and TLS settings share one client, "
+          "and with it their connections", 1, G_MAXUINT,
+          GST_S3_DOWNLOADER_CONFIG_DEFAULT_MAX_CONNECTIONS,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_BUCKET_REGION_CACHE_TTL,
+      g_param_spec_uint64 ("bucket-region-cache-ttl", "Bucket region cache TTL",
+          "How long in nanoseconds the region of a bucket is remembered when "
+          "the region property is not set (0 = look it up on every start)",
+          0, G_MAXUINT64, GST_S3_DOWNLOADER_CONFIG_DEFAULT_BUCKET_REGION_CACHE_TTL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_BUCKET_REGION_CACHE_FILE,
+      g_param_spec_string ("bucket-region-cache-file", "Bucket region cache file",
+          "File keeping the bucket regions across restarts", NULL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  gst_element_class_set_static_metadata (gstelement_class,
+      "S3 Source",
+      "Source/S3", "Read an object from an Amazon S3 bucket",
+      "Marcin Kolny <marcin.kolny at gmail.com>");
+  gst_element_class_add_static_pad_template (gstelement_class, &srctemplate);
+
+  gstbasesrc_class->start = GST_DEBUG_FUNCPTR (gst_s3_src_start);
+  gstbasesrc_class->stop = GST_DEBUG_FUNCPTR (gst_s3_src_stop);
+  gstbasesrc_class->get_size = GST_DEBUG_FUNCPTR (gst_s3_src_get_size);
+  gstbasesrc_class->is_seekable = GST_DEBUG_FUNCPTR (gst_s3_src_is_seekable);
+  gstbasesrc_class->create = GST_DEBUG_FUNCPTR (gst_s3_src_create);
+  gstbasesrc_class->unlock = GST_DEBUG_FUNCPTR (gst_s3_src_unlock);
+  gstbasesrc_class->unlock_stop = GST_DEBUG_FUNCPTR (gst_s3_src_unlock_stop);
+}
+
+static void
+gst_s3_destroy_downloader (GstS3Src * src)
+{
+  if (src->downloader) {
+    gst_s3_downloader_destroy (src->downloader);
+    src->downloader = NULL;
+  }
+}
+
+static void
+gst_s3_src_init (GstS3Src * s3src)
+{
+  s3src->config = GST_S3_DOWNLOADER_CONFIG_INIT;
+  s3src->config.credentials = gst_aws_credentials_new_default ();
+  s3src->downloader = NULL;
+  s3src->is_started = FALSE;
+  s3src->size = 0;
+
+  /* whole chunks in push mode */
+  gst_base_src_set_blocksize (GST_BASE_SRC (s3src), DEFAULT_CHUNK_SIZE);
+}
+
+static void
+gst_s3_src_release_config (GstS3DownloaderConfig * config)
+{
+  g_free (config->region);
+  g_free (config->bucket);
+  g_free (config->key);
+  g_free (config->location);
+  g_free (config->ca_file);
+  g_free (config->disk_cache_directory);
+  g_free (config->aws_sdk_endpoint);
+  g_free (config->bucket_region_cache_file);
+  gst_aws_credentials_free (config->credentials);
+
+  *config = GST_S3_DOWNLOADER_CONFIG_INIT;
+}
+
+static void
+gst_s3_src_dispose (GObject * object)
+{
+  GstS3Src *src = GST_S3_SRC (object);
+
+  gst_s3_src_release_config (&src->config);
+
+  gst_s3_destroy_downloader (src);
+
+  G_OBJECT_CLASS (parent_class)->dispose (object);
+}
+
+static void
+gst_s3_src_set_string_property (GstS3Src * src, const gchar * value,
+    gchar ** property, const gchar * property_name)
+{
+  if (src->is_started) {
+    GST_WARNING ("Changing the `%s' property on s3src "
+        "when streaming has started is not supported.", property_name);
+    return;
+  }
+
+  g_free (*property);
+
+  if (value != NULL) {
+    *property = g_strdup (value);
+    GST_INFO_OBJECT (src, "%s : %s", property_name, *property);
+  } else {
+    *property = NULL;
+  }
+}
+
+static void
+gst_s3_src_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstS3Src *src = GST_S3_SRC (object);
+
+  switch (prop_id) {
+    case PROP_BUCKET:
+      gst_s3_src_set_string_property (src, g_value_get_string (value),
+          &src->config.bucket, "bucket");
+      break;
+    case PROP_KEY:
+      gst_s3_src_set_string_property (src, g_value_get_string (value),
+          &src->config.key, "key");
+      break;
+    case PROP_LOCATION:
+      gst_s3_src_set_string_property (src, g_value_get_string (value),
+          &src->config.location, "location");
+      break;
+    case PROP_CA_FILE:
+      gst_s3_src_set_string_property (src, g_value_get_string (value),
+          &src->config.ca_file, "ca-file");
+      break;
+    case PROP_REGION:
+      gst_s3_src_set_string_property (src, g_value_get_string (value),
+          &src->config.region, "region");
+      break;
+    case PROP_BLOCK_SIZE:
+      if (src->is_started) {
+        GST_WARNING
+            ("Changing block-size property after starting the element is not supported.");
+      } else {
+        src->config.block_size = g_value_get_uint (value);
+      }
+      break;
+    case PROP_CHUNK_SIZE:
+      if (src->is_started) {
+        GST_WARNING
+            ("Changing chunk-size property after starting the element is not supported.");
+      } else {
+        src->config.chunk_size = g_value_get_uint (value);
+        gst_base_src_set_blocksize (GST_BASE_SRC (src), src->config.chunk_size);
+      }
+      break;
+    case PROP_READ_AHEAD:
+      if (src->is_started) {
+        GST_WARNING
+            ("Changing read-ahead property after starting the element is not supported.");
+      } else {
+        src->config.read_ahead = g_value_get_uint (value);
+      }
+      break;
+    case PROP_CACHE_SIZE:
+      if (src->is_started) {
+        GST_WARNING
+            ("Changing cache-size property after starting the element is not supported.");
+      } else {
+        src->config.cache_size = g_value_get_uint64 (value);
+      }
+      break;
+    case PROP_DISK_CACHE_DIRECTORY:
+      gst_s3_src_set_string_property (src, g_value_get_string (value),
+          &src->config.disk_cache_directory, "disk-cache-directory");
+      break;
+    case PROP_DISK_CACHE_SIZE:
+      if (src->is_started) {
+        GST_WARNING
+            ("Changing disk-cache-size property after starting the element is not supported.");
+      } else {
+        src->config.disk_cache_size = g_value_get_uint64 (value);
+      }
+      break;
+    case PROP_INIT_AWS_SDK:
+      src->config.init_aws_sdk = g_value_get_boolean (value);
+      break;
+    case PROP_CREDENTIALS:
+      if (src->config.credentials)
+        gst_aws_credentials_free (src->config.credentials);
+      src->config.credentials = gst_aws_credentials_copy (g_value_get_boxed (value));
+      break;
+    case PROP_AWS_SDK_ENDPOINT:
+      gst_s3_src_set_string_property (src, g_value_get_string (value),
+          &src->config.aws_sdk_endpoint, "aws-sdk-endpoint");
+      break;
+    case PROP_AWS_SDK_USE_HTTP:
+      src->config.aws_sdk_use_http = g_value_get_boolean (value);
+      break;
+    case PROP_AWS_SDK_VERIFY_SSL:
+      src->config.aws_sdk_verify_ssl = g_value_get_boolean (value);
+      break;
+    case PROP_MAX_CONNECTIONS:
+      src->config.max_connections = g_value_get_uint (value);
+      break;
+    case PROP_BUCKET_REGION_CACHE_TTL:
+      src->config.bucket_region_cache_ttl = g_value_get_uint64 (value);
+      break;
+    case PROP_BUCKET_REGION_CACHE_FILE:
+      gst_s3_src_set_string_property (src, g_value_get_string (value),
+          &src->config.bucket_region_cache_file, "bucket-region-cache-file");
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_s3_src_get_property (GObject * object, guint prop_id, GValue * value,
+    GParamSpec * pspec)
+{
+  GstS3Src *src = GST_S3_SRC (object);
+
+  switch (prop_id) {
+    case PROP_BUCKET:
+      g_value_set_string (value, src->config.bucket);
+      break;
+    case PROP_KEY:
+      g_value_set_string (value, src->config.key);
+      break;
+    case PROP_LOCATION:
+      g_value_set_string (value, src->config.location);
+      break;
+    case PROP_CA_FILE:
+      g_value_set_string (value, src->config.ca_file);
+      break;
+    case PROP_REGION:
+      g_value_set_string (value, src->config.region);
+      break;
+    case PROP_BLOCK_SIZE:
+      g_value_set_uint (value, src->config.block_size);
+      break;
+    case PROP_CHUNK_SIZE:
+      g_value_set_uint (value, src->config.chunk_size);
+      break;
+    case PROP_READ_AHEAD:
+      g_value_set_uint (value, src->config.read_ahead);
+      break;
+    case PROP_CACHE_SIZE:
+      g_value_set_uint64 (value, src->config.cache_size);
+      break;
+    case PROP_DISK_CACHE_DIRECTORY:
+      g_value_set_string (value, src->config.disk_cache_directory);
+      break;
+    case PROP_DISK_CACHE_SIZE:
+      g_value_set_uint64 (value, src->config.disk_cache_size);
+      break;
+    case PROP_INIT_AWS_SDK:
+      g_value_set_boolean (value, src->config.init_aws_sdk);
+      break;
+    case PROP_AWS_SDK_ENDPOINT:
+      g_value_set_string (value, src->config.aws_sdk_endpoint);
+      break;
+    case PROP_AWS_SDK_USE_HTTP:
+      g_value_set_boolean (value, src->config.aws_sdk_use_http);
+      break;
+    case PROP_AWS_SDK_VERIFY_SSL:
+      g_value_set_boolean (value, src->config.aws_sdk_verify_ssl);
+      break;
+    case PROP_MAX_CONNECTIONS:
+      g_value_set_uint (value, src->config.max_connections);
+      break;
+    case PROP_BUCKET_REGION_CACHE_TTL:
+      g_value_set_uint64 (value, src->config.bucket_region_cache_ttl);
+      break;
+    case PROP_BUCKET_REGION_CACHE_FILE:
+      g_value_set_string (value, src->config.bucket_region_cache_file);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static gboolean
+gst_s3_src_is_null_or_empty (const gchar * str)
+{
+  return str == NULL || str[0] == '\0';
+}
+
+static void
+gst_s3_src_post_read_error (GstS3Src * src, const gchar * what)
+{
+  gchar *error_code = NULL;
+  gchar *error_message = NULL;
+
+  if (gst_s3_downloader_get_error (src->downloader, &error_code,
+          &error_message)) {
+    GST_ELEMENT_ERROR_WITH_DETAILS (src, RESOURCE, READ,
+        ("%s", what), ("%s: %s", error_code, error_message),
+        ("error-code", G_TYPE_STRING, error_code, NULL));
+  } else {
+    GST_ELEMENT_ERROR (src, RESOURCE, READ, ("%s", what), (NULL));
+  }
+
+  g_free (error_code);
+  g_free (error_message);
+}
+
+static gboolean
+gst_s3_src_start (GstBaseSrc * basesrc)
+{
+  GstS3Src *src = GST_S3_SRC (basesrc);
+
+  if (gst_s3_src_is_null_or_empty (src->config.location) && (
+      gst_s3_src_is_null_or_empty (src->config.bucket)
+      || gst_s3_src_is_null_or_empty (src->config.key)))
+    goto no_source;
+
+  if (src->downloader == NULL)
+    src->downloader = gst_s3_range_downloader_new (&src->config);
+
+  if (!src->downloader)
+    goto init_failed;
+
+  if (!gst_s3_downloader_get_size (src->downloader, &src->size))
+    goto no_size;
+
+  if (gst_s3_src_is_null_or_empty (src->config.location)) {
+    GST_DEBUG_OBJECT (src, "started S3 download %s %s (%" G_GUINT64_FORMAT
+        " bytes)", src->config.bucket, src->config.key, src->size);
+  } else {
+    GST_DEBUG_OBJECT (src, "started S3 download %s (%" G_GUINT64_FORMAT
+        " bytes)", src->config.location, src->size);
+  }
+
+  src->is_started = TRUE;
+
+  return TRUE;
+
+  /* ERRORS */
+no_source:
+  {
+    GST_ELEMENT_ERROR (src, RESOURCE, NOT_FOUND,
+        ("No bucket or key specified for reading."), (NULL));
+    return FALSE;
+  }
+
+init_failed:
+  {
+    GST_ELEMENT_ERROR (src, RESOURCE, OPEN_READ,
+        ("Unable to initialize S3 downloader."), (NULL));
+    return FALSE;
+  }
+
+no_size:
+  {
+    gst_s3_src_post_read_error (src, "Unable to get the size of the object.");
+    gst_s3_destroy_downloader (src);
+    return FALSE;
+  }
+}
+
+static gboolean
+gst_s3_src_stop (GstBaseSrc * basesrc)
+{
+  GstS3Src *src = GST_S3_SRC (basesrc);
+
+  gst_s3_destroy_downloader (src);
+  src->size = 0;
+  src->is_started = FALSE;
+
+  return TRUE;
+}
+
+static gboolean
+gst_s3_src_get_size (GstBaseSrc * basesrc, guint64 * size)
+{
+  GstS3Src *src = GST_S3_SRC (basesrc);
+
+  if (!src->is_started)
+    return FALSE;
+
+  *size = src->size;
+  return TRUE;
+}
+
+static gboolean
+gst_s3_src_is_seekable (GstBaseSrc * basesrc)
+{
+  REQUIRED_BUT_UNUSED(basesrc);
+  return TRUE;
+}
+
+/* The downloader hands out at most a block at a time; in pull mode the
+ * buffer must have the requested length unless the object ends first. */
+static GstFlowReturn
+gst_s3_src_create (GstBaseSrc * basesrc, guint64 offset, guint length,
+    GstBuffer ** buffer)
+{
+  GstS3Src *src = GST_S3_SRC (basesrc);
+  GstBuffer *buf = NULL;
+  guint64 position = offset;
+
+  if (offset >= src->size)
+    return GST_FLOW_EOS;
+
+  while (position < offset + length && position < src->size) {
+    GstBuffer *part = gst_s3_downloader_read (src->downloader, position,
+        offset + length - position);
+    gsize part_size;
+
+    if (part == NULL)
+      goto read_failed;
+
+    part_size = gst_buffer_get_size (part);
+    if (part_size == 0) {
+      gst_buffer_unref (part);
+      break;
+    }
+
+    position += part_size;
+    buf = buf ? gst_buffer_append (buf, part) : part;
+  }
+
+  if (buf == NULL)
+    return GST_FLOW_EOS;
+
+  GST_BUFFER_OFFSET (buf) = offset;
+  GST_BUFFER_OFFSET_END (buf) = position;
+  *buffer = buf;
+
+  return GST_FLOW_OK;
+
+read_failed:
+  {
+    if (buf)
+      gst_buffer_unref (buf);
+
+    /* interrupted by unlock() */
+    if (!gst_s3_downloader_get_error (src->downloader, NULL, NULL))
+      return GST_FLOW_FLUSHING;
+
+    gst_s3_src_post_read_error (src, "Failed to read from S3.");
+    return GST_FLOW_ERROR;
+  }
+}
+
+static gboolean
+gst_s3_src_unlock (GstBaseSrc * basesrc)
+{
+  GstS3Src *src = GST_S3_SRC (basesrc);
+
+  if (src->downloader)
+    gst_s3_downloader_unlock (src->downloader);
+
+  return TRUE;
+}
+
+static gboolean
+gst_s3_src_unlock_stop (GstBaseSrc * basesrc)
+{
+  GstS3Src *src = GST_S3_SRC (basesrc);
+
+  if (src->downloader)
+    gst_s3_downloader_unlock_stop (src->downloader);
+
+  return TRUE;
+}
@@ -2,6 +2,9 @@
 
 #define GET_CLASS_(uploader) ((GstS3Uploader*) (uploader))->klass
 
+#define PART_CHECKSUM_QUARK_ g_quark_from_static_string ("gst-s3-part-checksum")
+#define PART_FILE_QUARK_ g_quark_from_static_string ("gst-s3-part-file")
+
 void
 gst_s3_uploader_destroy (GstS3Uploader * uploader)
 {
@@ -10,9 +13,9 @@ gst_s3_uploader_destroy (GstS3Uploader * uploader)
 
 gboolean
 gst_s3_uploader_upload_part (GstS3Uploader * uploader,
-    const gchar * buffer, gsize size)
+    GstBufferList * buffers)
 {
-  return GET_CLASS_ (uploader)->upload_part (uploader, buffer, size);
+  return GET_CLASS_ (uploader)->upload_part (uploader, buffers);
 }
 
 gboolean
@@ -20,3 +23,121 @@ gst_s3_uploader_complete (GstS3Uploader * uploader)
 {
   return GET_CLASS_ (uploader)->complete (uploader);
 }
+
+gboolean
+gst_s3_uploader_has_capacity (GstS3Uploader * uploader, gsize size)
+{
+  if (GET_CLASS_ (uploader)->has_capacity == NULL)
+    return TRUE;
+
+  return GET_CLASS_ (uploader)->has_capacity (uploader, size);
+}
+
+gboolean
+gst_s3_uploader_wait_for_capacity (GstS3Uploader * uploader, gsize size)
+{
+  if (GET_CLASS_ (uploader)->wait_for_capacity == NULL)
+    return TRUE;
+
+  return GET_CLASS_ (uploader)->wait_for_capacity (uploader, size);
+}
+
+void
+gst_s3_uploader_unlock (GstS3Uploader * uploader)
+{
+  if (GET_CLASS_ (uploader)->unlock != NULL)
+    GET_CLASS_ (uploader)->unlock (uploader);
+}
+
+void
+gst_s3_uploader_unlock_stop (GstS3Uploader * uploader)
+{
+  if (GET_CLASS_ (uploader)->unlock_stop != NULL)
+    GET_CLASS_ (uploader)->unlock_stop (uploader);
+}
+
+gboolean
+gst_s3_uploader_get_error (GstS3Uploader * uploader, gint * part_number,
+    gchar ** error_code, gchar ** error_message)
+{
+  if (GET_CLASS_ (uploader)->get_error == NULL)
+    return FALSE;
+
+  return GET_CLASS_ (uploader)->get_error (uploader, part_number, error_code,
+      error_message);
+}
+
+gboolean
+gst_s3_uploader_put_object (GstS3Uploader * uploader, GstBufferList * buffers)
+{
+  if (GET_CLASS_ (uploader)->put_object == NULL) {
+    return gst_s3_uploader_upload_part (uploader, buffers)
+        && gst_s3_uploader_complete (uploader);
+  }
+
+  return GET_CLASS_ (uploader)->put_object (uploader, buffers);
+}
+
+gboolean
+gst_s3_uploader_begin_part (GstS3Uploader * uploader, gsize size)
+{
+  if (GET_CLASS_ (uploader)->begin_part == NULL)
+    return TRUE;
+
+  return GET_CLASS_ (uploader)->begin_part (uploader, size);
+}
+
+void
+gst_s3_uploader_append_part (GstS3Uploader * uploader, GstBuffer * buffer)
+{
+  if (GET_CLASS_ (uploader)->append_part != NULL)
+    GET_CLASS_ (uploader)->append_part (uploader, buffer);
+}
+
+GstS3Uploader *
+gst_s3_uploader_create_next (GstS3Uploader * uploader,
+    const GstS3UploaderConfig * config)
+{
+  if (GET_CLASS_ (uploader)->create_next == NULL)
+    return NULL;
+
+  return GET_CLASS_ (uploader)->create_next (uploader, config);
+}
+
+gchar *
+gst_s3_uploader_get_etag (GstS3Uploader * uploader)
+{
+  if (GET_CLASS_ (uploader)->get_etag == NULL)
+    return NULL;
+
+  return GET_CLASS_ (uploader)->get_etag (uploader);
+}
+
+void
+gst_s3_uploader_set_part_checksum (GstBufferList * buffers,
+    const gchar * checksum)
+{
+  gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (buffers),
+      PART_CHECKSUM_QUARK_, g_strdup (checksum), g_free);
+}
+
+const gchar *
+gst_s3_uploader_get_part_checksum (GstBufferList * buffers)
+{
+  return gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (buffers),
+      PART_CHECKSUM_QUARK_);
+}
+
+void
+gst_s3_uploader_set_part_file (GstBufferList * buffers, const gchar * path)
+{
+  gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (buffers),
+      PART_FILE_QUARK_, g_strdup (path), g_free);
+}
+
+const gchar *
+gst_s3_uploader_get_part_file (GstBufferList * buffers)
+{
+  return gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (buffers),
+      PART_FILE_QUARK_);
+}
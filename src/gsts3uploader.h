@@ -19,7 +19,7 @@
 #ifndef __GST_S3_UPLOADER_H__
 #define __GST_S3_UPLOADER_H__
 
-#include <glib.h>
+#include <gst/gst.h>
 
 #include "gsts3uploaderconfig.h"
 
@@ -29,8 +29,45 @@ typedef struct _GstS3Uploader GstS3Uploader;
 
 typedef struct {
   void (*destroy) (GstS3Uploader *);
-  gboolean (*upload_part) (GstS3Uploader *, const gchar *, gsize);
+  /* Takes ownership of the buffer list; the buffers are read in place
+   * while the part is being sent, so no copy of the data is made. */
+  gboolean (*upload_part) (GstS3Uploader *, GstBufferList *);
   gboolean (*complete) (GstS3Uploader *);
+
+  /* Optional flow control. An uploader that doesn't implement these
+   * accepts parts at any time. */
+  gboolean (*has_capacity) (GstS3Uploader *, gsize);
+  /* Returns FALSE when the wait was interrupted by unlock(). */
+  gboolean (*wait_for_capacity) (GstS3Uploader *, gsize);
+  void (*unlock) (GstS3Uploader *);
+  void (*unlock_stop) (GstS3Uploader *);
+
+  /* Optional. Returns TRUE once a part failed to upload for good, along
+   * with its number and the S3 error; every out parameter may be NULL. */
+  gboolean (*get_error) (GstS3Uploader *, gint *, gchar **, gchar **);
+
+  /* Optional. Writes the whole object at once, for objects that fit in a
+   * single part. Takes ownership of the buffer list; no other part may have
+   * been uploaded and complete() must not be called afterwards. */
+  gboolean (*put_object) (GstS3Uploader *, GstBufferList *);
+
+  /* Optional streaming of parts. begin_part() opens the upload of a part of
+   * the given size before its data is available, and append_part() feeds it
+   * as it arrives, without taking ownership of the buffer. The buffer list
+   * of the part is still handed to upload_part() once it's complete; if it
+   * turns out to be smaller than announced, it's sent as a regular part. */
+  gboolean (*begin_part) (GstS3Uploader *, gsize);
+  void (*append_part) (GstS3Uploader *, GstBuffer *);
+
+  /* Optional. Creates the uploader of another object with the same
+   * settings, where only the destination is taken from the config. It
+   * shares what it can with this one, and may start the upload before the
+   * first part arrives. Returns NULL when not supported or on failure. */
+  GstS3Uploader * (*create_next) (GstS3Uploader *, const GstS3UploaderConfig *);
+
+  /* Optional. The ETag of the object once it's written, NULL otherwise.
+   * Free with g_free(). */
+  gchar * (*get_etag) (GstS3Uploader *);
 } GstS3UploaderClass;
 
 struct _GstS3Uploader {
@@ -42,10 +79,49 @@ GstS3Uploader *gst_s3_uploader_new_default (const GstS3UploaderConfig * config);
 void gst_s3_uploader_destroy (GstS3Uploader * uploader);
 
 gboolean gst_s3_uploader_upload_part (GstS3Uploader *
-    uploader, const gchar * buffer, gsize size);
+    uploader, GstBufferList * buffers);
 
 gboolean gst_s3_uploader_complete (GstS3Uploader * uploader);
 
+gboolean gst_s3_uploader_has_capacity (GstS3Uploader * uploader, gsize size);
+
+gboolean gst_s3_uploader_wait_for_capacity (GstS3Uploader * uploader,
+    gsize size);
+
+void gst_s3_uploader_unlock (GstS3Uploader * uploader);
+
+void gst_s3_uploader_unlock_stop (GstS3Uploader * uploader);
+
+gboolean gst_s3_uploader_get_error (GstS3Uploader * uploader,
+    gint * part_number, gchar ** error_code, gchar ** error_message);
+
+gboolean gst_s3_uploader_put_object (GstS3Uploader * uploader,
+    GstBufferList * buffers);
+
+gboolean gst_s3_uploader_begin_part (GstS3Uploader * uploader, gsize size);
+
+void gst_s3_uploader_append_part (GstS3Uploader * uploader,
+    GstBuffer * buffer);
+
+GstS3Uploader *gst_s3_uploader_create_next (GstS3Uploader * uploader,
+    const GstS3UploaderConfig * config);
+
+gchar *gst_s3_uploader_get_etag (GstS3Uploader * uploader);
+
+/* The base64 encoded checksum of a part travels with its buffer list, in
+ * the algorithm set by the checksum_algorithm config option. */
+void gst_s3_uploader_set_part_checksum (GstBufferList * buffers,
+    const gchar * checksum);
+
+const gchar *gst_s3_uploader_get_part_checksum (GstBufferList * buffers);
+
+/* A part written to the spool (see gsts3spool.h) carries the path of its
+ * file, which the uploader deletes once the part is in S3. */
+void gst_s3_uploader_set_part_file (GstBufferList * buffers,
+    const gchar * path);
+
+const gchar *gst_s3_uploader_get_part_file (GstBufferList * buffers);
+
 G_END_DECLS
 
 #endif /* __GST_S3_UPLOADER_H__ */
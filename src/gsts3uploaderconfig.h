@@ -22,15 +22,60 @@
 #include <glib.h>
 
 #include "gstawscredentials.h"
+#include "gsts3uploadstats.h"
 
 G_BEGIN_DECLS
 
+typedef enum {
+  GST_S3_CHECKSUM_ALGORITHM_NONE,
+  GST_S3_CHECKSUM_ALGORITHM_CRC32,
+  GST_S3_CHECKSUM_ALGORITHM_CRC32C,
+  GST_S3_CHECKSUM_ALGORITHM_SHA256
+} GstS3ChecksumAlgorithm;
+
+typedef enum {
+  GST_S3_PAYLOAD_SIGNING_AUTO,
+  GST_S3_PAYLOAD_SIGNING_ALWAYS,
+  GST_S3_PAYLOAD_SIGNING_NEVER
+} GstS3PayloadSigning;
+
+typedef enum {
+  GST_S3_PART_DURATION_MODE_RUNNING_TIME,
+  GST_S3_PART_DURATION_MODE_WALL_CLOCK
+} GstS3PartDurationMode;
+
+typedef enum {
+  GST_S3_ABORT_POLICY_AUTO,
+  GST_S3_ABORT_POLICY_ABORT,
+  GST_S3_ABORT_POLICY_KEEP
+} GstS3AbortPolicy;
+
 #define GST_S3_UPLOADER_CONFIG_DEFAULT_BUFFER_SIZE 5 * 1024 * 1024
 #define GST_S3_UPLOADER_CONFIG_DEFAULT_BUFFER_COUNT 4
 #define GST_S3_UPLOADER_CONFIG_DEFAULT_INIT_AWS_SDK TRUE
 #define GST_S3_UPLOADER_CONFIG_DEFAULT_PROP_AWS_SDK_USE_HTTP FALSE
 #define GST_S3_UPLOADER_CONFIG_DEFAULT_PROP_AWS_SDK_VERIFY_SSL TRUE
 #define GST_S3_UPLOADER_CONFIG_DEFAULT_PROP_AWS_SDK_S3_SIGN_PAYLOAD TRUE
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_IN_FLIGHT_PARTS 0
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_IN_FLIGHT_BYTES 0
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_ADAPTIVE_BUFFER_COUNT FALSE
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_RETRY_MAX_ATTEMPTS 5
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_RETRY_BUDGET (60 * GST_SECOND)
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_CONNECTIONS 25
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_BUCKET_REGION_CACHE_TTL (3600 * GST_SECOND)
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_UPLOAD_THREADS 0
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_UPLOAD_THREAD_NICE 0
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_CHECKSUM_ALGORITHM GST_S3_CHECKSUM_ALGORITHM_NONE
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_PAYLOAD_SIGNING GST_S3_PAYLOAD_SIGNING_AUTO
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_STREAMING_PARTS FALSE
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_PART_DURATION 0
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_PART_DURATION_MODE GST_S3_PART_DURATION_MODE_RUNNING_TIME
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_SPOOL_SYNC TRUE
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_RESUME FALSE
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_ABORT_POLICY GST_S3_ABORT_POLICY_AUTO
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_SEGMENT_SIZE 0
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_SEGMENT_DURATION 0
+#define GST_S3_UPLOADER_CONFIG_DEFAULT_ASYNC_FINALIZE FALSE
 
 typedef struct {
   gchar * region;
@@ -48,6 +93,32 @@ typedef struct {
   gboolean aws_sdk_use_http;
   gboolean aws_sdk_verify_ssl;
   gboolean aws_sdk_s3_sign_payload;
+  gsize max_in_flight_parts;
+  guint64 max_in_flight_bytes;
+  gboolean adaptive_buffer_count;
+  guint retry_max_attempts;
+  GstClockTime retry_budget;
+  guint max_connections;
+  GstClockTime bucket_region_cache_ttl;
+  gchar * bucket_region_cache_file;
+  guint upload_threads;
+  gchar * upload_thread_affinity;
+  gint upload_thread_nice;
+  GstS3ChecksumAlgorithm checksum_algorithm;
+  GstS3PayloadSigning payload_signing;
+  gboolean streaming_parts;
+  GstClockTime max_part_duration;
+  GstS3PartDurationMode part_duration_mode;
+  gchar * spool_directory;
+  gboolean spool_sync;
+  gboolean resume;
+  GstS3AbortPolicy abort_policy;
+  guint64 max_segment_size;
+  GstClockTime max_segment_duration;
+  gboolean async_finalize;
+  /* Not owned. The uploaders add to these counters when set, and the ones
+   * created with create_next() share them anyway. */
+  GstS3UploadStats * stats;
 } GstS3UploaderConfig;
 
 #define GST_S3_UPLOADER_CONFIG_INIT (GstS3UploaderConfig) { \
@@ -58,7 +129,31 @@ typedef struct {
   NULL, \
   GST_S3_UPLOADER_CONFIG_DEFAULT_PROP_AWS_SDK_USE_HTTP, \
   GST_S3_UPLOADER_CONFIG_DEFAULT_PROP_AWS_SDK_VERIFY_SSL, \
-  GST_S3_UPLOADER_CONFIG_DEFAULT_PROP_AWS_SDK_S3_SIGN_PAYLOAD \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_PROP_AWS_SDK_S3_SIGN_PAYLOAD, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_IN_FLIGHT_PARTS, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_IN_FLIGHT_BYTES, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_ADAPTIVE_BUFFER_COUNT, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_RETRY_MAX_ATTEMPTS, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_RETRY_BUDGET, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_CONNECTIONS, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_BUCKET_REGION_CACHE_TTL, \
+  NULL, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_UPLOAD_THREADS, \
+  NULL, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_UPLOAD_THREAD_NICE, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_CHECKSUM_ALGORITHM, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_PAYLOAD_SIGNING, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_STREAMING_PARTS, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_PART_DURATION, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_PART_DURATION_MODE, \
+  NULL, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_SPOOL_SYNC, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_RESUME, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_ABORT_POLICY, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_SEGMENT_SIZE, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_MAX_SEGMENT_DURATION, \
+  GST_S3_UPLOADER_CONFIG_DEFAULT_ASYNC_FINALIZE, \
+  NULL \
 }
 
 G_END_DECLS
@@ -0,0 +1,218 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include "gsts3uploadstats.h"
+
+#include <atomic>
+
+struct _GstS3UploadStats
+{
+    std::atomic<int> refcount;
+    std::atomic<guint64> counters[GST_S3_UPLOAD_COUNTER_COUNT];
+    std::atomic<guint64> requests[GST_S3_REQUEST_COUNT];
+
+    std::atomic<guint64> parts_completed;
+    std::atomic<guint64> part_bytes;
+    std::atomic<guint64> part_latency_total;
+    std::atomic<guint64> part_latency_max;
+    std::atomic<guint64> last_part_latency;
+    std::atomic<guint64> latency_buckets[GST_S3_UPLOAD_STATS_LATENCY_BUCKETS];
+};
+
+// From a fast local store to a part taking its time over a slow uplink.
+static const GstClockTime latency_bounds[GST_S3_UPLOAD_STATS_LATENCY_BUCKETS] = {
+    10 * GST_MSECOND,
+    25 * GST_MSECOND,
+    50 * GST_MSECOND,
+    100 * GST_MSECOND,
+    250 * GST_MSECOND,
+    500 * GST_MSECOND,
+    1 * GST_SECOND,
+    2500 * GST_MSECOND,
+    5 * GST_SECOND,
+    10 * GST_SECOND,
+    30 * GST_SECOND,
+    60 * GST_SECOND,
+    GST_CLOCK_TIME_NONE
+};
+
+// Reads are relaxed too: the counters are independent of each other, a
+// snapshot may be a few updates behind on some of them.
+static guint64
+load (const std::atomic<guint64>& counter)
+{
+    return counter.load(std::memory_order_relaxed);
+}
+
+static const char*
+get_request_field_name (GstS3Request request)
+{
+    switch (request)
+    {
+    case GST_S3_REQUEST_CREATE_MULTIPART_UPLOAD:
+        return "create-multipart-upload-requests";
+    case GST_S3_REQUEST_UPLOAD_PART:
+        return "upload-part-requests";
+    case GST_S3_REQUEST_COMPLETE_MULTIPART_UPLOAD:
+        return "complete-multipart-upload-requests";
+    case GST_S3_REQUEST_ABORT_MULTIPART_UPLOAD:
+        return "abort-multipart-upload-requests";
+    case GST_S3_REQUEST_LIST_PARTS:
+        return "list-parts-requests";
+    case GST_S3_REQUEST_PUT_OBJECT:
+        return "put-object-requests";
+    default:
+        g_assert_not_reached();
+        return nullptr;
+    }
+}
+
+GstS3UploadStats *
+gst_s3_upload_stats_new (void)
+{
+    GstS3UploadStats* stats = new GstS3UploadStats;
+
+    stats->refcount.store(1);
+    for (auto& counter : stats->counters)
+    {
+        counter.store(0);
+    }
+    for (auto& counter : stats->requests)
+    {
+        counter.store(0);
+    }
+    for (auto& counter : stats->latency_buckets)
+    {
+        counter.store(0);
+    }
+    stats->parts_completed.store(0);
+    stats->part_bytes.store(0);
+    stats->part_latency_total.store(0);
+    stats->part_latency_max.store(0);
+    stats->last_part_latency.store(0);
+
+    return stats;
+}
+
+GstS3UploadStats *
+gst_s3_upload_stats_ref (GstS3UploadStats * stats)
+{
+    stats->refcount.fetch_add(1, std::memory_order_relaxed);
+    return stats;
+}
+
+void
+gst_s3_upload_stats_unref (GstS3UploadStats * stats)
+{
+    if (stats->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        delete stats;
+    }
+}
+
+void
+gst_s3_upload_stats_add (GstS3UploadStats * stats, GstS3UploadCounter counter, guint64 value)
+{
+    stats->counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void
+gst_s3_upload_stats_count_request (GstS3UploadStats * stats, GstS3Request request)
+{
+    stats->requests[request].fetch_add(1, std::memory_order_relaxed);
+}
+
+void
+gst_s3_upload_stats_add_completed_part (GstS3UploadStats * stats, gsize size, GstClockTime latency)
+{
+    stats->counters[GST_S3_UPLOAD_COUNTER_BYTES_ACKNOWLEDGED].fetch_add(size, std::memory_order_relaxed);
+    stats->part_bytes.fetch_add(size, std::memory_order_relaxed);
+    stats->part_latency_total.fetch_add(latency, std::memory_order_relaxed);
+    stats->last_part_latency.store(latency, std::memory_order_relaxed);
+
+    guint bucket = 0;
+    while (latency > latency_bounds[bucket])
+    {
+        bucket++;
+    }
+    stats->latency_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    guint64 max = load(stats->part_latency_max);
+    while (latency > max &&
+        !stats->part_latency_max.compare_exchange_weak(max, latency, std::memory_order_relaxed))
+    {
+    }
+
+    // Last, so that a reader never sees more completed parts than started ones.
+    stats->parts_completed.fetch_add(1, std::memory_order_relaxed);
+}
+
+GstClockTime
+gst_s3_upload_stats_get_latency_bound (guint bucket)
+{
+    g_return_val_if_fail(bucket < GST_S3_UPLOAD_STATS_LATENCY_BUCKETS, GST_CLOCK_TIME_NONE);
+
+    return latency_bounds[bucket];
+}
+
+GstClockTime
+gst_s3_upload_stats_get_latency_histogram (GstS3UploadStats * stats,
+    guint64 counts[GST_S3_UPLOAD_STATS_LATENCY_BUCKETS])
+{
+    for (guint bucket = 0; bucket < GST_S3_UPLOAD_STATS_LATENCY_BUCKETS; bucket++)
+    {
+        counts[bucket] = load(stats->latency_buckets[bucket]);
+    }
+
+    return load(stats->part_latency_total);
+}
+
+GstStructure *
+gst_s3_upload_stats_to_structure (GstS3UploadStats * stats, const gchar * name)
+{
+    guint64 completed = load(stats->parts_completed);
+    guint64 failed = load(stats->counters[GST_S3_UPLOAD_COUNTER_PARTS_FAILED]);
+    guint64 abandoned = load(stats->counters[GST_S3_UPLOAD_COUNTER_PARTS_ABANDONED]);
+    guint64 started = load(stats->counters[GST_S3_UPLOAD_COUNTER_PARTS_STARTED]);
+    guint64 part_bytes = load(stats->part_bytes);
+    guint64 latency_total = load(stats->part_latency_total);
+    guint64 ended = completed + failed + abandoned;
+
+    GstStructure* s = gst_structure_new(name,
+        "bytes-enqueued", G_TYPE_UINT64, load(stats->counters[GST_S3_UPLOAD_COUNTER_BYTES_ENQUEUED]),
+        "bytes-acknowledged", G_TYPE_UINT64, load(stats->counters[GST_S3_UPLOAD_COUNTER_BYTES_ACKNOWLEDGED]),
+        "parts-in-flight", G_TYPE_UINT64, started > ended ? started - ended : 0,
+        "parts-completed", G_TYPE_UINT64, completed,
+        "parts-failed", G_TYPE_UINT64, failed,
+        "parts-retried", G_TYPE_UINT64, load(stats->counters[GST_S3_UPLOAD_COUNTER_PARTS_RETRIED]),
+        "part-latency-average", G_TYPE_UINT64, completed ? latency_total / completed : 0,
+        "part-latency-max", G_TYPE_UINT64, load(stats->part_latency_max),
+        "last-part-latency", G_TYPE_UINT64, load(stats->last_part_latency),
+        "part-throughput", G_TYPE_DOUBLE,
+            latency_total ? part_bytes * (gdouble) GST_SECOND / latency_total : 0.0,
+        "blocked-time", G_TYPE_UINT64, load(stats->counters[GST_S3_UPLOAD_COUNTER_BLOCKED_TIME]),
+        NULL);
+
+    for (int request = 0; request < GST_S3_REQUEST_COUNT; request++)
+    {
+        gst_structure_set(s, get_request_field_name(static_cast<GstS3Request>(request)),
+            G_TYPE_UINT64, load(stats->requests[request]), NULL);
+    }
+
+    return s;
+}
@@ -0,0 +1,91 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#ifndef __GST_S3_UPLOAD_STATS_H__
+#define __GST_S3_UPLOAD_STATS_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Counters of the uploads of an element, shared by its uploaders. They're
+ * updated without taking any lock, so that reading them doesn't hold up
+ * the upload threads. */
+typedef struct _GstS3UploadStats GstS3UploadStats;
+
+typedef enum {
+  GST_S3_UPLOAD_COUNTER_BYTES_ENQUEUED,
+  GST_S3_UPLOAD_COUNTER_BYTES_ACKNOWLEDGED,
+  GST_S3_UPLOAD_COUNTER_PARTS_STARTED,
+  GST_S3_UPLOAD_COUNTER_PARTS_FAILED,
+  /* streamed parts given up on, and sent again as regular parts */
+  GST_S3_UPLOAD_COUNTER_PARTS_ABANDONED,
+  GST_S3_UPLOAD_COUNTER_PARTS_RETRIED,
+  /* nanoseconds the sink waited for the uploader to accept a part */
+  GST_S3_UPLOAD_COUNTER_BLOCKED_TIME,
+  GST_S3_UPLOAD_COUNTER_COUNT
+} GstS3UploadCounter;
+
+/* The S3 calls made by the uploaders; the retries done by the SDK itself
+ * aren't counted. */
+typedef enum {
+  GST_S3_REQUEST_CREATE_MULTIPART_UPLOAD,
+  GST_S3_REQUEST_UPLOAD_PART,
+  GST_S3_REQUEST_COMPLETE_MULTIPART_UPLOAD,
+  GST_S3_REQUEST_ABORT_MULTIPART_UPLOAD,
+  GST_S3_REQUEST_LIST_PARTS,
+  GST_S3_REQUEST_PUT_OBJECT,
+  GST_S3_REQUEST_COUNT
+} GstS3Request;
+
+GstS3UploadStats *gst_s3_upload_stats_new (void);
+
+GstS3UploadStats *gst_s3_upload_stats_ref (GstS3UploadStats * stats);
+
+void gst_s3_upload_stats_unref (GstS3UploadStats * stats);
+
+void gst_s3_upload_stats_add (GstS3UploadStats * stats,
+    GstS3UploadCounter counter, guint64 value);
+
+void gst_s3_upload_stats_count_request (GstS3UploadStats * stats,
+    GstS3Request request);
+
+/* A part acknowledged by S3, latency being the time since it was started,
+ * retries included. */
+void gst_s3_upload_stats_add_completed_part (GstS3UploadStats * stats,
+    gsize size, GstClockTime latency);
+
+/* The part latencies are also counted in buckets, the last one of which
+ * has no upper bound. */
+#define GST_S3_UPLOAD_STATS_LATENCY_BUCKETS 13
+
+/* The upper bound of the bucket, GST_CLOCK_TIME_NONE for the last one. */
+GstClockTime gst_s3_upload_stats_get_latency_bound (guint bucket);
+
+/* Fills counts with the number of parts in each bucket, not cumulated, and
+ * returns the total latency of the parts. */
+GstClockTime gst_s3_upload_stats_get_latency_histogram (GstS3UploadStats *
+    stats, guint64 counts[GST_S3_UPLOAD_STATS_LATENCY_BUCKETS]);
+
+/* A snapshot of the counters. Free with gst_structure_free(). */
+GstStructure *gst_s3_upload_stats_to_structure (GstS3UploadStats * stats,
+    const gchar * name);
+
+G_END_DECLS
+
+#endif /* __GST_S3_UPLOAD_STATS_H__ */
@@ -0,0 +1,197 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include "gsts3client.hpp"
+#include "gstawscredentials.hpp"
+
+#include <aws/core/client/DefaultRetryStrategy.h>
+#include <aws/s3/S3Errors.h>
+
+#include <glib/gstdio.h>
+#include <gst/check/gstcheck.h>
+
+using namespace gst::aws::s3;
+
+static GstAWSCredentials*
+new_static_credentials()
+{
+    return gst_aws_credentials_new([] {
+        return std::unique_ptr<Aws::Auth::AWSCredentialsProvider>(
+            new Aws::Auth::SimpleAWSCredentialsProvider("access-key", "secret-key"));
+    });
+}
+
+GST_START_TEST(test_clients_are_shared_by_the_same_configuration)
+{
+    auto api_handle = AwsApiHandle::GetHandle();
+    GstAWSCredentials* credentials = new_static_credentials();
+    GstAWSCredentials* copy = gst_aws_credentials_copy(credentials);
+    GstAWSCredentials* other_credentials = new_static_credentials();
+    std::vector<int> no_cpus;
+
+    Aws::S3::S3ClientConfiguration config;
+    config.region = "eu-west-1";
+    auto client = get_s3_client(config, 2, no_cpus, 0, credentials);
+    fail_unless(client != nullptr);
+    fail_unless(get_s3_client(config, 2, no_cpus, 0, copy) == client);
+
+    fail_unless(get_s3_client(config, 2, no_cpus, 0, other_credentials) != client);
+    fail_unless(get_s3_client(config, 3, no_cpus, 0, credentials) != client);
+    fail_unless(get_s3_client(config, 2, std::vector<int>{0}, 0, credentials) != client);
+
+    Aws::S3::S3ClientConfiguration other_config(config);
+    other_config.region = "us-east-1";
+    fail_unless(get_s3_client(other_config, 2, no_cpus, 0, credentials) != client);
+    other_config = config;
+    other_config.maxConnections = config.maxConnections + 1;
+    fail_unless(get_s3_client(other_config, 2, no_cpus, 0, credentials) != client);
+    other_config = config;
+    other_config.retryStrategy = std::make_shared<Aws::Client::DefaultRetryStrategy>(0);
+    fail_unless(get_s3_client(other_config, 2, no_cpus, 0, credentials) != client);
+
+    // only kept while it's used
+    std::weak_ptr<Aws::S3::S3Client> released = client;
+    client.reset();
+    fail_unless(released.expired());
+
+    gst_aws_credentials_free(other_credentials);
+    gst_aws_credentials_free(copy);
+    gst_aws_credentials_free(credentials);
+}
+GST_END_TEST
+
+GST_START_TEST(test_bucket_regions_expire)
+{
+    BucketRegionCache& cache = BucketRegionCache::get_instance();
+    Aws::String region;
+
+    cache.store("some-bucket", "eu-west-1", std::chrono::hours(1), "");
+    fail_unless(cache.lookup("some-bucket", "", region));
+    fail_unless_equals_string(region.c_str(), "eu-west-1");
+
+    cache.store("expired-bucket", "eu-west-1", std::chrono::nanoseconds(0), "");
+    fail_if(cache.lookup("expired-bucket", "", region));
+    fail_if(cache.lookup("unknown-bucket", "", region));
+}
+GST_END_TEST
+
+GST_START_TEST(test_bucket_regions_are_kept_in_the_file)
+{
+    BucketRegionCache& cache = BucketRegionCache::get_instance();
+    gchar* dir = g_dir_make_tmp("s3client-XXXXXX", nullptr);
+    gchar* file = g_build_filename(dir, "regions", nullptr);
+    GKeyFile* key_file = g_key_file_new();
+    Aws::String region;
+
+    // saved by another process
+    g_key_file_set_string(key_file, "saved-bucket", "region", "ap-south-1");
+    g_key_file_set_int64(key_file, "saved-bucket", "expiration-time", g_get_real_time() + G_TIME_SPAN_HOUR);
+    g_key_file_set_string(key_file, "expired-bucket", "region", "ap-south-1");
+    g_key_file_set_int64(key_file, "expired-bucket", "expiration-time", g_get_real_time() - 1);
+    fail_unless(g_key_file_save_to_file(key_file, file, nullptr));
+    g_key_file_free(key_file);
+
+    fail_unless(cache.lookup("saved-bucket", file, region));
+    fail_unless_equals_string(region.c_str(), "ap-south-1");
+    fail_if(cache.lookup("expired-bucket", file, region));
+
+    cache.store("new-bucket", "us-west-2", std::chrono::hours(1), file);
+
+    key_file = g_key_file_new();
+    fail_unless(g_key_file_load_from_file(key_file, file, G_KEY_FILE_NONE, nullptr));
+    gchar* saved_region = g_key_file_get_string(key_file, "new-bucket", "region", nullptr);
+    fail_unless_equals_string(saved_region, "us-west-2");
+    fail_unless(g_key_file_get_int64(key_file, "new-bucket", "expiration-time", nullptr) > g_get_real_time());
+    fail_unless(g_key_file_has_group(key_file, "saved-bucket"));
+    g_free(saved_region);
+    g_key_file_free(key_file);
+
+    g_unlink(file);
+    g_rmdir(dir);
+    g_free(file);
+    g_free(dir);
+}
+GST_END_TEST
+
+GST_START_TEST(test_redirects_name_the_region)
+{
+    Aws::Client::AWSError<Aws::S3::S3Errors> error(Aws::S3::S3Errors::UNKNOWN, "PermanentRedirect", "", false);
+    Aws::Http::HeaderValueCollection headers;
+    Aws::String region;
+
+    fail_if(get_redirect_region(error, "us-east-1", region));
+
+    headers["x-amz-bucket-region"] = "eu-central-1";
+    error.SetResponseHeaders(headers);
+    fail_unless(get_redirect_region(error, "us-east-1", region));
+    fail_unless_equals_string(region.c_str(), "eu-central-1");
+
+    // already sent there, it's some other error
+    fail_if(get_redirect_region(error, "eu-central-1", region));
+}
+GST_END_TEST
+
+GST_START_TEST(test_cpu_lists_are_parsed)
+{
+    fail_unless(parse_cpu_list("0-3,6") == (std::vector<int>{0, 1, 2, 3, 6}));
+    fail_unless(parse_cpu_list(nullptr).empty());
+    fail_unless(parse_cpu_list("").empty());
+    // the invalid ranges are skipped
+    fail_unless(parse_cpu_list("2,x,5-4,-1,3-,1") == (std::vector<int>{2, 1}));
+}
+GST_END_TEST
+
+GST_START_TEST(test_executors_are_shared_by_the_same_settings)
+{
+    std::vector<int> no_cpus;
+    auto executor = get_upload_executor(2, no_cpus, 0);
+
+    fail_unless(get_upload_executor(2, no_cpus, 0) == executor);
+    fail_unless(get_upload_executor(3, no_cpus, 0) != executor);
+    fail_unless(get_upload_executor(2, std::vector<int>{0}, 0) != executor);
+    fail_unless(get_upload_executor(2, no_cpus, 1) != executor);
+
+    fail_unless_equals_int(get_upload_threads(4), 4);
+    g_setenv("GST_S3_UPLOAD_THREADS", "8", TRUE);
+    fail_unless_equals_int(get_upload_threads(0), 8);
+    fail_unless_equals_int(get_upload_threads(4), 4);
+    g_unsetenv("GST_S3_UPLOAD_THREADS");
+    fail_unless_equals_int(get_upload_threads(0), DEFAULT_UPLOAD_THREADS);
+}
+GST_END_TEST
+
+static Suite*
+s3client_suite(void)
+{
+    Suite* s = suite_create("s3client");
+    TCase* tc_chain = tcase_create("general");
+
+    GST_DEBUG_CATEGORY_INIT(gst_s3_client_debug, "s3client", 0, "S3 client of the S3 elements");
+
+    suite_add_tcase(s, tc_chain);
+    tcase_add_test(tc_chain, test_clients_are_shared_by_the_same_configuration);
+    tcase_add_test(tc_chain, test_bucket_regions_expire);
+    tcase_add_test(tc_chain, test_bucket_regions_are_kept_in_the_file);
+    tcase_add_test(tc_chain, test_redirects_name_the_region);
+    tcase_add_test(tc_chain, test_cpu_lists_are_parsed);
+    tcase_add_test(tc_chain, test_executors_are_shared_by_the_same_settings);
+
+    return s;
+}
+
+GST_CHECK_MAIN(s3client)
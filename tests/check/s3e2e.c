@@ -0,0 +1,1053 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include "s3mockserver.h"
+#include "gsts3uploader.h"
+
+#include <string.h>
+
+#include <glib/gstdio.h>
+#include <gst/check/gstcheck.h>
+
+/* The elements with their real S3 client, against the mock server. */
+
+#define TEST_BUCKET "some-bucket"
+#define TEST_KEY "some/key"
+#define MIB (1024 * 1024)
+
+static GstStaticPadTemplate srctemplate = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static GstS3MockServer *server;
+
+static void
+setup_server (void)
+{
+  /* keep the SDK from looking for an instance metadata service */
+  g_setenv ("AWS_EC2_METADATA_DISABLED", "true", TRUE);
+  server = gst_s3_mock_server_new ();
+}
+
+static void
+teardown_server (void)
+{
+  gst_s3_mock_server_free (server);
+  server = NULL;
+}
+
+static guint
+get_request_count (GstS3MockOperation operation)
+{
+  return gst_s3_mock_server_get_request_count (server, operation);
+}
+
+static GBytes *
+create_data (gsize size)
+{
+  guint8 *data = g_malloc (size);
+  gsize i;
+
+  /* different in every part */
+  for (i = 0; i < size; i++)
+    data[i] = (i + (i >> 20)) & 0xff;
+
+  return g_bytes_new_take (data, size);
+}
+
+static void
+set_s3_properties (GstElement * element)
+{
+  g_object_set (element,
+      "bucket", TEST_BUCKET,
+      "key", TEST_KEY,
+      "region", "us-east-1",
+      "aws-sdk-endpoint", gst_s3_mock_server_get_endpoint (server),
+      "aws-sdk-use-http", TRUE,
+      NULL);
+  gst_util_set_object_arg (G_OBJECT (element), "aws-credentials",
+      "access-key-id=AKIDEXAMPLE|secret-access-key=secret");
+}
+
+static GstElement *
+setup_s3_sink (void)
+{
+  GstElement *sink = gst_element_factory_make ("s3sink", "sink");
+
+  fail_if (sink == NULL);
+  set_s3_properties (sink);
+
+  return sink;
+}
+
+static GstPad *
+start_pushing (GstElement * sink)
+{
+  GstPad *srcpad = gst_check_setup_src_pad (sink, &srctemplate);
+  GstSegment segment;
+
+  gst_pad_set_active (srcpad, TRUE);
+  fail_unless (gst_element_set_state (sink, GST_STATE_PLAYING)
+      == GST_STATE_CHANGE_ASYNC);
+
+  gst_segment_init (&segment, GST_FORMAT_BYTES);
+  fail_unless (gst_pad_push_event (srcpad,
+          gst_event_new_stream_start ("test")));
+  fail_unless (gst_pad_push_event (srcpad, gst_event_new_segment (&segment)));
+
+  return srcpad;
+}
+
+/* Pushes the range of the data in 1 MiB buffers. */
+static void
+push_range (GstPad * srcpad, GBytes * data, gsize offset, gsize end)
+{
+  const guint8 *bytes = g_bytes_get_data (data, NULL);
+
+  for (; offset < end; offset += MIB) {
+    gsize length = MIN (MIB, end - offset);
+    GstBuffer *buffer = gst_buffer_new_allocate (NULL, length, NULL);
+
+    gst_buffer_fill (buffer, 0, bytes + offset, length);
+    fail_unless_equals_int (GST_FLOW_OK, gst_pad_push (srcpad, buffer));
+  }
+}
+
+static void
+finish_pushing (GstElement * sink)
+{
+  GstPad *sinkpad = gst_element_get_static_pad (sink, "sink");
+
+  gst_pad_send_event (sinkpad, gst_event_new_eos ());
+  gst_object_unref (sinkpad);
+
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_check_teardown_src_pad (sink);
+}
+
+/* Writes the data to the sink in 1 MiB buffers, up to EOS. */
+static void
+push_data (GstElement * sink, GBytes * data)
+{
+  GstPad *srcpad = start_pushing (sink);
+
+  push_range (srcpad, data, 0, g_bytes_get_size (data));
+  finish_pushing (sink);
+}
+
+static gboolean
+object_equals (GBytes * data)
+{
+  GBytes *object = gst_s3_mock_server_get_object (server, TEST_BUCKET,
+      TEST_KEY);
+  gboolean equal = object && g_bytes_equal (object, data);
+
+  if (object)
+    g_bytes_unref (object);
+  return equal;
+}
+
+/* Waits for the requests made in the background, like the aborts. */
+static guint
+wait_for_request_count (GstS3MockOperation operation, guint count)
+{
+  gint64 end_time = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+
+  while (get_request_count (operation) < count
+      && g_get_monotonic_time () < end_time)
+    g_usleep (G_USEC_PER_SEC / 100);
+
+  return get_request_count (operation);
+}
+
+GST_START_TEST (test_multipart_upload_round_trip)
+{
+  GstElement *sink = setup_s3_sink ();
+  GBytes *data = create_data (12 * MIB);
+
+  push_data (sink, data);
+
+  fail_unless_equals_int (1,
+      get_request_count (GST_S3_MOCK_OPERATION_CREATE_MULTIPART_UPLOAD));
+  fail_unless_equals_int (3,
+      get_request_count (GST_S3_MOCK_OPERATION_UPLOAD_PART));
+  fail_unless_equals_int (1,
+      get_request_count (GST_S3_MOCK_OPERATION_COMPLETE_MULTIPART_UPLOAD));
+  fail_unless_equals_int (0,
+      gst_s3_mock_server_get_pending_upload_count (server));
+  fail_unless (object_equals (data));
+
+  g_bytes_unref (data);
+  gst_object_unref (sink);
+}
+GST_END_TEST
+
+GST_START_TEST (test_stats_account_for_the_upload)
+{
+  GstElement *sink = setup_s3_sink ();
+  GBytes *data = create_data (12 * MIB);
+  GstStructure *stats = NULL;
+  guint64 value;
+
+  push_data (sink, data);
+
+  g_object_get (sink, "stats", &stats, NULL);
+  fail_unless (stats != NULL);
+  fail_unless (gst_structure_has_name (stats, "s3sink-stats"));
+  fail_unless (gst_structure_get_uint64 (stats, "bytes-enqueued", &value));
+  fail_unless_equals_uint64 (12 * MIB, value);
+  fail_unless (gst_structure_get_uint64 (stats, "bytes-acknowledged",
+          &value));
+  fail_unless_equals_uint64 (12 * MIB, value);
+  fail_unless (gst_structure_get_uint64 (stats, "parts-completed", &value));
+  fail_unless_equals_uint64 (3, value);
+  fail_unless (gst_structure_get_uint64 (stats, "parts-in-flight", &value));
+  fail_unless_equals_uint64 (0, value);
+  fail_unless (gst_structure_get_uint64 (stats, "upload-part-requests",
+          &value));
+  fail_unless_equals_uint64 (3, value);
+  fail_unless (gst_structure_get_uint64 (stats,
+          "complete-multipart-upload-requests", &value));
+  fail_unless_equals_uint64 (1, value);
+
+  gst_structure_free (stats);
+  g_bytes_unref (data);
+  gst_object_unref (sink);
+}
+GST_END_TEST
+
+GST_START_TEST (test_small_object_is_put_at_once)
+{
+  GstElement *sink = setup_s3_sink ();
+  GBytes *data = create_data (MIB + 17);
+
+  push_data (sink, data);
+
+  fail_unless_equals_int (1,
+      get_request_count (GST_S3_MOCK_OPERATION_PUT_OBJECT));
+  fail_unless_equals_int (0,
+      get_request_count (GST_S3_MOCK_OPERATION_UPLOAD_PART));
+  fail_unless (object_equals (data));
+
+  g_bytes_unref (data);
+  gst_object_unref (sink);
+}
+GST_END_TEST
+
+GST_START_TEST (test_failed_parts_are_retried)
+{
+  GstElement *sink = setup_s3_sink ();
+  GBytes *data = create_data (12 * MIB);
+  GstStructure *stats = NULL;
+  guint64 value;
+
+  gst_s3_mock_server_add_fault (server, GST_S3_MOCK_OPERATION_UPLOAD_PART,
+      GST_S3_MOCK_FAULT_INTERNAL_ERROR, 2);
+  gst_s3_mock_server_add_fault (server, GST_S3_MOCK_OPERATION_UPLOAD_PART,
+      GST_S3_MOCK_FAULT_TRUNCATE, 1);
+
+  push_data (sink, data);
+
+  /* retried by the sink itself, not by the SDK */
+  fail_unless_equals_int (6,
+      get_request_count (GST_S3_MOCK_OPERATION_UPLOAD_PART));
+  g_object_get (sink, "stats", &stats, NULL);
+  fail_unless (gst_structure_get_uint64 (stats, "parts-retried", &value));
+  fail_unless_equals_uint64 (3, value);
+  fail_unless (gst_structure_get_uint64 (stats, "upload-part-requests",
+          &value));
+  fail_unless_equals_uint64 (6, value);
+  fail_unless (object_equals (data));
+
+  gst_structure_free (stats);
+  g_bytes_unref (data);
+  gst_object_unref (sink);
+}
+GST_END_TEST
+
+GST_START_TEST (test_throttled_requests_are_retried)
+{
+  GstElement *sink = setup_s3_sink ();
+  GBytes *data = create_data (6 * MIB);
+  GstStructure *stats = NULL;
+  guint64 value;
+
+  gst_s3_mock_server_add_fault (server,
+      GST_S3_MOCK_OPERATION_CREATE_MULTIPART_UPLOAD,
+      GST_S3_MOCK_FAULT_SLOW_DOWN, 2);
+  gst_s3_mock_server_add_fault (server,
+      GST_S3_MOCK_OPERATION_COMPLETE_MULTIPART_UPLOAD,
+      GST_S3_MOCK_FAULT_SLOW_DOWN, 1);
+
+  push_data (sink, data);
+
+  fail_unless_equals_int (3,
+      get_request_count (GST_S3_MOCK_OPERATION_CREATE_MULTIPART_UPLOAD));
+  fail_unless_equals_int (2,
+      get_request_count (GST_S3_MOCK_OPERATION_COMPLETE_MULTIPART_UPLOAD));
+  g_object_get (sink, "stats", &stats, NULL);
+  fail_unless (gst_structure_get_uint64 (stats,
+          "create-multipart-upload-requests", &value));
+  fail_unless_equals_uint64 (3, value);
+  fail_unless (gst_structure_get_uint64 (stats,
+          "complete-multipart-upload-requests", &value));
+  fail_unless_equals_uint64 (2, value);
+  fail_unless (object_equals (data));
+
+  gst_structure_free (stats);
+  g_bytes_unref (data);
+  gst_object_unref (sink);
+}
+GST_END_TEST
+
+GST_START_TEST (test_failed_completion_aborts_the_upload)
+{
+  GstElement *sink = setup_s3_sink ();
+  GBytes *data = create_data (6 * MIB);
+  GstBus *bus = gst_bus_new ();
+  GstMessage *message;
+
+  gst_element_set_bus (sink, bus);
+  gst_s3_mock_server_add_fault (server,
+      GST_S3_MOCK_OPERATION_COMPLETE_MULTIPART_UPLOAD,
+      GST_S3_MOCK_FAULT_ACCESS_DENIED, 1);
+
+  push_data (sink, data);
+
+  message = gst_bus_pop_filtered (bus, GST_MESSAGE_ERROR);
+  fail_unless (message != NULL);
+  gst_message_unref (message);
+
+  fail_unless_equals_int (1,
+      wait_for_request_count (GST_S3_MOCK_OPERATION_ABORT_MULTIPART_UPLOAD,
+          1));
+  fail_unless_equals_int (0,
+      gst_s3_mock_server_get_pending_upload_count (server));
+  fail_if (object_equals (data));
+
+  gst_element_set_bus (sink, NULL);
+  gst_object_unref (bus);
+  g_bytes_unref (data);
+  gst_object_unref (sink);
+}
+GST_END_TEST
+
+static void
+remove_spool_directory (gchar * path)
+{
+  GDir *dir = g_dir_open (path, 0, NULL);
+  const gchar *name;
+
+  while (dir && (name = g_dir_read_name (dir))) {
+    gchar *file = g_build_filename (path, name, NULL);
+    g_unlink (file);
+    g_free (file);
+  }
+  if (dir)
+    g_dir_close (dir);
+  g_rmdir (path);
+  g_free (path);
+}
+
+/* Uploads parts of an object S3 then refuses to complete, which leaves the
+ * upload to the abort policy. */
+static void
+push_incomplete_upload (GstElement * sink)
+{
+  GBytes *data = create_data (12 * MIB);
+  GstBus *bus = gst_bus_new ();
+  GstMessage *message;
+
+  gst_element_set_bus (sink, bus);
+  gst_s3_mock_server_add_fault (server,
+      GST_S3_MOCK_OPERATION_COMPLETE_MULTIPART_UPLOAD,
+      GST_S3_MOCK_FAULT_ACCESS_DENIED, 1);
+
+  push_data (sink, data);
+
+  message = gst_bus_pop_filtered (bus, GST_MESSAGE_ERROR);
+  fail_unless (message != NULL);
+  gst_message_unref (message);
+
+  gst_element_set_bus (sink, NULL);
+  gst_object_unref (bus);
+  g_bytes_unref (data);
+}
+
+GST_START_TEST (test_abort_policy_keep_keeps_the_upload)
+{
+  GstElement *sink = setup_s3_sink ();
+
+  gst_util_set_object_arg (G_OBJECT (sink), "abort-policy", "keep");
+  push_incomplete_upload (sink);
+
+  /* the sink waits for its aborts when it stops */
+  fail_unless_equals_int (0,
+      get_request_count (GST_S3_MOCK_OPERATION_ABORT_MULTIPART_UPLOAD));
+  fail_unless_equals_int (1,
+      gst_s3_mock_server_get_pending_upload_count (server));
+
+  gst_object_unref (sink);
+}
+GST_END_TEST
+
+GST_START_TEST (test_abort_policy_auto_keeps_a_spooled_upload)
+{
+  GstElement *sink = setup_s3_sink ();
+  gchar *spool_dir = g_dir_make_tmp ("s3e2e-XXXXXX", NULL);
+
+  fail_unless (spool_dir != NULL);
+  g_object_set (sink, "spool-directory", spool_dir, "spool-sync", FALSE,
+      NULL);
+  push_incomplete_upload (sink);
+
+  fail_unless_equals_int (0,
+      get_request_count (GST_S3_MOCK_OPERATION_ABORT_MULTIPART_UPLOAD));
+  fail_unless_equals_int (1,
+      gst_s3_mock_server_get_pending_upload_count (server));
+
+  gst_object_unref (sink);
+  remove_spool_directory (spool_dir);
+}
+GST_END_TEST
+
+GST_START_TEST (test_abort_policy_abort_aborts_a_spooled_upload)
+{
+  GstElement *sink = setup_s3_sink ();
+  gchar *spool_dir = g_dir_make_tmp ("s3e2e-XXXXXX", NULL);
+
+  fail_unless (spool_dir != NULL);
+  g_object_set (sink, "spool-directory", spool_dir, "spool-sync", FALSE,
+      NULL);
+  gst_util_set_object_arg (G_OBJECT (sink), "abort-policy", "abort");
+  push_incomplete_upload (sink);
+
+  fail_unless_equals_int (1,
+      get_request_count (GST_S3_MOCK_OPERATION_ABORT_MULTIPART_UPLOAD));
+  fail_unless_equals_int (0,
+      gst_s3_mock_server_get_pending_upload_count (server));
+
+  gst_object_unref (sink);
+  remove_spool_directory (spool_dir);
+}
+GST_END_TEST
+
+/* Leaves the upload behind as a crashed sink would: the first two parts
+ * are in S3, the last one is only in the spool, and the journal has them
+ * all. */
+static void
+push_interrupted_upload (const gchar * spool_dir, GBytes * data)
+{
+  GstElement *sink = setup_s3_sink ();
+  GstBus *bus = gst_bus_new ();
+  GstMessage *message;
+  GstPad *srcpad;
+
+  g_object_set (sink, "spool-directory", spool_dir, "spool-sync", FALSE,
+      NULL);
+  gst_util_set_object_arg (G_OBJECT (sink), "abort-policy", "keep");
+  gst_element_set_bus (sink, bus);
+
+  srcpad = start_pushing (sink);
+  push_range (srcpad, data, 0, 10 * MIB);
+  fail_unless_equals_int (2,
+      wait_for_request_count (GST_S3_MOCK_OPERATION_UPLOAD_PART, 2));
+
+  gst_s3_mock_server_add_fault (server, GST_S3_MOCK_OPERATION_UPLOAD_PART,
+      GST_S3_MOCK_FAULT_ACCESS_DENIED, 1);
+  push_range (srcpad, data, 10 * MIB, g_bytes_get_size (data));
+  finish_pushing (sink);
+
+  message = gst_bus_pop_filtered (bus, GST_MESSAGE_ERROR);
+  fail_unless (message != NULL);
+  gst_message_unref (message);
+
+  fail_unless_equals_int (3,
+      get_request_count (GST_S3_MOCK_OPERATION_UPLOAD_PART));
+  fail_unless_equals_int (1,
+      gst_s3_mock_server_get_pending_upload_count (server));
+
+  gst_element_set_bus (sink, NULL);
+  gst_object_unref (bus);
+  gst_object_unref (sink);
+}
+
+GST_START_TEST (test_resume_only_uploads_the_missing_parts)
+{
+  GstElement *sink;
+  GBytes *data = create_data (12 * MIB);
+  GBytes *nothing = g_bytes_new (NULL, 0);
+  gchar *spool_dir = g_dir_make_tmp ("s3e2e-XXXXXX", NULL);
+
+  fail_unless (spool_dir != NULL);
+  push_interrupted_upload (spool_dir, data);
+
+  sink = setup_s3_sink ();
+  g_object_set (sink, "spool-directory", spool_dir, "spool-sync", FALSE,
+      "resume", TRUE, NULL);
+  push_data (sink, nothing);
+
+  fail_unless_equals_int (1,
+      get_request_count (GST_S3_MOCK_OPERATION_CREATE_MULTIPART_UPLOAD));
+  fail_unless_equals_int (1,
+      get_request_count (GST_S3_MOCK_OPERATION_LIST_PARTS));
+  /* the third part again, from the spool */
+  fail_unless_equals_int (4,
+      get_request_count (GST_S3_MOCK_OPERATION_UPLOAD_PART));
+  fail_unless_equals_int (1,
+      get_request_count (GST_S3_MOCK_OPERATION_COMPLETE_MULTIPART_UPLOAD));
+  fail_unless_equals_int (0,
+      gst_s3_mock_server_get_pending_upload_count (server));
+  fail_unless (object_equals (data));
+
+  gst_object_unref (sink);
+  g_bytes_unref (nothing);
+  g_bytes_unref (data);
+  remove_spool_directory (spool_dir);
+}
+GST_END_TEST
+
+/* As if the sink crashed after the spool handed the part over, but before
+ * the uploader journaled it. */
+static void
+forget_journaled_part (const gchar * spool_dir, gint part_number)
+{
+  GDir *dir = g_dir_open (spool_dir, 0, NULL);
+  gchar *group = g_strdup_printf ("part-%d", part_number);
+  const gchar *name;
+  gboolean found = FALSE;
+
+  fail_unless (dir != NULL);
+  while ((name = g_dir_read_name (dir))) {
+    gchar *path;
+    GKeyFile *journal;
+
+    if (!g_str_has_suffix (name, ".journal"))
+      continue;
+
+    path = g_build_filename (spool_dir, name, NULL);
+    journal = g_key_file_new ();
+    fail_unless (g_key_file_load_from_file (journal, path, G_KEY_FILE_NONE,
+            NULL));
+    fail_unless (g_key_file_remove_group (journal, group, NULL));
+    fail_unless (g_key_file_save_to_file (journal, path, NULL));
+    g_key_file_free (journal);
+    g_free (path);
+    found = TRUE;
+  }
+
+  g_dir_close (dir);
+  g_free (group);
+  fail_unless (found);
+}
+
+GST_START_TEST (test_resume_finds_the_unjournaled_part)
+{
+  GstElement *sink;
+  GBytes *data = create_data (12 * MIB);
+  GBytes *nothing = g_bytes_new (NULL, 0);
+  gchar *spool_dir = g_dir_make_tmp ("s3e2e-XXXXXX", NULL);
+
+  fail_unless (spool_dir != NULL);
+  push_interrupted_upload (spool_dir, data);
+  forget_journaled_part (spool_dir, 3);
+
+  sink = setup_s3_sink ();
+  g_object_set (sink, "spool-directory", spool_dir, "spool-sync", FALSE,
+      "resume", TRUE, NULL);
+  push_data (sink, nothing);
+
+  /* the third part again, from the file the spool named */
+  fail_unless_equals_int (4,
+      get_request_count (GST_S3_MOCK_OPERATION_UPLOAD_PART));
+  fail_unless_equals_int (0,
+      gst_s3_mock_server_get_pending_upload_count (server));
+  fail_unless (object_equals (data));
+
+  gst_object_unref (sink);
+  g_bytes_unref (nothing);
+  g_bytes_unref (data);
+  remove_spool_directory (spool_dir);
+}
+GST_END_TEST
+
+GST_START_TEST (test_dropped_upload_is_aborted)
+{
+  GstElement *sink;
+  GBytes *data = create_data (12 * MIB);
+  GBytes *other_data = create_data (6 * MIB);
+  gchar *spool_dir = g_dir_make_tmp ("s3e2e-XXXXXX", NULL);
+
+  fail_unless (spool_dir != NULL);
+  push_interrupted_upload (spool_dir, data);
+
+  sink = setup_s3_sink ();
+  g_object_set (sink, "spool-directory", spool_dir, "spool-sync", FALSE,
+      NULL);
+  push_data (sink, other_data);
+
+  fail_unless_equals_int (1,
+      get_request_count (GST_S3_MOCK_OPERATION_ABORT_MULTIPART_UPLOAD));
+  fail_unless_equals_int (0,
+      get_request_count (GST_S3_MOCK_OPERATION_LIST_PARTS));
+  fail_unless_equals_int (0,
+      gst_s3_mock_server_get_pending_upload_count (server));
+  fail_unless (object_equals (other_data));
+
+  gst_object_unref (sink);
+  g_bytes_unref (other_data);
+  g_bytes_unref (data);
+  remove_spool_directory (spool_dir);
+}
+GST_END_TEST
+
+GST_START_TEST (test_streaming_parts_need_https)
+{
+  GstElement *sink = setup_s3_sink ();
+  GBytes *data = create_data (12 * MIB);
+  GstPad *srcpad;
+
+  /* the client hashes the payloads over plain HTTP */
+  g_object_set (sink, "streaming-parts", TRUE, NULL);
+
+  srcpad = start_pushing (sink);
+  push_range (srcpad, data, 0, MIB);
+  g_usleep (G_USEC_PER_SEC / 5);
+  fail_unless_equals_int (0,
+      get_request_count (GST_S3_MOCK_OPERATION_UPLOAD_PART));
+
+  push_range (srcpad, data, MIB, g_bytes_get_size (data));
+  finish_pushing (sink);
+
+  fail_unless_equals_int (3,
+      get_request_count (GST_S3_MOCK_OPERATION_UPLOAD_PART));
+  fail_unless (object_equals (data));
+
+  g_bytes_unref (data);
+  gst_object_unref (sink);
+}
+GST_END_TEST
+
+GST_START_TEST (test_empty_stream_is_written_with_streaming_parts)
+{
+  GstS3UploaderConfig config = GST_S3_UPLOADER_CONFIG_INIT;
+  GValue credentials = G_VALUE_INIT;
+  GstS3Uploader *uploader;
+  GBytes *empty = g_bytes_new (NULL, 0);
+
+  /* the sink only streams parts over HTTPS, which the mock server doesn't
+   * serve: drive the uploader the way it does on EOS before any data */
+  g_value_init (&credentials, GST_TYPE_AWS_CREDENTIALS);
+  fail_unless (gst_value_deserialize (&credentials,
+          "access-key-id=AKIDEXAMPLE|secret-access-key=secret"));
+  config.bucket = (gchar *) TEST_BUCKET;
+  config.key = (gchar *) TEST_KEY;
+  config.region = (gchar *) "us-east-1";
+  config.aws_sdk_endpoint = (gchar *) gst_s3_mock_server_get_endpoint (server);
+  config.aws_sdk_use_http = TRUE;
+  config.credentials = g_value_get_boxed (&credentials);
+  config.streaming_parts = TRUE;
+
+  uploader = gst_s3_uploader_new_default (&config);
+  fail_if (uploader == NULL);
+  fail_unless (gst_s3_uploader_complete (uploader));
+  gst_s3_uploader_destroy (uploader);
+
+  fail_unless_equals_int (1,
+      get_request_count (GST_S3_MOCK_OPERATION_PUT_OBJECT));
+  fail_unless_equals_int (0,
+      get_request_count (GST_S3_MOCK_OPERATION_UPLOAD_PART));
+  fail_unless (object_equals (empty));
+
+  g_value_unset (&credentials);
+  g_bytes_unref (empty);
+}
+GST_END_TEST
+
+GST_START_TEST (test_payloads_are_signed_over_http)
+{
+  GstElement *sink = setup_s3_sink ();
+  GBytes *data = create_data (6 * MIB);
+  gchar *payload_hash;
+
+  gst_util_set_object_arg (G_OBJECT (sink), "payload-signing", "never");
+  push_data (sink, data);
+
+  payload_hash = gst_s3_mock_server_get_last_header (server,
+      GST_S3_MOCK_OPERATION_UPLOAD_PART, "x-amz-content-sha256");
+  fail_unless (payload_hash != NULL);
+  fail_unless_equals_int (64, strlen (payload_hash));
+  fail_unless (object_equals (data));
+
+  g_free (payload_hash);
+  g_bytes_unref (data);
+  gst_object_unref (sink);
+}
+GST_END_TEST
+
+GST_START_TEST (test_unsigned_payloads_keep_path_style_addressing)
+{
+  GstElement *sink = setup_s3_sink ();
+  GBytes *data = create_data (6 * MIB);
+  const gchar *endpoint = gst_s3_mock_server_get_endpoint (server);
+  gchar *localhost_endpoint, *host;
+
+  /* a host name, which would be prefixed with the bucket otherwise */
+  localhost_endpoint = g_strconcat ("localhost", strchr (endpoint, ':'),
+      NULL);
+  g_object_set (sink, "aws-sdk-endpoint", localhost_endpoint,
+      "aws-sdk-s3-sign-payload", FALSE, NULL);
+  gst_util_set_object_arg (G_OBJECT (sink), "payload-signing", "never");
+  push_data (sink, data);
+
+  host = gst_s3_mock_server_get_last_header (server,
+      GST_S3_MOCK_OPERATION_UPLOAD_PART, "host");
+  fail_unless_equals_string (localhost_endpoint, host);
+  fail_unless (object_equals (data));
+
+  g_free (host);
+  g_free (localhost_endpoint);
+  g_bytes_unref (data);
+  gst_object_unref (sink);
+}
+GST_END_TEST
+
+GST_START_TEST (test_parts_are_uploaded_concurrently)
+{
+  GstElement *sink = setup_s3_sink ();
+  GBytes *data = create_data (21 * MIB);
+  gint64 start_time;
+
+  gst_s3_mock_server_set_latency (server, GST_S3_MOCK_OPERATION_UPLOAD_PART,
+      GST_SECOND);
+
+  start_time = g_get_monotonic_time ();
+  push_data (sink, data);
+
+  /* 5 parts, each taking a second */
+  fail_unless_equals_int (5,
+      get_request_count (GST_S3_MOCK_OPERATION_UPLOAD_PART));
+  fail_unless (g_get_monotonic_time () - start_time < 4 * G_TIME_SPAN_SECOND);
+  fail_unless (object_equals (data));
+
+  g_bytes_unref (data);
+  gst_object_unref (sink);
+}
+GST_END_TEST
+
+GST_START_TEST (test_adaptive_buffer_count_grows_with_the_latency)
+{
+  GstElement *sink = setup_s3_sink ();
+  GBytes *data = create_data (60 * MIB);
+  gint64 start_time;
+
+  /* one part at a time would take 6 seconds */
+  g_object_set (sink, "buffer-count", 1, "adaptive-buffer-count", TRUE,
+      "max-in-flight-parts", 4, NULL);
+  gst_s3_mock_server_set_latency (server, GST_S3_MOCK_OPERATION_UPLOAD_PART,
+      GST_SECOND / 2);
+
+  start_time = g_get_monotonic_time ();
+  push_data (sink, data);
+
+  fail_unless_equals_int (12,
+      get_request_count (GST_S3_MOCK_OPERATION_UPLOAD_PART));
+  fail_unless (g_get_monotonic_time () - start_time < 4 * G_TIME_SPAN_SECOND);
+  fail_unless (object_equals (data));
+
+  g_bytes_unref (data);
+  gst_object_unref (sink);
+}
+GST_END_TEST
+
+GST_START_TEST (test_source_reads_back_the_object)
+{
+  GstElement *src = gst_element_factory_make ("s3src", "src");
+  GBytes *data = create_data (3 * MIB + 17);
+  GstPad *srcpad;
+  GstBuffer *buffer = NULL;
+  GByteArray *read = g_byte_array_new ();
+  GstFlowReturn ret;
+  GstMapInfo map;
+  GBytes *result;
+
+  fail_if (src == NULL);
+  set_s3_properties (src);
+  gst_s3_mock_server_put_object (server, TEST_BUCKET, TEST_KEY, data);
+  gst_s3_mock_server_add_fault (server, GST_S3_MOCK_OPERATION_GET_OBJECT,
+      GST_S3_MOCK_FAULT_INTERNAL_ERROR, 1);
+
+  srcpad = gst_element_get_static_pad (src, "src");
+  fail_unless (gst_element_set_state (src, GST_STATE_READY)
+      == GST_STATE_CHANGE_SUCCESS);
+  fail_unless (gst_pad_activate_mode (srcpad, GST_PAD_MODE_PULL, TRUE));
+
+  while ((ret = gst_pad_get_range (srcpad, read->len, 100000,
+              &buffer)) == GST_FLOW_OK) {
+    fail_unless_equals_uint64 (read->len, GST_BUFFER_OFFSET (buffer));
+    gst_buffer_map (buffer, &map, GST_MAP_READ);
+    g_byte_array_append (read, map.data, map.size);
+    gst_buffer_unmap (buffer, &map);
+    gst_buffer_unref (buffer);
+    buffer = NULL;
+  }
+  fail_unless_equals_int (GST_FLOW_EOS, ret);
+
+  result = g_byte_array_free_to_bytes (read);
+  fail_unless (g_bytes_equal (result, data));
+  fail_unless_equals_int (1,
+      get_request_count (GST_S3_MOCK_OPERATION_HEAD_OBJECT));
+
+  fail_unless (gst_pad_activate_mode (srcpad, GST_PAD_MODE_PULL, FALSE));
+  gst_element_set_state (src, GST_STATE_NULL);
+  g_bytes_unref (result);
+  g_bytes_unref (data);
+  gst_object_unref (srcpad);
+  gst_object_unref (src);
+}
+GST_END_TEST
+
+/* A source with 64 KiB blocks, the smallest cache and no read ahead. */
+static GstElement *
+setup_s3_src (guint chunk_size)
+{
+  GstElement *src = gst_element_factory_make ("s3src", "src");
+
+  fail_if (src == NULL);
+  set_s3_properties (src);
+  g_object_set (src, "block-size", 64 * 1024, "chunk-size", chunk_size,
+      "read-ahead", 0, "cache-size", (guint64) 0, NULL);
+
+  return src;
+}
+
+/* Starts reading the data in pull mode. */
+static GstPad *
+start_s3_src (GstElement * src, GBytes * data)
+{
+  GstPad *srcpad = gst_element_get_static_pad (src, "src");
+
+  gst_s3_mock_server_put_object (server, TEST_BUCKET, TEST_KEY, data);
+  fail_unless (gst_element_set_state (src, GST_STATE_READY)
+      == GST_STATE_CHANGE_SUCCESS);
+  fail_unless (gst_pad_activate_mode (srcpad, GST_PAD_MODE_PULL, TRUE));
+
+  return srcpad;
+}
+
+static void
+stop_s3_src (GstElement * src, GstPad * srcpad)
+{
+  fail_unless (gst_pad_activate_mode (srcpad, GST_PAD_MODE_PULL, FALSE));
+  gst_element_set_state (src, GST_STATE_NULL);
+  gst_object_unref (srcpad);
+  gst_object_unref (src);
+}
+
+/* Reads the range and checks it against the data. */
+static void
+read_range (GstPad * srcpad, GBytes * data, guint64 offset, guint size)
+{
+  const guint8 *bytes = g_bytes_get_data (data, NULL);
+  GstBuffer *buffer = NULL;
+
+  fail_unless_equals_int (GST_FLOW_OK, gst_pad_get_range (srcpad, offset,
+          size, &buffer));
+  fail_unless_equals_int (size, gst_buffer_get_size (buffer));
+  fail_unless (gst_buffer_memcmp (buffer, 0, bytes + offset, size) == 0);
+  gst_buffer_unref (buffer);
+}
+
+GST_START_TEST (test_source_fetches_missing_blocks_together)
+{
+  GBytes *data = create_data (MIB);
+  GstPad *srcpad;
+  GstElement *src = setup_s3_src (256 * 1024);
+  gchar *range;
+
+  srcpad = start_s3_src (src, data);
+
+  /* 4 blocks, the last one partly */
+  read_range (srcpad, data, 0, 200 * 1024);
+  fail_unless_equals_int (1,
+      get_request_count (GST_S3_MOCK_OPERATION_GET_OBJECT));
+  range = gst_s3_mock_server_get_last_header (server,
+      GST_S3_MOCK_OPERATION_GET_OBJECT, "range");
+  fail_unless_equals_string ("bytes=0-262143", range);
+  g_free (range);
+
+  read_range (srcpad, data, 200 * 1024, 56 * 1024);
+  fail_unless_equals_int (1,
+      get_request_count (GST_S3_MOCK_OPERATION_GET_OBJECT));
+
+  stop_s3_src (src, srcpad);
+  g_bytes_unref (data);
+}
+GST_END_TEST
+
+GST_START_TEST (test_source_hits_the_cache_after_a_seek)
+{
+  GBytes *data = create_data (2 * MIB);
+  GstPad *srcpad;
+  GstElement *src = setup_s3_src (256 * 1024);
+
+  srcpad = start_s3_src (src, data);
+
+  read_range (srcpad, data, 0, 64 * 1024);
+  read_range (srcpad, data, MIB, 64 * 1024);
+  fail_unless_equals_int (2,
+      get_request_count (GST_S3_MOCK_OPERATION_GET_OBJECT));
+
+  read_range (srcpad, data, 1000, 1000);
+  read_range (srcpad, data, MIB + 1000, 1000);
+  fail_unless_equals_int (2,
+      get_request_count (GST_S3_MOCK_OPERATION_GET_OBJECT));
+
+  stop_s3_src (src, srcpad);
+  g_bytes_unref (data);
+}
+GST_END_TEST
+
+GST_START_TEST (test_source_only_reads_ahead_sequentially)
+{
+  GBytes *data = create_data (4 * MIB);
+  GstPad *srcpad;
+  GstElement *src = setup_s3_src (256 * 1024);
+
+  /* 2 chunks of 4 blocks */
+  g_object_set (src, "read-ahead", 2, NULL);
+  srcpad = start_s3_src (src, data);
+
+  read_range (srcpad, data, 0, 64 * 1024);
+  fail_unless_equals_int (3,
+      wait_for_request_count (GST_S3_MOCK_OPERATION_GET_OBJECT, 3));
+
+  /* a seek */
+  read_range (srcpad, data, 2 * MIB, 64 * 1024);
+  g_usleep (G_USEC_PER_SEC / 5);
+  fail_unless_equals_int (4,
+      get_request_count (GST_S3_MOCK_OPERATION_GET_OBJECT));
+
+  /* read on from there */
+  read_range (srcpad, data, 2 * MIB + 64 * 1024, 64 * 1024);
+  fail_unless_equals_int (7,
+      wait_for_request_count (GST_S3_MOCK_OPERATION_GET_OBJECT, 7));
+
+  stop_s3_src (src, srcpad);
+  g_bytes_unref (data);
+}
+GST_END_TEST
+
+/* With 64 KiB chunks, the cache is raised to 2 blocks: reads blocks 0 and 1,
+ * then 0 again before 2, which evicts 1, the least recently used. */
+static void
+read_past_the_cache (GstPad * srcpad, GBytes * data)
+{
+  read_range (srcpad, data, 0, 64 * 1024);
+  read_range (srcpad, data, 64 * 1024, 64 * 1024);
+  read_range (srcpad, data, 0, 64 * 1024);
+  read_range (srcpad, data, 128 * 1024, 64 * 1024);
+  fail_unless_equals_int (3,
+      get_request_count (GST_S3_MOCK_OPERATION_GET_OBJECT));
+
+  read_range (srcpad, data, 0, 64 * 1024);
+  fail_unless_equals_int (3,
+      get_request_count (GST_S3_MOCK_OPERATION_GET_OBJECT));
+}
+
+GST_START_TEST (test_source_evicts_the_least_recently_used_blocks)
+{
+  GBytes *data = create_data (MIB);
+  GstPad *srcpad;
+  GstElement *src = setup_s3_src (64 * 1024);
+
+  srcpad = start_s3_src (src, data);
+
+  read_past_the_cache (srcpad, data);
+  read_range (srcpad, data, 64 * 1024, 64 * 1024);
+  fail_unless_equals_int (4,
+      get_request_count (GST_S3_MOCK_OPERATION_GET_OBJECT));
+
+  stop_s3_src (src, srcpad);
+  g_bytes_unref (data);
+}
+GST_END_TEST
+
+GST_START_TEST (test_source_reads_evicted_blocks_from_disk)
+{
+  GBytes *data = create_data (MIB);
+  GstPad *srcpad;
+  GstElement *src = setup_s3_src (64 * 1024);
+  gchar *cache_dir = g_dir_make_tmp ("s3e2e-XXXXXX", NULL);
+
+  fail_unless (cache_dir != NULL);
+  g_object_set (src, "disk-cache-directory", cache_dir, "disk-cache-size",
+      (guint64) MIB, NULL);
+  srcpad = start_s3_src (src, data);
+
+  read_past_the_cache (srcpad, data);
+  read_range (srcpad, data, 64 * 1024, 64 * 1024);
+  fail_unless_equals_int (3,
+      get_request_count (GST_S3_MOCK_OPERATION_GET_OBJECT));
+
+  stop_s3_src (src, srcpad);
+  g_bytes_unref (data);
+  remove_spool_directory (cache_dir);
+}
+GST_END_TEST
+
+static Suite *
+s3e2e_suite (void)
+{
+  Suite *s = suite_create ("s3e2e");
+  TCase *tc_chain = tcase_create ("general");
+
+  tcase_set_timeout (tc_chain, 60);
+  tcase_add_checked_fixture (tc_chain, setup_server, teardown_server);
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_multipart_upload_round_trip);
+  tcase_add_test (tc_chain, test_stats_account_for_the_upload);
+  tcase_add_test (tc_chain, test_small_object_is_put_at_once);
+  tcase_add_test (tc_chain, test_failed_parts_are_retried);
+  tcase_add_test (tc_chain, test_throttled_requests_are_retried);
+  tcase_add_test (tc_chain, test_failed_completion_aborts_the_upload);
+  tcase_add_test (tc_chain, test_abort_policy_keep_keeps_the_upload);
+  tcase_add_test (tc_chain, test_abort_policy_auto_keeps_a_spooled_upload);
+  tcase_add_test (tc_chain, test_abort_policy_abort_aborts_a_spooled_upload);
+  tcase_add_test (tc_chain, test_resume_only_uploads_the_missing_parts);
+  tcase_add_test (tc_chain, test_resume_finds_the_unjournaled_part);
+  tcase_add_test (tc_chain, test_dropped_upload_is_aborted);
+  tcase_add_test (tc_chain, test_streaming_parts_need_https);
+  tcase_add_test (tc_chain, test_empty_stream_is_written_with_streaming_parts);
+  tcase_add_test (tc_chain, test_payloads_are_signed_over_http);
+  tcase_add_test (tc_chain, test_unsigned_payloads_keep_path_style_addressing);
+  tcase_add_test (tc_chain, test_parts_are_uploaded_concurrently);
+  tcase_add_test (tc_chain, test_adaptive_buffer_count_grows_with_the_latency);
+  tcase_add_test (tc_chain, test_source_reads_back_the_object);
+  tcase_add_test (tc_chain, test_source_fetches_missing_blocks_together);
+  tcase_add_test (tc_chain, test_source_hits_the_cache_after_a_seek);
+  tcase_add_test (tc_chain, test_source_only_reads_ahead_sequentially);
+  tcase_add_test (tc_chain, test_source_evicts_the_least_recently_used_blocks);
+  tcase_add_test (tc_chain, test_source_reads_evicted_blocks_from_disk);
+
+  return s;
+}
+
+GST_CHECK_MAIN (s3e2e)
@@ -0,0 +1,275 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include "gsts3uploader.h"
+#include "gsts3hlssink.h"
+
+#include <string.h>
+
+#include <gio/gio.h>
+#include <gst/check/gstcheck.h>
+
+/************* TEST UPLOADER *************/
+typedef struct {
+    GstS3Uploader base;
+    gchar *key;
+} TestUploader;
+
+#define TEST_UPLOADER(uploader) ((TestUploader*) uploader)
+
+/* the keys of the objects written, in order */
+static GPtrArray *published;
+/* holds the segments back until cleared */
+static gboolean segments_blocked;
+static GMutex published_lock;
+static GCond published_cond;
+
+static GstS3Uploader *test_uploader_new (const gchar * key);
+
+static void
+test_uploader_destroy (GstS3Uploader * uploader)
+{
+  g_free (TEST_UPLOADER(uploader)->key);
+  g_free (uploader);
+}
+
+static gboolean
+test_uploader_put_object (GstS3Uploader * uploader, GstBufferList * buffers)
+{
+  const gchar *key = TEST_UPLOADER(uploader)->key;
+
+  g_mutex_lock (&published_lock);
+  while (segments_blocked && g_str_has_suffix (key, ".ts"))
+    g_cond_wait (&published_cond, &published_lock);
+  g_ptr_array_add (published, g_strdup (key));
+  g_cond_broadcast (&published_cond);
+  g_mutex_unlock (&published_lock);
+
+  gst_buffer_list_unref (buffers);
+  return TRUE;
+}
+
+static GstS3Uploader *
+test_uploader_create_next (G_GNUC_UNUSED GstS3Uploader * uploader,
+    const GstS3UploaderConfig * config)
+{
+  return test_uploader_new (config->key);
+}
+
+static GstS3UploaderClass test_uploader_class = {
+  test_uploader_destroy,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  test_uploader_put_object,
+  NULL,
+  NULL,
+  test_uploader_create_next,
+  NULL
+};
+
+static GstS3Uploader *
+test_uploader_new (const gchar * key)
+{
+  TestUploader *uploader = g_new (TestUploader, 1);
+
+  uploader->base.klass = &test_uploader_class;
+  uploader->key = g_strdup (key);
+
+  return (GstS3Uploader*) uploader;
+}
+
+/************* TEST UPLOADER END *************/
+
+#define TEST_PLAYLIST \
+  "#EXTM3U\n" \
+  "#EXT-X-VERSION:3\n" \
+  "#EXT-X-TARGETDURATION:2\n" \
+  "#EXTINF:2.000,\n" \
+  "segment00000.ts\n"
+
+static void
+set_segments_blocked (gboolean blocked)
+{
+  g_mutex_lock (&published_lock);
+  segments_blocked = blocked;
+  g_cond_broadcast (&published_cond);
+  g_mutex_unlock (&published_lock);
+}
+
+static guint
+wait_for_published (guint count)
+{
+  gint64 end_time = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+  guint len;
+
+  g_mutex_lock (&published_lock);
+  while (published->len < count
+      && g_cond_wait_until (&published_cond, &published_lock, end_time));
+  len = published->len;
+  g_mutex_unlock (&published_lock);
+
+  return len;
+}
+
+/* Writes an object the way hlssink2 does, through the stream it gets
+ * from the sink. */
+static void
+write_object (GstElement * hlssink, const gchar * signal,
+    const gchar * location, const gchar * data)
+{
+  GOutputStream *stream = NULL;
+
+  g_signal_emit_by_name (hlssink, signal, location, &stream);
+  fail_unless (stream != NULL);
+  fail_unless (g_output_stream_write_all (stream, data, strlen (data), NULL,
+          NULL, NULL));
+  fail_unless (g_output_stream_close (stream, NULL, NULL));
+  g_object_unref (stream);
+}
+
+static GstElement *
+setup_s3_hls_sink (void)
+{
+  GstElement *sink = gst_element_factory_make ("s3hlssink", "sink");
+
+  fail_if (sink == NULL);
+  /* only testable with a hlssink2 that has the stream signals */
+  if (GST_S3_HLS_SINK (sink)->hlssink == NULL) {
+    gst_object_unref (sink);
+    return NULL;
+  }
+
+  g_object_set (sink,
+      "bucket", "some-bucket",
+      "key-prefix", "live/",
+      NULL);
+  GST_S3_HLS_SINK (sink)->uploader = test_uploader_new (NULL);
+
+  published = g_ptr_array_new_with_free_func (g_free);
+  segments_blocked = FALSE;
+
+  fail_unless (gst_element_set_state (sink, GST_STATE_READY)
+      == GST_STATE_CHANGE_SUCCESS);
+
+  return sink;
+}
+
+static void
+teardown_s3_hls_sink (GstElement * sink)
+{
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_object_unref (sink);
+  g_ptr_array_unref (published);
+  published = NULL;
+}
+
+GST_START_TEST (test_no_bucket_then_start_should_fail)
+{
+  GstElement *sink = gst_element_factory_make ("s3hlssink", "sink");
+  GstStateChangeReturn ret;
+
+  fail_if (sink == NULL);
+
+  ret = gst_element_set_state (sink, GST_STATE_READY);
+  fail_unless (ret == GST_STATE_CHANGE_FAILURE);
+
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_object_unref (sink);
+}
+GST_END_TEST
+
+GST_START_TEST (test_playlist_is_published_after_its_segments)
+{
+  GstElement *sink = setup_s3_hls_sink ();
+  GstElement *hlssink;
+
+  if (sink == NULL)
+    return;
+  hlssink = GST_S3_HLS_SINK (sink)->hlssink;
+
+  set_segments_blocked (TRUE);
+  write_object (hlssink, "get-fragment-stream", "/tmp/segment00000.ts",
+      "segment");
+  write_object (hlssink, "get-playlist-stream", "/tmp/playlist.m3u8",
+      TEST_PLAYLIST);
+
+  /* the playlist waits for the segment */
+  g_usleep (G_USEC_PER_SEC / 10);
+  fail_unless_equals_int (0, wait_for_published (0));
+
+  set_segments_blocked (FALSE);
+  fail_unless_equals_int (2, wait_for_published (2));
+  fail_unless_equals_string ("live/segment00000.ts",
+      g_ptr_array_index (published, 0));
+  fail_unless_equals_string ("live/playlist.m3u8",
+      g_ptr_array_index (published, 1));
+
+  teardown_s3_hls_sink (sink);
+}
+GST_END_TEST
+
+GST_START_TEST (test_newer_playlist_replaces_the_waiting_one)
+{
+  GstElement *sink = setup_s3_hls_sink ();
+  GstElement *hlssink;
+
+  if (sink == NULL)
+    return;
+  hlssink = GST_S3_HLS_SINK (sink)->hlssink;
+
+  set_segments_blocked (TRUE);
+  write_object (hlssink, "get-fragment-stream", "/tmp/segment00000.ts",
+      "segment");
+  write_object (hlssink, "get-playlist-stream", "/tmp/playlist.m3u8",
+      TEST_PLAYLIST);
+  write_object (hlssink, "get-playlist-stream", "/tmp/playlist.m3u8",
+      TEST_PLAYLIST "#EXT-X-ENDLIST\n");
+  set_segments_blocked (FALSE);
+
+  /* stopping waits for the uploads */
+  gst_element_set_state (sink, GST_STATE_NULL);
+  fail_unless_equals_int (2, published->len);
+  fail_unless_equals_string ("live/playlist.m3u8",
+      g_ptr_array_index (published, 1));
+
+  teardown_s3_hls_sink (sink);
+}
+GST_END_TEST
+
+static Suite *
+s3hlssink_suite (void)
+{
+  Suite *s = suite_create ("s3hlssink");
+  TCase *tc_chain = tcase_create ("general");
+
+  tcase_set_timeout (tc_chain, 20);
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_no_bucket_then_start_should_fail);
+  tcase_add_test (tc_chain, test_playlist_is_published_after_its_segments);
+  tcase_add_test (tc_chain, test_newer_playlist_replaces_the_waiting_one);
+
+  return s;
+}
+
+GST_CHECK_MAIN (s3hlssink)
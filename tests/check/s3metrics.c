@@ -0,0 +1,223 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include "gsts3metrics.h"
+
+#include <string.h>
+
+#include <gio/gio.h>
+#include <gst/check/gstcheck.h>
+
+#define TEST_BUCKET "some-bucket"
+#define MIB (1024 * 1024)
+
+/* An element with stats of its own, registered as if it had started. */
+static GstElement *
+register_element (const gchar * name, const gchar * bucket,
+    const gchar * location, GstS3UploadStats ** stats)
+{
+  GstElement *element = gst_element_factory_make ("fakesink", name);
+  GstS3UploaderConfig config = GST_S3_UPLOADER_CONFIG_INIT;
+
+  fail_if (element == NULL);
+
+  config.bucket = (gchar *) bucket;
+  config.location = (gchar *) location;
+  config.stats = *stats = gst_s3_upload_stats_new ();
+  gst_s3_metrics_register (element, &config);
+
+  return element;
+}
+
+static void
+unregister_element (GstElement * element, GstS3UploadStats * stats)
+{
+  gst_s3_metrics_unregister (element);
+  gst_object_unref (element);
+  gst_s3_upload_stats_unref (stats);
+}
+
+static void
+fail_unless_has_line (const gchar * metrics, const gchar * line)
+{
+  gchar *needle = g_strconcat ("\n", line, "\n", NULL);
+
+  fail_unless (strstr (metrics, needle) != NULL, "No \"%s\" in:\n%s", line,
+      metrics);
+  g_free (needle);
+}
+
+GST_START_TEST (test_stats_are_rendered)
+{
+  GstS3UploadStats *stats;
+  GstElement *element = register_element ("sink", TEST_BUCKET, NULL, &stats);
+  gchar *metrics;
+
+  gst_s3_upload_stats_add (stats, GST_S3_UPLOAD_COUNTER_BYTES_ENQUEUED,
+      10 * MIB);
+  gst_s3_upload_stats_add (stats, GST_S3_UPLOAD_COUNTER_PARTS_STARTED, 2);
+  gst_s3_upload_stats_add (stats, GST_S3_UPLOAD_COUNTER_BLOCKED_TIME,
+      GST_SECOND / 2);
+  gst_s3_upload_stats_count_request (stats, GST_S3_REQUEST_UPLOAD_PART);
+  gst_s3_upload_stats_count_request (stats, GST_S3_REQUEST_UPLOAD_PART);
+  gst_s3_upload_stats_add_completed_part (stats, 5 * MIB, 300 * GST_MSECOND);
+
+  metrics = gst_s3_metrics_render ();
+
+  fail_unless_has_line (metrics, "# TYPE gst_s3_upload_enqueued_bytes "
+      "counter");
+  fail_unless_has_line (metrics, "gst_s3_upload_enqueued_bytes_total"
+      "{element=\"/sink\",bucket=\"some-bucket\"} 10485760");
+  fail_unless_has_line (metrics, "gst_s3_upload_acknowledged_bytes_total"
+      "{element=\"/sink\",bucket=\"some-bucket\"} 5242880");
+  fail_unless_has_line (metrics, "gst_s3_upload_parts_in_flight"
+      "{element=\"/sink\",bucket=\"some-bucket\"} 1");
+  fail_unless_has_line (metrics, "gst_s3_upload_blocked_seconds_total"
+      "{element=\"/sink\",bucket=\"some-bucket\"} 0.500000000");
+  fail_unless_has_line (metrics, "gst_s3_upload_requests_total"
+      "{element=\"/sink\",bucket=\"some-bucket\",api=\"UploadPart\"} 2");
+  fail_unless_has_line (metrics, "gst_s3_upload_part_latency_seconds_bucket"
+      "{element=\"/sink\",bucket=\"some-bucket\",le=\"0.25\"} 0");
+  fail_unless_has_line (metrics, "gst_s3_upload_part_latency_seconds_bucket"
+      "{element=\"/sink\",bucket=\"some-bucket\",le=\"0.5\"} 1");
+  fail_unless_has_line (metrics, "gst_s3_upload_part_latency_seconds_bucket"
+      "{element=\"/sink\",bucket=\"some-bucket\",le=\"+Inf\"} 1");
+  fail_unless_has_line (metrics, "gst_s3_upload_part_latency_seconds_count"
+      "{element=\"/sink\",bucket=\"some-bucket\"} 1");
+  fail_unless (g_str_has_suffix (metrics, "\n# EOF\n"));
+  g_free (metrics);
+
+  unregister_element (element, stats);
+
+  metrics = gst_s3_metrics_render ();
+  fail_unless (strstr (metrics, "/sink") == NULL);
+  g_free (metrics);
+}
+GST_END_TEST
+
+GST_START_TEST (test_elements_with_the_same_path_are_added_up)
+{
+  GstS3UploadStats *stats1, *stats2, *stats3;
+  GstElement *element1 = register_element ("sink", TEST_BUCKET, NULL,
+      &stats1);
+  GstElement *element2 = register_element ("sink", TEST_BUCKET, NULL,
+      &stats2);
+  GstElement *element3 = register_element ("sink", NULL,
+      "s3://other-bucket/some/key", &stats3);
+  gchar *metrics;
+
+  gst_s3_upload_stats_add_completed_part (stats1, MIB, GST_SECOND);
+  gst_s3_upload_stats_add_completed_part (stats2, MIB, GST_SECOND);
+  gst_s3_upload_stats_add_completed_part (stats3, MIB, GST_SECOND);
+
+  metrics = gst_s3_metrics_render ();
+  fail_unless_has_line (metrics, "gst_s3_upload_parts_completed_total"
+      "{element=\"/sink\",bucket=\"some-bucket\"} 2");
+  fail_unless_has_line (metrics, "gst_s3_upload_parts_completed_total"
+      "{element=\"/sink\",bucket=\"other-bucket\"} 1");
+  g_free (metrics);
+
+  unregister_element (element1, stats1);
+  unregister_element (element2, stats2);
+  unregister_element (element3, stats3);
+}
+GST_END_TEST
+
+/* Sends a request to the endpoint and returns the whole response. */
+static gchar *
+get (guint16 port, const gchar * path)
+{
+  GSocketClient *client = g_socket_client_new ();
+  GSocketConnection *connection;
+  GDataInputStream *in;
+  gchar *request, *response;
+  GError *err = NULL;
+
+  connection = g_socket_client_connect_to_host (client, "127.0.0.1", port,
+      NULL, &err);
+  fail_unless (connection != NULL, "%s", err ? err->message : "");
+
+  request = g_strdup_printf ("GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n",
+      path);
+  fail_unless (g_output_stream_write_all (g_io_stream_get_output_stream
+          (G_IO_STREAM (connection)), request, strlen (request), NULL, NULL,
+          NULL));
+
+  in = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM
+          (connection)));
+  response = g_data_input_stream_read_upto (in, "", 1, NULL, NULL, NULL);
+
+  g_object_unref (in);
+  g_free (request);
+  g_object_unref (connection);
+  g_object_unref (client);
+
+  return response;
+}
+
+GST_START_TEST (test_metrics_are_served)
+{
+  GstS3UploadStats *stats;
+  GstElement *element = register_element ("sink", TEST_BUCKET, NULL, &stats);
+  GError *err = NULL;
+  guint16 port;
+  gchar *response, *long_path;
+
+  port = gst_s3_metrics_serve ("127.0.0.1:0", &err);
+  fail_unless (port != 0, "%s", err ? err->message : "");
+  /* one endpoint per process */
+  fail_unless_equals_int (port, gst_s3_metrics_serve ("127.0.0.1:0", NULL));
+
+  response = get (port, "/metrics");
+  fail_unless (g_str_has_prefix (response, "HTTP/1.1 200 OK\r\n"));
+  fail_unless (strstr (response, "application/openmetrics-text") != NULL);
+  fail_unless (strstr (response, "bucket=\"some-bucket\"") != NULL);
+  fail_unless (g_str_has_suffix (response, "\n# EOF\n"));
+  g_free (response);
+
+  response = get (port, "/other");
+  fail_unless (g_str_has_prefix (response, "HTTP/1.1 404 Not Found\r\n"));
+  g_free (response);
+
+  long_path = g_strnfill (9000, 'a');
+  long_path[0] = '/';
+  response = get (port, long_path);
+  fail_unless (g_str_has_prefix (response,
+          "HTTP/1.1 431 Request Header Fields Too Large\r\n"));
+  g_free (response);
+  g_free (long_path);
+
+  unregister_element (element, stats);
+}
+GST_END_TEST
+
+static Suite *
+s3metrics_suite (void)
+{
+  Suite *s = suite_create ("s3metrics");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_stats_are_rendered);
+  tcase_add_test (tc_chain, test_elements_with_the_same_path_are_added_up);
+  tcase_add_test (tc_chain, test_metrics_are_served);
+
+  return s;
+}
+
+GST_CHECK_MAIN (s3metrics)
@@ -0,0 +1,1302 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include "s3mockserver.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gio/gio.h>
+
+#define MIN_PART_SIZE (5 * 1024 * 1024)
+
+#define XML_HEADER "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+#define S3_XMLNS "http://s3.amazonaws.com/doc/2006-03-01/"
+
+typedef struct {
+  GBytes *data;
+  gchar *etag;
+} MockObject;
+
+typedef struct {
+  GBytes *data;
+  gsize size;
+  gchar *etag;
+  guint8 md5[16];
+} MockPart;
+
+typedef struct {
+  gchar *bucket;
+  gchar *key;
+  /* part number -> MockPart */
+  GHashTable *parts;
+} MockUpload;
+
+typedef struct {
+  GstS3MockOperation operation;
+  GstS3MockFault fault;
+  guint count;
+} MockFaultRule;
+
+typedef struct {
+  GstS3MockServer *server;
+  GSocketConnection *connection;
+  GThread *thread;
+} MockConnection;
+
+struct _GstS3MockServer {
+  GSocket *listener;
+  gchar *endpoint;
+  GCancellable *cancellable;
+  GThread *accept_thread;
+
+  GMutex lock;
+  GList *connections;
+  /* "bucket/key" -> MockObject */
+  GHashTable *objects;
+  /* upload id -> MockUpload */
+  GHashTable *uploads;
+  /* upload id -> ETag of the object, so that a retried completion
+   * succeeds like it does with S3 */
+  GHashTable *completed_uploads;
+  guint next_upload_id;
+  GList *faults;
+  GstClockTime latency[GST_S3_MOCK_OPERATION_COUNT];
+  guint request_count[GST_S3_MOCK_OPERATION_COUNT];
+  /* GstClockTime, from the request line to the end of the response */
+  GArray *durations[GST_S3_MOCK_OPERATION_COUNT];
+  /* the headers of the last request of each operation */
+  GHashTable *last_headers[GST_S3_MOCK_OPERATION_COUNT];
+  gboolean discard_data;
+  guint64 discarded_bodies;
+};
+
+typedef struct {
+  gchar *method;
+  gchar *bucket;
+  gchar *key;
+  /* name -> value */
+  GHashTable *query;
+  /* lower case name -> value */
+  GHashTable *headers;
+  GByteArray *body;
+} MockRequest;
+
+typedef struct {
+  guint status;
+  GString *headers;
+  GBytes *body;
+  /* announced instead of the size of the body when not negative, for
+   * HEAD requests */
+  gint64 content_length;
+  gboolean truncate;
+} MockResponse;
+
+static void
+mock_object_free (MockObject * object)
+{
+  g_bytes_unref (object->data);
+  g_free (object->etag);
+  g_free (object);
+}
+
+static void
+mock_part_free (MockPart * part)
+{
+  g_bytes_unref (part->data);
+  g_free (part->etag);
+  g_free (part);
+}
+
+static void
+mock_upload_free (MockUpload * upload)
+{
+  g_free (upload->bucket);
+  g_free (upload->key);
+  g_hash_table_unref (upload->parts);
+  g_free (upload);
+}
+
+/* The quoted hex MD5 of the data, like S3 returns for simple uploads. */
+static gchar *
+compute_etag (const guint8 * data, gsize size, guint8 md5[16])
+{
+  GChecksum *checksum = g_checksum_new (G_CHECKSUM_MD5);
+  GString *etag = g_string_new ("\"");
+  gsize length = 16;
+  guint i;
+
+  g_checksum_update (checksum, data, size);
+  g_checksum_get_digest (checksum, md5, &length);
+  g_checksum_free (checksum);
+
+  for (i = 0; i < 16; i++)
+    g_string_append_printf (etag, "%02x", md5[i]);
+  g_string_append_c (etag, '"');
+
+  return g_string_free (etag, FALSE);
+}
+
+/* Drops the quotes, escaped or not, around an ETag. */
+static gchar *
+normalize_etag (const gchar * etag)
+{
+  GString *result = g_string_new (NULL);
+
+  while (*etag) {
+    if (g_str_has_prefix (etag, "&quot;"))
+      etag += strlen ("&quot;");
+    else if (*etag == '"')
+      etag++;
+    else
+      g_string_append_c (result, *etag++);
+  }
+
+  return g_string_free (result, FALSE);
+}
+
+/* The content of the first <name> element between start and end. */
+static gchar *
+xml_get_element (const gchar * start, const gchar * end, const gchar * name)
+{
+  gchar *open = g_strdup_printf ("<%s>", name);
+  gchar *close = g_strdup_printf ("</%s>", name);
+  const gchar *value = g_strstr_len (start, end - start, open);
+  const gchar *value_end;
+  gchar *result = NULL;
+
+  if (value) {
+    value += strlen (open);
+    value_end = g_strstr_len (value, end - value, close);
+    if (value_end)
+      result = g_strndup (value, value_end - value);
+  }
+
+  g_free (open);
+  g_free (close);
+  return result;
+}
+
+static const gchar *
+get_reason_phrase (guint status)
+{
+  switch (status) {
+    case 200:
+      return "OK";
+    case 204:
+      return "No Content";
+    case 206:
+      return "Partial Content";
+    case 400:
+      return "Bad Request";
+    case 403:
+      return "Forbidden";
+    case 404:
+      return "Not Found";
+    case 412:
+      return "Precondition Failed";
+    case 416:
+      return "Requested Range Not Satisfiable";
+    case 500:
+      return "Internal Server Error";
+    case 501:
+      return "Not Implemented";
+    case 503:
+      return "Service Unavailable";
+    default:
+      return "Unknown";
+  }
+}
+
+/* Keeps the body of an upload, or only its size when the data is
+ * discarded, in which case the ETag is only unique. */
+static GBytes *
+take_body (GstS3MockServer * server, MockRequest * request, gchar ** etag,
+    guint8 md5[16])
+{
+  if (server->discard_data) {
+    guint64 id = ++server->discarded_bodies;
+
+    *etag = compute_etag ((const guint8 *) &id, sizeof (id), md5);
+    return g_bytes_new (NULL, 0);
+  }
+
+  *etag = compute_etag (request->body->data, request->body->len, md5);
+  return g_bytes_new (request->body->data, request->body->len);
+}
+
+static void
+set_xml_response (MockResponse * response, guint status, GString * xml)
+{
+  gsize size = xml->len;
+
+  response->status = status;
+  g_string_append (response->headers, "Content-Type: application/xml\r\n");
+  response->body = g_bytes_new_take (g_string_free (xml, FALSE), size);
+}
+
+static void
+set_error_response (MockResponse * response, guint status,
+    const gchar * code, const gchar * message)
+{
+  GString *xml = g_string_new (XML_HEADER);
+
+  g_string_append_printf (xml, "<Error><Code>%s</Code><Message>%s</Message>"
+      "<RequestId>mock-request</RequestId></Error>", code, message);
+  set_xml_response (response, status, xml);
+}
+
+static GstS3MockOperation
+get_operation (MockRequest * request)
+{
+  const gchar *method = request->method;
+
+  if (request->key[0] == '\0') {
+    if (g_str_equal (method, "GET")
+        && g_hash_table_contains (request->query, "location"))
+      return GST_S3_MOCK_OPERATION_GET_BUCKET_LOCATION;
+    return GST_S3_MOCK_OPERATION_ANY;
+  }
+
+  if (g_str_equal (method, "POST")) {
+    if (g_hash_table_contains (request->query, "uploads"))
+      return GST_S3_MOCK_OPERATION_CREATE_MULTIPART_UPLOAD;
+    if (g_hash_table_contains (request->query, "uploadId"))
+      return GST_S3_MOCK_OPERATION_COMPLETE_MULTIPART_UPLOAD;
+  } else if (g_str_equal (method, "PUT")) {
+    if (g_hash_table_contains (request->query, "uploadId"))
+      return GST_S3_MOCK_OPERATION_UPLOAD_PART;
+    return GST_S3_MOCK_OPERATION_PUT_OBJECT;
+  } else if (g_str_equal (method, "DELETE")) {
+    if (g_hash_table_contains (request->query, "uploadId"))
+      return GST_S3_MOCK_OPERATION_ABORT_MULTIPART_UPLOAD;
+  } else if (g_str_equal (method, "GET")) {
+    if (g_hash_table_contains (request->query, "uploadId"))
+      return GST_S3_MOCK_OPERATION_LIST_PARTS;
+    return GST_S3_MOCK_OPERATION_GET_OBJECT;
+  } else if (g_str_equal (method, "HEAD")) {
+    return GST_S3_MOCK_OPERATION_HEAD_OBJECT;
+  }
+
+  return GST_S3_MOCK_OPERATION_ANY;
+}
+
+static gchar *
+get_object_path (MockRequest * request)
+{
+  return g_strdup_printf ("%s/%s", request->bucket, request->key);
+}
+
+static MockUpload *
+lookup_upload (GstS3MockServer * server, MockRequest * request,
+    MockResponse * response)
+{
+  const gchar *upload_id = g_hash_table_lookup (request->query, "uploadId");
+  MockUpload *upload = g_hash_table_lookup (server->uploads, upload_id);
+
+  if (upload == NULL || !g_str_equal (upload->bucket, request->bucket)
+      || !g_str_equal (upload->key, request->key)) {
+    set_error_response (response, 404, "NoSuchUpload",
+        "The specified upload does not exist.");
+    return NULL;
+  }
+
+  return upload;
+}
+
+static void
+create_multipart_upload (GstS3MockServer * server, MockRequest * request,
+    MockResponse * response)
+{
+  MockUpload *upload = g_new0 (MockUpload, 1);
+  gchar *upload_id = g_strdup_printf ("upload-%u", ++server->next_upload_id);
+  gchar *key = g_markup_escape_text (request->key, -1);
+  GString *xml = g_string_new (XML_HEADER);
+
+  upload->bucket = g_strdup (request->bucket);
+  upload->key = g_strdup (request->key);
+  upload->parts = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) mock_part_free);
+  g_hash_table_insert (server->uploads, g_strdup (upload_id), upload);
+
+  g_string_append_printf (xml, "<InitiateMultipartUploadResult xmlns=\""
+      S3_XMLNS "\"><Bucket>%s</Bucket><Key>%s</Key><UploadId>%s</UploadId>"
+      "</InitiateMultipartUploadResult>", request->bucket, key, upload_id);
+  set_xml_response (response, 200, xml);
+
+  g_free (key);
+  g_free (upload_id);
+}
+
+static void
+upload_part (GstS3MockServer * server, MockRequest * request,
+    MockResponse * response)
+{
+  MockUpload *upload = lookup_upload (server, request, response);
+  const gchar *part_number_str =
+      g_hash_table_lookup (request->query, "partNumber");
+  guint part_number;
+  MockPart *part;
+
+  if (upload == NULL)
+    return;
+
+  part_number = part_number_str ? atoi (part_number_str) : 0;
+  if (part_number < 1 || part_number > 10000) {
+    set_error_response (response, 400, "InvalidArgument",
+        "Part number must be an integer between 1 and 10000, inclusive.");
+    return;
+  }
+
+  part = g_new0 (MockPart, 1);
+  part->data = take_body (server, request, &part->etag, part->md5);
+  part->size = request->body->len;
+  g_hash_table_insert (upload->parts, GUINT_TO_POINTER (part_number), part);
+
+  response->status = 200;
+  g_string_append_printf (response->headers, "ETag: %s\r\n", part->etag);
+}
+
+static void
+complete_multipart_upload (GstS3MockServer * server, MockRequest * request,
+    MockResponse * response)
+{
+  const gchar *upload_id = g_hash_table_lookup (request->query, "uploadId");
+  const gchar *etag = g_hash_table_lookup (server->completed_uploads,
+      upload_id);
+  const gchar *xml_body, *xml_end, *cursor;
+  MockUpload *upload;
+  GByteArray *data = NULL;
+  GChecksum *checksum = NULL;
+  guint previous_number = 0, count = 0;
+  gsize previous_size = 0;
+  MockObject *object;
+  GString *xml;
+  gchar *key;
+
+  if (etag)
+    goto done;
+
+  upload = lookup_upload (server, request, response);
+  if (upload == NULL)
+    return;
+
+  /* the body is NUL terminated, see read_body() */
+  xml_body = (const gchar *) request->body->data;
+  xml_end = xml_body + strlen (xml_body);
+  data = g_byte_array_new ();
+  checksum = g_checksum_new (G_CHECKSUM_MD5);
+
+  for (cursor = strstr (xml_body, "<Part>"); cursor;
+      cursor = strstr (cursor + 1, "<Part>")) {
+    const gchar *part_end = strstr (cursor, "</Part>");
+    gchar *number_str, *element, *part_etag = NULL, *expected_etag = NULL;
+    guint number;
+    MockPart *part;
+    gboolean matches;
+
+    if (part_end == NULL)
+      goto malformed;
+
+    number_str = xml_get_element (cursor, part_end, "PartNumber");
+    number = number_str ? atoi (number_str) : 0;
+    g_free (number_str);
+
+    element = xml_get_element (cursor, part_end, "ETag");
+    if (element)
+      part_etag = normalize_etag (element);
+    g_free (element);
+
+    part = g_hash_table_lookup (upload->parts, GUINT_TO_POINTER (number));
+    if (part)
+      expected_etag = normalize_etag (part->etag);
+    matches = part_etag && expected_etag
+        && g_str_equal (part_etag, expected_etag);
+    g_free (part_etag);
+    g_free (expected_etag);
+
+    if (!matches) {
+      set_error_response (response, 400, "InvalidPart",
+          "One or more of the specified parts could not be found.");
+      goto failed;
+    }
+    if (number <= previous_number) {
+      set_error_response (response, 400, "InvalidPartOrder",
+          "The list of parts was not in ascending order.");
+      goto failed;
+    }
+    if (count > 0 && previous_size < MIN_PART_SIZE) {
+      set_error_response (response, 400, "EntityTooSmall",
+          "Your proposed upload is smaller than the minimum allowed size.");
+      goto failed;
+    }
+
+    g_byte_array_append (data, g_bytes_get_data (part->data, NULL),
+        g_bytes_get_size (part->data));
+    g_checksum_update (checksum, part->md5, 16);
+    previous_number = number;
+    previous_size = part->size;
+    count++;
+  }
+
+  if (count == 0)
+    goto malformed;
+
+  object = g_new0 (MockObject, 1);
+  object->etag = g_strdup_printf ("\"%s-%u\"",
+      g_checksum_get_string (checksum), count);
+  object->data = g_byte_array_free_to_bytes (data);
+  g_checksum_free (checksum);
+  g_hash_table_insert (server->objects, get_object_path (request), object);
+  g_hash_table_insert (server->completed_uploads, g_strdup (upload_id),
+      g_strdup (object->etag));
+  g_hash_table_remove (server->uploads, upload_id);
+  etag = object->etag;
+
+done:
+  key = g_markup_escape_text (request->key, -1);
+  xml = g_string_new (XML_HEADER);
+  g_string_append_printf (xml, "<CompleteMultipartUploadResult xmlns=\""
+      S3_XMLNS "\"><Location>http://mock/%s/%s</Location><Bucket>%s</Bucket>"
+      "<Key>%s</Key><ETag>", request->bucket, key, request->bucket, key);
+  g_free (key);
+  key = g_markup_escape_text (etag, -1);
+  g_string_append_printf (xml, "%s</ETag></CompleteMultipartUploadResult>",
+      key);
+  g_free (key);
+  set_xml_response (response, 200, xml);
+  return;
+
+malformed:
+  set_error_response (response, 400, "MalformedXML",
+      "The XML you provided was not well-formed.");
+failed:
+  g_byte_array_unref (data);
+  g_checksum_free (checksum);
+}
+
+static void
+abort_multipart_upload (GstS3MockServer * server, MockRequest * request,
+    MockResponse * response)
+{
+  if (lookup_upload (server, request, response) == NULL)
+    return;
+
+  g_hash_table_remove (server->uploads,
+      g_hash_table_lookup (request->query, "uploadId"));
+  response->status = 204;
+}
+
+static gint
+compare_part_numbers (gconstpointer a, gconstpointer b)
+{
+  return GPOINTER_TO_UINT (a) < GPOINTER_TO_UINT (b) ? -1 :
+      GPOINTER_TO_UINT (a) > GPOINTER_TO_UINT (b);
+}
+
+static void
+list_parts (GstS3MockServer * server, MockRequest * request,
+    MockResponse * response)
+{
+  MockUpload *upload = lookup_upload (server, request, response);
+  GList *numbers, *l;
+  GString *xml;
+  gchar *key;
+
+  if (upload == NULL)
+    return;
+
+  key = g_markup_escape_text (request->key, -1);
+  xml = g_string_new (XML_HEADER);
+  g_string_append_printf (xml, "<ListPartsResult xmlns=\"" S3_XMLNS "\">"
+      "<Bucket>%s</Bucket><Key>%s</Key><UploadId>%s</UploadId>"
+      "<IsTruncated>false</IsTruncated>", request->bucket, key,
+      (const gchar *) g_hash_table_lookup (request->query, "uploadId"));
+  g_free (key);
+
+  numbers = g_list_sort (g_hash_table_get_keys (upload->parts),
+      compare_part_numbers);
+  for (l = numbers; l; l = l->next) {
+    MockPart *part = g_hash_table_lookup (upload->parts, l->data);
+    gchar *etag = g_markup_escape_text (part->etag, -1);
+
+    g_string_append_printf (xml, "<Part><PartNumber>%u</PartNumber>"
+        "<ETag>%s</ETag><Size>%" G_GSIZE_FORMAT "</Size></Part>",
+        GPOINTER_TO_UINT (l->data), etag, part->size);
+    g_free (etag);
+  }
+  g_list_free (numbers);
+
+  g_string_append (xml, "</ListPartsResult>");
+  set_xml_response (response, 200, xml);
+}
+
+static void
+put_object (GstS3MockServer * server, MockRequest * request,
+    MockResponse * response)
+{
+  MockObject *object = g_new0 (MockObject, 1);
+  guint8 md5[16];
+
+  object->data = take_body (server, request, &object->etag, md5);
+  g_hash_table_insert (server->objects, get_object_path (request), object);
+
+  response->status = 200;
+  g_string_append_printf (response->headers, "ETag: %s\r\n", object->etag);
+}
+
+static void
+get_object (GstS3MockServer * server, MockRequest * request,
+    MockResponse * response, gboolean head)
+{
+  gchar *path = get_object_path (request);
+  MockObject *object = g_hash_table_lookup (server->objects, path);
+  const gchar *if_match = g_hash_table_lookup (request->headers, "if-match");
+  const gchar *range = g_hash_table_lookup (request->headers, "range");
+  gsize size;
+  guint64 first, last;
+
+  g_free (path);
+
+  if (object == NULL) {
+    set_error_response (response, 404, "NoSuchKey",
+        "The specified key does not exist.");
+    goto done;
+  }
+
+  if (if_match) {
+    gchar *expected = normalize_etag (object->etag);
+    gchar *actual = normalize_etag (if_match);
+    gboolean matches = g_str_equal (expected, actual);
+
+    g_free (expected);
+    g_free (actual);
+    if (!matches) {
+      set_error_response (response, 412, "PreconditionFailed",
+          "At least one of the pre-conditions you specified did not hold");
+      goto done;
+    }
+  }
+
+  size = g_bytes_get_size (object->data);
+  g_string_append_printf (response->headers, "ETag: %s\r\n"
+      "Accept-Ranges: bytes\r\n", object->etag);
+
+  if (range && g_str_has_prefix (range, "bytes=")) {
+    gchar *end;
+
+    first = g_ascii_strtoull (range + strlen ("bytes="), &end, 10);
+    last = *end == '-' && end[1] != '\0' ?
+        g_ascii_strtoull (end + 1, NULL, 10) : size - 1;
+    if (first >= size || last < first) {
+      set_error_response (response, 416, "InvalidRange",
+          "The requested range is not satisfiable");
+      goto done;
+    }
+    last = MIN (last, size - 1);
+
+    response->status = 206;
+    g_string_append_printf (response->headers,
+        "Content-Range: bytes %" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT
+        "/%" G_GSIZE_FORMAT "\r\n", first, last, size);
+  } else {
+    first = 0;
+    last = size - 1;
+    response->status = 200;
+  }
+
+  if (size == 0)
+    response->body = g_bytes_new (NULL, 0);
+  else
+    response->body = g_bytes_new_from_bytes (object->data, first,
+        last - first + 1);
+
+done:
+  if (head) {
+    response->content_length = response->body ?
+        (gint64) g_bytes_get_size (response->body) : 0;
+    g_clear_pointer (&response->body, g_bytes_unref);
+  }
+}
+
+static void
+get_bucket_location (MockResponse * response)
+{
+  GString *xml = g_string_new (XML_HEADER);
+
+  /* what S3 answers for us-east-1 */
+  g_string_append (xml, "<LocationConstraint xmlns=\"" S3_XMLNS "\"/>");
+  set_xml_response (response, 200, xml);
+}
+
+static void
+handle_operation (GstS3MockServer * server, GstS3MockOperation operation,
+    MockRequest * request, MockResponse * response)
+{
+  switch (operation) {
+    case GST_S3_MOCK_OPERATION_CREATE_MULTIPART_UPLOAD:
+      create_multipart_upload (server, request, response);
+      break;
+    case GST_S3_MOCK_OPERATION_UPLOAD_PART:
+      upload_part (server, request, response);
+      break;
+    case GST_S3_MOCK_OPERATION_COMPLETE_MULTIPART_UPLOAD:
+      complete_multipart_upload (server, request, response);
+      break;
+    case GST_S3_MOCK_OPERATION_ABORT_MULTIPART_UPLOAD:
+      abort_multipart_upload (server, request, response);
+      break;
+    case GST_S3_MOCK_OPERATION_LIST_PARTS:
+      list_parts (server, request, response);
+      break;
+    case GST_S3_MOCK_OPERATION_PUT_OBJECT:
+      put_object (server, request, response);
+      break;
+    case GST_S3_MOCK_OPERATION_HEAD_OBJECT:
+      get_object (server, request, response, TRUE);
+      break;
+    case GST_S3_MOCK_OPERATION_GET_OBJECT:
+      get_object (server, request, response, FALSE);
+      break;
+    case GST_S3_MOCK_OPERATION_GET_BUCKET_LOCATION:
+      get_bucket_location (response);
+      break;
+    default:
+      set_error_response (response, 501, "NotImplemented",
+          "A header you provided implies functionality that is not "
+          "implemented");
+      break;
+  }
+}
+
+/* Counts the request, and returns the fault to answer it with, if any. */
+static gboolean
+take_fault (GstS3MockServer * server, GstS3MockOperation operation,
+    GstS3MockFault * fault, GstClockTime * latency)
+{
+  GList *l;
+
+  server->request_count[GST_S3_MOCK_OPERATION_ANY]++;
+  if (operation != GST_S3_MOCK_OPERATION_ANY)
+    server->request_count[operation]++;
+
+  *latency = server->latency[GST_S3_MOCK_OPERATION_ANY];
+  if (operation != GST_S3_MOCK_OPERATION_ANY)
+    *latency += server->latency[operation];
+
+  for (l = server->faults; l; l = l->next) {
+    MockFaultRule *rule = l->data;
+
+    if (rule->operation != GST_S3_MOCK_OPERATION_ANY
+        && rule->operation != operation)
+      continue;
+
+    *fault = rule->fault;
+    if (--rule->count == 0) {
+      g_free (rule);
+      server->faults = g_list_delete_link (server->faults, l);
+    }
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+static gboolean
+read_exactly (GDataInputStream * reader, guint8 * data, gsize size)
+{
+  gsize read = 0;
+
+  return g_input_stream_read_all (G_INPUT_STREAM (reader), data, size, &read,
+      NULL, NULL) && read == size;
+}
+
+static gboolean
+read_chunked (GDataInputStream * reader, GByteArray * body)
+{
+  for (;;) {
+    gchar *line = g_data_input_stream_read_line (reader, NULL, NULL, NULL);
+    guint64 size;
+    guint length;
+
+    if (line == NULL)
+      return FALSE;
+    size = g_ascii_strtoull (line, NULL, 16);
+    g_free (line);
+
+    if (size == 0) {
+      /* the trailers, up to an empty line */
+      while ((line = g_data_input_stream_read_line (reader, NULL, NULL,
+                  NULL)) && line[0] != '\0')
+        g_free (line);
+      if (line == NULL)
+        return FALSE;
+      g_free (line);
+      return TRUE;
+    }
+
+    length = body->len;
+    g_byte_array_set_size (body, length + size);
+    if (!read_exactly (reader, body->data + length, size))
+      return FALSE;
+
+    line = g_data_input_stream_read_line (reader, NULL, NULL, NULL);
+    if (line == NULL)
+      return FALSE;
+    g_free (line);
+  }
+}
+
+/* The aws-chunked content encoding used for streamed and trailing
+ * checksums: chunks with signatures as extensions, then trailers. */
+static GByteArray *
+decode_aws_chunked (GByteArray * encoded)
+{
+  GByteArray *decoded = g_byte_array_new ();
+  gsize pos = 0;
+
+  while (pos < encoded->len) {
+    const guint8 *eol = memchr (encoded->data + pos, '\n', encoded->len - pos);
+    guint64 size;
+
+    if (eol == NULL)
+      break;
+    size = g_ascii_strtoull ((const gchar *) encoded->data + pos, NULL, 16);
+    pos = eol - encoded->data + 1;
+    if (size == 0 || size > encoded->len - pos)
+      break;
+
+    g_byte_array_append (decoded, encoded->data + pos, size);
+    pos += size + 2;
+  }
+
+  return decoded;
+}
+
+static gboolean
+read_body (GDataInputStream * reader, MockRequest * request)
+{
+  const gchar *transfer_encoding =
+      g_hash_table_lookup (request->headers, "transfer-encoding");
+  const gchar *content_encoding =
+      g_hash_table_lookup (request->headers, "content-encoding");
+  const gchar *content_length =
+      g_hash_table_lookup (request->headers, "content-length");
+
+  request->body = g_byte_array_new ();
+
+  if (transfer_encoding && strstr (transfer_encoding, "chunked")) {
+    if (!read_chunked (reader, request->body))
+      return FALSE;
+  } else if (content_length) {
+    guint64 size = g_ascii_strtoull (content_length, NULL, 10);
+
+    g_byte_array_set_size (request->body, size);
+    if (size > 0 && !read_exactly (reader, request->body->data, size))
+      return FALSE;
+  }
+
+  if (content_encoding && strstr (content_encoding, "aws-chunked")) {
+    GByteArray *decoded = decode_aws_chunked (request->body);
+
+    g_byte_array_unref (request->body);
+    request->body = decoded;
+  }
+
+  /* so that XML bodies can be read as strings; not part of the length */
+  g_byte_array_append (request->body, (const guint8 *) "", 1);
+  g_byte_array_set_size (request->body, request->body->len - 1);
+
+  return TRUE;
+}
+
+static GHashTable *
+parse_query (const gchar * query)
+{
+  GHashTable *params = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, g_free);
+  gchar **pairs;
+  guint i;
+
+  if (query == NULL)
+    return params;
+
+  pairs = g_strsplit (query, "&", -1);
+  for (i = 0; pairs[i]; i++) {
+    gchar **pair = g_strsplit (pairs[i], "=", 2);
+
+    if (pair[0][0] != '\0') {
+      g_hash_table_insert (params, g_uri_unescape_string (pair[0], NULL),
+          pair[1] ? g_uri_unescape_string (pair[1], NULL) : g_strdup (""));
+    }
+    g_strfreev (pair);
+  }
+  g_strfreev (pairs);
+
+  return params;
+}
+
+/* Path style (http://127.0.0.1:port/bucket/key) unless the host isn't an
+ * address, in which case the bucket comes first in it. */
+static void
+parse_target (MockRequest * request, const gchar * target)
+{
+  const gchar *host = g_hash_table_lookup (request->headers, "host");
+  const gchar *query = strchr (target, '?');
+  gchar *escaped_path = g_strndup (target,
+      query ? (gsize) (query - target) : strlen (target));
+  gchar *path = g_uri_unescape_string (escaped_path, NULL);
+  gchar *hostname = NULL;
+  const gchar *key = path ? path + 1 : "";
+
+  g_free (escaped_path);
+  request->query = parse_query (query ? query + 1 : NULL);
+
+  if (host) {
+    const gchar *colon = strrchr (host, ':');
+    hostname = g_strndup (host, colon ? (gsize) (colon - host) : strlen (host));
+  }
+
+  if (hostname && !g_hostname_is_ip_address (hostname)
+      && !g_str_equal (hostname, "localhost") && strchr (hostname, '.')) {
+    request->bucket = g_strndup (hostname, strchr (hostname, '.') - hostname);
+  } else {
+    const gchar *slash = strchr (key, '/');
+
+    request->bucket = g_strndup (key, slash ? (gsize) (slash - key)
+        : strlen (key));
+    key = slash ? slash + 1 : "";
+  }
+  request->key = g_strdup (key);
+
+  g_free (hostname);
+  g_free (path);
+}
+
+static gboolean
+write_response (GOutputStream * out, MockResponse * response)
+{
+  GString *head = g_string_new (NULL);
+  gsize body_size = response->body ? g_bytes_get_size (response->body) : 0;
+  gint64 content_length = response->content_length >= 0 ?
+      response->content_length : (gint64) body_size;
+  gboolean ok;
+
+  g_string_append_printf (head, "HTTP/1.1 %u %s\r\n", response->status,
+      get_reason_phrase (response->status));
+  g_string_append (head, "x-amz-request-id: mock-request\r\n");
+  g_string_append (head, response->headers->str);
+  g_string_append_printf (head, "Content-Length: %" G_GINT64_FORMAT "\r\n\r\n",
+      content_length);
+
+  if (response->truncate && body_size == 0) {
+    /* nothing to cut but the head */
+    g_output_stream_write_all (out, head->str, head->len / 2, NULL, NULL,
+        NULL);
+    g_string_free (head, TRUE);
+    return FALSE;
+  }
+
+  ok = g_output_stream_write_all (out, head->str, head->len, NULL, NULL, NULL);
+  g_string_free (head, TRUE);
+
+  if (ok && body_size > 0) {
+    ok = g_output_stream_write_all (out, g_bytes_get_data (response->body,
+            NULL), response->truncate ? body_size / 2 : body_size, NULL, NULL,
+        NULL);
+  }
+
+  return ok && !response->truncate;
+}
+
+/* Returns FALSE once the connection is to be closed. */
+static gboolean
+handle_request (GstS3MockServer * server, GDataInputStream * reader,
+    GOutputStream * out)
+{
+  MockRequest request = { 0 };
+  MockResponse response = { 0 };
+  GstS3MockOperation operation;
+  GstS3MockFault fault;
+  GstClockTime latency, start_time, duration;
+  gboolean faulty;
+  gboolean keep_alive = FALSE;
+  const gchar *value;
+  gchar **request_line = NULL;
+  gchar *line;
+
+  line = g_data_input_stream_read_line (reader, NULL, NULL, NULL);
+  if (line == NULL)
+    return FALSE;
+  start_time = gst_util_get_timestamp ();
+  request_line = g_strsplit (line, " ", 3);
+  g_free (line);
+  if (g_strv_length (request_line) < 3)
+    goto done;
+
+  request.headers = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      g_free);
+  while ((line = g_data_input_stream_read_line (reader, NULL, NULL, NULL))
+      && line[0] != '\0') {
+    gchar *colon = strchr (line, ':');
+
+    if (colon) {
+      *colon = '\0';
+      g_hash_table_insert (request.headers, g_ascii_strdown (line, -1),
+          g_strdup (g_strstrip (colon + 1)));
+    }
+    g_free (line);
+  }
+  if (line == NULL)
+    goto done;
+  g_free (line);
+
+  value = g_hash_table_lookup (request.headers, "expect");
+  if (value && g_ascii_strcasecmp (value, "100-continue") == 0) {
+    static const gchar continue_response[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+    if (!g_output_stream_write_all (out, continue_response,
+            strlen (continue_response), NULL, NULL, NULL))
+      goto done;
+  }
+
+  if (!read_body (reader, &request))
+    goto done;
+
+  request.method = g_strdup (request_line[0]);
+  parse_target (&request, request_line[1]);
+  operation = get_operation (&request);
+
+  response.headers = g_string_new (NULL);
+  response.content_length = -1;
+
+  g_mutex_lock (&server->lock);
+  faulty = take_fault (server, operation, &fault, &latency);
+  g_mutex_unlock (&server->lock);
+
+  if (latency > 0)
+    g_usleep (GST_TIME_AS_USECONDS (latency));
+
+  if (faulty && fault == GST_S3_MOCK_FAULT_INTERNAL_ERROR) {
+    set_error_response (&response, 500, "InternalError",
+        "We encountered an internal error. Please try again.");
+  } else if (faulty && fault == GST_S3_MOCK_FAULT_SLOW_DOWN) {
+    set_error_response (&response, 503, "SlowDown",
+        "Please reduce your request rate.");
+  } else if (faulty && fault == GST_S3_MOCK_FAULT_ACCESS_DENIED) {
+    set_error_response (&response, 403, "AccessDenied", "Access Denied");
+  } else {
+    g_mutex_lock (&server->lock);
+    handle_operation (server, operation, &request, &response);
+    g_mutex_unlock (&server->lock);
+    response.truncate = faulty && fault == GST_S3_MOCK_FAULT_TRUNCATE;
+  }
+
+  keep_alive = write_response (out, &response);
+
+  duration = gst_util_get_timestamp () - start_time;
+  g_mutex_lock (&server->lock);
+  g_array_append_val (server->durations[GST_S3_MOCK_OPERATION_ANY], duration);
+  if (operation != GST_S3_MOCK_OPERATION_ANY)
+    g_array_append_val (server->durations[operation], duration);
+  if (server->last_headers[operation])
+    g_hash_table_unref (server->last_headers[operation]);
+  server->last_headers[operation] = g_hash_table_ref (request.headers);
+  g_mutex_unlock (&server->lock);
+
+  value = g_hash_table_lookup (request.headers, "connection");
+  if (value && g_ascii_strcasecmp (value, "close") == 0)
+    keep_alive = FALSE;
+
+done:
+  g_strfreev (request_line);
+  g_free (request.method);
+  g_free (request.bucket);
+  g_free (request.key);
+  if (request.query)
+    g_hash_table_unref (request.query);
+  if (request.headers)
+    g_hash_table_unref (request.headers);
+  if (request.body)
+    g_byte_array_unref (request.body);
+  if (response.headers)
+    g_string_free (response.headers, TRUE);
+  if (response.body)
+    g_bytes_unref (response.body);
+
+  return keep_alive;
+}
+
+static gpointer
+mock_connection_run (gpointer data)
+{
+  MockConnection *connection = data;
+  GIOStream *stream = G_IO_STREAM (connection->connection);
+  GDataInputStream *reader =
+      g_data_input_stream_new (g_io_stream_get_input_stream (stream));
+  GOutputStream *out = g_io_stream_get_output_stream (stream);
+
+  g_data_input_stream_set_newline_type (reader,
+      G_DATA_STREAM_NEWLINE_TYPE_CR_LF);
+  g_filter_input_stream_set_close_base_stream (G_FILTER_INPUT_STREAM (reader),
+      FALSE);
+
+  while (handle_request (connection->server, reader, out));
+
+  g_object_unref (reader);
+  g_io_stream_close (stream, NULL, NULL);
+
+  return NULL;
+}
+
+static gpointer
+mock_server_accept (gpointer data)
+{
+  GstS3MockServer *server = data;
+  GSocket *socket;
+
+  while ((socket = g_socket_accept (server->listener, server->cancellable,
+              NULL))) {
+    MockConnection *connection = g_new0 (MockConnection, 1);
+
+    connection->server = server;
+    connection->connection =
+        g_socket_connection_factory_create_connection (socket);
+    g_object_unref (socket);
+
+    g_mutex_lock (&server->lock);
+    server->connections = g_list_prepend (server->connections, connection);
+    connection->thread = g_thread_new ("s3-mock-connection",
+        mock_connection_run, connection);
+    g_mutex_unlock (&server->lock);
+  }
+
+  return NULL;
+}
+
+GstS3MockServer *
+gst_s3_mock_server_new (void)
+{
+  GstS3MockServer *server = g_new0 (GstS3MockServer, 1);
+  GInetAddress *loopback = g_inet_address_new_loopback (G_SOCKET_FAMILY_IPV4);
+  GSocketAddress *address = g_inet_socket_address_new (loopback, 0);
+  GSocketAddress *local_address;
+  guint i;
+
+  server->listener = g_socket_new (G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM,
+      G_SOCKET_PROTOCOL_TCP, NULL);
+  g_assert (server->listener);
+  g_assert (g_socket_bind (server->listener, address, TRUE, NULL));
+  g_assert (g_socket_listen (server->listener, NULL));
+  g_object_unref (address);
+  g_object_unref (loopback);
+
+  local_address = g_socket_get_local_address (server->listener, NULL);
+  server->endpoint = g_strdup_printf ("127.0.0.1:%u",
+      g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (local_address)));
+  g_object_unref (local_address);
+
+  g_mutex_init (&server->lock);
+  server->objects = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) mock_object_free);
+  server->uploads = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) mock_upload_free);
+  server->completed_uploads = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, g_free);
+  for (i = 0; i < GST_S3_MOCK_OPERATION_COUNT; i++)
+    server->durations[i] = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+
+  server->cancellable = g_cancellable_new ();
+  server->accept_thread = g_thread_new ("s3-mock-server", mock_server_accept,
+      server);
+
+  return server;
+}
+
+void
+gst_s3_mock_server_free (GstS3MockServer * server)
+{
+  GList *l;
+  guint i;
+
+  g_cancellable_cancel (server->cancellable);
+  g_thread_join (server->accept_thread);
+
+  /* the clients may keep their connections open, wake up their threads */
+  for (l = server->connections; l; l = l->next) {
+    MockConnection *connection = l->data;
+
+    g_socket_shutdown (g_socket_connection_get_socket (connection->connection),
+        TRUE, TRUE, NULL);
+    g_thread_join (connection->thread);
+    g_object_unref (connection->connection);
+    g_free (connection);
+  }
+  g_list_free (server->connections);
+
+  g_socket_close (server->listener, NULL);
+  g_object_unref (server->listener);
+  g_object_unref (server->cancellable);
+  g_list_free_full (server->faults, g_free);
+  g_hash_table_unref (server->objects);
+  g_hash_table_unref (server->uploads);
+  g_hash_table_unref (server->completed_uploads);
+  for (i = 0; i < GST_S3_MOCK_OPERATION_COUNT; i++) {
+    g_array_unref (server->durations[i]);
+    if (server->last_headers[i])
+      g_hash_table_unref (server->last_headers[i]);
+  }
+  g_mutex_clear (&server->lock);
+  g_free (server->endpoint);
+  g_free (server);
+}
+
+const gchar *
+gst_s3_mock_server_get_endpoint (GstS3MockServer * server)
+{
+  return server->endpoint;
+}
+
+void
+gst_s3_mock_server_set_latency (GstS3MockServer * server,
+    GstS3MockOperation operation, GstClockTime latency)
+{
+  g_mutex_lock (&server->lock);
+  server->latency[operation] = latency;
+  g_mutex_unlock (&server->lock);
+}
+
+void
+gst_s3_mock_server_add_fault (GstS3MockServer * server,
+    GstS3MockOperation operation, GstS3MockFault fault, guint count)
+{
+  MockFaultRule *rule;
+
+  if (count == 0)
+    return;
+
+  rule = g_new0 (MockFaultRule, 1);
+  rule->operation = operation;
+  rule->fault = fault;
+  rule->count = count;
+
+  g_mutex_lock (&server->lock);
+  server->faults = g_list_append (server->faults, rule);
+  g_mutex_unlock (&server->lock);
+}
+
+void
+gst_s3_mock_server_set_discard_data (GstS3MockServer * server,
+    gboolean discard)
+{
+  g_mutex_lock (&server->lock);
+  server->discard_data = discard;
+  g_mutex_unlock (&server->lock);
+}
+
+void
+gst_s3_mock_server_put_object (GstS3MockServer * server, const gchar * bucket,
+    const gchar * key, GBytes * data)
+{
+  MockObject *object = g_new0 (MockObject, 1);
+  guint8 md5[16];
+  gsize size;
+  gconstpointer bytes = g_bytes_get_data (data, &size);
+
+  object->etag = compute_etag (bytes, size, md5);
+  object->data = g_bytes_ref (data);
+
+  g_mutex_lock (&server->lock);
+  g_hash_table_insert (server->objects,
+      g_strdup_printf ("%s/%s", bucket, key), object);
+  g_mutex_unlock (&server->lock);
+}
+
+GBytes *
+gst_s3_mock_server_get_object (GstS3MockServer * server, const gchar * bucket,
+    const gchar * key)
+{
+  gchar *path = g_strdup_printf ("%s/%s", bucket, key);
+  MockObject *object;
+  GBytes *data = NULL;
+
+  g_mutex_lock (&server->lock);
+  object = g_hash_table_lookup (server->objects, path);
+  if (object)
+    data = g_bytes_ref (object->data);
+  g_mutex_unlock (&server->lock);
+
+  g_free (path);
+  return data;
+}
+
+guint
+gst_s3_mock_server_get_request_count (GstS3MockServer * server,
+    GstS3MockOperation operation)
+{
+  guint count;
+
+  g_mutex_lock (&server->lock);
+  count = server->request_count[operation];
+  g_mutex_unlock (&server->lock);
+
+  return count;
+}
+
+guint
+gst_s3_mock_server_get_pending_upload_count (GstS3MockServer * server)
+{
+  guint count;
+
+  g_mutex_lock (&server->lock);
+  count = g_hash_table_size (server->uploads);
+  g_mutex_unlock (&server->lock);
+
+  return count;
+}
+
+GArray *
+gst_s3_mock_server_get_request_durations (GstS3MockServer * server,
+    GstS3MockOperation operation)
+{
+  GArray *durations = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+
+  g_mutex_lock (&server->lock);
+  g_array_append_vals (durations, server->durations[operation]->data,
+      server->durations[operation]->len);
+  g_mutex_unlock (&server->lock);
+
+  return durations;
+}
+
+gchar *
+gst_s3_mock_server_get_last_header (GstS3MockServer * server,
+    GstS3MockOperation operation, const gchar * name)
+{
+  gchar *lower_name = g_ascii_strdown (name, -1);
+  gchar *value = NULL;
+
+  g_mutex_lock (&server->lock);
+  if (server->last_headers[operation])
+    value = g_strdup (g_hash_table_lookup (server->last_headers[operation],
+            lower_name));
+  g_mutex_unlock (&server->lock);
+  g_free (lower_name);
+
+  return value;
+}
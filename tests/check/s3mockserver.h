@@ -0,0 +1,110 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#ifndef __GST_S3_MOCK_SERVER_H__
+#define __GST_S3_MOCK_SERVER_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* An S3 stand-in listening on the loopback interface, for tests and
+ * benchmarks of the elements with their real S3 client. Point the
+ * aws-sdk-endpoint property at gst_s3_mock_server_get_endpoint() and set
+ * aws-sdk-use-http.
+ *
+ * It keeps the objects in memory and implements what the elements use:
+ * the multipart upload requests, PutObject, HeadObject, GetObject (with
+ * Range and If-Match) and GetBucketLocation. Requests aren't
+ * authenticated. */
+typedef struct _GstS3MockServer GstS3MockServer;
+
+typedef enum {
+  GST_S3_MOCK_OPERATION_ANY,
+  GST_S3_MOCK_OPERATION_CREATE_MULTIPART_UPLOAD,
+  GST_S3_MOCK_OPERATION_UPLOAD_PART,
+  GST_S3_MOCK_OPERATION_COMPLETE_MULTIPART_UPLOAD,
+  GST_S3_MOCK_OPERATION_ABORT_MULTIPART_UPLOAD,
+  GST_S3_MOCK_OPERATION_LIST_PARTS,
+  GST_S3_MOCK_OPERATION_PUT_OBJECT,
+  GST_S3_MOCK_OPERATION_HEAD_OBJECT,
+  GST_S3_MOCK_OPERATION_GET_OBJECT,
+  GST_S3_MOCK_OPERATION_GET_BUCKET_LOCATION,
+  GST_S3_MOCK_OPERATION_COUNT
+} GstS3MockOperation;
+
+typedef enum {
+  /* 500 InternalError, the request isn't carried out */
+  GST_S3_MOCK_FAULT_INTERNAL_ERROR,
+  /* 503 SlowDown, the request isn't carried out */
+  GST_S3_MOCK_FAULT_SLOW_DOWN,
+  /* 403 AccessDenied, which clients don't retry */
+  GST_S3_MOCK_FAULT_ACCESS_DENIED,
+  /* the request is carried out, but the connection is closed half way
+   * through the response (its body, or its head when it has none) */
+  GST_S3_MOCK_FAULT_TRUNCATE
+} GstS3MockFault;
+
+GstS3MockServer *gst_s3_mock_server_new (void);
+
+void gst_s3_mock_server_free (GstS3MockServer * server);
+
+/* "127.0.0.1:<port>" */
+const gchar *gst_s3_mock_server_get_endpoint (GstS3MockServer * server);
+
+/* Delays every response to the operation. */
+void gst_s3_mock_server_set_latency (GstS3MockServer * server,
+    GstS3MockOperation operation, GstClockTime latency);
+
+/* Makes the next count requests of the operation fail. Faults are used up
+ * in the order they were added. */
+void gst_s3_mock_server_add_fault (GstS3MockServer * server,
+    GstS3MockOperation operation, GstS3MockFault fault, guint count);
+
+/* Only keeps the size of what's uploaded, for benchmarks. The objects
+ * read back are empty. */
+void gst_s3_mock_server_set_discard_data (GstS3MockServer * server,
+    gboolean discard);
+
+void gst_s3_mock_server_put_object (GstS3MockServer * server,
+    const gchar * bucket, const gchar * key, GBytes * data);
+
+/* Returns NULL when there's no such object. */
+GBytes *gst_s3_mock_server_get_object (GstS3MockServer * server,
+    const gchar * bucket, const gchar * key);
+
+guint gst_s3_mock_server_get_request_count (GstS3MockServer * server,
+    GstS3MockOperation operation);
+
+/* The time taken by each of the requests answered, from their request line
+ * to the end of their response, as an array of GstClockTime. Free with
+ * g_array_unref(). */
+GArray *gst_s3_mock_server_get_request_durations (GstS3MockServer * server,
+    GstS3MockOperation operation);
+
+/* The value of the header in the last request of the operation, NULL if
+ * there's none. Free with g_free(). */
+gchar *gst_s3_mock_server_get_last_header (GstS3MockServer * server,
+    GstS3MockOperation operation, const gchar * name);
+
+/* The multipart uploads neither completed nor aborted. */
+guint gst_s3_mock_server_get_pending_upload_count (GstS3MockServer * server);
+
+G_END_DECLS
+
+#endif /* __GST_S3_MOCK_SERVER_H__ */
@@ -20,6 +20,7 @@
 #include "gsts3sink.h"
 
 #include <gst/check/gstcheck.h>
+#include <glib/gstdio.h>
 
 static GstStaticPadTemplate srctemplate = GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_SRC,
@@ -33,40 +34,208 @@ typedef struct {
     gboolean fail_complete;
 
     gint upload_part_count;
+    gint complete_count;
+    gint put_object_count;
+    gsize last_part_size;
+    gchar *last_part_checksum;
+    gchar *last_part_file;
+
+    gint begin_part_count;
+    gsize streamed_bytes;
+
+    /* set on the uploaders made by create_next */
+    gchar *key;
+
+    gint failed_part_number;
+
+    gboolean no_capacity;
+    gboolean waiting;
+    gboolean unlocked;
+    GMutex lock;
+    GCond cond;
 } TestUploader;
 
 #define TEST_UPLOADER(uploader) ((TestUploader*) uploader)
 
+/* completed by any test uploader, including the ones already destroyed */
+static gint completed_objects;
+
 static void
 test_uploader_destroy (GstS3Uploader * uploader)
 {
+  g_mutex_clear (&TEST_UPLOADER(uploader)->lock);
+  g_cond_clear (&TEST_UPLOADER(uploader)->cond);
+  g_free (TEST_UPLOADER(uploader)->last_part_checksum);
+  g_free (TEST_UPLOADER(uploader)->last_part_file);
+  g_free (TEST_UPLOADER(uploader)->key);
   g_free(uploader);
 }
 
 static gboolean
-test_uploader_upload_part (GstS3Uploader * uploader, G_GNUC_UNUSED const gchar * buffer, G_GNUC_UNUSED gsize size)
+test_uploader_upload_part (GstS3Uploader * uploader, GstBufferList * buffers)
 {
   gboolean ok = TEST_UPLOADER(uploader)->fail_upload_retry != 0;
+  guint i;
 
   TEST_UPLOADER(uploader)->upload_part_count++;
+  g_free (TEST_UPLOADER(uploader)->last_part_checksum);
+  TEST_UPLOADER(uploader)->last_part_checksum =
+      g_strdup (gst_s3_uploader_get_part_checksum (buffers));
+  g_free (TEST_UPLOADER(uploader)->last_part_file);
+  TEST_UPLOADER(uploader)->last_part_file =
+      g_strdup (gst_s3_uploader_get_part_file (buffers));
+  TEST_UPLOADER(uploader)->last_part_size = 0;
+  for (i = 0; i < gst_buffer_list_length (buffers); i++)
+    TEST_UPLOADER(uploader)->last_part_size +=
+        gst_buffer_get_size (gst_buffer_list_get (buffers, i));
 
   if (ok) {
     TEST_UPLOADER(uploader)->fail_upload_retry--;
   }
 
+  gst_buffer_list_unref (buffers);
+
   return ok;
 }
 
 static gboolean
 test_uploader_complete (GstS3Uploader * uploader)
 {
+  TEST_UPLOADER(uploader)->complete_count++;
+  g_atomic_int_inc (&completed_objects);
+  return !TEST_UPLOADER(uploader)->fail_complete;
+}
+
+static gboolean
+test_uploader_put_object (GstS3Uploader * uploader, GstBufferList * buffers)
+{
+  guint i;
+
+  TEST_UPLOADER(uploader)->put_object_count++;
+  TEST_UPLOADER(uploader)->last_part_size = 0;
+  for (i = 0; i < gst_buffer_list_length (buffers); i++)
+    TEST_UPLOADER(uploader)->last_part_size +=
+        gst_buffer_get_size (gst_buffer_list_get (buffers, i));
+  g_atomic_int_inc (&completed_objects);
+
+  gst_buffer_list_unref (buffers);
+
   return !TEST_UPLOADER(uploader)->fail_complete;
 }
 
+static gboolean
+test_uploader_has_capacity (GstS3Uploader * uploader, G_GNUC_UNUSED gsize size)
+{
+  return !TEST_UPLOADER(uploader)->no_capacity;
+}
+
+static gboolean
+test_uploader_wait_for_capacity (GstS3Uploader * uploader, G_GNUC_UNUSED gsize size)
+{
+  TestUploader *self = TEST_UPLOADER(uploader);
+  gboolean ret;
+
+  g_mutex_lock (&self->lock);
+  self->waiting = TRUE;
+  g_cond_broadcast (&self->cond);
+  while (self->no_capacity && !self->unlocked)
+    g_cond_wait (&self->cond, &self->lock);
+  ret = !self->no_capacity;
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+static void
+test_uploader_set_unlocked (GstS3Uploader * uploader, gboolean unlocked)
+{
+  TestUploader *self = TEST_UPLOADER(uploader);
+
+  g_mutex_lock (&self->lock);
+  self->unlocked = unlocked;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+test_uploader_unlock (GstS3Uploader * uploader)
+{
+  test_uploader_set_unlocked (uploader, TRUE);
+}
+
+static void
+test_uploader_unlock_stop (GstS3Uploader * uploader)
+{
+  test_uploader_set_unlocked (uploader, FALSE);
+}
+
+static gboolean
+test_uploader_get_error (GstS3Uploader * uploader, gint * part_number,
+    gchar ** error_code, gchar ** error_message)
+{
+  TestUploader *self = TEST_UPLOADER(uploader);
+
+  if (self->failed_part_number == 0)
+    return FALSE;
+
+  if (part_number)
+    *part_number = self->failed_part_number;
+  if (error_code)
+    *error_code = g_strdup ("SlowDown");
+  if (error_message)
+    *error_message = g_strdup ("Please reduce your request rate.");
+  return TRUE;
+}
+
+static gboolean
+test_uploader_begin_part (GstS3Uploader * uploader, G_GNUC_UNUSED gsize size)
+{
+  TEST_UPLOADER(uploader)->begin_part_count++;
+  return TRUE;
+}
+
+static void
+test_uploader_append_part (GstS3Uploader * uploader, GstBuffer * buffer)
+{
+  TEST_UPLOADER(uploader)->streamed_bytes += gst_buffer_get_size (buffer);
+}
+
+static GstS3Uploader *test_uploader_new (gint fail_upload_retry,
+    gboolean fail_complete);
+
+static GstS3Uploader *
+test_uploader_create_next (G_GNUC_UNUSED GstS3Uploader * uploader,
+    const GstS3UploaderConfig * config)
+{
+  GstS3Uploader *next = test_uploader_new (-1, FALSE);
+
+  TEST_UPLOADER(next)->key = g_strdup (config->key);
+  return next;
+}
+
+static gchar *
+test_uploader_get_etag (GstS3Uploader * uploader)
+{
+  if (TEST_UPLOADER(uploader)->complete_count == 0)
+    return NULL;
+
+  return g_strdup ("\"test-etag\"");
+}
+
 static GstS3UploaderClass test_uploader_class = {
   test_uploader_destroy,
   test_uploader_upload_part,
-  test_uploader_complete
+  test_uploader_complete,
+  test_uploader_has_capacity,
+  test_uploader_wait_for_capacity,
+  test_uploader_unlock,
+  test_uploader_unlock_stop,
+  test_uploader_get_error,
+  NULL,
+  test_uploader_begin_part,
+  test_uploader_append_part,
+  test_uploader_create_next,
+  test_uploader_get_etag
 };
 
 static GstS3Uploader*
@@ -78,10 +247,38 @@ test_uploader_new (gint fail_upload_retry, gboolean fail_complete)
   uploader->fail_upload_retry = fail_upload_retry;
   uploader->fail_complete = fail_complete;
   uploader->upload_part_count = 0;
+  uploader->complete_count = 0;
+  uploader->put_object_count = 0;
+  uploader->last_part_size = 0;
+  uploader->last_part_checksum = NULL;
+  uploader->last_part_file = NULL;
+  uploader->begin_part_count = 0;
+  uploader->streamed_bytes = 0;
+  uploader->key = NULL;
+  uploader->failed_part_number = 0;
+  uploader->no_capacity = FALSE;
+  uploader->waiting = FALSE;
+  uploader->unlocked = FALSE;
+  g_mutex_init (&uploader->lock);
+  g_cond_init (&uploader->cond);
 
   return (GstS3Uploader*) uploader;
 }
 
+/* Writes the objects that fit in a single part with put_object. */
+static GstS3Uploader*
+test_put_object_uploader_new (void)
+{
+  static GstS3UploaderClass klass;
+  GstS3Uploader *uploader = test_uploader_new (-1, FALSE);
+
+  klass = test_uploader_class;
+  klass.put_object = test_uploader_put_object;
+  uploader->klass = &klass;
+
+  return uploader;
+}
+
 /************* TEST UPLOADER END *************/
 
 static gboolean
@@ -113,6 +310,14 @@ push_bytes_finalize:
   return ret;
 }
 
+static gpointer
+push_part_thread (gpointer pad)
+{
+  GstBuffer *buf = gst_buffer_new_and_alloc (5 * 1024 * 1024);
+
+  return GINT_TO_POINTER (gst_pad_push (GST_PAD (pad), buf));
+}
+
 #define PUSH_BYTES(pad, num_bytes) fail_if (!push_bytes(pad, num_bytes, GST_FLOW_OK))
 #define PUSH_BYTES_FAILURE(pad, num_bytes) fail_if (!push_bytes(pad, num_bytes, GST_FLOW_ERROR))
 
@@ -211,8 +416,10 @@ GST_START_TEST (test_change_properties_after_start_should_fail)
   const gchar *content_type = "content-type";
   const gchar *ca_file = "/path/to/ca";
   gint buffer_size = 1024*1024*10;
+  gint buffer_count = 8;
   gchar *new_bucket = NULL, *new_key = NULL, *new_content_type = NULL, *new_ca_file = NULL;
   gint new_buffer_size = 0;
+  gint new_buffer_count = 0;
 
   fail_if (sink == NULL);
 
@@ -224,6 +431,7 @@ GST_START_TEST (test_change_properties_after_start_should_fail)
     "content-type", content_type,
     "ca-file", ca_file,
     "buffer-size", buffer_size,
+    "buffer-count", buffer_count,
     NULL);
 
   ret = gst_element_set_state (sink, GST_STATE_PLAYING);
@@ -235,6 +443,7 @@ GST_START_TEST (test_change_properties_after_start_should_fail)
     "content-type", "new-content-type",
     "ca-file", "new-ca-file",
     "buffer-size", buffer_size * 2,
+    "buffer-count", buffer_count * 2,
     NULL);
 
   g_object_get(sink,
@@ -243,6 +452,7 @@ GST_START_TEST (test_change_properties_after_start_should_fail)
     "content-type", &new_content_type,
     "ca-file", &new_ca_file,
     "buffer-size", &new_buffer_size,
+    "buffer-count", &new_buffer_count,
     NULL);
 
   fail_unless_equals_string(bucket, new_bucket);
@@ -250,6 +460,7 @@ GST_START_TEST (test_change_properties_after_start_should_fail)
   fail_unless_equals_string(content_type, new_content_type);
   fail_unless_equals_string(ca_file, new_ca_file);
   fail_unless_equals_int(buffer_size, new_buffer_size);
+  fail_unless_equals_int(buffer_count, new_buffer_count);
 
   gst_element_set_state (sink, GST_STATE_NULL);
   gst_object_unref (sink);
@@ -293,6 +504,122 @@ GST_START_TEST (test_send_eos_should_flush_buffer)
 }
 GST_END_TEST
 
+GST_START_TEST (test_small_object_is_finalized_on_eos)
+{
+  GstElement *sink;
+  GstStateChangeReturn ret;
+  GstPad *sinkpad, *srcpad;
+  TestUploader *uploader = (TestUploader *) test_uploader_new (-1, FALSE);
+
+  sink = setup_default_s3_sink ((GstS3Uploader*) uploader);
+  fail_if (sink == NULL);
+
+  srcpad = gst_check_setup_src_pad (sink, &srctemplate);
+  gst_pad_set_active (srcpad, TRUE);
+
+  ret = gst_element_set_state (sink, GST_STATE_PLAYING);
+  fail_unless (ret == GST_STATE_CHANGE_ASYNC);
+
+  fail_unless(TRUE == prepare_to_push_bytes(srcpad, NULL));
+
+  PUSH_BYTES(srcpad, 10);
+
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_send_event(sinkpad, gst_event_new_eos ());
+  gst_object_unref (sinkpad);
+
+  fail_unless_equals_int(1, uploader->upload_part_count);
+  fail_unless_equals_int(10, uploader->last_part_size);
+  fail_unless_equals_int(1, uploader->complete_count);
+
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (srcpad);
+}
+GST_END_TEST
+
+GST_START_TEST (test_small_object_is_put_with_one_request)
+{
+  GstElement *sink;
+  GstStateChangeReturn ret;
+  GstPad *sinkpad, *srcpad;
+  GstSegment segment;
+  TestUploader *uploader = (TestUploader *) test_put_object_uploader_new ();
+
+  sink = setup_default_s3_sink ((GstS3Uploader*) uploader);
+  fail_if (sink == NULL);
+
+  srcpad = gst_check_setup_src_pad (sink, &srctemplate);
+  gst_pad_set_active (srcpad, TRUE);
+
+  ret = gst_element_set_state (sink, GST_STATE_PLAYING);
+  fail_unless (ret == GST_STATE_CHANGE_ASYNC);
+
+  fail_unless(TRUE == prepare_to_push_bytes(srcpad, NULL));
+
+  PUSH_BYTES(srcpad, 10);
+
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_send_event(sinkpad, gst_event_new_eos ());
+  gst_object_unref (sinkpad);
+
+  fail_unless_equals_int(1, uploader->put_object_count);
+  fail_unless_equals_int(10, uploader->last_part_size);
+  fail_unless_equals_int(0, uploader->upload_part_count);
+  fail_unless_equals_int(0, uploader->complete_count);
+
+  /* past a flush, the object that's already written is left alone */
+  fail_unless (gst_pad_push_event (srcpad, gst_event_new_flush_start ()));
+  fail_unless (gst_pad_push_event (srcpad, gst_event_new_flush_stop (TRUE)));
+  gst_segment_init (&segment, GST_FORMAT_BYTES);
+  fail_unless (gst_pad_push_event (srcpad, gst_event_new_segment (&segment)));
+  fail_if (!push_bytes (srcpad, 10, GST_FLOW_EOS));
+  fail_unless_equals_int(1, uploader->put_object_count);
+  fail_unless_equals_int(0, uploader->upload_part_count);
+
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (srcpad);
+}
+GST_END_TEST
+
+GST_START_TEST (test_part_checksum_is_computed_incrementally)
+{
+  GstElement *sink;
+  GstStateChangeReturn ret;
+  GstPad *sinkpad, *srcpad;
+  TestUploader *uploader = (TestUploader *) test_uploader_new (-1, FALSE);
+
+  sink = setup_default_s3_sink ((GstS3Uploader*) uploader);
+  fail_if (sink == NULL);
+  gst_util_set_object_arg (G_OBJECT (sink), "checksum-algorithm", "crc32c");
+
+  srcpad = gst_check_setup_src_pad (sink, &srctemplate);
+  gst_pad_set_active (srcpad, TRUE);
+
+  ret = gst_element_set_state (sink, GST_STATE_PLAYING);
+  fail_unless (ret == GST_STATE_CHANGE_ASYNC);
+
+  fail_unless(TRUE == prepare_to_push_bytes(srcpad, NULL));
+
+  fail_unless_equals_int (GST_FLOW_OK, gst_pad_push (srcpad,
+          gst_buffer_new_wrapped (g_strdup ("12345"), 5)));
+  fail_unless_equals_int (GST_FLOW_OK, gst_pad_push (srcpad,
+          gst_buffer_new_wrapped (g_strdup ("6789"), 4)));
+
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_send_event(sinkpad, gst_event_new_eos ());
+  gst_object_unref (sinkpad);
+
+  /* CRC32C("123456789") = 0xe3069283 */
+  fail_unless_equals_string ("4waSgw==", uploader->last_part_checksum);
+
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (srcpad);
+}
+GST_END_TEST
+
 GST_START_TEST (test_push_buffer_should_flush_buffer_if_reaches_limit)
 {
   GstElement *sink;
@@ -326,78 +653,122 @@ GST_START_TEST (test_push_buffer_should_flush_buffer_if_reaches_limit)
 }
 GST_END_TEST
 
-GST_START_TEST (test_query_position)
+GST_START_TEST (test_buffers_spanning_parts_are_split)
 {
-  GstElement *sink = setup_default_s3_sink (test_uploader_new (-1, FALSE));
+  GstElement *sink;
   GstStateChangeReturn ret;
-  GstPad *srcpad, *sinkpad;
-  const gint64 bytes_to_write = 31337;
-  gint64 position_bytes = 0;
+  GstPad *sinkpad, *srcpad;
+  const gsize part_size = 5 * 1024 * 1024;
+  TestUploader *uploader = (TestUploader *) test_uploader_new (-1, FALSE);
 
+  sink = setup_default_s3_sink ((GstS3Uploader*) uploader);
   fail_if (sink == NULL);
 
+  g_object_set(sink, "buffer-size", part_size, NULL);
+
   srcpad = gst_check_setup_src_pad (sink, &srctemplate);
   gst_pad_set_active (srcpad, TRUE);
 
-  sinkpad = gst_element_get_static_pad (sink, "sink");
-  fail_if (sinkpad == NULL);
-
   ret = gst_element_set_state (sink, GST_STATE_PLAYING);
   fail_unless (ret == GST_STATE_CHANGE_ASYNC);
 
   fail_unless(TRUE == prepare_to_push_bytes(srcpad, NULL));
 
-  PUSH_BYTES(srcpad, bytes_to_write);
+  PUSH_BYTES (srcpad, 3 * 1024 * 1024);
+  PUSH_BYTES (srcpad, 3 * 1024 * 1024);
 
-  gst_pad_query_position (sinkpad, GST_FORMAT_BYTES, &position_bytes);
+  fail_unless_equals_int (1, uploader->upload_part_count);
+  fail_unless_equals_int (part_size, uploader->last_part_size);
 
-  fail_unless_equals_int64 (bytes_to_write, position_bytes);
+  PUSH_BYTES (srcpad, 3 * 1024 * 1024);
 
-  gst_element_set_state (sink, GST_STATE_NULL);
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_send_event(sinkpad, gst_event_new_eos ());
   gst_object_unref (sinkpad);
-  gst_object_unref (srcpad);
+
+  fail_unless_equals_int (2, uploader->upload_part_count);
+  fail_unless_equals_int (4 * 1024 * 1024, uploader->last_part_size);
+
+  gst_element_set_state (sink, GST_STATE_NULL);
   gst_object_unref (sink);
+  gst_object_unref (srcpad);
 }
 GST_END_TEST
 
-GST_START_TEST (test_query_seeking)
+GST_START_TEST (test_streaming_parts_are_fed_as_they_fill)
 {
-  const GstFormat expected_format = GST_FORMAT_DEFAULT;
-  GstFormat format;
-  gboolean seekable;
-  GstElement *sink = setup_default_s3_sink (test_uploader_new (-1, FALSE));
+  GstElement *sink;
   GstStateChangeReturn ret;
+  GstPad *sinkpad, *srcpad;
+  const gsize part_size = 5 * 1024 * 1024;
+  TestUploader *uploader = (TestUploader *) test_uploader_new (-1, FALSE);
 
+  sink = setup_default_s3_sink ((GstS3Uploader*) uploader);
   fail_if (sink == NULL);
 
+  g_object_set(sink, "buffer-size", part_size, "streaming-parts", TRUE, NULL);
+
+  srcpad = gst_check_setup_src_pad (sink, &srctemplate);
+  gst_pad_set_active (srcpad, TRUE);
+
   ret = gst_element_set_state (sink, GST_STATE_PLAYING);
   fail_unless (ret == GST_STATE_CHANGE_ASYNC);
 
-  GstQuery* query = gst_query_new_seeking (expected_format);
+  fail_unless(TRUE == prepare_to_push_bytes(srcpad, NULL));
 
-  gst_element_query (sink, query);
+  PUSH_BYTES (srcpad, 3 * 1024 * 1024);
 
-  gst_query_parse_seeking (query, &format, &seekable, NULL, NULL);
-  fail_if (seekable == TRUE);
-  fail_unless (format == expected_format);
+  fail_unless_equals_int (1, uploader->begin_part_count);
+  fail_unless_equals_int (3 * 1024 * 1024, uploader->streamed_bytes);
+  fail_unless_equals_int (0, uploader->upload_part_count);
 
-  gst_query_unref (query);
+  PUSH_BYTES (srcpad, 3 * 1024 * 1024);
+
+  fail_unless_equals_int (2, uploader->begin_part_count);
+  fail_unless_equals_int (6 * 1024 * 1024, uploader->streamed_bytes);
+  fail_unless_equals_int (1, uploader->upload_part_count);
+  fail_unless_equals_int (part_size, uploader->last_part_size);
+
+  /* a streamed object never takes the single request path */
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_send_event(sinkpad, gst_event_new_eos ());
+  gst_object_unref (sinkpad);
+
+  fail_unless_equals_int (2, uploader->upload_part_count);
+  fail_unless_equals_int (1024 * 1024, uploader->last_part_size);
 
   gst_element_set_state (sink, GST_STATE_NULL);
   gst_object_unref (sink);
+  gst_object_unref (srcpad);
 }
 GST_END_TEST
 
-GST_START_TEST (test_upload_part_failure)
+static void
+push_frame (GstPad * pad, gsize size, gboolean keyframe)
 {
-  GstElement *sink = setup_default_s3_sink (test_uploader_new (2, FALSE));
+  GstBuffer *buf = gst_buffer_new_and_alloc (size);
+
+  gst_buffer_memset (buf, 0, 0, size);
+  if (!keyframe)
+    GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+  fail_unless_equals_int (GST_FLOW_OK, gst_pad_push (pad, buf));
+}
+
+GST_START_TEST (test_stream_is_split_into_objects_on_keyframes)
+{
+  GstElement *sink;
   GstStateChangeReturn ret;
-  GstPad *srcpad;
-  const guint bytes_to_write = 5 * 1024 * 1024;
+  GstPad *sinkpad, *srcpad;
+  TestUploader *uploader = (TestUploader *) test_uploader_new (-1, FALSE);
+  TestUploader *next;
+
+  completed_objects = 0;
 
+  sink = setup_default_s3_sink ((GstS3Uploader*) uploader);
   fail_if (sink == NULL);
 
-  g_object_set (sink, "buffer-size", bytes_to_write, NULL);
+  g_object_set(sink, "key", "cam/seg-%05d.bin",
+      "max-segment-size", (guint64) 1024 * 1024, NULL);
 
   srcpad = gst_check_setup_src_pad (sink, &srctemplate);
   gst_pad_set_active (srcpad, TRUE);
@@ -407,11 +778,679 @@ GST_START_TEST (test_upload_part_failure)
 
   fail_unless(TRUE == prepare_to_push_bytes(srcpad, NULL));
 
-  PUSH_BYTES(srcpad, bytes_to_write);
-  PUSH_BYTES(srcpad, bytes_to_write);
-  PUSH_BYTES_FAILURE(srcpad, bytes_to_write);
+  fail_unless_equals_string ("cam/seg-00000.bin",
+      GST_S3_SINK (sink)->segment_target);
+
+  push_frame (srcpad, 1024 * 1024, TRUE);
+  fail_unless (GST_S3_SINK (sink)->next_uploader == NULL);
+
+  /* over the limit: the next object is prepared, but the current one only
+   * ends on a keyframe */
+  push_frame (srcpad, 1024 * 1024, FALSE);
+  next = TEST_UPLOADER (GST_S3_SINK (sink)->next_uploader);
+  fail_unless (next != NULL);
+  fail_unless_equals_string ("cam/seg-00001.bin", next->key);
+  fail_unless (GST_S3_SINK (sink)->uploader == (GstS3Uploader *) uploader);
+
+  /* the first object is handed over, and can't be looked at anymore */
+  push_frame (srcpad, 1024 * 1024, TRUE);
+  fail_unless (GST_S3_SINK (sink)->uploader == (GstS3Uploader *) next);
+  fail_unless (GST_S3_SINK (sink)->next_uploader == NULL);
+
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_send_event(sinkpad, gst_event_new_eos ());
+  gst_object_unref (sinkpad);
+
+  fail_unless_equals_int (2, g_atomic_int_get (&completed_objects));
+  fail_unless_equals_int (1, next->upload_part_count);
+  fail_unless_equals_int (1024 * 1024, next->last_part_size);
+
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (srcpad);
+}
+GST_END_TEST
+
+GST_START_TEST (test_async_finalize_hands_the_object_over_on_eos)
+{
+  GstElement *sink;
+  GstStateChangeReturn ret;
+  GstPad *sinkpad, *srcpad;
+  GstBus *bus;
+  GstMessage *msg;
+  const GstStructure *s;
+  guint64 size;
+  TestUploader *uploader = (TestUploader *) test_uploader_new (-1, FALSE);
+
+  sink = setup_default_s3_sink ((GstS3Uploader*) uploader);
+  fail_if (sink == NULL);
+
+  g_object_set(sink, "async-finalize", TRUE, NULL);
+
+  bus = gst_bus_new ();
+  gst_element_set_bus (sink, bus);
+
+  srcpad = gst_check_setup_src_pad (sink, &srctemplate);
+  gst_pad_set_active (srcpad, TRUE);
+
+  ret = gst_element_set_state (sink, GST_STATE_PLAYING);
+  fail_unless (ret == GST_STATE_CHANGE_ASYNC);
+
+  fail_unless(TRUE == prepare_to_push_bytes(srcpad, NULL));
+
+  PUSH_BYTES(srcpad, 10);
+
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_send_event(sinkpad, gst_event_new_eos ());
+  gst_object_unref (sinkpad);
+
+  /* the uploader belongs to the finalizer now */
+  fail_unless (GST_S3_SINK (sink)->uploader == NULL);
+
+  msg = gst_bus_timed_pop_filtered (bus, 10 * GST_SECOND, GST_MESSAGE_ELEMENT);
+  fail_unless (msg != NULL);
+  s = gst_message_get_structure (msg);
+  fail_unless (gst_structure_has_name (s, "s3sink-object"));
+  fail_unless_equals_string ("some-bucket",
+      gst_structure_get_string (s, "bucket"));
+  fail_unless_equals_string ("some-key", gst_structure_get_string (s, "key"));
+  fail_unless_equals_string ("\"test-etag\"",
+      gst_structure_get_string (s, "etag"));
+  fail_unless (gst_structure_get_uint64 (s, "size", &size));
+  fail_unless_equals_int (10, size);
+  gst_message_unref (msg);
+
+  /* the next object is created from the previous uploader */
+  gst_element_set_state (sink, GST_STATE_NULL);
+  g_object_set (sink, "key", "next-key", NULL);
+  ret = gst_element_set_state (sink, GST_STATE_PLAYING);
+  fail_unless (ret == GST_STATE_CHANGE_ASYNC);
+  fail_unless (GST_S3_SINK (sink)->uploader != NULL);
+  fail_unless_equals_string ("next-key",
+      TEST_UPLOADER (GST_S3_SINK (sink)->uploader)->key);
+
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_element_set_bus (sink, NULL);
+  gst_object_unref (bus);
+  gst_object_unref (sink);
+  gst_object_unref (srcpad);
+}
+GST_END_TEST
+
+GST_START_TEST (test_async_finalize_writes_one_object_at_a_time)
+{
+  GstElement *sink;
+  GstStateChangeReturn ret;
+  GstPad *sinkpad, *srcpad;
+  GstBus *bus;
+  GstMessage *msg;
+  TestUploader *uploader = (TestUploader *) test_uploader_new (-1, FALSE);
+
+  sink = setup_default_s3_sink ((GstS3Uploader*) uploader);
+  fail_if (sink == NULL);
+
+  g_object_set(sink, "async-finalize", TRUE, NULL);
+
+  bus = gst_bus_new ();
+  gst_element_set_bus (sink, bus);
+
+  srcpad = gst_check_setup_src_pad (sink, &srctemplate);
+  gst_pad_set_active (srcpad, TRUE);
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+
+  ret = gst_element_set_state (sink, GST_STATE_PLAYING);
+  fail_unless (ret == GST_STATE_CHANGE_ASYNC);
+  fail_unless(TRUE == prepare_to_push_bytes(srcpad, NULL));
+  PUSH_BYTES(srcpad, 10);
+  gst_element_set_state (sink, GST_STATE_NULL);
+
+  g_object_set (sink, "key", "next-key", NULL);
+  ret = gst_element_set_state (sink, GST_STATE_PLAYING);
+  fail_unless (ret == GST_STATE_CHANGE_ASYNC);
+  fail_unless(TRUE == prepare_to_push_bytes(srcpad, NULL));
+  PUSH_BYTES(srcpad, 10);
+  gst_pad_send_event(sinkpad, gst_event_new_eos ());
+
+  /* the first object was written before the second one was handed over */
+  msg = gst_bus_pop_filtered (bus, GST_MESSAGE_ELEMENT);
+  fail_unless (msg != NULL);
+  fail_unless_equals_string ("some-key",
+      gst_structure_get_string (gst_message_get_structure (msg), "key"));
+  gst_message_unref (msg);
+
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_object_unref (sinkpad);
+  gst_element_set_bus (sink, NULL);
+  gst_object_unref (bus);
+  gst_object_unref (sink);
+  gst_object_unref (srcpad);
+}
+GST_END_TEST
+
+static GstBuffer *
+new_timestamped_buffer (gsize size, GstClockTime pts)
+{
+  GstBuffer *buf = gst_buffer_new_and_alloc (size);
+
+  gst_buffer_memset (buf, 0, 0, size);
+  GST_BUFFER_PTS (buf) = pts;
+  return buf;
+}
+
+GST_START_TEST (test_part_is_flushed_after_max_part_duration)
+{
+  GstElement *sink;
+  GstStateChangeReturn ret;
+  GstPad *srcpad;
+  GstSegment segment;
+  TestUploader *uploader = (TestUploader *) test_uploader_new (-1, FALSE);
+
+  sink = setup_default_s3_sink ((GstS3Uploader*) uploader);
+  fail_if (sink == NULL);
+
+  g_object_set(sink, "buffer-size", 8 * 1024 * 1024,
+      "max-part-duration", (guint64) GST_SECOND, NULL);
+
+  srcpad = gst_check_setup_src_pad (sink, &srctemplate);
+  gst_pad_set_active (srcpad, TRUE);
+
+  ret = gst_element_set_state (sink, GST_STATE_PLAYING);
+  fail_unless (ret == GST_STATE_CHANGE_ASYNC);
+
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  fail_unless (gst_pad_push_event (srcpad, gst_event_new_stream_start ("test")));
+  fail_unless (gst_pad_push_event (srcpad, gst_event_new_segment (&segment)));
+
+  /* too small to be sent before the end, however long it waits */
+  fail_unless_equals_int (GST_FLOW_OK, gst_pad_push (srcpad,
+          new_timestamped_buffer (3 * 1024 * 1024, 0)));
+  fail_unless_equals_int (GST_FLOW_OK, gst_pad_push (srcpad,
+          new_timestamped_buffer (1024 * 1024, 2 * GST_SECOND)));
+  fail_unless_equals_int (0, uploader->upload_part_count);
+
+  fail_unless_equals_int (GST_FLOW_OK, gst_pad_push (srcpad,
+          new_timestamped_buffer (1024 * 1024 + 1024, 3 * GST_SECOND)));
+  fail_unless_equals_int (1, uploader->upload_part_count);
+  fail_unless_equals_int (5 * 1024 * 1024 + 1024, uploader->last_part_size);
+
+  /* the next part is measured from its own first buffer */
+  fail_unless_equals_int (GST_FLOW_OK, gst_pad_push (srcpad,
+          new_timestamped_buffer (6 * 1024 * 1024, 3 * GST_SECOND)));
+  fail_unless_equals_int (1, uploader->upload_part_count);
+
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (srcpad);
+}
+GST_END_TEST
+
+static GstBuffer *
+new_frame (GstClockTime pts, gboolean keyframe)
+{
+  GstBuffer *buf = new_timestamped_buffer (1024, pts);
+
+  if (!keyframe)
+    GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+  return buf;
+}
+
+GST_START_TEST (test_stream_is_split_into_objects_by_duration)
+{
+  GstElement *sink;
+  GstStateChangeReturn ret;
+  GstPad *srcpad;
+  GstSegment segment;
+  TestUploader *uploader = (TestUploader *) test_uploader_new (-1, FALSE);
+  TestUploader *next;
+
+  sink = setup_default_s3_sink ((GstS3Uploader*) uploader);
+  fail_if (sink == NULL);
+
+  g_object_set(sink, "key", "cam/seg-%05d.bin",
+      "max-segment-duration", (guint64) 2 * GST_SECOND, NULL);
+
+  srcpad = gst_check_setup_src_pad (sink, &srctemplate);
+  gst_pad_set_active (srcpad, TRUE);
+
+  ret = gst_element_set_state (sink, GST_STATE_PLAYING);
+  fail_unless (ret == GST_STATE_CHANGE_ASYNC);
+
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  fail_unless (gst_pad_push_event (srcpad, gst_event_new_stream_start ("test")));
+  fail_unless (gst_pad_push_event (srcpad, gst_event_new_segment (&segment)));
+
+  fail_unless_equals_int (GST_FLOW_OK, gst_pad_push (srcpad,
+          new_frame (0, TRUE)));
+  fail_unless_equals_int (GST_FLOW_OK, gst_pad_push (srcpad,
+          new_frame (GST_SECOND, FALSE)));
+  fail_unless (GST_S3_SINK (sink)->next_uploader == NULL);
+
+  /* the duration is up, but the current object only ends on a keyframe */
+  fail_unless_equals_int (GST_FLOW_OK, gst_pad_push (srcpad,
+          new_frame (2 * GST_SECOND, FALSE)));
+  next = TEST_UPLOADER (GST_S3_SINK (sink)->next_uploader);
+  fail_unless (next != NULL);
+  fail_unless_equals_string ("cam/seg-00001.bin", next->key);
+  fail_unless (GST_S3_SINK (sink)->uploader == (GstS3Uploader *) uploader);
+
+  fail_unless_equals_int (GST_FLOW_OK, gst_pad_push (srcpad,
+          new_frame (2 * GST_SECOND + GST_SECOND / 2, TRUE)));
+  fail_unless (GST_S3_SINK (sink)->uploader == (GstS3Uploader *) next);
+  fail_unless_equals_string ("cam/seg-00001.bin",
+      GST_S3_SINK (sink)->segment_target);
+
+  /* measured from the start of the new object */
+  fail_unless_equals_int (GST_FLOW_OK, gst_pad_push (srcpad,
+          new_frame (4 * GST_SECOND, TRUE)));
+  fail_unless (GST_S3_SINK (sink)->uploader == (GstS3Uploader *) next);
+  fail_unless (GST_S3_SINK (sink)->next_uploader == NULL);
+
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (srcpad);
+}
+GST_END_TEST
+
+static void
+remove_spool_directory (gchar * path)
+{
+  GDir *dir = g_dir_open (path, 0, NULL);
+  const gchar *name;
+
+  while (dir && (name = g_dir_read_name (dir))) {
+    gchar *file = g_build_filename (path, name, NULL);
+    g_unlink (file);
+    g_free (file);
+  }
+  if (dir)
+    g_dir_close (dir);
+  g_rmdir (path);
+  g_free (path);
+}
+
+GST_START_TEST (test_full_part_is_uploaded_from_the_spool)
+{
+  GstElement *sink;
+  GstStateChangeReturn ret;
+  GstPad *srcpad;
+  GStatBuf st;
+  gchar *spool_dir = g_dir_make_tmp ("s3sink-XXXXXX", NULL);
+  TestUploader *uploader = (TestUploader *) test_uploader_new (-1, FALSE);
+
+  fail_unless (spool_dir != NULL);
+
+  sink = setup_default_s3_sink ((GstS3Uploader*) uploader);
+  fail_if (sink == NULL);
+
+  g_object_set(sink, "buffer-size", 5 * 1024 * 1024,
+      "spool-directory", spool_dir, "spool-sync", FALSE, NULL);
+
+  srcpad = gst_check_setup_src_pad (sink, &srctemplate);
+  gst_pad_set_active (srcpad, TRUE);
+
+  ret = gst_element_set_state (sink, GST_STATE_PLAYING);
+  fail_unless (ret == GST_STATE_CHANGE_ASYNC);
+
+  fail_unless(TRUE == prepare_to_push_bytes(srcpad, NULL));
+
+  PUSH_BYTES (srcpad, 5 * 1024 * 1024);
+
+  fail_unless_equals_int (1, uploader->upload_part_count);
+  fail_unless_equals_int (5 * 1024 * 1024, uploader->last_part_size);
+  fail_unless (uploader->last_part_file != NULL);
+  fail_unless (g_str_has_prefix (uploader->last_part_file, spool_dir));
+  fail_unless_equals_int (0, g_stat (uploader->last_part_file, &st));
+  fail_unless_equals_int (5 * 1024 * 1024, st.st_size);
+
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (srcpad);
+  remove_spool_directory (spool_dir);
+}
+GST_END_TEST
+
+GST_START_TEST (test_segments_are_not_spooled)
+{
+  GstElement *sink;
+  GstStateChangeReturn ret;
+  GstPad *srcpad;
+  gchar *spool_dir = g_dir_make_tmp ("s3sink-XXXXXX", NULL);
+  GDir *dir;
+  TestUploader *uploader = (TestUploader *) test_uploader_new (-1, FALSE);
+
+  fail_unless (spool_dir != NULL);
+
+  sink = setup_default_s3_sink ((GstS3Uploader*) uploader);
+  fail_if (sink == NULL);
+
+  g_object_set(sink, "key", "cam/seg-%05d.bin",
+      "max-segment-size", (guint64) 1024 * 1024,
+      "spool-directory", spool_dir, "spool-sync", FALSE, NULL);
+
+  srcpad = gst_check_setup_src_pad (sink, &srctemplate);
+  gst_pad_set_active (srcpad, TRUE);
+
+  ret = gst_element_set_state (sink, GST_STATE_PLAYING);
+  fail_unless (ret == GST_STATE_CHANGE_ASYNC);
+
+  fail_unless(TRUE == prepare_to_push_bytes(srcpad, NULL));
+  PUSH_BYTES (srcpad, 1024);
+
+  /* their keys change on every run, they could never be resumed */
+  fail_unless (GST_S3_SINK (sink)->spool == NULL);
+  dir = g_dir_open (spool_dir, 0, NULL);
+  fail_unless (dir != NULL);
+  fail_unless (g_dir_read_name (dir) == NULL);
+  g_dir_close (dir);
+
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (srcpad);
+  remove_spool_directory (spool_dir);
+}
+GST_END_TEST
+
+GST_START_TEST (test_resume_continues_the_spooled_part)
+{
+  GstElement *sink;
+  GstStateChangeReturn ret;
+  GstPad *sinkpad, *srcpad;
+  gchar *spool_dir = g_dir_make_tmp ("s3sink-XXXXXX", NULL);
+  gchar *name, *filename, *current;
+  TestUploader *uploader = (TestUploader *) test_uploader_new (-1, FALSE);
+
+  fail_unless (spool_dir != NULL);
+
+  /* the part a crashed sink was filling */
+  name = g_compute_checksum_for_string (G_CHECKSUM_SHA256,
+      "s3://some-bucket/some-key", -1);
+  filename = g_strconcat (name, ".current", NULL);
+  current = g_build_filename (spool_dir, filename, NULL);
+  fail_unless (g_file_set_contents (current, "0123456789", 10, NULL));
+
+  sink = setup_default_s3_sink ((GstS3Uploader*) uploader);
+  fail_if (sink == NULL);
+
+  g_object_set(sink, "spool-directory", spool_dir, "resume", TRUE, NULL);
+
+  srcpad = gst_check_setup_src_pad (sink, &srctemplate);
+  gst_pad_set_active (srcpad, TRUE);
+
+  ret = gst_element_set_state (sink, GST_STATE_PLAYING);
+  fail_unless (ret == GST_STATE_CHANGE_ASYNC);
+
+  fail_unless(TRUE == prepare_to_push_bytes(srcpad, NULL));
+
+  PUSH_BYTES (srcpad, 5);
+
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_send_event(sinkpad, gst_event_new_eos ());
+  gst_object_unref (sinkpad);
+
+  fail_unless_equals_int (1, uploader->upload_part_count);
+  fail_unless_equals_int (15, uploader->last_part_size);
+  fail_unless_equals_int (1, uploader->complete_count);
+  fail_if (g_file_test (current, G_FILE_TEST_EXISTS));
+
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (srcpad);
+  g_free (current);
+  g_free (filename);
+  g_free (name);
+  remove_spool_directory (spool_dir);
+}
+GST_END_TEST
+
+GST_START_TEST (test_resumed_part_bigger_than_buffer_size_is_flushed)
+{
+  GstElement *sink;
+  GstStateChangeReturn ret;
+  GstPad *sinkpad, *srcpad;
+  gchar *spool_dir = g_dir_make_tmp ("s3sink-XXXXXX", NULL);
+  gchar *name, *filename, *current, *data;
+  gsize leftover_size = 6 * 1024 * 1024;
+  TestUploader *uploader = (TestUploader *) test_uploader_new (-1, FALSE);
+
+  fail_unless (spool_dir != NULL);
+
+  /* filled by a crashed sink that had a bigger buffer-size */
+  name = g_compute_checksum_for_string (G_CHECKSUM_SHA256,
+      "s3://some-bucket/some-key", -1);
+  filename = g_strconcat (name, ".current", NULL);
+  current = g_build_filename (spool_dir, filename, NULL);
+  data = g_malloc0 (leftover_size);
+  fail_unless (g_file_set_contents (current, data, leftover_size, NULL));
+  g_free (data);
+
+  sink = setup_default_s3_sink ((GstS3Uploader*) uploader);
+  fail_if (sink == NULL);
+
+  g_object_set(sink, "buffer-size", 5 * 1024 * 1024,
+      "spool-directory", spool_dir, "spool-sync", FALSE, "resume", TRUE,
+      NULL);
+
+  srcpad = gst_check_setup_src_pad (sink, &srctemplate);
+  gst_pad_set_active (srcpad, TRUE);
+
+  ret = gst_element_set_state (sink, GST_STATE_PLAYING);
+  fail_unless (ret == GST_STATE_CHANGE_ASYNC);
+
+  fail_unless(TRUE == prepare_to_push_bytes(srcpad, NULL));
+
+  /* the resumed part goes as is, the new data starts the next one */
+  PUSH_BYTES (srcpad, 5);
+  fail_unless_equals_int (1, uploader->upload_part_count);
+  fail_unless_equals_int (leftover_size, uploader->last_part_size);
+
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_send_event(sinkpad, gst_event_new_eos ());
+  gst_object_unref (sinkpad);
+
+  fail_unless_equals_int (2, uploader->upload_part_count);
+  fail_unless_equals_int (5, uploader->last_part_size);
+  fail_unless_equals_int (1, uploader->complete_count);
+
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (srcpad);
+  g_free (current);
+  g_free (filename);
+  g_free (name);
+  remove_spool_directory (spool_dir);
+}
+GST_END_TEST
+
+GST_START_TEST (test_stop_while_waiting_for_uploader)
+{
+  GstElement *sink;
+  GstStateChangeReturn ret;
+  GstPad *srcpad;
+  GstBus *bus;
+  GstMessage *msg;
+  GThread *thread;
+  gboolean stalled = FALSE;
+  TestUploader *uploader = (TestUploader *) test_uploader_new (-1, FALSE);
+
+  uploader->no_capacity = TRUE;
+
+  sink = setup_default_s3_sink ((GstS3Uploader*) uploader);
+  fail_if (sink == NULL);
+
+  g_object_set(sink, "buffer-size", 5 * 1024 * 1024, NULL);
+
+  bus = gst_bus_new ();
+  gst_element_set_bus (sink, bus);
+
+  srcpad = gst_check_setup_src_pad (sink, &srctemplate);
+  gst_pad_set_active (srcpad, TRUE);
+
+  ret = gst_element_set_state (sink, GST_STATE_PLAYING);
+  fail_unless (ret == GST_STATE_CHANGE_ASYNC);
+
+  fail_unless(TRUE == prepare_to_push_bytes(srcpad, NULL));
+
+  thread = g_thread_new ("push", push_part_thread, srcpad);
+
+  g_mutex_lock (&uploader->lock);
+  while (!uploader->waiting)
+    g_cond_wait (&uploader->cond, &uploader->lock);
+  g_mutex_unlock (&uploader->lock);
+
+  msg = gst_bus_pop_filtered (bus, GST_MESSAGE_ELEMENT);
+  fail_if (msg == NULL);
+  fail_unless (gst_message_has_name (msg, "s3sink-backpressure"));
+  gst_structure_get_boolean (gst_message_get_structure (msg), "stalled",
+      &stalled);
+  fail_unless (stalled);
+  gst_message_unref (msg);
+
+  /* must not deadlock although the uploader never gets capacity back */
+  gst_element_set_state (sink, GST_STATE_NULL);
+  fail_unless_equals_int (GST_FLOW_FLUSHING,
+      GPOINTER_TO_INT (g_thread_join (thread)));
+
+  gst_element_set_bus (sink, NULL);
+  gst_object_unref (bus);
+  gst_object_unref (sink);
+  gst_object_unref (srcpad);
+}
+GST_END_TEST
+
+GST_START_TEST (test_query_position)
+{
+  GstElement *sink = setup_default_s3_sink (test_uploader_new (-1, FALSE));
+  GstStateChangeReturn ret;
+  GstPad *srcpad, *sinkpad;
+  const gint64 bytes_to_write = 31337;
+  gint64 position_bytes = 0;
+
+  fail_if (sink == NULL);
+
+  srcpad = gst_check_setup_src_pad (sink, &srctemplate);
+  gst_pad_set_active (srcpad, TRUE);
+
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  fail_if (sinkpad == NULL);
+
+  ret = gst_element_set_state (sink, GST_STATE_PLAYING);
+  fail_unless (ret == GST_STATE_CHANGE_ASYNC);
+
+  fail_unless(TRUE == prepare_to_push_bytes(srcpad, NULL));
+
+  PUSH_BYTES(srcpad, bytes_to_write);
+
+  gst_pad_query_position (sinkpad, GST_FORMAT_BYTES, &position_bytes);
+
+  fail_unless_equals_int64 (bytes_to_write, position_bytes);
+
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_object_unref (sinkpad);
+  gst_object_unref (srcpad);
+  gst_object_unref (sink);
+}
+GST_END_TEST
+
+GST_START_TEST (test_query_seeking)
+{
+  const GstFormat expected_format = GST_FORMAT_DEFAULT;
+  GstFormat format;
+  gboolean seekable;
+  GstElement *sink = setup_default_s3_sink (test_uploader_new (-1, FALSE));
+  GstStateChangeReturn ret;
+
+  fail_if (sink == NULL);
+
+  ret = gst_element_set_state (sink, GST_STATE_PLAYING);
+  fail_unless (ret == GST_STATE_CHANGE_ASYNC);
+
+  GstQuery* query = gst_query_new_seeking (expected_format);
+
+  gst_element_query (sink, query);
+
+  gst_query_parse_seeking (query, &format, &seekable, NULL, NULL);
+  fail_if (seekable == TRUE);
+  fail_unless (format == expected_format);
+
+  gst_query_unref (query);
+
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_object_unref (sink);
+}
+GST_END_TEST
+
+GST_START_TEST (test_upload_part_failure)
+{
+  GstElement *sink = setup_default_s3_sink (test_uploader_new (2, FALSE));
+  GstStateChangeReturn ret;
+  GstPad *srcpad;
+  const guint bytes_to_write = 5 * 1024 * 1024;
+
+  fail_if (sink == NULL);
+
+  g_object_set (sink, "buffer-size", bytes_to_write, NULL);
+
+  srcpad = gst_check_setup_src_pad (sink, &srctemplate);
+  gst_pad_set_active (srcpad, TRUE);
+
+  ret = gst_element_set_state (sink, GST_STATE_PLAYING);
+  fail_unless (ret == GST_STATE_CHANGE_ASYNC);
+
+  fail_unless(TRUE == prepare_to_push_bytes(srcpad, NULL));
+
+  PUSH_BYTES(srcpad, bytes_to_write);
+  PUSH_BYTES(srcpad, bytes_to_write);
+  PUSH_BYTES_FAILURE(srcpad, bytes_to_write);
+
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_object_unref (srcpad);
+  gst_object_unref (sink);
+}
+GST_END_TEST
+
+GST_START_TEST (test_failed_part_is_reported_on_next_render)
+{
+  TestUploader *uploader = (TestUploader *) test_uploader_new (-1, FALSE);
+  GstElement *sink = setup_default_s3_sink ((GstS3Uploader *) uploader);
+  GstStateChangeReturn ret;
+  GstPad *srcpad;
+  GstBus *bus;
+  GstMessage *msg;
+  const GstStructure *details = NULL;
+  gint part_number = 0;
+
+  fail_if (sink == NULL);
+
+  bus = gst_bus_new ();
+  gst_element_set_bus (sink, bus);
+
+  srcpad = gst_check_setup_src_pad (sink, &srctemplate);
+  gst_pad_set_active (srcpad, TRUE);
+
+  ret = gst_element_set_state (sink, GST_STATE_PLAYING);
+  fail_unless (ret == GST_STATE_CHANGE_ASYNC);
+
+  fail_unless(TRUE == prepare_to_push_bytes(srcpad, NULL));
+
+  PUSH_BYTES(srcpad, 10);
+
+  /* a part failed in the background, long before the end of the stream */
+  uploader->failed_part_number = 3;
+  PUSH_BYTES_FAILURE(srcpad, 10);
+
+  msg = gst_bus_pop_filtered (bus, GST_MESSAGE_ERROR);
+  fail_if (msg == NULL);
+  gst_message_parse_error_details (msg, &details);
+  fail_if (details == NULL);
+  fail_unless (gst_structure_get_int (details, "part-number", &part_number));
+  fail_unless_equals_int (3, part_number);
+  fail_unless_equals_string ("SlowDown",
+      gst_structure_get_string (details, "error-code"));
+  gst_message_unref (msg);
 
   gst_element_set_state (sink, GST_STATE_NULL);
+  gst_element_set_bus (sink, NULL);
+  gst_object_unref (bus);
   gst_object_unref (srcpad);
   gst_object_unref (sink);
 }
@@ -457,10 +1496,26 @@ s3sink_suite (void)
   tcase_add_test (tc_chain, test_gst_urihandler_interface);
   tcase_add_test (tc_chain, test_change_properties_after_start_should_fail);
   tcase_add_test (tc_chain, test_send_eos_should_flush_buffer);
+  tcase_add_test (tc_chain, test_small_object_is_finalized_on_eos);
+  tcase_add_test (tc_chain, test_small_object_is_put_with_one_request);
+  tcase_add_test (tc_chain, test_part_checksum_is_computed_incrementally);
   tcase_add_test (tc_chain, test_push_buffer_should_flush_buffer_if_reaches_limit);
+  tcase_add_test (tc_chain, test_buffers_spanning_parts_are_split);
+  tcase_add_test (tc_chain, test_streaming_parts_are_fed_as_they_fill);
+  tcase_add_test (tc_chain, test_part_is_flushed_after_max_part_duration);
+  tcase_add_test (tc_chain, test_full_part_is_uploaded_from_the_spool);
+  tcase_add_test (tc_chain, test_segments_are_not_spooled);
+  tcase_add_test (tc_chain, test_resume_continues_the_spooled_part);
+  tcase_add_test (tc_chain, test_resumed_part_bigger_than_buffer_size_is_flushed);
+  tcase_add_test (tc_chain, test_stream_is_split_into_objects_on_keyframes);
+  tcase_add_test (tc_chain, test_stream_is_split_into_objects_by_duration);
+  tcase_add_test (tc_chain, test_async_finalize_hands_the_object_over_on_eos);
+  tcase_add_test (tc_chain, test_async_finalize_writes_one_object_at_a_time);
+  tcase_add_test (tc_chain, test_stop_while_waiting_for_uploader);
   tcase_add_test (tc_chain, test_query_position);
   tcase_add_test (tc_chain, test_query_seeking);
   tcase_add_test (tc_chain, test_upload_part_failure);
+  tcase_add_test (tc_chain, test_failed_part_is_reported_on_next_render);
   tcase_add_test (tc_chain, test_push_empty_buffer);
 
   return s;
@@ -0,0 +1,329 @@
+/* amazon-s3-gst-plugin
+ * Copyright (C) 2019 Amazon <mkolny@amazon.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include "gsts3downloader.h"
+#include "gsts3src.h"
+
+#include <gst/check/gstcheck.h>
+
+/************* TEST DOWNLOADER *************/
+typedef struct {
+  GstS3Downloader base;
+  guint64 size;
+  gboolean fail;
+} TestDownloader;
+
+#define TEST_DOWNLOADER(downloader) ((TestDownloader*) downloader)
+
+/* the object is cut in chunks of this size, like the range downloader does */
+#define TEST_CHUNK_SIZE 1000
+
+static void
+test_downloader_destroy (GstS3Downloader * downloader)
+{
+  g_free (downloader);
+}
+
+static gboolean
+test_downloader_get_size (GstS3Downloader * downloader, guint64 * size)
+{
+  *size = TEST_DOWNLOADER(downloader)->size;
+  return TRUE;
+}
+
+static GstBuffer *
+test_downloader_read (GstS3Downloader * downloader, guint64 offset,
+    gsize size)
+{
+  TestDownloader *self = TEST_DOWNLOADER(downloader);
+  GstBuffer *buffer;
+  GstMapInfo map;
+  gsize i;
+
+  if (self->fail)
+    return NULL;
+  if (offset >= self->size)
+    return gst_buffer_new ();
+
+  size = MIN (size, TEST_CHUNK_SIZE - offset % TEST_CHUNK_SIZE);
+  size = MIN (size, self->size - offset);
+
+  buffer = gst_buffer_new_allocate (NULL, size, NULL);
+  gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+  for (i = 0; i < size; i++)
+    map.data[i] = (offset + i) & 0xff;
+  gst_buffer_unmap (buffer, &map);
+
+  return buffer;
+}
+
+static gboolean
+test_downloader_get_error (GstS3Downloader * downloader,
+    gchar ** error_code, gchar ** error_message)
+{
+  if (!TEST_DOWNLOADER(downloader)->fail)
+    return FALSE;
+
+  if (error_code)
+    *error_code = g_strdup ("InternalError");
+  if (error_message)
+    *error_message = g_strdup ("We encountered an internal error.");
+  return TRUE;
+}
+
+static GstS3DownloaderClass test_downloader_class = {
+  test_downloader_destroy,
+  test_downloader_get_size,
+  test_downloader_read,
+  NULL,
+  NULL,
+  test_downloader_get_error
+};
+
+static GstS3Downloader *
+test_downloader_new (guint64 size)
+{
+  TestDownloader *downloader = g_new0 (TestDownloader, 1);
+
+  downloader->base.klass = &test_downloader_class;
+  downloader->size = size;
+
+  return (GstS3Downloader*) downloader;
+}
+
+/************* TEST DOWNLOADER END *************/
+
+static GstStaticPadTemplate sinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static GstElement *
+setup_s3_src (guint64 size)
+{
+  GstElement *src = gst_element_factory_make ("s3src", "src");
+
+  fail_if (src == NULL);
+  g_object_set (src, "bucket", "some-bucket", "key", "some-key", NULL);
+  GST_S3_SRC (src)->downloader = test_downloader_new (size);
+
+  return src;
+}
+
+static gboolean
+check_data (GstBuffer * buffer)
+{
+  GstMapInfo map;
+  gboolean ok = TRUE;
+  gsize i;
+
+  gst_buffer_map (buffer, &map, GST_MAP_READ);
+  for (i = 0; i < map.size && ok; i++)
+    ok = map.data[i] == ((GST_BUFFER_OFFSET (buffer) + i) & 0xff);
+  gst_buffer_unmap (buffer, &map);
+
+  return ok;
+}
+
+GST_START_TEST (test_no_bucket_then_start_should_fail)
+{
+  GstElement *src = gst_element_factory_make ("s3src", "src");
+  GstStateChangeReturn ret;
+
+  fail_if (src == NULL);
+
+  ret = gst_element_set_state (src, GST_STATE_PAUSED);
+  fail_unless (ret == GST_STATE_CHANGE_FAILURE);
+
+  gst_element_set_state (src, GST_STATE_NULL);
+  gst_object_unref (src);
+}
+GST_END_TEST
+
+GST_START_TEST (test_uri_handler)
+{
+  GstElement *src = gst_element_make_from_uri (GST_URI_SRC,
+      "s3://some-bucket/some/key", "src", NULL);
+  gchar *uri;
+
+  fail_if (src == NULL);
+  fail_unless (GST_IS_S3_SRC (src));
+
+  uri = gst_uri_handler_get_uri (GST_URI_HANDLER (src));
+  fail_unless_equals_string ("s3://some-bucket/some/key", uri);
+  g_free (uri);
+
+  gst_object_unref (src);
+}
+GST_END_TEST
+
+GST_START_TEST (test_reads_the_whole_object_in_order)
+{
+  GstElement *src = setup_s3_src (4500);
+  GstPad *sinkpad;
+  GstBuffer *buffer;
+  guint64 offset = 0;
+  GList *l;
+
+  sinkpad = gst_check_setup_sink_pad (src, &sinktemplate);
+  gst_pad_set_active (sinkpad, TRUE);
+  g_object_set (src, "blocksize", 1500, NULL);
+
+  fail_unless (gst_element_set_state (src, GST_STATE_PLAYING)
+      == GST_STATE_CHANGE_SUCCESS);
+
+  g_mutex_lock (&check_mutex);
+  while (g_list_length (buffers) < 3)
+    g_cond_wait (&check_cond, &check_mutex);
+  g_mutex_unlock (&check_mutex);
+
+  /* the requested length, across chunks */
+  for (l = buffers; l; l = l->next) {
+    buffer = GST_BUFFER (l->data);
+    fail_unless_equals_uint64 (offset, GST_BUFFER_OFFSET (buffer));
+    fail_unless_equals_int (1500, gst_buffer_get_size (buffer));
+    fail_unless (check_data (buffer));
+    offset += gst_buffer_get_size (buffer);
+  }
+
+  gst_element_set_state (src, GST_STATE_NULL);
+  gst_check_drop_buffers ();
+  gst_pad_set_active (sinkpad, FALSE);
+  gst_check_teardown_sink_pad (src);
+  gst_object_unref (src);
+}
+GST_END_TEST
+
+GST_START_TEST (test_pull_range_at_any_offset)
+{
+  GstElement *src = setup_s3_src (4500);
+  GstPad *srcpad = gst_element_get_static_pad (src, "src");
+  GstBuffer *buffer = NULL;
+
+  fail_unless (gst_element_set_state (src, GST_STATE_READY)
+      == GST_STATE_CHANGE_SUCCESS);
+  fail_unless (gst_pad_activate_mode (srcpad, GST_PAD_MODE_PULL, TRUE));
+
+  fail_unless_equals_int (GST_FLOW_OK,
+      gst_pad_get_range (srcpad, 2500, 1000, &buffer));
+  fail_unless_equals_uint64 (2500, GST_BUFFER_OFFSET (buffer));
+  fail_unless_equals_int (1000, gst_buffer_get_size (buffer));
+  fail_unless (check_data (buffer));
+  gst_buffer_unref (buffer);
+  buffer = NULL;
+
+  /* backwards, and cut short by the end of the object */
+  fail_unless_equals_int (GST_FLOW_OK,
+      gst_pad_get_range (srcpad, 4000, 1000, &buffer));
+  fail_unless_equals_int (500, gst_buffer_get_size (buffer));
+  fail_unless (check_data (buffer));
+  gst_buffer_unref (buffer);
+  buffer = NULL;
+
+  fail_unless_equals_int (GST_FLOW_EOS,
+      gst_pad_get_range (srcpad, 4500, 1000, &buffer));
+
+  fail_unless (gst_pad_activate_mode (srcpad, GST_PAD_MODE_PULL, FALSE));
+  gst_element_set_state (src, GST_STATE_NULL);
+  gst_object_unref (srcpad);
+  gst_object_unref (src);
+}
+GST_END_TEST
+
+GST_START_TEST (test_answers_the_seeking_query)
+{
+  GstElement *src = setup_s3_src (4500);
+  GstPad *sinkpad;
+  GstQuery *query;
+  gboolean seekable;
+  gint64 start, end;
+
+  sinkpad = gst_check_setup_sink_pad (src, &sinktemplate);
+  gst_pad_set_active (sinkpad, TRUE);
+  fail_unless (gst_element_set_state (src, GST_STATE_PAUSED)
+      == GST_STATE_CHANGE_SUCCESS);
+
+  query = gst_query_new_seeking (GST_FORMAT_BYTES);
+  fail_unless (gst_element_query (src, query));
+  gst_query_parse_seeking (query, NULL, &seekable, &start, &end);
+  fail_unless (seekable);
+  fail_unless_equals_int64 (0, start);
+  fail_unless_equals_int64 (4500, end);
+  gst_query_unref (query);
+
+  gst_element_set_state (src, GST_STATE_NULL);
+  gst_check_drop_buffers ();
+  gst_pad_set_active (sinkpad, FALSE);
+  gst_check_teardown_sink_pad (src);
+  gst_object_unref (src);
+}
+GST_END_TEST
+
+GST_START_TEST (test_read_error_is_posted)
+{
+  GstElement *src = setup_s3_src (4500);
+  GstPad *srcpad = gst_element_get_static_pad (src, "src");
+  GstBus *bus = gst_bus_new ();
+  GstBuffer *buffer = NULL;
+  GstMessage *message;
+  const GstStructure *details;
+
+  gst_element_set_bus (src, bus);
+  fail_unless (gst_element_set_state (src, GST_STATE_READY)
+      == GST_STATE_CHANGE_SUCCESS);
+  fail_unless (gst_pad_activate_mode (srcpad, GST_PAD_MODE_PULL, TRUE));
+
+  TEST_DOWNLOADER (GST_S3_SRC (src)->downloader)->fail = TRUE;
+  fail_unless_equals_int (GST_FLOW_ERROR,
+      gst_pad_get_range (srcpad, 0, 1000, &buffer));
+
+  message = gst_bus_pop_filtered (bus, GST_MESSAGE_ERROR);
+  fail_unless (message != NULL);
+  gst_message_parse_error_details (message, &details);
+  fail_unless (details != NULL);
+  fail_unless_equals_string ("InternalError",
+      gst_structure_get_string (details, "error-code"));
+  gst_message_unref (message);
+
+  fail_unless (gst_pad_activate_mode (srcpad, GST_PAD_MODE_PULL, FALSE));
+  gst_element_set_state (src, GST_STATE_NULL);
+  gst_element_set_bus (src, NULL);
+  gst_object_unref (bus);
+  gst_object_unref (srcpad);
+  gst_object_unref (src);
+}
+GST_END_TEST
+
+static Suite *
+s3src_suite (void)
+{
+  Suite *s = suite_create ("s3src");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_no_bucket_then_start_should_fail);
+  tcase_add_test (tc_chain, test_uri_handler);
+  tcase_add_test (tc_chain, test_reads_the_whole_object_in_order);
+  tcase_add_test (tc_chain, test_pull_range_at_any_offset);
+  tcase_add_test (tc_chain, test_answers_the_seeking_query);
+  tcase_add_test (tc_chain, test_read_error_is_posted);
+
+  return s;
+}
+
+GST_CHECK_MAIN (s3src)